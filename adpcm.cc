@@ -0,0 +1,59 @@
+#include "adpcm.h"
+
+typedef Adpcm::BYTE BYTE;
+
+static const BYTE CMD_STOP = 1 << 0;
+static const BYTE CMD_PLAY = 1 << 1;
+static const BYTE STATUS_STOPPED = 1 << 7;
+
+// Clock dividers selected by port C bits 2-3.
+static const int kDividers[] = {1024, 768, 512, 512};
+
+Adpcm::Adpcm()
+  : play(false), clock4MHz(false), portC(0x0b), fetched(0) {
+}
+
+BYTE Adpcm::read(uint32_t ofs) const {
+  (void)ofs;
+  return play ? 0x40 : STATUS_STOPPED | 0x40;
+}
+
+bool Adpcm::write(uint32_t ofs, BYTE value, uint64_t now) {
+  if ((ofs & 3) != 1)  // Data port: recording is not supported.
+    return false;
+  if ((value & CMD_STOP) != 0 && play) {
+    play = false;
+    return true;
+  }
+  if ((value & CMD_PLAY) != 0 && !play) {
+    play = true;
+    fetched = now;
+    return true;
+  }
+  return false;
+}
+
+int Adpcm::upsampling() const {
+  // 62.5kHz * divider / clock.
+  int divider = kDividers[(portC >> 2) & 3];
+  return clock4MHz ? divider / 64 : divider / 128;
+}
+
+uint64_t Adpcm::cyclesPerByte() const {
+  // Two samples per byte, CPU at 10MHz.
+  int divider = kDividers[(portC >> 2) & 3];
+  return 2 * divider * 10 / (clock4MHz ? 4 : 8);
+}
+
+uint64_t Adpcm::nextEvent() const {
+  return play ? fetched + kFetchBytes * cyclesPerByte() : kNever;
+}
+
+uint32_t Adpcm::takeDue(uint64_t now) {
+  if (!play || now < fetched)
+    return 0;
+  uint64_t perByte = cyclesPerByte();
+  uint32_t bytes = (now - fetched) / perByte;
+  fetched += bytes * perByte;
+  return bytes;
+}
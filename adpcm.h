@@ -0,0 +1,47 @@
+#ifndef __ADPCM_H__
+#define __ADPCM_H__
+
+#include <stdint.h>
+
+// MSM6258 ADPCM at 0xe92000, CPU side: command and status, and the data
+// clock. The sample clock comes from OPM CT1 (8MHz or 4MHz) and the
+// divider and panning from i8255 port C. Data is pulled through DMAC
+// channel 3 in blocks of kFetchBytes rather than a byte per request; the
+// bytes due are handed to the sound generator together with their time.
+class Adpcm {
+public:
+  typedef uint8_t BYTE;
+
+  static const int kDmaChannel = 3;
+  static const uint32_t kFetchBytes = 128;
+  static const uint64_t kNever = ~(uint64_t)0;
+
+  Adpcm();
+
+  BYTE read(uint32_t ofs) const;
+  // Returns true if playback started or stopped.
+  bool write(uint32_t ofs, BYTE value, uint64_t now);
+
+  void setClock4MHz(bool on)  { clock4MHz = on; }
+  void setPortC(BYTE value)  { portC = value; }
+
+  bool playing() const  { return play; }
+  // Output samples per ADPCM sample at the OPM sample rate.
+  int upsampling() const;
+  // Bit 0: left off, bit 1: right off.
+  int pan() const  { return portC & 3; }
+
+  uint64_t nextEvent() const;
+  // Returns the bytes consumed up to `now` and moves the data clock on.
+  uint32_t takeDue(uint64_t now);
+
+private:
+  uint64_t cyclesPerByte() const;
+
+  bool play;
+  bool clock4MHz;
+  BYTE portC;
+  uint64_t fetched;  // Data clock: time up to which bytes were taken.
+};
+
+#endif
@@ -0,0 +1,128 @@
+#include "adpcmsynth.h"
+#include <math.h>
+#include <string.h>
+
+typedef AdpcmSynth::BYTE BYTE;
+
+static const int kSteps = 49;
+static const int kStepSizes[kSteps] = {
+  16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45, 50, 55, 60, 66,
+  73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+  337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963, 1060, 1166, 1282, 1411,
+  1552,
+};
+static const int kIndexShift[8] = {-1, -1, -1, -1, 2, 4, 6, 8};
+static const float kGain = 8.0f;
+
+// Signal change and next step index for every step index and nibble.
+struct DecodeTables {
+  int delta[kSteps][16];
+  int next[kSteps][16];
+
+  DecodeTables() {
+    for (int i = 0; i < kSteps; ++i) {
+      for (int n = 0; n < 16; ++n) {
+        int d = (2 * (n & 7) + 1) * kStepSizes[i] / 8;
+        delta[i][n] = (n & 8) != 0 ? -d : d;
+        int j = i + kIndexShift[n & 7];
+        next[i][n] = j < 0 ? 0 : j >= kSteps ? kSteps - 1 : j;
+      }
+    }
+  }
+};
+
+static const DecodeTables kTables;
+
+AdpcmSynth::AdpcmSynth()
+  : signal(0), stepIndex(0), upsampling(4), pan(0), outputPos(0) {
+  memset(history, 0, sizeof(history));
+  buildFilter();
+}
+
+void AdpcmSynth::control(int upsampling, int pan, bool restart) {
+  this->pan = pan;
+  if (upsampling != this->upsampling) {
+    this->upsampling = upsampling;
+    buildFilter();
+  }
+  if (restart) {
+    signal = 0;
+    stepIndex = 0;
+  }
+}
+
+// Windowed sinc low pass at the ADPCM Nyquist rate, split into one set of
+// taps per output phase, each normalized to unit gain.
+void AdpcmSynth::buildFilter() {
+  int length = kTaps * upsampling;
+  std::vector<float> h(length);
+  double center = (length - 1) / 2.0;
+  for (int n = 0; n < length; ++n) {
+    double x = (n - center) / upsampling;
+    double sinc = x == 0 ? 1 : sin(M_PI * x) / (M_PI * x);
+    double w = 0.42 - 0.5 * cos(2 * M_PI * n / (length - 1)) + 0.08 * cos(4 * M_PI * n / (length - 1));
+    h[n] = sinc * w;
+  }
+  filter.assign(length, 0);
+  for (int p = 0; p < upsampling; ++p) {
+    float sum = 0;
+    for (int k = 0; k < kTaps; ++k)
+      sum += h[p + k * upsampling];
+    for (int k = 0; k < kTaps; ++k)
+      filter[p * kTaps + k] = h[p + k * upsampling] / sum;
+  }
+}
+
+void AdpcmSynth::decodeBlock(const BYTE* data, int count, float* dst) {
+  int s = signal;
+  int index = stepIndex;
+  for (int i = 0; i < count; ++i) {
+    BYTE b = data[i];
+    for (int half = 0; half < 2; ++half) {
+      int nibble = half == 0 ? b & 0x0f : b >> 4;
+      s += kTables.delta[index][nibble];
+      s = s < -2048 ? -2048 : s > 2047 ? 2047 : s;
+      index = kTables.next[index][nibble];
+      *dst++ = s;
+    }
+  }
+  signal = s;
+  stepIndex = index;
+}
+
+void AdpcmSynth::feed(const BYTE* data, int count) {
+  std::vector<float> samples(count * 2);
+  decodeBlock(data, count, samples.data());
+
+  if (outputPos > 0 && outputPos * 2 >= output.size()) {
+    output.erase(output.begin(), output.begin() + outputPos);
+    outputPos = 0;
+  }
+  size_t base = output.size();
+  output.resize(base + samples.size() * upsampling);
+  int16_t* dst = &output[base];
+  for (size_t i = 0; i < samples.size(); ++i) {
+    memmove(history + 1, history, sizeof(history) - sizeof(history[0]));
+    history[0] = samples[i];
+    for (int p = 0; p < upsampling; ++p) {
+      const float* taps = &filter[p * kTaps];
+      float y = 0;
+      for (int k = 0; k < kTaps; ++k)
+        y += taps[k] * history[k];
+      y *= kGain;
+      *dst++ = y > 32767 ? 32767 : y < -32768 ? -32768 : (int16_t)y;
+    }
+  }
+}
+
+void AdpcmSynth::mix(int16_t* out, int count) {
+  for (int i = 0; i < count && outputPos < output.size(); ++i) {
+    int v = output[outputPos++];
+    for (int c = 0; c < 2; ++c) {
+      if ((pan & (1 << c)) != 0)
+        continue;
+      int m = out[i * 2 + c] + v;
+      out[i * 2 + c] = m > 32767 ? 32767 : m < -32768 ? -32768 : m;
+    }
+  }
+}
@@ -0,0 +1,42 @@
+#ifndef __ADPCMSYNTH_H__
+#define __ADPCMSYNTH_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// MSM6258 sound generation: decodes blocks of ADPCM bytes with a table
+// driven kernel and brings them to the OPM sample rate with a polyphase
+// interpolation filter. Every ADPCM rate is an integer fraction of the
+// OPM rate, so one filter phase per output sample suffices.
+class AdpcmSynth {
+public:
+  typedef uint8_t BYTE;
+
+  AdpcmSynth();
+
+  // `upsampling` output samples per ADPCM sample; `pan` bit 0 mutes left,
+  // bit 1 right. `restart` resets the decoder as a play command does.
+  void control(int upsampling, int pan, bool restart);
+  // Decodes `count` bytes, two samples each, low nibble first.
+  void feed(const BYTE* data, int count);
+  // Adds the next `count` output samples to interleaved stereo `out`.
+  void mix(int16_t* out, int count);
+
+private:
+  static const int kTaps = 8;  // Input samples per output sample.
+
+  void decodeBlock(const BYTE* data, int count, float* dst);
+  void buildFilter();
+
+  int signal;  // 12-bit
+  int stepIndex;
+  int upsampling;
+  int pan;
+  std::vector<float> filter;  // [phase][tap]
+  float history[kTaps];       // Newest first.
+  std::vector<int16_t> output;
+  size_t outputPos;
+};
+
+#endif
@@ -0,0 +1,168 @@
+#include "audiothread.h"
+#include <string.h>
+#include "opm.h"
+
+typedef AudioThread::BYTE BYTE;
+
+static const int kCpuHz = 10000000;
+static const uint64_t kCyclesPerSample = kCpuHz / OPM::kSampleRate;
+static const int kChannels = 2;
+
+static void putLe(BYTE* p, uint32_t value, int bytes) {
+  for (int i = 0; i < bytes; ++i)
+    p[i] = value >> (i * 8);
+}
+
+AudioThread::AudioThread()
+  : fp(nullptr), seekable(false), samples(0), quit(false) {
+}
+
+AudioThread::~AudioThread() {
+  stop(0);
+}
+
+bool AudioThread::open(const char* path) {
+  fp = strcmp(path, "-") == 0 ? stdout : fopen(path, "wb");
+  if (fp == nullptr)
+    return false;
+  seekable = fp != stdout;
+  // Unknown length until stop(); a pipe keeps the maximum.
+  writeHeader(0xffffffff - 36);
+  return true;
+}
+
+void AudioThread::start() {
+  quit = false;
+  thread = std::thread(&AudioThread::audioMain, this);
+}
+
+void AudioThread::stop(uint64_t endTime) {
+  if (thread.joinable()) {
+    advance(endTime);
+    quit = true;
+    wake();
+    thread.join();
+  }
+  if (fp == nullptr)
+    return;
+  if (seekable && fseek(fp, 0, SEEK_SET) == 0)
+    writeHeader(samples * kChannels * sizeof(int16_t));
+  if (fp != stdout)
+    fclose(fp);
+  else
+    fflush(fp);
+  fp = nullptr;
+}
+
+void AudioThread::writeHeader(uint32_t dataBytes) {
+  BYTE h[44];
+  memcpy(h, "RIFF", 4);
+  putLe(h + 4, dataBytes + 36, 4);
+  memcpy(h + 8, "WAVEfmt ", 8);
+  putLe(h + 16, 16, 4);
+  putLe(h + 20, 1, 2);  // PCM
+  putLe(h + 22, kChannels, 2);
+  putLe(h + 24, OPM::kSampleRate, 4);
+  putLe(h + 28, OPM::kSampleRate * kChannels * sizeof(int16_t), 4);
+  putLe(h + 32, kChannels * sizeof(int16_t), 2);
+  putLe(h + 34, 16, 2);
+  memcpy(h + 36, "data", 4);
+  putLe(h + 40, dataBytes, 4);
+  fwrite(h, 1, sizeof(h), fp);
+}
+
+// The queue holds seconds of writes; a full one means the audio thread
+// fell far behind, so wait for it rather than lose a write.
+void AudioThread::push(const Event& e) {
+  while (!queue.push(e)) {
+    std::unique_lock<std::mutex> lock(mutex);
+    cond.notify_all();
+    cond.wait(lock, [this] { return !queue.full(); });
+  }
+}
+
+void AudioThread::pushData(BYTE value) {
+  while (!adpcmData.push(value)) {
+    std::unique_lock<std::mutex> lock(mutex);
+    cond.notify_all();
+    cond.wait(lock, [this] { return !adpcmData.full(); });
+  }
+}
+
+void AudioThread::wake() {
+  std::lock_guard<std::mutex> lock(mutex);
+  cond.notify_all();
+}
+
+void AudioThread::writeOpm(uint64_t time, int reg, BYTE value) {
+  Event e = {time, EVENT_OPM, (BYTE)reg, value, 0};
+  push(e);
+}
+
+void AudioThread::controlAdpcm(uint64_t time, int upsampling, int pan, bool restart) {
+  Event e = {time, EVENT_ADPCM_CONTROL, (BYTE)upsampling, (BYTE)(pan | (restart ? 0x80 : 0)), 0};
+  push(e);
+}
+
+void AudioThread::writeAdpcm(uint64_t time, const BYTE* data, uint32_t count) {
+  while (count > 0) {
+    uint16_t n = count < 4096 ? count : 4096;
+    for (uint16_t i = 0; i < n; ++i)
+      pushData(data[i]);
+    Event e = {time, EVENT_ADPCM_DATA, 0, 0, n};
+    push(e);
+    data += n;
+    count -= n;
+  }
+}
+
+void AudioThread::advance(uint64_t time) {
+  Event e = {time, EVENT_MARK, 0, 0, 0};
+  push(e);
+  wake();
+}
+
+void AudioThread::audioMain() {
+  for (;;) {
+    Event e;
+    if (!queue.pop(&e)) {
+      if (quit)
+        return;
+      // Run dry: a CPU thread waiting for room can go on.
+      std::unique_lock<std::mutex> lock(mutex);
+      cond.notify_all();
+      cond.wait(lock, [this] { return quit || !queue.empty(); });
+      continue;
+    }
+    renderTo(e.time);
+    switch (e.type) {
+    case EVENT_OPM:
+      synth.write(e.reg, e.value);
+      break;
+    case EVENT_ADPCM_CONTROL:
+      adpcm.control(e.reg, e.value & 3, (e.value & 0x80) != 0);
+      break;
+    case EVENT_ADPCM_DATA: {
+      BYTE data[4096];
+      for (int i = 0; i < e.count; ++i)
+        adpcmData.pop(&data[i]);
+      adpcm.feed(data, e.count);
+      break;
+    }
+    }
+  }
+}
+
+void AudioThread::renderTo(uint64_t time) {
+  int16_t block[kBlockSamples * kChannels];
+  uint64_t target = time / kCyclesPerSample;
+  uint64_t done = samples.load(std::memory_order_relaxed);
+  while (done < target) {
+    int n = target - done < (uint64_t)kBlockSamples ? target - done : kBlockSamples;
+    synth.render(block, n);
+    adpcm.mix(block, n);
+    fwrite(block, sizeof(int16_t) * kChannels, n, fp);
+    done += n;
+    samples.store(done, std::memory_order_relaxed);
+  }
+}
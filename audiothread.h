@@ -0,0 +1,83 @@
+#ifndef __AUDIOTHREAD_H__
+#define __AUDIOTHREAD_H__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "adpcmsynth.h"
+#include "fmsynth.h"
+#include "spsc.h"
+
+// Generates FM and ADPCM sound on a thread of its own and writes it as a
+// 16-bit stereo WAV stream at the OPM sample rate.
+// The CPU thread only appends timestamped register writes to a lock-free
+// queue. The audio thread renders up to each write's time before applying
+// it, and never past the last time the CPU reported through advance(), so
+// the output depends only on the emulated timeline.
+class AudioThread {
+public:
+  typedef uint8_t BYTE;
+
+  AudioThread();
+  ~AudioThread();
+
+  // `path` is a file name or "-" for stdout.
+  bool open(const char* path);
+  void start();
+  // Renders up to `endTime`, stops the thread and finishes the file.
+  void stop(uint64_t endTime);
+
+  // CPU side, times in CPU cycles.
+  void writeOpm(uint64_t time, int reg, BYTE value);
+  void controlAdpcm(uint64_t time, int upsampling, int pan, bool restart);
+  void writeAdpcm(uint64_t time, const BYTE* data, uint32_t count);
+  void advance(uint64_t time);
+
+  uint64_t samplesWritten() const  { return samples.load(std::memory_order_relaxed); }
+
+private:
+  enum EventType {
+    EVENT_MARK,  // Time reached by the CPU.
+    EVENT_OPM,
+    EVENT_ADPCM_CONTROL,  // reg: upsampling, value: pan | restart << 7.
+    EVENT_ADPCM_DATA,     // count bytes in the data ring.
+  };
+
+  struct Event {
+    uint64_t time;
+    BYTE type;
+    BYTE reg;
+    BYTE value;
+    uint16_t count;
+  };
+
+  static const int kBlockSamples = 1024;
+
+  void push(const Event& e);
+  void pushData(BYTE value);
+  void wake();
+  void audioMain();
+  void renderTo(uint64_t time);
+  void writeHeader(uint32_t dataBytes);
+
+  SpscQueue<Event, 16384> queue;
+  SpscQueue<BYTE, 65536> adpcmData;
+  FmSynth synth;
+  AdpcmSynth adpcm;
+  FILE* fp;
+  bool seekable;
+  std::atomic<uint64_t> samples;
+
+  std::thread thread;
+  std::atomic<bool> quit;
+  // The audio thread sleeps on `cond` while the queue is empty, and the
+  // CPU thread while a ring is full; the audio thread wakes it on running
+  // dry. Notified under the lock.
+  std::mutex mutex;
+  std::condition_variable cond;
+};
+
+#endif
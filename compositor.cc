@@ -0,0 +1,34 @@
+#include "compositor.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+static const uint32_t kBackdrop = 0xff000000;
+
+void Compositor::overlay(uint32_t* dst, const uint32_t* src, int width) {
+  int x = 0;
+#ifdef __SSE2__
+  const __m128i alpha = _mm_set1_epi32(0xff000000);
+  const __m128i zero = _mm_setzero_si128();
+  for (; x + 4 <= width; x += 4) {
+    __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x));
+    __m128i d = _mm_loadu_si128(reinterpret_cast<__m128i*>(dst + x));
+    __m128i clear = _mm_cmpeq_epi32(_mm_and_si128(s, alpha), zero);
+    d = _mm_or_si128(_mm_and_si128(clear, d), _mm_andnot_si128(clear, s));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), d);
+  }
+#endif
+  for (; x < width; ++x) {
+    if ((src[x] & 0xff000000) != 0)
+      dst[x] = src[x];
+  }
+}
+
+void Compositor::composeLine(uint32_t* dst, const uint32_t* const* layers, int count, int width) {
+  for (int x = 0; x < width; ++x)
+    dst[x] = kBackdrop;
+  for (int i = count; --i >= 0;) {
+    if (layers[i] != nullptr)
+      overlay(dst, layers[i], width);
+  }
+}
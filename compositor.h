@@ -0,0 +1,18 @@
+#ifndef __COMPOSITOR_H__
+#define __COMPOSITOR_H__
+
+#include <stdint.h>
+
+// Scanline kernels merging RGBA layers. A pixel with alpha 0 is transparent.
+namespace Compositor {
+
+// Draws `src` over `dst` where `src` is opaque.
+void overlay(uint32_t* dst, const uint32_t* src, int width);
+
+// Fills `dst` with the backdrop and draws `layers` back to front over it.
+// `layers` is in priority order, front first; null entries are skipped.
+void composeLine(uint32_t* dst, const uint32_t* const* layers, int count, int width);
+
+}  // namespace Compositor
+
+#endif
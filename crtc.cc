@@ -0,0 +1,108 @@
+#include "crtc.h"
+
+typedef CRTC::BYTE BYTE;
+typedef CRTC::WORD WORD;
+
+static const uint64_t kCpuKHz = 10000;
+// Dot clock sources for 31kHz and 15kHz modes.
+static const uint64_t kHighResKHz = 69552;
+static const uint64_t kLowResKHz = 38864;
+// Twice the dot clock divider, indexed by the horizontal resolution in R20.
+static const int kHighResDivider2[] = {12, 6, 4, 4};
+static const int kLowResDivider2[] = {16, 8, 8, 8};
+
+static const uint32_t OPERATION_PORT = 0x481;
+
+CRTC::CRTC()
+  : operation(0), frameStart(0) {
+  // 768x512 31kHz, as set up by the IPL.
+  static const WORD kDefaults[REG_COUNT] = {
+    0x0089, 0x000e, 0x001c, 0x007c, 0x0237, 0x0005, 0x0028, 0x0228,
+    0x001b, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+    0x0000, 0x0000, 0x0000, 0x0000, 0x0016, 0x0000, 0x0000, 0x0000,
+  };
+  for (int i = 0; i < REG_COUNT; ++i)
+    regs[i] = kDefaults[i];
+}
+
+BYTE CRTC::read8(uint32_t ofs) const {
+  if (ofs < REG_COUNT * 2) {
+    WORD value = regs[ofs >> 1];
+    return (ofs & 1) == 0 ? value >> 8 : value;
+  }
+  if (ofs == OPERATION_PORT)
+    return operation;
+  return 0;
+}
+
+bool CRTC::write8(uint32_t ofs, BYTE value, uint64_t now) {
+  if (ofs < REG_COUNT * 2) {
+    int no = ofs >> 1;
+    WORD& r = regs[no];
+    if ((ofs & 1) == 0)
+      r = (value << 8) | (r & 0x00ff);
+    else
+      r = (r & 0xff00) | value;
+    if (no == R00_HTOTAL || no == R04_VTOTAL || no == R20_MODE)
+      frameStart = now;  // Restart the frame with the new timing.
+    return no <= R09_RASTER_INT || no == R20_MODE;
+  }
+  if (ofs == OPERATION_PORT)
+    operation |= value;
+  return false;
+}
+
+BYTE CRTC::takeOperation() {
+  BYTE op = operation;
+  operation = 0;
+  return op;
+}
+
+uint64_t CRTC::lineCycles() const {
+  int hd = regs[R20_MODE] & 3;
+  bool highRes = (regs[R20_MODE] & 0x10) != 0;
+  uint64_t dots = ((regs[R00_HTOTAL] & 0xff) + 1) * 8;
+  uint64_t divider2 = highRes ? kHighResDivider2[hd] : kLowResDivider2[hd];
+  uint64_t cycles = dots * divider2 * kCpuKHz / (2 * (highRes ? kHighResKHz : kLowResKHz));
+  return cycles != 0 ? cycles : 1;
+}
+
+int CRTC::totalLines() const {
+  return (regs[R04_VTOTAL] & 0x3ff) + 1;
+}
+
+int CRTC::line(uint64_t now) const {
+  return (now - frameStart) / lineCycles() % totalLines();
+}
+
+bool CRTC::vdisp(uint64_t now) const {
+  int l = line(now);
+  return (regs[R06_VDISP_START] & 0x3ff) <= l && l < (regs[R07_VDISP_END] & 0x3ff);
+}
+
+bool CRTC::rasterMatch(uint64_t now) const {
+  return line(now) == (regs[R09_RASTER_INT] & 0x3ff);
+}
+
+uint64_t CRTC::nextEvent(uint64_t now) const {
+  uint64_t cycles = lineCycles();
+  int total = totalLines();
+  uint64_t absLine = (now - frameStart) / cycles;
+  int current = absLine % total;
+
+  const int edges[] = {
+    regs[R06_VDISP_START] & 0x3ff,
+    regs[R07_VDISP_END] & 0x3ff,
+    regs[R09_RASTER_INT] & 0x3ff,
+    ((regs[R09_RASTER_INT] & 0x3ff) + 1) % total,
+  };
+  int distance = total;
+  for (int i = 0; i < 4; ++i) {
+    if (edges[i] >= total)
+      continue;
+    int d = (edges[i] - current + total) % total;
+    if (d != 0 && d < distance)
+      distance = d;
+  }
+  return frameStart + (absLine + distance) * cycles;
+}
@@ -0,0 +1,67 @@
+#ifndef __CRTC_H__
+#define __CRTC_H__
+
+#include <stdint.h>
+
+// CRT controller (VICON): display timing, raster interrupt, scroll and
+// text VRAM access mode registers.
+// Signals are derived from the cycle count and the frame start, so that
+// only their edges need scheduler events.
+class CRTC {
+public:
+  typedef uint8_t BYTE;
+  typedef uint16_t WORD;
+
+  static const uint64_t kNever = ~(uint64_t)0;
+
+  enum {
+    R00_HTOTAL = 0,
+    R04_VTOTAL = 4,
+    R06_VDISP_START = 6,
+    R07_VDISP_END = 7,
+    R09_RASTER_INT = 9,
+    R10_TEXT_SCROLL_X = 10,
+    R11_TEXT_SCROLL_Y = 11,
+    R12_GRAPHIC_SCROLL = 12,  // X, Y for pages 0-3 up to R19.
+    R20_MODE = 20,
+    R21_TEXT_ACCESS = 21,
+    R22_RASTER_COPY = 22,
+    R23_TEXT_MASK = 23,
+    REG_COUNT = 24,
+  };
+
+  // R21
+  static const WORD TEXT_SIMULTANEOUS = 1 << 8;
+  static const WORD TEXT_MASK_ENABLE = 1 << 9;
+
+  // Operation port.
+  static const BYTE OP_RASTER_COPY = 1 << 3;
+
+  CRTC();
+
+  BYTE read8(uint32_t ofs) const;
+  // Returns true if a register affecting timing was written.
+  bool write8(uint32_t ofs, BYTE value, uint64_t now);
+
+  WORD reg(int no) const  { return regs[no]; }
+  // Clears and returns the pending operation bits.
+  BYTE takeOperation();
+
+  // Raster line being scanned at cycle `now`.
+  int line(uint64_t now) const;
+  bool vdisp(uint64_t now) const;
+  bool rasterMatch(uint64_t now) const;
+  // Cycle at which one of the signals changes next after `now`.
+  uint64_t nextEvent(uint64_t now) const;
+  uint64_t frameCycles() const  { return lineCycles() * totalLines(); }
+
+private:
+  uint64_t lineCycles() const;
+  int totalLines() const;
+
+  WORD regs[REG_COUNT];
+  BYTE operation;
+  uint64_t frameStart;
+};
+
+#endif
@@ -0,0 +1,91 @@
+#include "decodecache.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string>
+
+typedef DecodeCache::BYTE BYTE;
+
+struct CacheHeader {
+  char magic[8];
+  uint64_t key;
+  uint64_t size;
+};
+
+static const char kMagic[8] = {'X', '6', '8', 'D', 'E', 'C', 0, 1};
+
+// Maps the table from `path` if the header matches.
+static const BYTE* mapTable(const char* path, uint64_t key, size_t size) {
+  int fd = open(path, O_RDONLY);
+  if (fd == -1)
+    return nullptr;
+  const BYTE* table = nullptr;
+  struct stat st;
+  if (fstat(fd, &st) != -1 && st.st_size == (off_t)(sizeof(CacheHeader) + size)) {
+    void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (p != MAP_FAILED) {
+      const CacheHeader* header = static_cast<const CacheHeader*>(p);
+      if (memcmp(header->magic, kMagic, sizeof(kMagic)) == 0 && header->key == key && header->size == size)
+        table = static_cast<const BYTE*>(p) + sizeof(CacheHeader);
+      else
+        munmap(p, st.st_size);
+    }
+  }
+  close(fd);
+  return table;
+}
+
+static bool writeTable(const char* path, uint64_t key, const BYTE* table, size_t size) {
+  std::string temp = std::string(path) + "." + std::to_string(getpid());
+  FILE* fp = fopen(temp.c_str(), "wb");
+  if (fp == nullptr)
+    return false;
+  CacheHeader header;
+  memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.key = key;
+  header.size = size;
+  bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 && fwrite(table, size, 1, fp) == 1;
+  ok = fclose(fp) == 0 && ok;
+  if (ok && rename(temp.c_str(), path) == 0)
+    return true;
+  unlink(temp.c_str());
+  return false;
+}
+
+const BYTE* DecodeCache::open(const char* dir, const char* name, uint64_t key, size_t size,
+                              void (*build)(BYTE* table, void* context), void* context, bool* hit) {
+  if (hit != nullptr)
+    *hit = false;
+  char file[64];
+  snprintf(file, sizeof(file), "/%s-%016llx.bin", name, (unsigned long long)key);
+  std::string path = dir != nullptr ? dir + std::string(file) : std::string();
+  if (!path.empty()) {
+    const BYTE* table = mapTable(path.c_str(), key, size);
+    if (table != nullptr) {
+      if (hit != nullptr)
+        *hit = true;
+      return table;
+    }
+  }
+  BYTE* table = new BYTE[size];
+  build(table, context);
+  if (!path.empty() && writeTable(path.c_str(), key, table, size)) {
+    // Drop the private copy for the shared mapping.
+    const BYTE* mapped = mapTable(path.c_str(), key, size);
+    if (mapped != nullptr) {
+      delete[] table;
+      return mapped;
+    }
+  }
+  return table;
+}
+
+uint64_t DecodeCache::hash(const void* data, size_t size, uint64_t hash) {
+  const BYTE* p = static_cast<const BYTE*>(data);
+  for (size_t i = 0; i < size; ++i)
+    hash = (hash ^ p[i]) * 1099511628211ULL;
+  return hash;
+}
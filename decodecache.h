@@ -0,0 +1,30 @@
+#ifndef __DECODECACHE_H__
+#define __DECODECACHE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Decode tables kept in files across runs. A table is stored as
+// `name`-<key>.bin, the key covering everything the table follows from, so
+// tables for other builds or ROMs live side by side; the header repeats the
+// key and a file that does not match is rebuilt. New files are written
+// under a temporary name and renamed into place, so processes sharing the
+// file never see it half written, and the table is mapped read-only, so
+// they all share one copy in the page cache.
+class DecodeCache {
+public:
+  typedef uint8_t BYTE;
+
+  // Returns the `size` byte table for `key` from directory `dir`, calling
+  // `build` with `context` to fill it when the file cannot be used. Without
+  // a directory, or when the file cannot be written, the table is built in
+  // memory. `hit` tells whether the file was usable as it was. Never freed.
+  static const BYTE* open(const char* dir, const char* name, uint64_t key, size_t size,
+                          void (*build)(BYTE* table, void* context), void* context, bool* hit = nullptr);
+
+  // FNV-1a of `size` bytes, continuing from `hash`, for making keys.
+  static const uint64_t kHashSeed = 14695981039346656037ULL;
+  static uint64_t hash(const void* data, size_t size, uint64_t hash = kHashSeed);
+};
+
+#endif
@@ -0,0 +1,395 @@
+#include "diskimage.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+typedef DiskImage::BYTE BYTE;
+
+static const uint32_t kXdfSize = 77 * 2 * 8 * 1024;
+
+static const uint32_t kD88HeaderSize = 0x2b0;
+static const BYTE kD88WriteProtect = 0x10;
+static const BYTE kD88Deleted = 0x10;
+
+static const uint32_t kDimHeaderSize = 0x100;
+static const char kDimSignature[] = "DIFC HEADER  ";
+
+// Shapes of the DIM media types supported: sectors, N and cylinders.
+struct DimType {
+  BYTE type;
+  int sectors;
+  BYTE n;
+  int cylinders;
+};
+static const DimType kDimTypes[] = {
+  {0, 8, 3, 77},   // 2HD
+  {2, 15, 2, 80},  // 2HC
+  {9, 18, 2, 80},  // 2HQ
+};
+
+static const char kJournalMagic[8] = {'X', '6', '8', 'J', 'N', 'L', '0', '1'};
+
+struct JournalHeader {
+  char magic[8];
+  uint32_t imageSize;
+};
+
+struct JournalRecord {
+  uint32_t offset;
+  uint32_t size;
+};
+
+static uint32_t readLe16(const BYTE* p) {
+  return p[0] | (p[1] << 8);
+}
+
+static uint32_t readLe32(const BYTE* p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static bool writeAll(int fd, const void* data, size_t size) {
+  const BYTE* p = static_cast<const BYTE*>(data);
+  while (size > 0) {
+    ssize_t n = write(fd, p, size);
+    if (n <= 0)
+      return false;
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+DiskImage::DiskImage()
+  : fmt(FORMAT_NONE), map(nullptr), imageFd(-1), size(0), cylinders(0), journalFd(-1),
+    detached(false) {
+  for (int i = 0; i < kTracks; ++i)
+    tracks[i].parsed = false;
+}
+
+DiskImage::~DiskImage() {
+  close(false);
+}
+
+bool DiskImage::open(const char* path, const char* journalPath) {
+  close(false);
+  int fd = ::open(path, O_RDONLY);
+  if (fd == -1)
+    return false;
+  struct stat st;
+  if (fstat(fd, &st) == -1 || st.st_size == 0 || st.st_size > 0x7fffffff || flock(fd, LOCK_SH) == -1) {
+    ::close(fd);
+    return false;
+  }
+  void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  if (p == MAP_FAILED) {
+    ::close(fd);
+    return false;
+  }
+  map = static_cast<const BYTE*>(p);
+  imageFd = fd;
+  size = st.st_size;
+  this->path = path;
+  this->journalPath = journalPath != nullptr ? journalPath : "";
+  if (!detect() || !replayJournal()) {
+    close(false);
+    return false;
+  }
+  return true;
+}
+
+void DiskImage::close(bool merge) {
+  if (map == nullptr)
+    return;
+  if (merge && !overlay.empty() && flock(imageFd, LOCK_EX | LOCK_NB) == -1) {
+    fprintf(stderr, "%s is in use elsewhere, keeping %s\n", path.c_str(), journalPath.c_str());
+  } else if (merge) {
+    int fd = overlay.empty() ? -1 : ::open(path.c_str(), O_WRONLY);
+    bool merged = overlay.empty() || fd != -1;
+    for (std::map<uint32_t, std::vector<BYTE> >::const_iterator it = overlay.begin();
+         merged && it != overlay.end(); ++it)
+      merged = pwrite(fd, it->second.data(), it->second.size(), it->first) == (ssize_t)it->second.size();
+    if (fd != -1)
+      merged = fsync(fd) == 0 && merged;
+    if (fd != -1)
+      ::close(fd);
+    if (merged && !journalPath.empty())
+      unlink(journalPath.c_str());
+    else
+      fprintf(stderr, "Cannot merge %s into %s, keeping it\n", journalPath.c_str(), path.c_str());
+  }
+  if (journalFd != -1)
+    ::close(journalFd);
+  journalFd = -1;
+  munmap(const_cast<BYTE*>(map), size);
+  ::close(imageFd);
+  imageFd = -1;
+  map = nullptr;
+  size = 0;
+  fmt = FORMAT_NONE;
+  cylinders = 0;
+  overlay.clear();
+  written.clear();
+  detached = false;
+  for (int i = 0; i < kTracks; ++i) {
+    tracks[i].parsed = false;
+    tracks[i].sectors.clear();
+  }
+}
+
+// D88 records its own size in the header, DIM has a signature and XDF is
+// a bare 2HD image recognized by size.
+bool DiskImage::detect() {
+  if (size >= kD88HeaderSize && readLe32(map + 0x1c) == size) {
+    fmt = FORMAT_D88;
+    cylinders = kCylinders;
+    return true;
+  }
+  if (size >= kDimHeaderSize && memcmp(map + 0xab, kDimSignature, strlen(kDimSignature)) == 0) {
+    for (size_t i = 0; i < sizeof(kDimTypes) / sizeof(kDimTypes[0]); ++i) {
+      const DimType& type = kDimTypes[i];
+      if (map[0] != type.type)
+        continue;
+      // Only the tracks flagged in the header are stored.
+      uint32_t trackSize = type.sectors * (128 << type.n);
+      uint32_t offset = kDimHeaderSize;
+      for (int t = 0; t < kTracks; ++t) {
+        bool present = t < type.cylinders * 2 && map[1 + t] != 0 && offset + trackSize <= size;
+        geometry.trackOffset[t] = present ? offset : kNoTrack;
+        if (present)
+          offset += trackSize;
+      }
+      geometry.sectors = type.sectors;
+      geometry.n = type.n;
+      cylinders = type.cylinders;
+      fmt = FORMAT_DIM;
+      return true;
+    }
+    fprintf(stderr, "Unsupported DIM type %d\n", map[0]);
+    return false;
+  }
+  if (size == kXdfSize) {
+    uint32_t trackSize = 8 * 1024;
+    for (int t = 0; t < kTracks; ++t)
+      geometry.trackOffset[t] = (uint32_t)t * trackSize < size ? t * trackSize : kNoTrack;
+    geometry.sectors = 8;
+    geometry.n = 3;
+    cylinders = 77;
+    fmt = FORMAT_XDF;
+    return true;
+  }
+  return false;
+}
+
+// nullptr for a track number beyond the image.
+DiskImage::Track* DiskImage::track(int no) {
+  if (map == nullptr || no < 0 || no >= cylinders * 2)
+    return nullptr;
+  Track* t = &tracks[no];
+  if (!t->parsed) {
+    if (fmt == FORMAT_D88)
+      parseD88(no, t);
+    else
+      parseFixed(no, t);
+    t->parsed = true;
+  }
+  return t;
+}
+
+// Walks the sector headers of a D88 track, stopping at anything which
+// would run past the image.
+void DiskImage::parseD88(int no, Track* t) {
+  uint32_t offset = readLe32(map + 0x20 + no * 4);
+  if (offset < kD88HeaderSize)
+    return;
+  for (uint32_t count = 0;; ) {
+    if (offset + 16 > size)
+      return;
+    const BYTE* h = map + offset;
+    if (count == 0)
+      count = readLe16(h + 4);
+    uint32_t dataSize = readLe16(h + 14);
+    if (offset + 16 + dataSize > size)
+      return;
+    Sector s = {{h[0], h[1], h[2], h[3]}, offset + 16, dataSize, offset + 7};
+    t->sectors.push_back(s);
+    if (t->sectors.size() >= count)
+      return;
+    offset += 16 + dataSize;
+  }
+}
+
+void DiskImage::parseFixed(int no, Track* t) {
+  if (geometry.trackOffset[no] == kNoTrack)
+    return;
+  uint32_t sectorSize = 128 << geometry.n;
+  for (int i = 0; i < geometry.sectors; ++i) {
+    Sector s = {{(BYTE)(no >> 1), (BYTE)(no & 1), (BYTE)(i + 1), geometry.n},
+                geometry.trackOffset[no] + i * sectorSize, sectorSize, 0};
+    t->sectors.push_back(s);
+  }
+}
+
+const BYTE* DiskImage::bytesAt(uint32_t offset) const {
+  std::map<uint32_t, std::vector<BYTE> >::const_iterator it = overlay.find(offset);
+  return it != overlay.end() ? it->second.data() : map + offset;
+}
+
+int DiskImage::sectorCount(int no) {
+  const Track* t = track(no);
+  return t != nullptr ? t->sectors.size() : 0;
+}
+
+const DiskImage::SectorId& DiskImage::sectorId(int no, int index) {
+  return track(no)->sectors[index].id;
+}
+
+int DiskImage::findSector(int no, const SectorId& id) {
+  const Track* t = track(no);
+  if (t == nullptr)
+    return -1;
+  for (size_t i = 0; i < t->sectors.size(); ++i) {
+    const SectorId& s = t->sectors[i].id;
+    if (s.c == id.c && s.h == id.h && s.r == id.r && s.n == id.n)
+      return i;
+  }
+  return -1;
+}
+
+const BYTE* DiskImage::sectorData(int no, int index, uint32_t* pSize, bool* pDeleted) {
+  const Sector& s = track(no)->sectors[index];
+  *pSize = s.size;
+  *pDeleted = s.markOffset != 0 && (*bytesAt(s.markOffset) & kD88Deleted) != 0;
+  return bytesAt(s.offset);
+}
+
+bool DiskImage::writeSector(int no, int index, const BYTE* data, bool deleted) {
+  if (fmt == FORMAT_D88 && (map[0x1a] & kD88WriteProtect) != 0)
+    return false;
+  const Sector& s = track(no)->sectors[index];
+  if (!appendRecord(s.offset, data, s.size))
+    return false;
+  if (s.markOffset != 0 && ((*bytesAt(s.markOffset) & kD88Deleted) != 0) != deleted) {
+    BYTE mark = deleted ? kD88Deleted : 0;
+    return appendRecord(s.markOffset, &mark, 1);
+  }
+  return true;
+}
+
+// Created on the first write, so sessions which only read leave no file.
+// A default journal gets a name no other instance uses.
+bool DiskImage::openJournal() {
+  if (journalPath.empty()) {
+    std::string name = path + ".XXXXXX.jnl";
+    journalFd = mkstemps(&name[0], 4);
+    if (journalFd != -1)
+      journalPath = name;
+  } else {
+    journalFd = ::open(journalPath.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+  }
+  if (journalFd == -1) {
+    fprintf(stderr, "Cannot create a journal for %s\n", path.c_str());
+    return false;
+  }
+  struct stat st;
+  if (fstat(journalFd, &st) == 0 && st.st_size == 0) {
+    JournalHeader header;
+    memcpy(header.magic, kJournalMagic, sizeof(header.magic));
+    header.imageSize = size;
+    return writeAll(journalFd, &header, sizeof(header));
+  }
+  return true;
+}
+
+// Loads the overlay from an existing journal. A record cut short by a
+// crash is dropped along with anything after it.
+bool DiskImage::replayJournal() {
+  if (journalPath.empty())
+    return true;
+  int fd = ::open(journalPath.c_str(), O_RDWR);
+  if (fd == -1)
+    return true;
+  struct stat st;
+  JournalHeader header;
+  if (fstat(fd, &st) == -1 || pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+      memcmp(header.magic, kJournalMagic, sizeof(header.magic)) != 0 || header.imageSize != size) {
+    fprintf(stderr, "%s does not belong to %s\n", journalPath.c_str(), path.c_str());
+    ::close(fd);
+    return false;
+  }
+  off_t pos = sizeof(header);
+  for (;;) {
+    JournalRecord record;
+    if (pread(fd, &record, sizeof(record), pos) != sizeof(record) ||
+        record.offset + (uint64_t)record.size > size ||
+        pos + (off_t)sizeof(record) + record.size > st.st_size)
+      break;
+    std::vector<BYTE>& data = overlay[record.offset];
+    data.resize(record.size);
+    if (pread(fd, data.data(), record.size, pos + sizeof(record)) != (ssize_t)record.size) {
+      overlay.erase(record.offset);
+      break;
+    }
+    written.insert(record.offset);
+    pos += sizeof(record) + record.size;
+  }
+  if (pos < st.st_size && ftruncate(fd, pos) == -1)
+    fprintf(stderr, "Cannot truncate %s\n", journalPath.c_str());
+  ::close(fd);
+  return true;
+}
+
+bool DiskImage::appendRecord(uint32_t offset, const BYTE* data, uint32_t size) {
+  if (!detached) {
+    if (journalFd == -1 && !openJournal())
+      return false;
+    std::vector<BYTE> buffer(sizeof(JournalRecord) + size);
+    JournalRecord record = {offset, size};
+    memcpy(buffer.data(), &record, sizeof(record));
+    memcpy(buffer.data() + sizeof(record), data, size);
+    if (!writeAll(journalFd, buffer.data(), buffer.size()))
+      return false;
+  }
+  overlay[offset].assign(data, data + size);
+  written.insert(offset);
+  return true;
+}
+
+void DiskImage::takeWrites(std::vector<BYTE>* out) {
+  out->clear();
+  for (std::set<uint32_t>::const_iterator it = written.begin(); it != written.end(); ++it) {
+    const std::vector<BYTE>& data = overlay[*it];
+    JournalRecord record = {*it, (uint32_t)data.size()};
+    const BYTE* p = reinterpret_cast<const BYTE*>(&record);
+    out->insert(out->end(), p, p + sizeof(record));
+    out->insert(out->end(), data.begin(), data.end());
+  }
+  written.clear();
+}
+
+void DiskImage::clearWrites() {
+  if (journalFd != -1)
+    ::close(journalFd);
+  journalFd = -1;
+  journalPath.clear();
+  detached = true;
+  overlay.clear();
+  written.clear();
+}
+
+// Records run past the image or the buffer are dropped.
+void DiskImage::applyWrites(const std::vector<BYTE>& records) {
+  for (size_t pos = 0; pos + sizeof(JournalRecord) <= records.size(); ) {
+    JournalRecord record;
+    memcpy(&record, &records[pos], sizeof(record));
+    pos += sizeof(record);
+    if (record.size > records.size() - pos || record.offset + (uint64_t)record.size > size)
+      return;
+    overlay[record.offset].assign(&records[pos], &records[pos] + record.size);
+    pos += record.size;
+  }
+}
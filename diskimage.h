@@ -0,0 +1,119 @@
+#ifndef __DISKIMAGE_H__
+#define __DISKIMAGE_H__
+
+#include <stdint.h>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+// Floppy disk image in XDF, DIM or D88 format, told apart by header and
+// size. The image is mapped read-only, so any number of processes booting
+// the same master share one copy in the page cache, and tracks are only
+// parsed when first accessed.
+// Writes never touch the image: they land in a copy-on-write overlay which
+// is appended to a journal file as it changes. Opening with that journal
+// again replays it, and close() can merge it back into the image.
+// Every instance holds a shared lock on the image, so a merge only happens
+// when nobody else has it open.
+class DiskImage {
+public:
+  typedef uint8_t BYTE;
+
+  enum Format {
+    FORMAT_NONE,
+    FORMAT_XDF,
+    FORMAT_DIM,
+    FORMAT_D88,
+  };
+
+  static const int kCylinders = 82;
+  static const int kTracks = kCylinders * 2;
+  static const uint32_t kNoTrack = ~(uint32_t)0;
+
+  struct SectorId {
+    BYTE c, h, r, n;
+  };
+
+  DiskImage();
+  ~DiskImage();
+
+  // Maps `path` and replays `journalPath` if it exists. Without one the
+  // journal is a new path + ".XXXXXX.jnl" made on the first write.
+  bool open(const char* path, const char* journalPath = nullptr);
+  // With `merge` the overlay is written into the image and the journal is
+  // removed; otherwise the journal is kept for the next session.
+  void close(bool merge);
+  // Journal path, empty while a default journal has not been made yet.
+  const std::string& journal() const  { return journalPath; }
+
+  Format format() const  { return fmt; }
+  // Cylinders the image can hold, where the head stops.
+  int cylinderCount() const  { return cylinders; }
+
+  // `track` is cylinder * 2 + head. Tracks outside the image have no
+  // sectors.
+  int sectorCount(int track);
+  // The sector calls below take an index below sectorCount().
+  const SectorId& sectorId(int track, int index);
+  // Index of the sector with ID `id` on `track`, or -1.
+  int findSector(int track, const SectorId& id);
+  // Sector contents, from the overlay if written and from the mapping
+  // otherwise. Valid until the sector is written again.
+  const BYTE* sectorData(int track, int index, uint32_t* pSize, bool* pDeleted);
+  // Returns false if the journal cannot be written.
+  bool writeSector(int track, int index, const BYTE* data, bool deleted);
+
+  // For recordings: journal records of the overlay written since the last
+  // call, all of it the first time.
+  void takeWrites(std::vector<BYTE>* out);
+  // For replay: drops the overlay and the journal, so writes stay in
+  // memory, and applies records from takeWrites().
+  void clearWrites();
+  void applyWrites(const std::vector<BYTE>& records);
+
+private:
+  struct Sector {
+    SectorId id;
+    uint32_t offset;      // Data in the image.
+    uint32_t size;
+    uint32_t markOffset;  // D88 deleted mark byte, 0 if the format has none.
+  };
+
+  struct Track {
+    bool parsed;
+    std::vector<Sector> sectors;
+  };
+
+  // Layout of the formats with one sector shape for the whole disk.
+  struct Geometry {
+    int sectors;
+    BYTE n;
+    uint32_t trackOffset[kTracks];  // kNoTrack if not stored.
+  };
+
+  bool detect();
+  Track* track(int no);
+  void parseD88(int no, Track* t);
+  void parseFixed(int no, Track* t);
+  const BYTE* bytesAt(uint32_t offset) const;
+  bool openJournal();
+  bool replayJournal();
+  bool appendRecord(uint32_t offset, const BYTE* data, uint32_t size);
+
+  std::string path;
+  std::string journalPath;
+  Format fmt;
+  const BYTE* map;
+  int imageFd;  // Holds the shared lock.
+  uint32_t size;
+  Geometry geometry;
+  int cylinders;
+  Track tracks[kTracks];
+  std::map<uint32_t, std::vector<BYTE> > overlay;  // Image offset to contents.
+  std::set<uint32_t> written;  // Overlay offsets for takeWrites().
+  int journalFd;
+  bool detached;  // No journal, since clearWrites().
+};
+
+#endif
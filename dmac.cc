@@ -0,0 +1,327 @@
+#include "dmac.h"
+#include <string.h>
+
+typedef DMAC::BYTE BYTE;
+typedef DMAC::WORD WORD;
+typedef DMAC::LONG LONG;
+
+static const BYTE CSR_COC = 1 << 7;  // Channel operation complete.
+static const BYTE CSR_BTC = 1 << 6;  // Block transfer complete.
+static const BYTE CSR_NDT = 1 << 5;  // Normal device termination.
+static const BYTE CSR_ERR = 1 << 4;
+static const BYTE CSR_ACT = 1 << 3;
+static const BYTE CSR_PCT = 1 << 1;
+static const BYTE CSR_CLEARABLE = CSR_COC | CSR_BTC | CSR_NDT | CSR_ERR | CSR_PCT;
+
+static const BYTE CCR_STR = 1 << 7;
+static const BYTE CCR_CNT = 1 << 6;
+static const BYTE CCR_SAB = 1 << 4;
+static const BYTE CCR_INT = 1 << 3;
+
+static const BYTE OCR_DIR = 1 << 7;  // Device to memory.
+static const int CHAIN_ARRAY = 2;
+static const int CHAIN_LINK = 3;
+static const int REQ_EXTERNAL = 2;  // REQG of 2 and 3 wait for the device.
+
+static const BYTE ERR_MTC_COUNT = 0x0d;
+static const BYTE ERR_BTC_COUNT = 0x0f;
+static const BYTE ERR_SOFTWARE_ABORT = 0x11;
+
+// Bytes and CPU cycles per unit by OCR size: byte, word, long, unpacked
+// byte. A dual address transfer is a read and a write bus cycle per word.
+static const uint32_t kUnitBytes[] = {1, 2, 4, 1};
+static const uint64_t kUnitCycles[] = {8, 8, 16, 8};
+
+static BYTE byteOf(LONG value, int index, int size) {
+  return value >> ((size - 1 - index) * 8);
+}
+
+static void setByte(LONG* value, int index, int size, BYTE b) {
+  int shift = (size - 1 - index) * 8;
+  *value = (*value & ~((LONG)0xff << shift)) | ((LONG)b << shift);
+}
+
+static void setByte(WORD* value, int index, BYTE b) {
+  LONG v = *value;
+  setByte(&v, index, 2, b);
+  *value = v;
+}
+
+static LONG readLong(const BYTE* p) {
+  return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+// Address step per unit from a MAC or DAC field.
+static int addressStep(int field, uint32_t unit) {
+  switch (field & 3) {
+  case 1:  return unit;
+  case 2:  return -(int)unit;
+  default:  return 0;
+  }
+}
+
+DMAC::DMAC()
+  : gcr(0) {
+  memset(channels, 0, sizeof(channels));
+  for (int i = 0; i < kChannels; ++i) {
+    channels[i].niv = channels[i].eiv = 0x0f;  // Uninitialized vector.
+    channels[i].finish = kNever;
+  }
+}
+
+BYTE DMAC::read8(uint32_t ofs) const {
+  int ch = (ofs >> 6) & 3;
+  const Channel& c = channels[ch];
+  uint32_t r = ofs & 0x3f;
+  switch (r) {
+  case 0x00:  return c.csr;
+  case 0x01:  return c.cer;
+  case 0x04:  return c.dcr;
+  case 0x05:  return c.ocr;
+  case 0x06:  return c.scr;
+  case 0x07:  return c.ccr;
+  case 0x0a: case 0x0b:  return byteOf(c.mtc, r - 0x0a, 2);
+  case 0x0c: case 0x0d: case 0x0e: case 0x0f:  return byteOf(c.mar, r - 0x0c, 4);
+  case 0x14: case 0x15: case 0x16: case 0x17:  return byteOf(c.dar, r - 0x14, 4);
+  case 0x1a: case 0x1b:  return byteOf(c.btc, r - 0x1a, 2);
+  case 0x1c: case 0x1d: case 0x1e: case 0x1f:  return byteOf(c.bar, r - 0x1c, 4);
+  case 0x25:  return c.niv;
+  case 0x27:  return c.eiv;
+  case 0x29:  return c.mfc;
+  case 0x2d:  return c.cpr;
+  case 0x31:  return c.dfc;
+  case 0x39:  return c.bfc;
+  case 0x3f:  return ch == 3 ? gcr : 0;
+  default:  return 0;
+  }
+}
+
+void DMAC::write8(uint32_t ofs, BYTE value, Bus* bus, uint64_t now) {
+  int ch = (ofs >> 6) & 3;
+  Channel& c = channels[ch];
+  uint32_t r = ofs & 0x3f;
+  switch (r) {
+  case 0x00:
+    c.csr &= ~(value & CSR_CLEARABLE);
+    if ((value & CSR_ERR) != 0)
+      c.cer = 0;
+    break;
+  case 0x04:  c.dcr = value; break;
+  case 0x05:  c.ocr = value; break;
+  case 0x06:  c.scr = value; break;
+  case 0x07:
+    c.ccr = value & ~(CCR_STR | CCR_SAB);
+    if ((value & CCR_SAB) != 0 && (c.csr & CSR_ACT) != 0)
+      error(&c, ERR_SOFTWARE_ABORT);
+    if ((value & CCR_STR) != 0 && (c.csr & CSR_ACT) == 0)
+      start(ch, bus, now);
+    break;
+  case 0x0a: case 0x0b:  setByte(&c.mtc, r - 0x0a, value); break;
+  case 0x0c: case 0x0d: case 0x0e: case 0x0f:  setByte(&c.mar, r - 0x0c, 4, value); break;
+  case 0x14: case 0x15: case 0x16: case 0x17:  setByte(&c.dar, r - 0x14, 4, value); break;
+  case 0x1a: case 0x1b:  setByte(&c.btc, r - 0x1a, value); break;
+  case 0x1c: case 0x1d: case 0x1e: case 0x1f:  setByte(&c.bar, r - 0x1c, 4, value); break;
+  case 0x25:  c.niv = value; break;
+  case 0x27:  c.eiv = value; break;
+  case 0x29:  c.mfc = value; break;
+  case 0x2d:  c.cpr = value; break;
+  case 0x31:  c.dfc = value; break;
+  case 0x39:  c.bfc = value; break;
+  case 0x3f:
+    if (ch == 3)
+      gcr = value;
+    break;
+  default:
+    break;
+  }
+}
+
+void DMAC::start(int ch, Bus* bus, uint64_t now) {
+  Channel& c = channels[ch];
+  int chain = (c.ocr >> 2) & 3;
+  if (chain == CHAIN_ARRAY || chain == CHAIN_LINK) {
+    if (chain == CHAIN_ARRAY && c.btc == 0) {
+      error(&c, ERR_BTC_COUNT);
+      return;
+    }
+    nextBlock(&c, bus);
+  }
+  if (c.mtc == 0) {
+    error(&c, ERR_MTC_COUNT);
+    return;
+  }
+  c.csr |= CSR_ACT;
+  if ((c.ocr & 3) < REQ_EXTERNAL)
+    c.finish = now + runAuto(&c, bus);
+}
+
+// Loads the next block of a chain or a continued transfer into MAR and MTC.
+bool DMAC::nextBlock(Channel* c, Bus* bus) {
+  BYTE entry[10];
+  switch ((c->ocr >> 2) & 3) {
+  case CHAIN_ARRAY:
+    if (c->btc == 0)
+      return false;
+    bus->dmaRead(c->bar, entry, 6);
+    c->mar = readLong(entry);
+    c->mtc = (entry[4] << 8) | entry[5];
+    c->bar += 6;
+    --c->btc;
+    return true;
+  case CHAIN_LINK:
+    if (c->bar == 0)
+      return false;
+    bus->dmaRead(c->bar, entry, 10);
+    c->mar = readLong(entry);
+    c->mtc = (entry[4] << 8) | entry[5];
+    c->bar = readLong(entry + 6);
+    return true;
+  default:
+    if ((c->ccr & CCR_CNT) == 0)
+      return false;
+    c->mar = c->bar;
+    c->mtc = c->btc;
+    c->ccr &= ~CCR_CNT;
+    c->csr |= CSR_BTC;
+    return true;
+  }
+}
+
+// Moves every block of an auto-request transfer at once and returns the
+// cycles the transfer takes.
+uint64_t DMAC::runAuto(Channel* c, Bus* bus) {
+  int size = (c->ocr >> 4) & 3;
+  uint32_t unit = kUnitBytes[size];
+  uint64_t cycles = 0;
+  BYTE buffer[4096];
+  do {
+    bool toMemory = (c->ocr & OCR_DIR) != 0;
+    LONG* src = toMemory ? &c->dar : &c->mar;
+    LONG* dst = toMemory ? &c->mar : &c->dar;
+    int srcStep = addressStep(toMemory ? c->scr : c->scr >> 2, unit);
+    int dstStep = addressStep(toMemory ? c->scr >> 2 : c->scr, unit);
+    uint32_t bytes = c->mtc * unit;
+    if (srcStep == (int)unit && dstStep == (int)unit) {
+      for (uint32_t done = 0; done < bytes;) {
+        uint32_t n = bytes - done < sizeof(buffer) ? bytes - done : sizeof(buffer);
+        bus->dmaRead(*src + done, buffer, n);
+        bus->dmaWrite(*dst + done, buffer, n);
+        done += n;
+      }
+      *src += bytes;
+      *dst += bytes;
+    } else {
+      for (int i = 0; i < c->mtc; ++i) {
+        bus->dmaRead(*src, buffer, unit);
+        bus->dmaWrite(*dst, buffer, unit);
+        *src += srcStep;
+        *dst += dstStep;
+      }
+    }
+    cycles += c->mtc * kUnitCycles[size];
+    c->mtc = 0;
+  } while (nextBlock(c, bus));
+  return cycles;
+}
+
+uint32_t DMAC::transferToMemory(int ch, const BYTE* data, uint32_t bytes, Bus* bus) {
+  Channel& c = channels[ch];
+  if ((c.csr & CSR_ACT) == 0 || c.finish != kNever)
+    return 0;
+  uint32_t unit = kUnitBytes[(c.ocr >> 4) & 3];
+  int step = addressStep(c.scr >> 2, unit);
+  uint32_t done = 0;
+  while (bytes - done >= unit) {
+    uint32_t n = bytes - done < c.mtc * unit ? (bytes - done) / unit * unit : c.mtc * unit;
+    if (step == (int)unit) {
+      bus->dmaWrite(c.mar, data + done, n);
+      c.mar += n;
+    } else {
+      for (uint32_t i = 0; i < n; i += unit, c.mar += step)
+        bus->dmaWrite(c.mar, data + done + i, unit);
+    }
+    c.mtc -= n / unit;
+    done += n;
+    if (c.mtc == 0 && !nextBlock(&c, bus)) {
+      complete(&c);
+      break;
+    }
+  }
+  return done;
+}
+
+uint32_t DMAC::transferFromMemory(int ch, BYTE* data, uint32_t bytes, Bus* bus) {
+  Channel& c = channels[ch];
+  if ((c.csr & CSR_ACT) == 0 || c.finish != kNever)
+    return 0;
+  uint32_t unit = kUnitBytes[(c.ocr >> 4) & 3];
+  int step = addressStep(c.scr >> 2, unit);
+  uint32_t done = 0;
+  while (bytes - done >= unit) {
+    uint32_t n = bytes - done < c.mtc * unit ? (bytes - done) / unit * unit : c.mtc * unit;
+    if (step == (int)unit) {
+      bus->dmaRead(c.mar, data + done, n);
+      c.mar += n;
+    } else {
+      for (uint32_t i = 0; i < n; i += unit, c.mar += step)
+        bus->dmaRead(c.mar, data + done + i, unit);
+    }
+    c.mtc -= n / unit;
+    done += n;
+    if (c.mtc == 0 && !nextBlock(&c, bus)) {
+      complete(&c);
+      break;
+    }
+  }
+  return done;
+}
+
+bool DMAC::active(int ch) const {
+  return (channels[ch].csr & CSR_ACT) != 0;
+}
+
+void DMAC::update(uint64_t now) {
+  for (int i = 0; i < kChannels; ++i) {
+    if (channels[i].finish <= now)
+      complete(&channels[i]);
+  }
+}
+
+uint64_t DMAC::nextEvent() const {
+  uint64_t next = kNever;
+  for (int i = 0; i < kChannels; ++i) {
+    if (channels[i].finish < next)
+      next = channels[i].finish;
+  }
+  return next;
+}
+
+void DMAC::complete(Channel* c) {
+  c->csr = (c->csr & ~CSR_ACT) | CSR_COC;
+  c->finish = kNever;
+}
+
+void DMAC::error(Channel* c, BYTE code) {
+  c->csr = (c->csr & ~CSR_ACT) | CSR_COC | CSR_ERR;
+  c->cer = code;
+  c->finish = kNever;
+}
+
+bool DMAC::irq() const {
+  for (int i = 0; i < kChannels; ++i) {
+    const Channel& c = channels[i];
+    if ((c.ccr & CCR_INT) != 0 && (c.csr & (CSR_COC | CSR_BTC | CSR_NDT | CSR_ERR)) != 0)
+      return true;
+  }
+  return false;
+}
+
+// The request stays asserted until the status bits are cleared through CSR.
+int DMAC::acknowledge() {
+  for (int i = 0; i < kChannels; ++i) {
+    const Channel& c = channels[i];
+    if ((c.ccr & CCR_INT) != 0 && (c.csr & (CSR_COC | CSR_BTC | CSR_NDT | CSR_ERR)) != 0)
+      return (c.csr & CSR_ERR) != 0 ? c.eiv : c.niv;
+  }
+  return -1;
+}
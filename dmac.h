@@ -0,0 +1,70 @@
+#ifndef __DMAC_H__
+#define __DMAC_H__
+
+#include <stdint.h>
+
+// HD63450 DMA controller at 0xe84000, four channels of 0x40 bytes.
+// On the X68000 channel 0 serves the FDC, 1 the hard disk, 2 memory to
+// memory moves and 3 the ADPCM.
+// Transfers are never run unit by unit: an auto-request channel moves its
+// whole transfer, chain included, when it is started and completes at the
+// cycle the transfer would have taken. Devices on external request
+// channels push or pull whole blocks through transferToMemory() and
+// transferFromMemory().
+class DMAC {
+public:
+  typedef uint8_t BYTE;
+  typedef uint16_t WORD;
+  typedef uint32_t LONG;
+
+  static const int kIrqLevel = 3;
+  static const int kChannels = 4;
+  static const uint64_t kNever = ~(uint64_t)0;
+
+  // Memory as seen by the DMAC. Blocks are at ascending addresses.
+  class Bus {
+  public:
+    virtual ~Bus() {}
+    virtual void dmaRead(LONG adr, BYTE* data, uint32_t bytes) = 0;
+    virtual void dmaWrite(LONG adr, const BYTE* data, uint32_t bytes) = 0;
+  };
+
+  DMAC();
+
+  BYTE read8(uint32_t ofs) const;
+  void write8(uint32_t ofs, BYTE value, Bus* bus, uint64_t now);
+
+  // Device side of an active channel: moves up to `bytes` bytes between the
+  // device and memory and returns the count taken.
+  uint32_t transferToMemory(int ch, const BYTE* data, uint32_t bytes, Bus* bus);
+  uint32_t transferFromMemory(int ch, BYTE* data, uint32_t bytes, Bus* bus);
+  bool active(int ch) const;
+
+  // Completes the auto-request transfers finished by `now`.
+  void update(uint64_t now);
+  uint64_t nextEvent() const;
+
+  bool irq() const;
+  // Interrupt acknowledge cycle: returns the vector, or -1 if none.
+  int acknowledge();
+
+private:
+  struct Channel {
+    BYTE csr, cer, dcr, ocr, scr, ccr;
+    WORD mtc, btc;
+    LONG mar, dar, bar;
+    BYTE niv, eiv, mfc, cpr, dfc, bfc;
+    uint64_t finish;  // Completion of a running auto-request transfer.
+  };
+
+  void start(int ch, Bus* bus, uint64_t now);
+  bool nextBlock(Channel* c, Bus* bus);
+  uint64_t runAuto(Channel* c, Bus* bus);
+  void complete(Channel* c);
+  void error(Channel* c, BYTE code);
+
+  Channel channels[kChannels];
+  BYTE gcr;
+};
+
+#endif
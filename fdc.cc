@@ -0,0 +1,373 @@
+#include "fdc.h"
+#include <string.h>
+#include <vector>
+#include "diskimage.h"
+
+typedef FDC::BYTE BYTE;
+
+enum {
+  CMD_READ_DIAGNOSTIC = 0x02,
+  CMD_SPECIFY = 0x03,
+  CMD_SENSE_DRIVE_STATUS = 0x04,
+  CMD_WRITE_DATA = 0x05,
+  CMD_READ_DATA = 0x06,
+  CMD_RECALIBRATE = 0x07,
+  CMD_SENSE_INTERRUPT_STATUS = 0x08,
+  CMD_WRITE_DELETED_DATA = 0x09,
+  CMD_READ_ID = 0x0a,
+  CMD_READ_DELETED_DATA = 0x0c,
+  CMD_FORMAT_TRACK = 0x0d,
+  CMD_SEEK = 0x0f,
+  CMD_VERSION = 0x10,
+};
+
+static const BYTE CMD_MT = 1 << 7;
+static const BYTE CMD_SK = 1 << 5;
+
+static const BYTE MSR_RQM = 1 << 7;
+static const BYTE MSR_DIO = 1 << 6;
+static const BYTE MSR_CB = 1 << 4;
+
+static const BYTE ST0_ABNORMAL = 0x40;
+static const BYTE ST0_INVALID = 0x80;
+static const BYTE ST0_SEEK_END = 0x20;
+static const BYTE ST0_NOT_READY = 0x08;
+static const BYTE ST1_END_OF_CYLINDER = 0x80;
+static const BYTE ST1_OVERRUN = 0x10;
+static const BYTE ST1_NO_DATA = 0x04;
+static const BYTE ST1_NOT_WRITABLE = 0x02;
+static const BYTE ST1_MISSING_AM = 0x01;
+static const BYTE ST2_CONTROL_MARK = 0x40;
+static const BYTE ST3_READY = 0x20;
+static const BYTE ST3_TRACK0 = 0x10;
+static const BYTE ST3_TWO_SIDE = 0x08;
+
+// Command bytes by the low five bits of the first one.
+static const int kCommandLengths[32] = {
+  1, 1, 9, 3, 2, 9, 9, 2, 1, 9, 2, 1, 9, 6, 1, 3,
+  1, 9, 1, 1, 1, 1, 1, 1, 1, 9, 1, 1, 1, 9, 1, 1,
+};
+
+// 2HD at 360rpm and 500kbps with the CPU at 10MHz.
+static const uint64_t kRotationCycles = 10000000 * 60 / 360;
+static const uint64_t kByteCycles = 160;
+static const uint64_t kStepCyclesPerMs = 10000;
+
+FDC::FDC()
+  : phase(PHASE_COMMAND), commandLength(0), commandCount(0), resultLength(0), resultPos(0),
+    interrupt(false), executeAt(kNever), resultAt(kNever), srt(0), seekEnded(0),
+    driveSelect(0), accessDrive(0) {
+  for (int i = 0; i < kDrives; ++i) {
+    pcn[i] = 0;
+    seekTarget[i] = 0;
+    seekEnd[i] = kNever;
+    seekSt0[i] = 0;
+    readIdIndex[i] = 0;
+  }
+}
+
+BYTE FDC::read(uint32_t ofs, Host* host) {
+  switch (ofs & 7) {
+  case 1: {  // Main status
+    BYTE msr = 0;
+    for (int i = 0; i < kDrives; ++i) {
+      if (seekEnd[i] != kNever)
+        msr |= 1 << i;
+    }
+    if (phase == PHASE_COMMAND)
+      msr |= MSR_RQM | (commandCount > 0 ? MSR_CB : 0);
+    else if (phase == PHASE_EXECUTION)
+      msr |= MSR_CB;
+    else
+      msr |= MSR_RQM | MSR_DIO | MSR_CB;
+    return msr;
+  }
+  case 3: {  // Data
+    if (phase != PHASE_RESULT)
+      return 0xff;
+    BYTE value = result[resultPos++];
+    interrupt = false;
+    if (resultPos >= resultLength)
+      phase = PHASE_COMMAND;
+    return value;
+  }
+  case 5: {  // Drive status of the lowest selected drive: bit 7 inserted.
+    for (int i = 0; i < kDrives; ++i) {
+      if ((driveSelect & (1 << i)) != 0)
+        return host->disk(i) != nullptr ? 0x80 : 0x00;
+    }
+    return 0x00;
+  }
+  default:
+    return 0xff;
+  }
+}
+
+void FDC::write(uint32_t ofs, BYTE value, uint64_t now, Host* host) {
+  switch (ofs & 7) {
+  case 3:
+    if (phase != PHASE_COMMAND)
+      return;
+    if (commandCount == 0)
+      commandLength = kCommandLengths[value & 0x1f];
+    command[commandCount++] = value;
+    if (commandCount >= commandLength) {
+      commandCount = 0;
+      startCommand(now, host);
+    }
+    break;
+  case 5:  // Drive control; eject and LED are not modeled.
+    driveSelect = value & 0x0f;
+    break;
+  case 7:  // Access drive and motor.
+    accessDrive = value;
+    break;
+  default:
+    break;
+  }
+}
+
+void FDC::startCommand(uint64_t now, Host* host) {
+  int drive = command[1] & 3;
+  switch (command[0] & 0x1f) {
+  case CMD_SPECIFY:
+    srt = command[1] >> 4;
+    break;
+  case CMD_SENSE_DRIVE_STATUS: {
+    BYTE st3 = (command[1] & 7) | ST3_TWO_SIDE;
+    if (host->disk(drive) != nullptr)
+      st3 |= ST3_READY;
+    if (pcn[drive] == 0)
+      st3 |= ST3_TRACK0;
+    setResult(&st3, 1);
+    break;
+  }
+  case CMD_RECALIBRATE:
+  case CMD_SEEK: {
+    seekTarget[drive] = (command[0] & 0x1f) == CMD_SEEK ? command[2] : 0;
+    // The head stops at the last cylinder of the medium.
+    DiskImage* disk = host->disk(drive);
+    int last = (disk != nullptr ? disk->cylinderCount() : DiskImage::kCylinders) - 1;
+    if (seekTarget[drive] > last)
+      seekTarget[drive] = last;
+    int steps = seekTarget[drive] > pcn[drive] ? seekTarget[drive] - pcn[drive] : pcn[drive] - seekTarget[drive];
+    seekEnd[drive] = now + (steps > 0 ? steps : 1) * (16 - srt) * kStepCyclesPerMs;
+    seekSt0[drive] = ST0_SEEK_END | drive;
+    seekEnded &= ~(1 << drive);
+    break;
+  }
+  case CMD_SENSE_INTERRUPT_STATUS:
+    if (seekEnded != 0) {
+      int d = __builtin_ctz(seekEnded);
+      seekEnded &= ~(1 << d);
+      BYTE data[] = {seekSt0[d], pcn[d]};
+      setResult(data, 2);
+    } else {
+      BYTE st0 = ST0_INVALID;
+      setResult(&st0, 1);
+    }
+    break;
+  case CMD_VERSION: {
+    BYTE version = 0x90;
+    setResult(&version, 1);
+    break;
+  }
+  case CMD_READ_DATA:
+  case CMD_READ_DELETED_DATA:
+  case CMD_WRITE_DATA:
+  case CMD_WRITE_DELETED_DATA:
+  case CMD_READ_ID:
+  case CMD_READ_DIAGNOSTIC:
+  case CMD_FORMAT_TRACK:
+  case 0x11:  // SCAN
+  case 0x19:
+  case 0x1d:
+    // Half a revolution to the first sector, on average.
+    phase = PHASE_EXECUTION;
+    executeAt = now + kRotationCycles / 2;
+    break;
+  default: {
+    BYTE st0 = ST0_INVALID;
+    setResult(&st0, 1);
+    break;
+  }
+  }
+}
+
+void FDC::setResult(const BYTE* data, int count) {
+  memcpy(result, data, count);
+  resultLength = count;
+  resultPos = 0;
+  phase = PHASE_RESULT;
+}
+
+void FDC::update(uint64_t now, Host* host) {
+  for (int i = 0; i < kDrives; ++i) {
+    if (seekEnd[i] <= now) {
+      pcn[i] = seekTarget[i];
+      seekEnd[i] = kNever;
+      if (host->disk(i) == nullptr)
+        seekSt0[i] |= ST0_ABNORMAL | ST0_NOT_READY;
+      seekEnded |= 1 << i;
+    }
+  }
+  if (executeAt <= now) {
+    execute(host);
+    executeAt = kNever;
+  }
+  if (resultAt <= now) {
+    resultAt = kNever;
+    phase = PHASE_RESULT;
+    interrupt = true;
+  }
+}
+
+uint64_t FDC::nextEvent() const {
+  uint64_t next = executeAt < resultAt ? executeAt : resultAt;
+  for (int i = 0; i < kDrives; ++i) {
+    if (seekEnd[i] < next)
+      next = seekEnd[i];
+  }
+  return next;
+}
+
+// Runs the data transfer of the command at once and holds the result back
+// for as long as the bytes would have taken to pass under the head.
+void FDC::execute(Host* host) {
+  uint32_t bytes = 0;
+  switch (command[0] & 0x1f) {
+  case CMD_READ_DATA:
+    bytes = transfer(host, false, false);
+    break;
+  case CMD_READ_DELETED_DATA:
+    bytes = transfer(host, false, true);
+    break;
+  case CMD_WRITE_DATA:
+    bytes = transfer(host, true, false);
+    break;
+  case CMD_WRITE_DELETED_DATA:
+    bytes = transfer(host, true, true);
+    break;
+  case CMD_READ_ID:
+    readId(host);
+    break;
+  default: {  // Unsupported: no address mark found.
+    BYTE data[] = {(BYTE)(ST0_ABNORMAL | (command[1] & 7)), ST1_MISSING_AM, 0,
+                   command[2], command[3], command[4], command[5]};
+    setResult(data, 7);
+    break;
+  }
+  }
+  phase = PHASE_EXECUTION;
+  resultAt = executeAt + bytes * kByteCycles;
+}
+
+// READ/WRITE (DELETED) DATA from R up to EOT, or until the DMAC reaches
+// terminal count. Returns the bytes transferred.
+uint32_t FDC::transfer(Host* host, bool write, bool deleted) {
+  int drive = command[1] & 3;
+  int head = (command[1] >> 2) & 1;
+  bool multiTrack = (command[0] & CMD_MT) != 0;
+  bool skip = (command[0] & CMD_SK) != 0;
+  DiskImage::SectorId id = {command[2], command[3], command[4], command[5]};
+  BYTE eot = command[6];
+  BYTE st0 = command[1] & 7, st1 = 0, st2 = 0;
+  uint32_t total = 0;
+
+  DiskImage* disk = host->disk(drive);
+  if (disk == nullptr)
+    st0 |= ST0_ABNORMAL | ST0_NOT_READY;
+  while (disk != nullptr) {
+    int track = pcn[drive] * 2 + head;
+    int index = disk->findSector(track, id);
+    if (index < 0) {  // A track missing from the image has no address marks.
+      st0 |= ST0_ABNORMAL;
+      st1 |= disk->sectorCount(track) == 0 ? ST1_MISSING_AM : ST1_NO_DATA;
+      break;
+    }
+    uint32_t size;
+    bool markDeleted;
+    const BYTE* data = disk->sectorData(track, index, &size, &markDeleted);
+    uint32_t length = id.n == 0 ? command[8] : 128u << (id.n & 7);
+    if (length > size)
+      length = size;
+
+    bool last = false;
+    if (write) {
+      std::vector<BYTE> buffer(data, data + size);
+      uint32_t got = host->fdcFromMemory(buffer.data(), length);
+      total += got;
+      if (got == 0) {
+        st0 |= ST0_ABNORMAL;
+        st1 |= ST1_OVERRUN;
+        break;
+      }
+      if (!disk->writeSector(track, index, buffer.data(), deleted)) {
+        st0 |= ST0_ABNORMAL;
+        st1 |= ST1_NOT_WRITABLE;
+        break;
+      }
+    } else if (markDeleted != deleted && skip) {
+      st2 |= ST2_CONTROL_MARK;
+    } else {
+      if (markDeleted != deleted) {
+        st2 |= ST2_CONTROL_MARK;
+        last = true;
+      }
+      uint32_t got = host->fdcToMemory(data, length);
+      total += got;
+      if (got == 0) {
+        st0 |= ST0_ABNORMAL;
+        st1 |= ST1_OVERRUN;
+        break;
+      }
+    }
+
+    // Next sector, as reported in the result.
+    bool endOfCylinder = false;
+    if (id.r == eot) {
+      id.r = 1;
+      if (multiTrack && head == 0) {
+        head = 1;
+        id.h ^= 1;
+      } else {
+        ++id.c;
+        if (multiTrack)
+          id.h ^= 1;
+        endOfCylinder = true;
+      }
+    } else {
+      ++id.r;
+    }
+    if (!host->fdcDmaActive() || last)
+      break;
+    if (endOfCylinder) {
+      st0 |= ST0_ABNORMAL;
+      st1 |= ST1_END_OF_CYLINDER;
+      break;
+    }
+  }
+
+  BYTE data[] = {st0, st1, st2, id.c, id.h, id.r, id.n};
+  setResult(data, 7);
+  return total;
+}
+
+// Reports the IDs of a track in turn as they would pass under the head.
+void FDC::readId(Host* host) {
+  int drive = command[1] & 3;
+  int head = (command[1] >> 2) & 1;
+  BYTE st0 = command[1] & 7;
+  DiskImage* disk = host->disk(drive);
+  int track = pcn[drive] * 2 + head;
+  int count = disk != nullptr ? disk->sectorCount(track) : 0;
+  if (count == 0) {
+    st0 |= ST0_ABNORMAL | (disk == nullptr ? ST0_NOT_READY : 0);
+    BYTE data[] = {st0, ST1_MISSING_AM, 0, 0, 0, 0, 0};
+    setResult(data, 7);
+    return;
+  }
+  const DiskImage::SectorId& id = disk->sectorId(track, readIdIndex[drive]++ % count);
+  BYTE data[] = {st0, 0, 0, id.c, id.h, id.r, id.n};
+  setResult(data, 7);
+}
@@ -0,0 +1,78 @@
+#ifndef __FDC_H__
+#define __FDC_H__
+
+#include <stdint.h>
+
+class DiskImage;
+
+// uPD72065 floppy disk controller at 0xe94000, with the drive control
+// ports of the X68000. Data always moves through DMAC channel 0, and a
+// read hands each sector to the DMAC straight out of the disk image.
+// Seeks and transfers finish at modeled times handed to the scheduler, so
+// the state is a plain value like the other devices'.
+// Not supported: non-DMA mode, READ DIAGNOSTIC, FORMAT and the SCAN commands.
+class FDC {
+public:
+  typedef uint8_t BYTE;
+
+  static const int kDrives = 4;
+  static const int kDmaChannel = 0;
+  static const uint64_t kNever = ~(uint64_t)0;
+
+  // What the FDC reaches while executing a command.
+  class Host {
+  public:
+    virtual ~Host() {}
+    virtual DiskImage* disk(int drive) = 0;
+    // DMA channel 0; both return the bytes moved.
+    virtual uint32_t fdcToMemory(const BYTE* data, uint32_t bytes) = 0;
+    virtual uint32_t fdcFromMemory(BYTE* data, uint32_t bytes) = 0;
+    // False once the DMAC reached terminal count.
+    virtual bool fdcDmaActive() = 0;
+  };
+
+  FDC();
+
+  BYTE read(uint32_t ofs, Host* host);
+  void write(uint32_t ofs, BYTE value, uint64_t now, Host* host);
+
+  // Finishes the seeks and the command due by `now`.
+  void update(uint64_t now, Host* host);
+  uint64_t nextEvent() const;
+  bool irq() const  { return interrupt || seekEnded != 0; }
+
+private:
+  enum Phase {
+    PHASE_COMMAND,
+    PHASE_EXECUTION,
+    PHASE_RESULT,
+  };
+
+  void startCommand(uint64_t now, Host* host);
+  void execute(Host* host);
+  uint32_t transfer(Host* host, bool write, bool deleted);
+  void readId(Host* host);
+  void setResult(const BYTE* data, int count);
+
+  Phase phase;
+  BYTE command[9];
+  int commandLength;
+  int commandCount;
+  BYTE result[7];
+  int resultLength;
+  int resultPos;
+  bool interrupt;        // Set on entering the result phase of a transfer.
+  uint64_t executeAt;    // Execution phase: data transfer, then result.
+  uint64_t resultAt;
+  BYTE srt;              // Step rate from SPECIFY.
+  BYTE pcn[kDrives];     // Cylinder under the head.
+  BYTE seekTarget[kDrives];
+  uint64_t seekEnd[kDrives];
+  BYTE seekSt0[kDrives];
+  BYTE seekEnded;        // Drives with a seek end not yet sensed.
+  BYTE readIdIndex[kDrives];
+  BYTE driveSelect;      // 0xe94005, drives whose status is read.
+  BYTE accessDrive;      // 0xe94007, drive and motor.
+};
+
+#endif
@@ -0,0 +1,360 @@
+#include "fmsynth.h"
+#include <math.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "opm.h"
+
+typedef FmSynth::BYTE BYTE;
+
+static const int kChannels = FmSynth::kChannels;
+
+// Modulation and feedback inputs per unit of operator output, in cycles.
+static const float kModulationScale = 4.0f;
+static const float kOutputGain = 8192.0f;
+
+// Sources modulating each stage (M1, C1, M2, C2) and the stages summed to
+// the output, per algorithm. Bit n is stage n.
+static const int kModulators[8][4] = {
+  {0, 1, 2, 4},
+  {0, 0, 3, 4},
+  {0, 0, 2, 5},
+  {0, 1, 0, 6},
+  {0, 1, 0, 4},
+  {0, 1, 1, 1},
+  {0, 1, 0, 0},
+  {0, 0, 0, 0},
+};
+static const int kCarriers[8] = {8, 8, 8, 8, 10, 14, 14, 15};
+
+// Stage of the register slot groups M1, M2, C1, C2.
+static const int kRegisterStage[4] = {0, 2, 1, 3};
+
+// Semitones above C# for the KC note codes; unused codes repeat the
+// previous note.
+static const int kNoteSemitone[16] = {0, 1, 2, 2, 3, 4, 5, 5, 6, 7, 8, 8, 9, 10, 11, 11};
+static const float kDt2Cents[4] = {0, 600, 781, 950};
+static const float kAmsDb[4] = {0, 5.9f, 11.8f, 23.6f};
+static const float kPmsCents[8] = {0, 5, 10, 20, 50, 100, 400, 700};
+
+// Envelope change in attenuation units per sample for an effective rate.
+static float rateStep(int rate) {
+  return rate < 4 ? 0 : (4 + (rate & 3)) * (float)(1 << (rate >> 2)) / 8192;
+}
+
+#ifdef __SSE2__
+// sin(2 pi x) for four lanes.
+static __m128 sin2pi(__m128 x) {
+  const __m128 half = _mm_set1_ps(0.5f);
+  const __m128 quarter = _mm_set1_ps(0.25f);
+  const __m128 one = _mm_set1_ps(1.0f);
+  // r = x - round(x), in -0.5 to 0.5.
+  __m128 t = _mm_add_ps(x, half);
+  __m128 f = _mm_cvtepi32_ps(_mm_cvttps_epi32(t));
+  f = _mm_sub_ps(f, _mm_and_ps(_mm_cmpgt_ps(f, t), one));
+  __m128 r = _mm_sub_ps(x, f);
+  // Fold into -0.25 to 0.25 using sin(pi - a) = sin(a).
+  __m128 sign = _mm_and_ps(r, _mm_set1_ps(-0.0f));
+  __m128 mirror = _mm_sub_ps(_mm_or_ps(half, sign), r);
+  __m128 far = _mm_cmpgt_ps(_mm_andnot_ps(_mm_set1_ps(-0.0f), r), quarter);
+  r = _mm_or_ps(_mm_and_ps(far, mirror), _mm_andnot_ps(far, r));
+  __m128 a = _mm_mul_ps(r, _mm_set1_ps(6.28318531f));
+  __m128 a2 = _mm_mul_ps(a, a);
+  __m128 p = _mm_set1_ps(-1.0f / 5040);
+  p = _mm_add_ps(_mm_mul_ps(p, a2), _mm_set1_ps(1.0f / 120));
+  p = _mm_add_ps(_mm_mul_ps(p, a2), _mm_set1_ps(-1.0f / 6));
+  p = _mm_add_ps(_mm_mul_ps(p, a2), one);
+  return _mm_mul_ps(p, a);
+}
+#endif
+
+static float sin2pi(float x) {
+  float r = x - floorf(x + 0.5f);
+  if (r > 0.25f)
+    r = 0.5f - r;
+  else if (r < -0.25f)
+    r = -0.5f - r;
+  float a = r * 6.28318531f;
+  float a2 = a * a;
+  return (((-1.0f / 5040 * a2 + 1.0f / 120) * a2 - 1.0f / 6) * a2 + 1) * a;
+}
+
+// out = sin(2 pi (phase + mod)) * amp, for all channels.
+static void operate(const float* phase, const float* mod, const float* amp, float* out) {
+  int i = 0;
+#ifdef __SSE2__
+  for (; i < kChannels; i += 4) {
+    __m128 x = _mm_add_ps(_mm_loadu_ps(phase + i), _mm_loadu_ps(mod + i));
+    _mm_storeu_ps(out + i, _mm_mul_ps(sin2pi(x), _mm_loadu_ps(amp + i)));
+  }
+#endif
+  for (; i < kChannels; ++i)
+    out[i] = sin2pi(phase[i] + mod[i]) * amp[i];
+}
+
+// acc += a * b, for all channels.
+static void mulAdd(float* acc, const float* a, const float* b) {
+  int i = 0;
+#ifdef __SSE2__
+  for (; i < kChannels; i += 4) {
+    __m128 v = _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i));
+    _mm_storeu_ps(acc + i, _mm_add_ps(_mm_loadu_ps(acc + i), v));
+  }
+#endif
+  for (; i < kChannels; ++i)
+    acc[i] += a[i] * b[i];
+}
+
+// phase = frac(phase + step), for all channels.
+static void advance(float* phase, const float* step) {
+  int i = 0;
+#ifdef __SSE2__
+  const __m128 one = _mm_set1_ps(1.0f);
+  for (; i < kChannels; i += 4) {
+    __m128 p = _mm_add_ps(_mm_loadu_ps(phase + i), _mm_loadu_ps(step + i));
+    p = _mm_sub_ps(p, _mm_and_ps(_mm_cmpge_ps(p, one), one));
+    _mm_storeu_ps(phase + i, p);
+  }
+#endif
+  for (; i < kChannels; ++i) {
+    phase[i] += step[i];
+    if (phase[i] >= 1)
+      phase[i] -= 1;
+  }
+}
+
+FmSynth::FmSynth()
+  : amd(0), pmd(0), lfoPhase(0), lfoAm(0), lfoPm(0), lfoRandom(1)
+  , noisePhase(0), noiseValue(1), noiseLfsr(1) {
+  memset(regs, 0, sizeof(regs));
+  memset(slots, 0, sizeof(slots));
+  memset(phase, 0, sizeof(phase));
+  memset(out, 0, sizeof(out));
+  memset(amp, 0, sizeof(amp));
+  memset(feedback, 0, sizeof(feedback));
+  for (int op = 0; op < OP_COUNT; ++op) {
+    for (int ch = 0; ch < kChannels; ++ch) {
+      slots[op][ch].env = ENV_RELEASE;
+      slots[op][ch].level = 1023;
+    }
+  }
+  for (int ch = 0; ch < kChannels; ++ch) {
+    updateConnection(ch);
+    updateStep(ch);
+  }
+}
+
+void FmSynth::write(int reg, BYTE value) {
+  regs[reg] = value;
+  if (reg == 0x08) {
+    int ch = value & 7;
+    for (int op = 0; op < OP_COUNT; ++op) {
+      Slot& s = slots[op][ch];
+      bool on = (value & (8 << op)) != 0;
+      if (on && !s.keyOn) {
+        s.env = ENV_ATTACK;
+        phase[op][ch] = 0;
+      } else if (!on && s.keyOn) {
+        s.env = ENV_RELEASE;
+      }
+      s.keyOn = on;
+    }
+  } else if (reg == 0x19) {
+    if ((value & 0x80) != 0)
+      pmd = value & 0x7f;
+    else
+      amd = value & 0x7f;
+  } else if (0x20 <= reg && reg < 0x28) {
+    updateConnection(reg & 7);
+  } else if (0x28 <= reg && reg < 0x38) {
+    updateStep(reg & 7);
+  } else if (reg >= 0x40) {
+    int ch = reg & 7;
+    Slot& s = slots[kRegisterStage[(reg >> 3) & 3]][ch];
+    switch (reg & 0xe0) {
+    case 0x40:
+      s.mul = value & 0x0f;  // DT1 is not modelled.
+      updateStep(ch);
+      break;
+    case 0x60:  s.tl = value & 0x7f; break;
+    case 0x80:
+      s.ks = value >> 6;
+      s.ar = value & 0x1f;
+      break;
+    case 0xa0:
+      s.amEnable = (value & 0x80) != 0;
+      s.d1r = value & 0x1f;
+      break;
+    case 0xc0:
+      s.dt2 = value >> 6;
+      s.d2r = value & 0x1f;
+      updateStep(ch);
+      break;
+    case 0xe0:
+      s.d1l = value >> 4;
+      s.rr = value & 0x0f;
+      break;
+    }
+  }
+}
+
+void FmSynth::updateConnection(int ch) {
+  BYTE r = regs[0x20 + ch];
+  int algorithm = r & 7;
+  for (int target = 0; target < OP_COUNT; ++target) {
+    for (int source = 0; source < OP_COUNT; ++source)
+      modMask[target][source][ch] = (kModulators[algorithm][target] >> source) & 1 ? kModulationScale : 0;
+    outMask[target][ch] = (kCarriers[algorithm] >> target) & 1;
+  }
+  int fb = (r >> 3) & 7;
+  feedbackScale[ch] = fb != 0 ? ldexpf(1.0f, fb - 7) : 0;
+}
+
+void FmSynth::updateStep(int ch) {
+  BYTE kc = regs[0x28 + ch];
+  float pitch = ((kc >> 4) & 7) * 12 + kNoteSemitone[kc & 15] + (regs[0x30 + ch] >> 2) / 64.0f;
+  // A4 (octave 4, note A) is 440Hz on a 3.58MHz chip; the X68000 runs it at
+  // 4MHz.
+  float hz = 440.0f * exp2f((pitch - 56) / 12) * (OPM::kClockKHz / 3579.545f);
+  for (int op = 0; op < OP_COUNT; ++op) {
+    const Slot& s = slots[op][ch];
+    float mul = s.mul != 0 ? s.mul : 0.5f;
+    baseStep[op][ch] = hz * exp2f(kDt2Cents[s.dt2] / 1200) * mul / OPM::kSampleRate;
+    step[op][ch] = baseStep[op][ch];
+  }
+}
+
+int FmSynth::effectiveRate(int rate, int ch, const Slot& s) const {
+  if (rate == 0)
+    return 0;
+  int keyCode = regs[0x28 + ch] >> 2;
+  int r = rate * 2 + (keyCode >> (3 - s.ks));
+  return r < 63 ? r : 63;
+}
+
+void FmSynth::stepEnvelope(Slot* s, int ch) {
+  switch (s->env) {
+  case ENV_ATTACK: {
+    int rate = effectiveRate(s->ar, ch, *s);
+    float k = rateStep(rate) / 16;
+    if (rate >= 62 || k >= 1)
+      s->level = 0;
+    else
+      s->level -= s->level * k;
+    if (s->level < 1) {
+      s->level = 0;
+      s->env = ENV_DECAY1;
+    }
+    break;
+  }
+  case ENV_DECAY1: {
+    s->level += rateStep(effectiveRate(s->d1r, ch, *s));
+    float sustain = s->d1l == 15 ? 1023 : s->d1l * 32;
+    if (s->level >= sustain)
+      s->env = ENV_DECAY2;
+    break;
+  }
+  case ENV_DECAY2:
+    s->level += rateStep(effectiveRate(s->d2r, ch, *s));
+    break;
+  case ENV_RELEASE:
+    s->level += rateStep(effectiveRate(s->rr * 2 + 1, ch, *s));
+    break;
+  }
+  if (s->level > 1023)
+    s->level = 1023;
+}
+
+void FmSynth::stepLfo() {
+  float hz = 0.008f * exp2f(regs[0x18] * (12.69f / 255));
+  lfoPhase += hz / OPM::kSampleRate;
+  if (lfoPhase >= 1) {
+    lfoPhase -= 1;
+    lfoRandom = lfoRandom * 1103515245 + 12345;
+  }
+  float p = lfoPhase;
+  switch (regs[0x1b] & 3) {
+  case 0:  // Saw
+    lfoAm = 1 - p;
+    lfoPm = p < 0.5f ? 2 * p : 2 * p - 2;
+    break;
+  case 1:  // Square
+    lfoAm = p < 0.5f ? 1 : 0;
+    lfoPm = p < 0.5f ? 1 : -1;
+    break;
+  case 2:  // Triangle
+    lfoAm = p < 0.5f ? 1 - 2 * p : 2 * p - 1;
+    lfoPm = p < 0.25f ? 4 * p : p < 0.75f ? 2 - 4 * p : 4 * p - 4;
+    break;
+  default:  // Noise
+    lfoAm = (lfoRandom >> 8) / 16777216.0f;
+    lfoPm = lfoAm * 2 - 1;
+    break;
+  }
+}
+
+float FmSynth::noiseSample() {
+  int nfrq = regs[0x0f] & 0x1f;
+  noisePhase += OPM::kClockKHz * 1000.0f / (32 * (32 - nfrq)) / OPM::kSampleRate;
+  while (noisePhase >= 1) {
+    noisePhase -= 1;
+    noiseLfsr = (noiseLfsr >> 1) | (((noiseLfsr ^ (noiseLfsr >> 3)) & 1) << 16);
+    noiseValue = (noiseLfsr & 1) != 0 ? 1.0f : -1.0f;
+  }
+  return noiseValue;
+}
+
+void FmSynth::render(int16_t* dst, int count) {
+  for (int n = 0; n < count; ++n) {
+    stepLfo();
+    for (int ch = 0; ch < kChannels; ++ch) {
+      BYTE sens = regs[0x38 + ch];
+      float am = lfoAm * amd / 127 * kAmsDb[sens & 3];
+      float cents = lfoPm * pmd / 127 * kPmsCents[(sens >> 4) & 7];
+      float pm = cents != 0 ? exp2f(cents / 1200) : 1;
+      for (int op = 0; op < OP_COUNT; ++op) {
+        Slot& s = slots[op][ch];
+        stepEnvelope(&s, ch);
+        float db = s.level * 0.09375f + s.tl * 0.75f + (s.amEnable ? am : 0);
+        amp[op][ch] = s.level < 1023 ? exp2f(-db / 6.0206f) : 0;
+        step[op][ch] = baseStep[op][ch] * pm;
+      }
+    }
+
+    // M1 with its own feedback, then each stage from the earlier ones.
+    float mod[kChannels];
+    for (int ch = 0; ch < kChannels; ++ch)
+      mod[ch] = (feedback[0][ch] + feedback[1][ch]) * feedbackScale[ch];
+    operate(phase[OP_M1], mod, amp[OP_M1], out[OP_M1]);
+    memcpy(feedback[1], feedback[0], sizeof(feedback[0]));
+    memcpy(feedback[0], out[OP_M1], sizeof(feedback[0]));
+    for (int op = OP_C1; op < OP_COUNT; ++op) {
+      memset(mod, 0, sizeof(mod));
+      for (int source = 0; source < op; ++source)
+        mulAdd(mod, modMask[op][source], out[source]);
+      operate(phase[op], mod, amp[op], out[op]);
+    }
+    if ((regs[0x0f] & 0x80) != 0)  // Noise replaces channel 7 C2.
+      out[OP_C2][7] = noiseSample() * amp[OP_C2][7];
+
+    float mix[kChannels];
+    memset(mix, 0, sizeof(mix));
+    for (int op = 0; op < OP_COUNT; ++op) {
+      mulAdd(mix, outMask[op], out[op]);
+      advance(phase[op], step[op]);
+    }
+
+    float left = 0, right = 0;
+    for (int ch = 0; ch < kChannels; ++ch) {
+      BYTE r = regs[0x20 + ch];
+      if ((r & 0x40) != 0)
+        left += mix[ch];
+      if ((r & 0x80) != 0)
+        right += mix[ch];
+    }
+    float l = left * kOutputGain, r = right * kOutputGain;
+    dst[n * 2] = l > 32767 ? 32767 : l < -32768 ? -32768 : (int16_t)l;
+    dst[n * 2 + 1] = r > 32767 ? 32767 : r < -32768 ? -32768 : (int16_t)r;
+  }
+}
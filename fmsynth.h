@@ -0,0 +1,79 @@
+#ifndef __FMSYNTH_H__
+#define __FMSYNTH_H__
+
+#include <stdint.h>
+
+// YM2151 sound generation from register writes: 8 channels of 4 operators
+// with the 8 connection algorithms, feedback, ADSR envelopes, LFO and
+// noise, at the chip's own sample rate.
+// Operator state is kept per operator stage across the 8 channels, so each
+// stage is evaluated for all channels at once with SIMD.
+class FmSynth {
+public:
+  typedef uint8_t BYTE;
+
+  static const int kChannels = 8;
+
+  FmSynth();
+
+  void write(int reg, BYTE value);
+  // Renders `count` interleaved stereo samples.
+  void render(int16_t* out, int count);
+
+private:
+  // Operator stages in evaluation order, which is also their key-on bit
+  // order in register 0x08.
+  enum {
+    OP_M1,
+    OP_C1,
+    OP_M2,
+    OP_C2,
+    OP_COUNT
+  };
+
+  enum EnvelopePhase {
+    ENV_ATTACK,
+    ENV_DECAY1,
+    ENV_DECAY2,
+    ENV_RELEASE,
+  };
+
+  struct Slot {
+    int dt2, mul, tl, ks, ar, d1r, d2r, d1l, rr;
+    bool amEnable;
+    bool keyOn;
+    EnvelopePhase env;
+    float level;  // Attenuation in 0.09375dB units, 1023 is silence.
+  };
+
+  void updateConnection(int ch);
+  void updateStep(int ch);
+  int effectiveRate(int rate, int ch, const Slot& s) const;
+  void stepEnvelope(Slot* s, int ch);
+  void stepLfo();
+  float noiseSample();
+
+  BYTE regs[256];
+  Slot slots[OP_COUNT][kChannels];
+
+  // Per stage and channel, laid out for SIMD.
+  float phase[OP_COUNT][kChannels];     // In cycles, 0 to 1.
+  float baseStep[OP_COUNT][kChannels];  // Cycles per sample without PM.
+  float step[OP_COUNT][kChannels];
+  float amp[OP_COUNT][kChannels];
+  float out[OP_COUNT][kChannels];
+  float modMask[OP_COUNT][OP_COUNT][kChannels];  // [target][source]
+  float outMask[OP_COUNT][kChannels];
+  float feedbackScale[kChannels];
+  float feedback[2][kChannels];  // Last two M1 outputs.
+
+  int amd, pmd;  // Register 0x19 holds both, selected by bit 7.
+  float lfoPhase;
+  float lfoAm, lfoPm;  // 0 to 1 and -1 to 1.
+  uint32_t lfoRandom;
+  float noisePhase;
+  float noiseValue;
+  uint32_t noiseLfsr;
+};
+
+#endif
@@ -0,0 +1,79 @@
+#include "gvram.h"
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+typedef GraphicVram::BYTE BYTE;
+
+// Converts `count` big endian GGGGGRRRRRBBBBBI words to RGBA, colour 0 being
+// transparent.
+static void directToRgba(const BYTE* src, size_t count, uint32_t* dst) {
+#ifdef __SSE2__
+  const __m128i mask5 = _mm_set1_epi16(0x1f);
+  const __m128i one = _mm_set1_epi16(1);
+  const __m128i opaque = _mm_set1_epi16(0xff);
+  for (; count >= 8; count -= 8, src += 16, dst += 8) {
+    __m128i w = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+    w = _mm_or_si128(_mm_slli_epi16(w, 8), _mm_srli_epi16(w, 8));
+    __m128i in = _mm_slli_epi16(_mm_and_si128(w, one), 2);
+    __m128i g = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(_mm_srli_epi16(w, 11), mask5), 3), in);
+    __m128i r = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(_mm_srli_epi16(w, 6), mask5), 3), in);
+    __m128i b = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(_mm_srli_epi16(w, 1), mask5), 3), in);
+    __m128i a = _mm_andnot_si128(_mm_cmpeq_epi16(w, _mm_setzero_si128()), opaque);
+    __m128i rg = _mm_or_si128(r, _mm_slli_epi16(g, 8));
+    __m128i ba = _mm_or_si128(b, _mm_slli_epi16(a, 8));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm_unpacklo_epi16(rg, ba));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 4), _mm_unpackhi_epi16(rg, ba));
+  }
+#endif
+  for (size_t i = 0; i < count; ++i) {
+    uint16_t w = (src[i * 2] << 8) | src[i * 2 + 1];
+    dst[i] = w != 0 ? VideoController::toRgba(w) : 0;
+  }
+}
+
+void GraphicVram::loadPage(int index, const BYTE* data) {
+  memcpy(mem->writablePage(index), data, PageStore::kPageSize);
+}
+
+GraphicVram::GraphicVram() {
+  mem = new PageStore(kSize);
+}
+
+GraphicVram::GraphicVram(GraphicVram* parent) {
+  mem = new PageStore(parent->mem);
+}
+
+GraphicVram::~GraphicVram() {
+  delete mem;
+}
+
+void GraphicVram::convertLine(VideoController::GraphicMode mode, int page, int y, int scrollX, int scrollY,
+                              int width, const uint32_t* palette, uint32_t* dst) const {
+  // A 1KB line never crosses a store page.
+  uint32_t ofs = page * kPageSize + ((y + scrollY) & (kHeight - 1)) * kWidth * 2;
+  const BYTE* line = mem->page(ofs >> PageStore::kPageShift) + (ofs & PageStore::kPageMask);
+
+  uint32_t pixels[kWidth];
+  switch (mode) {
+  case VideoController::GRAPHIC_16:
+    for (int x = 0; x < kWidth; ++x) {
+      int index = line[x * 2 + 1] & 0x0f;
+      pixels[x] = index != 0 ? palette[index] : 0;
+    }
+    break;
+  case VideoController::GRAPHIC_256:
+    for (int x = 0; x < kWidth; ++x) {
+      int index = line[x * 2 + 1];
+      pixels[x] = index != 0 ? palette[index] : 0;
+    }
+    break;
+  default:
+    directToRgba(line, kWidth, pixels);
+    break;
+  }
+
+  for (int x = 0; x < width; ++x)
+    dst[x] = pixels[(scrollX + x) & (kWidth - 1)];
+}
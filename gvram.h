@@ -0,0 +1,38 @@
+#ifndef __GVRAM_H__
+#define __GVRAM_H__
+
+#include <stdint.h>
+#include "pagemem.h"
+#include "video.h"
+
+// Graphic VRAM: 2MB at 0xc00000 in the CPU visible layout, 512x512 words
+// per 512KB page. Each page keeps its pixel in the low nibble (16 colours),
+// the low byte (256 colours) or the whole word (65536 colours).
+class GraphicVram {
+public:
+  typedef uint8_t BYTE;
+
+  static const uint32_t kSize = 0x200000;
+  static const uint32_t kPageSize = 0x80000;
+  static const int kWidth = 512;
+  static const int kHeight = 512;
+
+  GraphicVram();
+  explicit GraphicVram(GraphicVram* parent);  // Fork.
+  ~GraphicVram();
+
+  PageStore* store()  { return mem; }
+  void rewind()  { mem->rewind(); }
+  // Replaces page `index` of the store, for shadow copies.
+  void loadPage(int index, const BYTE* data);
+
+  // Converts `width` pixels of line `y` of `page` scrolled by (scrollX,
+  // scrollY) to RGBA, leaving transparent pixels at alpha 0.
+  void convertLine(VideoController::GraphicMode mode, int page, int y, int scrollX, int scrollY,
+                   int width, const uint32_t* palette, uint32_t* dst) const;
+
+private:
+  PageStore* mem;
+};
+
+#endif
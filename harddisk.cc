@@ -0,0 +1,162 @@
+#include "harddisk.h"
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+typedef HardDisk::BYTE BYTE;
+
+HardDisk::HardDisk()
+  : fd(-1), blocks(0), transfer(kMaxBlocks * kBlockSize), quit(false), readsQueued(0),
+    readsDone(0), readOk(false), writesQueued(0), writesDone(0), writeOk(true), aheadBlock(0), aheadCount(0), lastEnd(0), hits(0) {
+}
+
+HardDisk::~HardDisk() {
+  close();
+}
+
+bool HardDisk::open(const char* path) {
+  close();
+  fd = ::open(path, O_RDWR);
+  if (fd == -1)
+    return false;
+  struct stat st;
+  if (fstat(fd, &st) == -1 || st.st_size < (off_t)kBlockSize) {
+    ::close(fd);
+    fd = -1;
+    return false;
+  }
+  blocks = st.st_size / kBlockSize;
+  quit = false;
+  thread = std::thread(&HardDisk::workerMain, this);
+  return true;
+}
+
+void HardDisk::close() {
+  if (thread.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      quit = true;
+    }
+    cond.notify_one();
+    thread.join();
+  }
+  if (fd != -1)
+    ::close(fd);
+  fd = -1;
+  blocks = 0;
+}
+
+void HardDisk::startRead(uint32_t block, uint32_t count) {
+  Request r;
+  r.write = false;
+  r.block = block;
+  r.count = count;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    ++readsQueued;
+    queue.push_back(r);
+  }
+  cond.notify_one();
+}
+
+bool HardDisk::finishRead() {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (readsDone != readsQueued)
+    doneCond.wait(lock);
+  if (readOk)
+    memcpy(transfer.data(), readData.data(), readData.size());
+  return readOk;
+}
+
+void HardDisk::write(uint32_t block, uint32_t count) {
+  Request r;
+  r.write = true;
+  r.block = block;
+  r.count = count;
+  r.data.assign(transfer.begin(), transfer.begin() + count * kBlockSize);
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    ++writesQueued;
+    queue.push_back(std::move(r));
+  }
+  cond.notify_one();
+}
+
+bool HardDisk::finishWrite() {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (writesDone != writesQueued)
+    doneCond.wait(lock);
+  bool ok = writeOk;
+  writeOk = true;
+  return ok;
+}
+
+// Requests run in order, so a read sees every write queued before it.
+// Read-ahead only runs while the queue is empty.
+void HardDisk::workerMain() {
+  std::vector<BYTE> data(kMaxBlocks * kBlockSize);
+  for (;;) {
+    Request r;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      while (queue.empty() && !quit)
+        cond.wait(lock);
+      if (queue.empty())
+        return;
+      r = std::move(queue.front());
+      queue.pop_front();
+    }
+    if (r.write) {
+      uint32_t bytes = r.count * kBlockSize;
+      bool ok = pwrite(fd, r.data.data(), bytes, (off_t)r.block * kBlockSize) == (ssize_t)bytes;
+      if (!ok)
+        perror("HardDisk");
+      if (r.block < aheadBlock + aheadCount && aheadBlock < r.block + r.count)
+        aheadCount = 0;
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        writeOk = writeOk && ok;
+        ++writesDone;
+      }
+      doneCond.notify_one();
+      continue;
+    }
+    bool ok = readBlocks(r.block, r.count, data.data());
+    bool sequential = r.block == lastEnd;
+    lastEnd = r.block + r.count;
+    bool idle;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      readOk = ok;
+      readData.assign(data.begin(), data.begin() + r.count * kBlockSize);
+      ++readsDone;
+      idle = queue.empty();
+    }
+    doneCond.notify_one();
+    if (ok && sequential && idle)
+      readAhead(lastEnd);
+  }
+}
+
+bool HardDisk::readBlocks(uint32_t block, uint32_t count, BYTE* out) {
+  if (block + count > blocks)
+    return false;
+  if (aheadBlock <= block && block + count <= aheadBlock + aheadCount) {
+    memcpy(out, &ahead[(block - aheadBlock) * kBlockSize], count * kBlockSize);
+    hits.fetch_add(1, std::memory_order_relaxed);
+    return true;
+  }
+  uint32_t bytes = count * kBlockSize;
+  return pread(fd, out, bytes, (off_t)block * kBlockSize) == (ssize_t)bytes;
+}
+
+void HardDisk::readAhead(uint32_t block) {
+  if (block >= blocks || (aheadBlock <= block && block + kReadAheadBlocks / 2 <= aheadBlock + aheadCount))
+    return;  // Still well covered.
+  uint32_t count = block + kReadAheadBlocks <= blocks ? kReadAheadBlocks : blocks - block;
+  ahead.resize(kReadAheadBlocks * kBlockSize);
+  aheadBlock = block;
+  aheadCount = pread(fd, ahead.data(), count * kBlockSize, (off_t)block * kBlockSize) ==
+      (ssize_t)(count * kBlockSize) ? count : 0;
+}
@@ -0,0 +1,91 @@
+#ifndef __HARDDISK_H__
+#define __HARDDISK_H__
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Hard disk image (HDF, or HDS used as a flat image) in 256-byte blocks,
+// served by an I/O worker thread with pread/pwrite. The CPU side only
+// queues requests; a read or write is collected once its modeled latency
+// has passed, by which time the worker has normally long finished it.
+// Collecting blocks the CPU thread otherwise: the result must be there at
+// the modeled time to keep runs deterministic.
+// Sequential reads make the worker read ahead into a cache.
+class HardDisk {
+public:
+  typedef uint8_t BYTE;
+
+  static const uint32_t kBlockSize = 256;
+  static const uint32_t kMaxBlocks = 256;  // Per request.
+
+  HardDisk();
+  ~HardDisk();
+
+  bool open(const char* path);
+  // Finishes the queued writes and stops the worker.
+  void close();
+
+  uint32_t blockCount() const  { return blocks; }
+  // Transfer buffer of the CPU side, kMaxBlocks blocks.
+  BYTE* buffer()  { return transfer.data(); }
+
+  // Queues a read of `count` blocks for finishRead() to collect into
+  // buffer().
+  void startRead(uint32_t block, uint32_t count);
+  // Waits for the read, which only blocks when the host disk is slower
+  // than the modeled latency. Returns false on an I/O error.
+  bool finishRead();
+  // Queues a write of `count` blocks from buffer().
+  void write(uint32_t block, uint32_t count);
+  // Waits for the writes queued. Returns false if any failed since the
+  // last call.
+  bool finishWrite();
+
+  uint64_t readAheadHits() const  { return hits.load(std::memory_order_relaxed); }
+
+private:
+  static const uint32_t kReadAheadBlocks = 128;
+
+  struct Request {
+    bool write;
+    uint32_t block;
+    uint32_t count;
+    std::vector<BYTE> data;
+  };
+
+  void workerMain();
+  bool readBlocks(uint32_t block, uint32_t count, BYTE* out);
+  void readAhead(uint32_t block);
+
+  int fd;
+  uint32_t blocks;
+  std::vector<BYTE> transfer;
+
+  std::thread thread;
+  std::mutex mutex;
+  std::condition_variable cond;      // Worker: queue or quit.
+  std::condition_variable doneCond;  // CPU: read or write finished.
+  std::deque<Request> queue;
+  bool quit;
+  uint64_t readsQueued;  // The last read queued is the one collected.
+  uint64_t readsDone;
+  bool readOk;
+  std::vector<BYTE> readData;
+  uint64_t writesQueued;
+  uint64_t writesDone;
+  bool writeOk;
+
+  // Worker only.
+  std::vector<BYTE> ahead;
+  uint32_t aheadBlock;
+  uint32_t aheadCount;
+  uint32_t lastEnd;
+  std::atomic<uint64_t> hits;
+};
+
+#endif
@@ -0,0 +1,1078 @@
+#include "human68k.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+
+typedef Human68k::BYTE BYTE;
+typedef Human68k::WORD WORD;
+typedef Human68k::LONG LONG;
+
+enum {
+  DOS_EXIT = 0x00,
+  DOS_GETCHAR = 0x01,
+  DOS_PUTCHAR = 0x02,
+  DOS_COMINP = 0x03,
+  DOS_COMOUT = 0x04,
+  DOS_PRNOUT = 0x05,
+  DOS_INPOUT = 0x06,
+  DOS_INKEY = 0x07,
+  DOS_GETC = 0x08,
+  DOS_PRINT = 0x09,
+  DOS_GETS = 0x0a,
+  DOS_KEYSNS = 0x0b,
+  DOS_KFLUSH = 0x0c,
+  DOS_FFLUSH = 0x0d,
+  DOS_CHGDRV = 0x0e,
+  DOS_CURDRV = 0x19,
+  DOS_FGETC = 0x1b,
+  DOS_FGETS = 0x1c,
+  DOS_FPUTC = 0x1d,
+  DOS_FPUTS = 0x1e,
+  DOS_SUPER = 0x20,
+  DOS_CONCTRL = 0x23,
+  DOS_INTVCS = 0x25,
+  DOS_GETTIM2 = 0x27,
+  DOS_GETDATE = 0x2a,
+  DOS_GETTIME = 0x2c,
+  DOS_VERNUM = 0x30,
+  DOS_KEEPPR = 0x31,
+  DOS_BREAKCK = 0x33,
+  DOS_INTVCG = 0x35,
+  DOS_DSKFRE = 0x36,
+  DOS_MKDIR = 0x39,
+  DOS_RMDIR = 0x3a,
+  DOS_CHDIR = 0x3b,
+  DOS_CREATE = 0x3c,
+  DOS_OPEN = 0x3d,
+  DOS_CLOSE = 0x3e,
+  DOS_READ = 0x3f,
+  DOS_WRITE = 0x40,
+  DOS_DELETE = 0x41,
+  DOS_SEEK = 0x42,
+  DOS_CHMOD = 0x43,
+  DOS_IOCTRL = 0x44,
+  DOS_DUP = 0x45,
+  DOS_DUP2 = 0x46,
+  DOS_CURDIR = 0x47,
+  DOS_MALLOC = 0x48,
+  DOS_MFREE = 0x49,
+  DOS_SETBLOCK = 0x4a,
+  DOS_EXIT2 = 0x4c,
+  DOS_WAIT = 0x4d,
+  DOS_FILES = 0x4e,
+  DOS_NFILES = 0x4f,
+  // Version 2 numbers; version 3 moved these to 0x80-0x8b.
+  DOS_SETPDB = 0x50,
+  DOS_GETPDB = 0x51,
+  DOS_GETENV = 0x53,
+  DOS_RENAME = 0x56,
+  DOS_FILEDATE = 0x57,
+  DOS_MALLOC2 = 0x58,
+  DOS_NEWFILE = 0x5b,
+};
+
+// Error codes, negative in d0.
+static const LONG ERR_INVALID_FUNCTION = -1;
+static const LONG ERR_FILE_NOT_FOUND = -2;
+static const LONG ERR_DIR_NOT_FOUND = -3;
+static const LONG ERR_TOO_MANY_FILES = -4;
+static const LONG ERR_NOT_ACCESSIBLE = -5;
+static const LONG ERR_BAD_HANDLE = -6;
+static const LONG ERR_NO_MEMORY = -8;
+static const LONG ERR_BAD_POINTER = -9;
+static const LONG ERR_BAD_ENVIRONMENT = -10;
+static const LONG ERR_BAD_ACCESS_MODE = -12;
+static const LONG ERR_BAD_NAME = -13;
+static const LONG ERR_BAD_PARAMETER = -14;
+static const LONG ERR_BAD_DRIVE = -15;
+static const LONG ERR_NO_MORE_FILES = -18;
+static const LONG ERR_WRITE_PROTECTED = -19;
+static const LONG ERR_DIR_EXISTS = -20;
+static const LONG ERR_DIR_NOT_EMPTY = -21;
+static const LONG ERR_CANNOT_RENAME = -22;
+static const LONG ERR_DISK_FULL = -23;
+static const LONG ERR_CANNOT_SEEK = -25;
+static const LONG ERR_FILE_EXISTS = -80;
+
+static const BYTE ATTR_READONLY = 0x01;
+static const BYTE ATTR_DIRECTORY = 0x10;
+static const BYTE ATTR_ARCHIVE = 0x20;
+
+static const WORD kFlagS = 0x2000;
+static const uint32_t kChunkSize = 0x10000;  // Host buffer of DOS_READ and DOS_WRITE.
+
+// Low memory: one F-line word per vector so that an exception ends the
+// program with its vector, an rte for the interrupts, the environment,
+// the command line and the supervisor stack.
+static const LONG kAbortStubs = 0x400;
+static const LONG kRteStub = 0x600;
+static const LONG kEnvironment = 0x1000;
+static const LONG kEnvironmentSize = 0x400;
+static const LONG kCommandLine = 0x1400;
+static const LONG kSsp = 0x8000;
+static const LONG kProcess = 0x10000;  // MCB of the process, the PSP follows.
+static const int kFirstInterrupt = 24;
+static const int kStdHandles = 5;      // stdin, stdout, stderr, aux, prn.
+
+static WORD read16(X68K* x68k, LONG adr) {
+  return (x68k->readMem8(adr) << 8) | x68k->readMem8(adr + 1);
+}
+
+static LONG read32(X68K* x68k, LONG adr) {
+  return (read16(x68k, adr) << 16) | read16(x68k, adr + 2);
+}
+
+static void write16(X68K* x68k, LONG adr, WORD value) {
+  x68k->writeMem8(adr, value >> 8);
+  x68k->writeMem8(adr + 1, value);
+}
+
+static void write32(X68K* x68k, LONG adr, LONG value) {
+  write16(x68k, adr, value >> 16);
+  write16(x68k, adr + 2, value);
+}
+
+static std::string readString(X68K* x68k, LONG adr) {
+  std::string s;
+  for (BYTE c; s.size() < 1024 && (c = x68k->readMem8(adr)) != 0; ++adr)
+    s += (char)c;
+  return s;
+}
+
+static void writeString(X68K* x68k, LONG adr, const std::string& s) {
+  x68k->writeBlock(adr, (const BYTE*)s.c_str(), s.size() + 1);
+}
+
+static uint32_t big32(const BYTE* p) {
+  return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static bool isSjisLead(BYTE c) {
+  return (c >= 0x81 && c <= 0x9f) || (c >= 0xe0 && c <= 0xfc);
+}
+
+static LONG hostError(int err) {
+  switch (err) {
+  case ENOENT:     return ERR_FILE_NOT_FOUND;
+  case ENOTDIR:    return ERR_DIR_NOT_FOUND;
+  case EMFILE:
+  case ENFILE:     return ERR_TOO_MANY_FILES;
+  case EISDIR:     return ERR_NOT_ACCESSIBLE;
+  case EBADF:      return ERR_BAD_HANDLE;
+  case EACCES:
+  case EPERM:
+  case EROFS:      return ERR_WRITE_PROTECTED;
+  case EEXIST:     return ERR_FILE_EXISTS;
+  case ENOTEMPTY:  return ERR_DIR_NOT_EMPTY;
+  case ENOSPC:     return ERR_DISK_FULL;
+  case ENAMETOOLONG: return ERR_BAD_NAME;
+  default:         return ERR_INVALID_FUNCTION;
+  }
+}
+
+// Date in the high word, time in the low word, both in FAT format.
+static LONG dosDateTime(time_t t) {
+  struct tm tm;
+  localtime_r(&t, &tm);
+  LONG date = ((tm.tm_year - 80) << 9) | ((tm.tm_mon + 1) << 5) | tm.tm_mday;
+  LONG time = (tm.tm_hour << 11) | (tm.tm_min << 5) | (tm.tm_sec / 2);
+  return (date << 16) | time;
+}
+
+static time_t hostTime(LONG dateTime) {
+  struct tm tm;
+  memset(&tm, 0, sizeof(tm));
+  tm.tm_year = (dateTime >> 25) + 80;
+  tm.tm_mon = ((dateTime >> 21) & 0x0f) - 1;
+  tm.tm_mday = (dateTime >> 16) & 0x1f;
+  tm.tm_hour = (dateTime >> 11) & 0x1f;
+  tm.tm_min = (dateTime >> 5) & 0x3f;
+  tm.tm_sec = (dateTime & 0x1f) * 2;
+  tm.tm_isdst = -1;
+  return mktime(&tm);
+}
+
+Human68k::Human68k(const char* root)
+  : root(root), psp(kProcess), memoryEnd(X68K::kRamSize), nextSearch(1), exitStatus(0) {
+  for (int i = 0; i < kMaxFiles; ++i)
+    fds[i] = -1;
+  fds[0] = 0;
+  fds[1] = 1;
+  fds[2] = 2;
+}
+
+Human68k::~Human68k() {
+  for (int i = kStdHandles; i < kMaxFiles; ++i) {
+    if (fds[i] != -1)
+      close(fds[i]);
+  }
+}
+
+bool Human68k::load(X68K* x68k, const char* path, const char* args) {
+  std::vector<BYTE> image;
+  FILE* fp = fopen(path, "rb");
+  if (fp == nullptr)
+    return false;
+  BYTE buf[4096];
+  for (size_t n; (n = fread(buf, 1, sizeof(buf), fp)) > 0; )
+    image.insert(image.end(), buf, buf + n);
+  fclose(fp);
+
+  for (int i = 0; i < 256; ++i) {
+    write32(x68k, i * 4, i >= 2 && i < kFirstInterrupt ? kAbortStubs + i * 2 : kRteStub);
+    write16(x68k, kAbortStubs + i * 2, 0xff00 | DOS_EXIT2);
+  }
+  write16(x68k, kRteStub, 0x4e73);
+
+  envAdr = kEnvironment;
+  write32(x68k, envAdr, kEnvironmentSize);
+  writeString(x68k, envAdr + 4, "path=A:\\");
+  x68k->writeMem8(envAdr + 4 + 9, 0);
+
+  size_t argLength = std::min(strlen(args), (size_t)255);
+  x68k->writeMem8(kCommandLine, argLength);
+  writeString(x68k, kCommandLine + 1, std::string(args, argLength));
+
+  LONG text = psp + 0x100;
+  LONG entry, end;
+  const char* ext = strrchr(path, '.');
+  if (ext != nullptr && strcasecmp(ext, ".r") == 0) {
+    x68k->writeBlock(text, image.data(), image.size());
+    entry = text;
+    end = text + image.size();
+  } else if (!loadX(x68k, image, text, &entry, &end)) {
+    fprintf(stderr, "%s: not a Human68k executable\n", path);
+    return false;
+  }
+  if (end > memoryEnd)
+    return false;
+
+  // The process gets all the memory, as under Human68k; it gives back what
+  // it does not need with _SETBLOCK.
+  blocks.clear();
+  Block process = {memoryEnd, 0};
+  blocks[psp] = process;
+  writeMcbs(x68k);
+  write32(x68k, psp + 0x10, envAdr);
+  write32(x68k, psp + 0x20, kCommandLine);
+  write32(x68k, psp + 0x30, end);
+  write32(x68k, psp + 0x34, end);
+  write32(x68k, psp + 0x38, memoryEnd);
+  writeString(x68k, psp + 0x80, "A:\\");
+  const char* name = strrchr(path, '/');
+  writeString(x68k, psp + 0xc4, name != nullptr ? name + 1 : path);
+
+  MC68K::Context ctx;
+  x68k->saveContext(&ctx);
+  for (int i = 0; i < 8; ++i)
+    ctx.d[i].l = 0;
+  ctx.a[0] = psp;
+  ctx.a[1] = end;
+  ctx.a[2] = kCommandLine;
+  ctx.a[3] = envAdr;
+  ctx.a[4] = entry;
+  ctx.a[5] = ctx.a[6] = 0;
+  ctx.a[7] = memoryEnd;
+  ctx.usp = memoryEnd;
+  ctx.ssp = kSsp;
+  ctx.sr = 0;  // User mode.
+  ctx.pc = entry;
+  x68k->loadContext(ctx);
+  return true;
+}
+
+// .X: a 64-byte header, text and data, then the relocation table. Each
+// table entry is the distance to the next fixup as a word, or 1 followed
+// by a long; an odd distance marks a word fixup.
+bool Human68k::loadX(X68K* x68k, const std::vector<BYTE>& file, LONG adr, LONG* pEntry, LONG* pEnd) {
+  if (file.size() < 64 || file[0] != 'H' || file[1] != 'U')
+    return false;
+  LONG base = big32(&file[0x04]);
+  LONG entry = big32(&file[0x08]);
+  LONG textSize = big32(&file[0x0c]);
+  LONG dataSize = big32(&file[0x10]);
+  LONG bssSize = big32(&file[0x14]);
+  LONG relocSize = big32(&file[0x18]);
+  size_t body = 64 + (size_t)textSize + dataSize;
+  if (body + relocSize > file.size() || adr + textSize + dataSize + bssSize > memoryEnd)
+    return false;
+
+  std::vector<BYTE> image(file.begin() + 64, file.begin() + body);
+  LONG delta = adr - base;
+  const BYTE* reloc = &file[body];
+  size_t pos = 0;
+  for (LONG i = 0; i + 2 <= relocSize; ) {
+    LONG distance = (reloc[i] << 8) | reloc[i + 1];
+    i += 2;
+    if (distance == 1) {
+      if (i + 4 > relocSize)
+        return false;
+      distance = big32(&reloc[i]);
+      i += 4;
+    }
+    bool word = (distance & 1) != 0;
+    pos += distance & ~1;
+    if (pos + (word ? 2 : 4) > image.size())
+      return false;
+    BYTE* p = &image[pos];
+    if (word) {
+      WORD value = ((p[0] << 8) | p[1]) + delta;
+      p[0] = value >> 8;
+      p[1] = value;
+    } else {
+      LONG value = big32(p) + delta;
+      p[0] = value >> 24;
+      p[1] = value >> 16;
+      p[2] = value >> 8;
+      p[3] = value;
+    }
+  }
+  x68k->writeBlock(adr, image.data(), image.size());
+  std::vector<BYTE> bss(bssSize);
+  x68k->writeBlock(adr + image.size(), bss.data(), bss.size());
+  *pEntry = adr + (entry - base);
+  *pEnd = adr + image.size() + bssSize;
+  return true;
+}
+
+bool Human68k::dosCall(X68K* x68k, int no) {
+  LONG args = x68k->a[7];
+  LONG callAdr = x68k->pc - 2;
+  if (callAdr >= kAbortStubs && callAdr < kAbortStubs + 256 * 2) {
+    fprintf(stderr, "Exception %d at $%06x\n", (callAdr - kAbortStubs) / 2, read32(x68k, args + 2));
+    exitStatus = -1;
+    return false;
+  }
+
+  LONG result;
+  switch (no) {
+  case DOS_EXIT:
+    exitStatus = 0;
+    return false;
+  case DOS_EXIT2:
+    exitStatus = (int16_t)read16(x68k, args);
+    return false;
+  case DOS_KEEPPR:
+    exitStatus = (int16_t)read16(x68k, args + 4);
+    return false;
+
+  case DOS_GETCHAR:
+  case DOS_INKEY:
+  case DOS_GETC:
+    result = consoleIn();
+    break;
+  case DOS_PUTCHAR:
+    result = writeHandle(1, std::string(1, (char)read16(x68k, args)));
+    break;
+  case DOS_INPOUT: {
+    WORD code = read16(x68k, args);
+    result = code >= 0xfe ? 0 : writeHandle(1, std::string(1, (char)code));
+    break;
+  }
+  case DOS_PRINT:
+    writeHandle(1, readString(x68k, read32(x68k, args)));
+    result = 0;
+    break;
+  case DOS_GETS:
+    result = gets(x68k, read32(x68k, args), 0);
+    break;
+  case DOS_KFLUSH:
+    switch (read16(x68k, args)) {
+    case 1: case 7: case 8:  result = consoleIn(); break;
+    case 10:                 result = gets(x68k, read32(x68k, args + 2), 0); break;
+    default:                 result = 0; break;
+    }
+    break;
+  case DOS_CONCTRL:
+    switch (read16(x68k, args)) {
+    case 0:  result = writeHandle(1, std::string(1, (char)read16(x68k, args + 2))); break;
+    case 1:  result = writeHandle(1, readString(x68k, read32(x68k, args + 2))); break;
+    default: result = 0; break;
+    }
+    break;
+  case DOS_COMINP:
+  case DOS_COMOUT:
+  case DOS_PRNOUT:
+  case DOS_KEYSNS:
+  case DOS_FFLUSH:
+  case DOS_CURDRV:
+  case DOS_BREAKCK:
+  case DOS_WAIT:
+    result = 0;
+    break;
+  case DOS_CHGDRV:
+    result = 1;  // Drives available.
+    break;
+
+  case DOS_FGETC: {
+    BYTE c;
+    result = readHandle(read16(x68k, args), &c, 1);
+    if (result == 1)
+      result = c;
+    else if (result == 0)
+      result = -1;
+    break;
+  }
+  case DOS_FGETS:
+    result = gets(x68k, read32(x68k, args), read16(x68k, args + 4));
+    break;
+  case DOS_FPUTC:
+    result = writeHandle(read16(x68k, args + 2), std::string(1, (char)read16(x68k, args)));
+    break;
+  case DOS_FPUTS:
+    result = writeHandle(read16(x68k, args + 4), readString(x68k, read32(x68k, args)));
+    break;
+  case DOS_CREATE:
+    result = open(x68k, read32(x68k, args), O_RDWR | O_CREAT | O_TRUNC);
+    break;
+  case DOS_NEWFILE:
+  case DOS_NEWFILE + 0x30:
+    result = open(x68k, read32(x68k, args), O_RDWR | O_CREAT | O_EXCL);
+    break;
+  case DOS_OPEN: {
+    static const int kModes[] = {O_RDONLY, O_WRONLY, O_RDWR};
+    WORD mode = read16(x68k, args + 4) & 0x0f;
+    result = mode < 3 ? open(x68k, read32(x68k, args), kModes[mode]) : ERR_BAD_ACCESS_MODE;
+    break;
+  }
+  case DOS_CLOSE: {
+    int h = read16(x68k, args);
+    result = 0;
+    if (h >= kMaxFiles || fds[h] == -1)
+      result = ERR_BAD_HANDLE;
+    else if (h >= kStdHandles)
+      closeHandle(h);
+    break;
+  }
+  case DOS_READ:
+    result = readToGuest(x68k, read16(x68k, args), read32(x68k, args + 2), read32(x68k, args + 6));
+    break;
+  case DOS_WRITE: {
+    int h = read16(x68k, args);
+    LONG size = read32(x68k, args + 6);
+    if (size == 0 && h >= kStdHandles && h < kMaxFiles && fds[h] != -1) {
+      // Writing nothing truncates the file at the position.
+      off_t pos = lseek(fds[h], 0, SEEK_CUR);
+      result = pos != -1 && ftruncate(fds[h], pos) == 0 ? 0 : hostError(errno);
+      break;
+    }
+    result = writeFromGuest(x68k, h, read32(x68k, args + 2), size);
+    break;
+  }
+  case DOS_SEEK: {
+    int h = read16(x68k, args);
+    struct stat st;
+    if (h >= kMaxFiles || fds[h] == -1) {
+      result = ERR_BAD_HANDLE;
+    } else if (h < kStdHandles || fstat(fds[h], &st) != 0 || !S_ISREG(st.st_mode)) {
+      result = 0;
+    } else {
+      static const int kWhence[] = {SEEK_SET, SEEK_CUR, SEEK_END};
+      WORD mode = read16(x68k, args + 6);
+      off_t now = lseek(fds[h], 0, SEEK_CUR);
+      off_t origin = mode == 0 ? 0 : mode == 1 ? now : st.st_size;
+      off_t target = origin + (int32_t)read32(x68k, args + 2);
+      if (mode > 2)
+        result = ERR_BAD_PARAMETER;
+      else if (target < 0 || target > st.st_size)  // Human68k cannot seek past the end.
+        result = ERR_CANNOT_SEEK;
+      else
+        result = lseek(fds[h], (int32_t)read32(x68k, args + 2), kWhence[mode]);
+    }
+    break;
+  }
+  case DOS_DELETE:
+    result = unlink(hostPath(x68k, read32(x68k, args)).c_str()) == 0 ? 0 : hostError(errno);
+    break;
+  case DOS_CHMOD:
+    result = chmod(x68k, read32(x68k, args), read16(x68k, args + 4));
+    break;
+  case DOS_IOCTRL:
+    result = ioctrl(x68k, args);
+    break;
+  case DOS_DUP:
+  case DOS_DUP2: {
+    int h = read16(x68k, args);
+    int target = no == DOS_DUP ? allocHandle() : read16(x68k, args + 2);
+    if (h >= kMaxFiles || fds[h] == -1 || target >= kMaxFiles) {
+      result = ERR_BAD_HANDLE;
+    } else if (target < 0) {
+      result = ERR_TOO_MANY_FILES;
+    } else {
+      int fd = dup(fds[h]);
+      if (fd == -1) {
+        result = hostError(errno);
+      } else {
+        if (fds[target] != -1)
+          closeHandle(target);
+        fds[target] = fd;
+        result = no == DOS_DUP ? target : 0;
+      }
+    }
+    break;
+  }
+  case DOS_RENAME:
+  case DOS_RENAME + 0x30: {
+    std::string from = hostPath(x68k, read32(x68k, args));
+    std::string to = hostPath(x68k, read32(x68k, args + 4));
+    result = rename(from.c_str(), to.c_str()) == 0 ? 0 : errno == ENOENT ? ERR_FILE_NOT_FOUND : ERR_CANNOT_RENAME;
+    break;
+  }
+  case DOS_FILEDATE:
+  case DOS_FILEDATE + 0x30:
+    result = fileDate(read16(x68k, args), read32(x68k, args + 2));
+    break;
+
+  case DOS_MKDIR:
+    result = mkdir(hostPath(x68k, read32(x68k, args)).c_str(), 0777) == 0 ? 0 :
+        errno == EEXIST ? ERR_DIR_EXISTS : hostError(errno);
+    break;
+  case DOS_RMDIR:
+    result = rmdir(hostPath(x68k, read32(x68k, args)).c_str()) == 0 ? 0 : hostError(errno);
+    break;
+  case DOS_CHDIR: {
+    std::string guest;
+    std::string host = resolve(readString(x68k, read32(x68k, args)), &guest);
+    struct stat st;
+    if (host.empty())
+      result = ERR_BAD_NAME;
+    else if (stat(host.c_str(), &st) != 0 || !S_ISDIR(st.st_mode))
+      result = ERR_DIR_NOT_FOUND;
+    else
+      result = 0;
+    if (result == 0)
+      currentDir = guest;
+    break;
+  }
+  case DOS_CURDIR: {
+    WORD drive = read16(x68k, args);
+    result = drive > 1 ? ERR_BAD_DRIVE : 0;
+    if (result == 0)
+      writeString(x68k, read32(x68k, args + 2), currentDir);
+    break;
+  }
+  case DOS_DSKFRE:
+    result = diskFree(x68k, read32(x68k, args + 2));
+    break;
+  case DOS_FILES: {
+    LONG buf = read32(x68k, args);
+    result = startFiles(x68k, buf, readString(x68k, read32(x68k, args + 4)), read16(x68k, args + 8));
+    break;
+  }
+  case DOS_NFILES: {
+    LONG buf = read32(x68k, args);
+    std::map<LONG, Search>::iterator it = searches.find(read32(x68k, buf + 2));
+    result = it != searches.end() ? files(x68k, buf, it) : ERR_NO_MORE_FILES;
+    break;
+  }
+
+  case DOS_MALLOC:
+    result = malloc(x68k, read32(x68k, args));
+    break;
+  case DOS_MALLOC2:
+  case DOS_MALLOC2 + 0x30:
+    result = malloc(x68k, read32(x68k, args + 2));
+    break;
+  case DOS_MFREE:
+    result = mfree(x68k, read32(x68k, args));
+    break;
+  case DOS_SETBLOCK:
+    result = setBlock(x68k, read32(x68k, args), read32(x68k, args + 4));
+    break;
+
+  case DOS_VERNUM:
+    result = 0x36380302;  // "68", version 3.02.
+    break;
+  case DOS_GETPDB:
+  case DOS_GETPDB + 0x30:
+    result = psp + 0x10;
+    break;
+  case DOS_SETPDB:
+  case DOS_SETPDB + 0x30:
+    result = psp + 0x10;  // Only one process to switch to.
+    break;
+  case DOS_GETENV:
+  case DOS_GETENV + 0x30:
+    result = getEnv(x68k, read32(x68k, args), read32(x68k, args + 4), read32(x68k, args + 8));
+    break;
+  case DOS_SUPER:
+    result = super(x68k, read32(x68k, args));
+    break;
+  case DOS_INTVCS:
+  case DOS_INTVCG: {
+    WORD vector = read16(x68k, args);
+    LONG* slot = vector < 0x100 ? nullptr : &dosVectors[vector];
+    result = slot != nullptr ? *slot : read32(x68k, vector * 4);
+    if (no == DOS_INTVCS) {
+      LONG adr = read32(x68k, args + 2);
+      if (slot != nullptr)
+        *slot = adr;
+      else
+        write32(x68k, vector * 4, adr);
+    }
+    break;
+  }
+  case DOS_GETDATE: {
+    time_t t = time(nullptr);
+    struct tm tm;
+    localtime_r(&t, &tm);
+    result = (dosDateTime(t) >> 16) | (tm.tm_wday << 16);
+    break;
+  }
+  case DOS_GETTIME:
+    result = dosDateTime(time(nullptr)) & 0xffff;
+    break;
+  case DOS_GETTIM2: {
+    time_t t = time(nullptr);
+    struct tm tm;
+    localtime_r(&t, &tm);
+    result = (tm.tm_hour << 16) | (tm.tm_min << 8) | tm.tm_sec;
+    break;
+  }
+
+  default:
+    fprintf(stderr, "Unsupported DOS call $ff%02x at $%06x\n", no, callAdr);
+    result = ERR_INVALID_FUNCTION;
+    break;
+  }
+  x68k->d[0].l = result;
+  return true;
+}
+
+LONG Human68k::consoleIn() {
+  BYTE c;
+  return read(0, &c, 1) == 1 ? c : 0x1a;  // ^Z at the end of input.
+}
+
+// Reads a line into the _GETS buffer: the maximum length, the length read,
+// then the characters without the line end.
+LONG Human68k::gets(X68K* x68k, LONG buf, int h) {
+  BYTE max = x68k->readMem8(buf);
+  std::string line;
+  BYTE c;
+  while (line.size() < max && readHandle(h, &c, 1) == 1 && c != '\n') {
+    if (c != '\r')
+      line += (char)c;
+  }
+  x68k->writeMem8(buf + 1, line.size());
+  writeString(x68k, buf + 2, line);
+  return line.size();
+}
+
+int Human68k::allocHandle() {
+  for (int i = kStdHandles; i < kMaxFiles; ++i) {
+    if (fds[i] == -1)
+      return i;
+  }
+  return -1;
+}
+
+void Human68k::closeHandle(int h) {
+  if (fds[h] > 2)  // Never the host stdio.
+    close(fds[h]);
+  fds[h] = -1;
+}
+
+LONG Human68k::readHandle(int h, BYTE* data, uint32_t bytes) {
+  if (h >= kMaxFiles || (fds[h] == -1 && h >= kStdHandles))
+    return ERR_BAD_HANDLE;
+  if (fds[h] == -1)
+    return 0;  // aux and prn.
+  ssize_t n = read(fds[h], data, bytes);
+  return n >= 0 ? n : hostError(errno);
+}
+
+LONG Human68k::writeHandle(int h, const std::string& data) {
+  if (h >= kMaxFiles || (fds[h] == -1 && h >= kStdHandles))
+    return ERR_BAD_HANDLE;
+  if (fds[h] == -1)
+    return data.size();
+  size_t done = 0;
+  while (done < data.size()) {
+    ssize_t n = write(fds[h], data.data() + done, data.size() - done);
+    if (n <= 0)
+      return done > 0 ? (LONG)done : hostError(errno);
+    done += n;
+  }
+  return done;
+}
+
+// Bytes from `adr` to the end of its area: main RAM, or the rest of the
+// address space.
+static LONG clampToArea(LONG adr, LONG size) {
+  adr &= 0xffffff;
+  LONG end = adr < X68K::kRamSize ? X68K::kRamSize : 0x1000000;
+  return std::min(size, end - adr);
+}
+
+// Transfers go through a fixed buffer in chunks, so a large count costs no
+// more than the bytes actually moved.
+LONG Human68k::readToGuest(X68K* x68k, int h, LONG adr, LONG size) {
+  BYTE data[kChunkSize];
+  size = clampToArea(adr, size);
+  LONG done = 0;
+  do {
+    uint32_t n = std::min(size - done, kChunkSize);
+    LONG got = readHandle(h, data, n);
+    if ((int32_t)got < 0)
+      return done > 0 ? done : got;
+    x68k->writeBlock(adr + done, data, got);
+    done += got;
+    if (got < n)
+      break;
+  } while (done < size);
+  return done;
+}
+
+LONG Human68k::writeFromGuest(X68K* x68k, int h, LONG adr, LONG size) {
+  std::string data;
+  size = clampToArea(adr, size);
+  LONG done = 0;
+  do {
+    uint32_t n = std::min(size - done, kChunkSize);
+    data.resize(n);
+    x68k->readBlock(adr + done, (BYTE*)&data[0], n);
+    LONG put = writeHandle(h, data);
+    if ((int32_t)put < 0)
+      return done > 0 ? done : put;
+    done += put;
+    if (put < n)
+      break;
+  } while (done < size);
+  return done;
+}
+
+LONG Human68k::open(X68K* x68k, LONG name, int flags) {
+  int h = allocHandle();
+  if (h < 0)
+    return ERR_TOO_MANY_FILES;
+  std::string guest = readString(x68k, name);
+  std::string host;
+  if (strcasecmp(guest.c_str(), "NUL") == 0) {
+    host = "/dev/null";
+  } else {
+    host = resolve(guest);
+    if (host.empty())
+      return ERR_BAD_NAME;
+    struct stat st;
+    if ((flags & O_CREAT) == 0 && stat(host.c_str(), &st) == 0 && S_ISDIR(st.st_mode))
+      return ERR_NOT_ACCESSIBLE;
+  }
+  int fd = ::open(host.c_str(), flags, 0666);
+  if (fd == -1)
+    return hostError(errno);
+  fds[h] = fd;
+  return h;
+}
+
+LONG Human68k::chmod(X68K* x68k, LONG name, WORD attributes) {
+  std::string host = hostPath(x68k, name);
+  struct stat st;
+  if (stat(host.c_str(), &st) != 0)
+    return hostError(errno);
+  if (attributes != 0xffff) {
+    mode_t mode = (attributes & ATTR_READONLY) != 0 ? st.st_mode & ~0222 : st.st_mode | 0200;
+    if (::chmod(host.c_str(), mode & 07777) != 0)
+      return hostError(errno);
+    st.st_mode = mode;
+  }
+  return (S_ISDIR(st.st_mode) ? ATTR_DIRECTORY : ATTR_ARCHIVE) | ((st.st_mode & 0200) == 0 ? ATTR_READONLY : 0);
+}
+
+LONG Human68k::ioctrl(X68K* x68k, LONG args) {
+  WORD mode = read16(x68k, args);
+  int h = read16(x68k, args + 2);
+  if (mode > 7)
+    return 0;
+  if (h >= kMaxFiles || (fds[h] == -1 && h >= kStdHandles))
+    return ERR_BAD_HANDLE;
+  struct stat st;
+  bool device = fds[h] == -1 || fstat(fds[h], &st) != 0 || !S_ISREG(st.st_mode);
+  switch (mode) {
+  case 0:  // Device information: bit 7 for a character device, then stdin/stdout.
+    return device ? 0x80 | (h == 0 ? 0x01 : 0) | (h == 1 ? 0x02 : 0) : 0;
+  case 6:  // Input status
+  case 7:  // Output status
+    return 0xff;
+  default:
+    return 0;
+  }
+}
+
+LONG Human68k::fileDate(int h, LONG dateTime) {
+  if (h >= kMaxFiles || fds[h] == -1)
+    return ERR_BAD_HANDLE;
+  if (dateTime != 0) {
+    struct timespec times[2];
+    times[0].tv_sec = times[1].tv_sec = hostTime(dateTime);
+    times[0].tv_nsec = times[1].tv_nsec = 0;
+    return futimens(fds[h], times) == 0 ? 0 : hostError(errno);
+  }
+  struct stat st;
+  return fstat(fds[h], &st) == 0 ? dosDateTime(st.st_mtime) : hostError(errno);
+}
+
+// Fills free clusters, total clusters, sectors a cluster and bytes a sector,
+// in words, with 32KB clusters so that the counts fit.
+LONG Human68k::diskFree(X68K* x68k, LONG buf) {
+  static const uint64_t kClusterSize = 32768;
+  struct statvfs vfs;
+  if (statvfs(root.c_str(), &vfs) != 0)
+    return hostError(errno);
+  uint64_t avail = (uint64_t)vfs.f_bavail * vfs.f_frsize;
+  uint64_t total = (uint64_t)vfs.f_blocks * vfs.f_frsize;
+  write16(x68k, buf, std::min<uint64_t>(avail / kClusterSize, 0xffff));
+  write16(x68k, buf + 2, std::min<uint64_t>(total / kClusterSize, 0xffff));
+  write16(x68k, buf + 4, kClusterSize / 1024);
+  write16(x68k, buf + 6, 1024);
+  return std::min<uint64_t>(avail, 0x7fffffff);
+}
+
+// The _FILES buffer: search attributes, drive, reserved bytes where the
+// search id is kept, then attributes, time, date, size and name.
+LONG Human68k::startFiles(X68K* x68k, LONG buf, const std::string& name, BYTE attributes) {
+  size_t split = name.find_last_of("\\/:");
+  std::string dir = split != std::string::npos ? name.substr(0, split + 1) : "";
+  std::string pattern = split != std::string::npos ? name.substr(split + 1) : name;
+  if (pattern == "*.*")
+    pattern = "*";
+  std::string host = resolve(dir.empty() ? "." : dir);
+  DIR* d = host.empty() ? nullptr : opendir(host.c_str());
+  if (d == nullptr)
+    return ERR_DIR_NOT_FOUND;
+  Search search;
+  search.dir = host;
+  search.attributes = attributes;
+  for (struct dirent* e; (e = readdir(d)) != nullptr; ) {
+    if (strcmp(e->d_name, ".") != 0 && strcmp(e->d_name, "..") != 0 && strlen(e->d_name) <= 22 &&
+        fnmatch(pattern.c_str(), e->d_name, FNM_CASEFOLD) == 0)
+      search.names.push_back(e->d_name);
+  }
+  closedir(d);
+  std::sort(search.names.begin(), search.names.end());
+  search.next = 0;
+  LONG id = nextSearch++;
+  x68k->writeMem8(buf, attributes);
+  x68k->writeMem8(buf + 1, 0);
+  write32(x68k, buf + 2, id);
+  return files(x68k, buf, searches.insert(std::make_pair(id, search)).first);
+}
+
+LONG Human68k::files(X68K* x68k, LONG buf, std::map<LONG, Search>::iterator it) {
+  Search& search = it->second;
+  while (search.next < search.names.size()) {
+    const std::string& name = search.names[search.next++];
+    struct stat st;
+    if (stat((search.dir + "/" + name).c_str(), &st) != 0)
+      continue;
+    BYTE attributes = (S_ISDIR(st.st_mode) ? ATTR_DIRECTORY : ATTR_ARCHIVE) |
+        ((st.st_mode & 0200) == 0 ? ATTR_READONLY : 0);
+    if ((attributes & search.attributes & (ATTR_DIRECTORY | ATTR_ARCHIVE)) == 0)
+      continue;
+    LONG dateTime = dosDateTime(st.st_mtime);
+    x68k->writeMem8(buf + 21, attributes);
+    write16(x68k, buf + 22, dateTime);
+    write16(x68k, buf + 24, dateTime >> 16);
+    write32(x68k, buf + 26, std::min<off_t>(st.st_size, 0x7fffffff));
+    writeString(x68k, buf + 30, name);
+    return 0;
+  }
+  searches.erase(it);
+  return ERR_NO_MORE_FILES;
+}
+
+LONG Human68k::getEnv(X68K* x68k, LONG name, LONG env, LONG buf) {
+  std::string key = readString(x68k, name) + "=";
+  if (env == 0)
+    env = envAdr;
+  LONG end = env + read32(x68k, env);
+  for (LONG adr = env + 4; adr < end; ) {
+    std::string entry = readString(x68k, adr);
+    if (entry.empty())
+      break;
+    if (strncasecmp(entry.c_str(), key.c_str(), key.size()) == 0) {
+      writeString(x68k, buf, entry.substr(key.size()));
+      return 0;
+    }
+    adr += entry.size() + 1;
+  }
+  return ERR_BAD_ENVIRONMENT;
+}
+
+// _SUPER(0) enters supervisor mode on the user stack and returns the old
+// SSP; any other value returns to user mode with it as the SSP.
+LONG Human68k::super(X68K* x68k, LONG stack) {
+  MC68K::Context ctx;
+  x68k->saveContext(&ctx);
+  LONG result = 0;
+  if (stack == 0) {
+    if ((ctx.sr & kFlagS) != 0)
+      return ERR_INVALID_FUNCTION;
+    result = ctx.ssp;
+    ctx.usp = ctx.a[7];
+    ctx.sr |= kFlagS;
+  } else {
+    if ((ctx.sr & kFlagS) == 0)
+      return ERR_INVALID_FUNCTION;
+    ctx.ssp = stack;
+    ctx.sr &= ~kFlagS;
+  }
+  x68k->loadContext(ctx);
+  return result;
+}
+
+// Blocks are kept in a map and mirrored into the MCB chain in memory:
+// previous, owner, end and next.
+void Human68k::writeMcbs(X68K* x68k) {
+  LONG prev = 0;
+  for (std::map<LONG, Block>::iterator it = blocks.begin(); it != blocks.end(); ++it) {
+    std::map<LONG, Block>::iterator next = it;
+    ++next;
+    write32(x68k, it->first, prev);
+    write32(x68k, it->first + 4, it->second.owner);
+    write32(x68k, it->first + 8, it->second.end);
+    write32(x68k, it->first + 12, next != blocks.end() ? next->first : 0);
+    prev = it->first;
+  }
+}
+
+// Largest allocation that would fit, MCB excluded.
+LONG Human68k::largestFree() const {
+  LONG largest = 0;
+  LONG start = psp;
+  for (std::map<LONG, Block>::const_iterator it = blocks.begin(); it != blocks.end(); ++it) {
+    if (it->first > start)
+      largest = std::max(largest, it->first - start);
+    start = (it->second.end + 15) & ~15;
+  }
+  if (memoryEnd > start)
+    largest = std::max(largest, memoryEnd - start);
+  return largest > 16 ? largest - 16 : 0;
+}
+
+// First fit. On failure the result holds the largest size available.
+LONG Human68k::malloc(X68K* x68k, LONG size) {
+  if (size >= 0x1000000)
+    return 0x81000000 | largestFree();
+  LONG need = (size + 16 + 15) & ~15;
+  LONG start = psp;
+  std::map<LONG, Block>::iterator it = blocks.begin();
+  for (;; ++it) {
+    LONG limit = it != blocks.end() ? it->first : memoryEnd;
+    if (limit >= start && limit - start >= need)
+      break;
+    if (it == blocks.end()) {
+      LONG largest = largestFree();
+      return largest > 0 ? 0x81000000 | largest : 0x82000000;
+    }
+    start = (it->second.end + 15) & ~15;
+  }
+  Block block = {start + 16 + size, psp};
+  blocks[start] = block;
+  writeMcbs(x68k);
+  return start + 16;
+}
+
+LONG Human68k::mfree(X68K* x68k, LONG adr) {
+  if (adr == 0) {  // Everything the process allocated.
+    for (std::map<LONG, Block>::iterator it = blocks.begin(); it != blocks.end(); ) {
+      if (it->first != psp && it->second.owner == psp)
+        blocks.erase(it++);
+      else
+        ++it;
+    }
+  } else if (adr - 16 == psp || blocks.erase(adr - 16) == 0) {
+    return ERR_BAD_POINTER;
+  }
+  writeMcbs(x68k);
+  return 0;
+}
+
+LONG Human68k::setBlock(X68K* x68k, LONG adr, LONG size) {
+  std::map<LONG, Block>::iterator it = blocks.find(adr - 16);
+  if (it == blocks.end())
+    return ERR_BAD_POINTER;
+  std::map<LONG, Block>::iterator next = it;
+  ++next;
+  LONG limit = next != blocks.end() ? next->first : memoryEnd;
+  if (size >= 0x1000000 || size > limit - adr)
+    return 0x81000000 | (limit - adr);
+  it->second.end = adr + size;
+  writeMcbs(x68k);
+  return 0;
+}
+
+std::string Human68k::hostPath(X68K* x68k, LONG name) {
+  return resolve(readString(x68k, name));
+}
+
+// Maps a guest path onto the host directory: drive A: only, "\" or "/"
+// separated with Shift_JIS second bytes left alone, relative to the
+// current directory. A component that does not exist as spelled takes the
+// first host entry equal to it ignoring case. Returns "" for a bad name;
+// `guest` gets the path from the root with "\".
+std::string Human68k::resolve(const std::string& name, std::string* guest) {
+  std::string path = name;
+  if (path.size() >= 2 && path[1] == ':') {
+    if (toupper((BYTE)path[0]) != 'A')
+      return "";
+    path = path.substr(2);
+  }
+  std::vector<std::string> parts;
+  bool absolute = !path.empty() && (path[0] == '\\' || path[0] == '/');
+  std::string full = absolute ? path : currentDir + "\\" + path;
+  std::string part;
+  for (size_t i = 0; i <= full.size(); ++i) {
+    BYTE c = i < full.size() ? full[i] : '\\';
+    if (isSjisLead(c) && i + 1 < full.size()) {
+      part += full[i];
+      part += full[++i];
+      continue;
+    }
+    if (c != '\\' && c != '/') {
+      part += (char)c;
+      continue;
+    }
+    if (part == "..") {
+      if (!parts.empty())
+        parts.pop_back();
+    } else if (!part.empty() && part != ".") {
+      parts.push_back(part);
+    }
+    part.clear();
+  }
+
+  std::string host = root;
+  std::string normalized;
+  for (size_t i = 0; i < parts.size(); ++i) {
+    std::string entry = parts[i];
+    struct stat st;
+    if (stat((host + "/" + entry).c_str(), &st) != 0) {
+      DIR* d = opendir(host.c_str());
+      if (d != nullptr) {
+        for (struct dirent* e; (e = readdir(d)) != nullptr; ) {
+          if (strcasecmp(e->d_name, entry.c_str()) == 0) {
+            entry = e->d_name;
+            break;
+          }
+        }
+        closedir(d);
+      }
+    }
+    host += "/" + entry;
+    normalized += (i > 0 ? "\\" : "") + entry;
+  }
+  if (guest != nullptr)
+    *guest = normalized;
+  return host;
+}
@@ -0,0 +1,93 @@
+#ifndef __HUMAN68K_H__
+#define __HUMAN68K_H__
+
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "x68k.h"
+
+// Runs a Human68k executable without booting the OS: loads a .X or .R
+// file into main RAM, sets up the process, environment and command line
+// as Human68k would, and services the DOS calls (F-line $FFxx) in C++.
+// Drive A: is a host directory.
+// Only what a single command line tool needs: one process, no _EXEC, no
+// devices other than the console.
+class Human68k : public X68K::DosHandler {
+public:
+  typedef MC68K::BYTE BYTE;
+  typedef MC68K::WORD WORD;
+  typedef MC68K::LONG LONG;
+
+  // `root` is the host directory seen as A:\.
+  explicit Human68k(const char* root);
+  virtual ~Human68k();
+
+  // Loads the host file `path` and sets the registers to run it with the
+  // command line `args`.
+  bool load(X68K* x68k, const char* path, const char* args);
+
+  virtual bool dosCall(X68K* x68k, int no) override;
+
+  int exitCode() const  { return exitStatus; }
+
+private:
+  static const int kMaxFiles = 96;
+
+  struct Block {
+    LONG end;     // Past the last byte, MCB included.
+    LONG owner;   // MCB of the owning process.
+  };
+
+  struct Search {
+    std::string dir;    // Host directory.
+    std::vector<std::string> names;
+    size_t next;
+    BYTE attributes;
+  };
+
+  bool loadX(X68K* x68k, const std::vector<BYTE>& file, LONG adr, LONG* pEntry, LONG* pEnd);
+
+  LONG consoleIn();
+  LONG gets(X68K* x68k, LONG buf, int h);
+
+  int allocHandle();
+  void closeHandle(int h);
+  LONG readHandle(int h, BYTE* data, uint32_t bytes);
+  LONG writeHandle(int h, const std::string& data);
+  LONG readToGuest(X68K* x68k, int h, LONG adr, LONG size);
+  LONG writeFromGuest(X68K* x68k, int h, LONG adr, LONG size);
+  LONG open(X68K* x68k, LONG name, int flags);
+  LONG chmod(X68K* x68k, LONG name, WORD attributes);
+  LONG ioctrl(X68K* x68k, LONG args);
+  LONG fileDate(int h, LONG dateTime);
+  LONG diskFree(X68K* x68k, LONG buf);
+  LONG startFiles(X68K* x68k, LONG buf, const std::string& name, BYTE attributes);
+  LONG files(X68K* x68k, LONG buf, std::map<LONG, Search>::iterator it);
+
+  LONG getEnv(X68K* x68k, LONG name, LONG env, LONG buf);
+  LONG super(X68K* x68k, LONG stack);
+
+  void writeMcbs(X68K* x68k);
+  LONG largestFree() const;
+  LONG malloc(X68K* x68k, LONG size);
+  LONG mfree(X68K* x68k, LONG adr);
+  LONG setBlock(X68K* x68k, LONG adr, LONG size);
+
+  std::string hostPath(X68K* x68k, LONG name);
+  std::string resolve(const std::string& name, std::string* guest = nullptr);
+
+  std::string root;
+  std::string currentDir;  // Guest path without drive, "\" separated.
+  int fds[kMaxFiles];      // Host descriptor by handle, -1 if closed.
+  LONG psp;                // MCB of the process.
+  LONG memoryEnd;
+  LONG envAdr;
+  std::map<LONG, Block> blocks;  // By MCB address.
+  std::map<LONG, Search> searches;
+  LONG nextSearch;
+  std::map<int, LONG> dosVectors;  // _INTVCS entries beyond the CPU vectors.
+  int exitStatus;
+};
+
+#endif
@@ -0,0 +1,61 @@
+#include "ioc.h"
+
+typedef IOC::BYTE BYTE;
+
+// Status bits at 0xe9c001 for each source: request and enable.
+static const BYTE kRequestBits[] = {0x80, 0x40, 0x10, 0x20};
+static const BYTE kEnableBits[] = {0x04, 0x02, 0x08, 0x01};
+
+IOC::IOC()
+  : requests(0), enables(0), vectorBase(0) {
+}
+
+BYTE IOC::read8(uint32_t ofs) const {
+  if ((ofs & 0x0f) != 1)
+    return 0xff;
+  BYTE value = 0;
+  for (int i = 0; i < SOURCE_COUNT; ++i) {
+    if ((requests & (1 << i)) != 0)
+      value |= kRequestBits[i];
+    if ((enables & (1 << i)) != 0)
+      value |= kEnableBits[i];
+  }
+  return value;
+}
+
+void IOC::write8(uint32_t ofs, BYTE value) {
+  switch (ofs & 0x0f) {
+  case 1:
+    enables = 0;
+    for (int i = 0; i < SOURCE_COUNT; ++i) {
+      if ((value & kEnableBits[i]) != 0)
+        enables |= 1 << i;
+    }
+    break;
+  case 3:
+    vectorBase = value & 0xfc;
+    break;
+  default:
+    break;
+  }
+}
+
+void IOC::setRequest(int source, bool on) {
+  if (on)
+    requests |= 1 << source;
+  else
+    requests &= ~(1 << source);
+}
+
+bool IOC::irq() const {
+  return (requests & enables) != 0;
+}
+
+// Requests are levels held by the devices, so acknowledging clears nothing.
+int IOC::acknowledge() const {
+  for (int i = 0; i < SOURCE_COUNT; ++i) {
+    if ((requests & enables & (1 << i)) != 0)
+      return vectorBase + i;
+  }
+  return -1;
+}
@@ -0,0 +1,40 @@
+#ifndef __IOC_H__
+#define __IOC_H__
+
+#include <stdint.h>
+
+// I/O controller at 0xe9c000: gathers the FDC, FDD, HDD and printer
+// interrupt requests onto level 1 with a common vector base.
+class IOC {
+public:
+  typedef uint8_t BYTE;
+
+  static const int kIrqLevel = 1;
+
+  // In priority order; the vector is the base plus the source.
+  enum Source {
+    SOURCE_FDC,
+    SOURCE_FDD,
+    SOURCE_HDD,
+    SOURCE_PRINTER,
+    SOURCE_COUNT
+  };
+
+  IOC();
+
+  BYTE read8(uint32_t ofs) const;
+  void write8(uint32_t ofs, BYTE value);
+
+  void setRequest(int source, bool on);
+
+  bool irq() const;
+  // Interrupt acknowledge cycle: returns the vector, or -1 if none.
+  int acknowledge() const;
+
+private:
+  BYTE requests;  // Bit per source.
+  BYTE enables;
+  BYTE vectorBase;
+};
+
+#endif
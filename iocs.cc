@@ -0,0 +1,551 @@
+#include "iocs.h"
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+typedef Iocs::BYTE BYTE;
+typedef Iocs::WORD WORD;
+typedef Iocs::LONG LONG;
+
+enum {
+  IOCS_B_PUTC = 0x20,
+  IOCS_B_PRINT = 0x21,
+  IOCS_B_COLOR = 0x22,
+  IOCS_B_LOCATE = 0x23,
+  IOCS_B_CLR_ST = 0x2a,
+  IOCS_B_BPEEK = 0x84,
+  IOCS_B_WPEEK = 0x85,
+  IOCS_B_LPEEK = 0x86,
+  IOCS_B_MEMSTR = 0x87,
+  IOCS_B_BPOKE = 0x88,
+  IOCS_B_WPOKE = 0x89,
+  IOCS_B_LPOKE = 0x8a,
+  IOCS_B_MEMSET = 0x8b,
+  IOCS_APAGE = 0xb1,
+  IOCS_PSET = 0xb6,
+  IOCS_POINT = 0xb7,
+  IOCS_LINE = 0xb8,
+  IOCS_BOX = 0xb9,
+  IOCS_FILL = 0xba,
+};
+
+static const int kTextCalls[] = {IOCS_B_PUTC, IOCS_B_PRINT, IOCS_B_COLOR, IOCS_B_LOCATE, IOCS_B_CLR_ST};
+static const int kMemoryCalls[] = {IOCS_B_BPEEK, IOCS_B_WPEEK, IOCS_B_LPEEK, IOCS_B_MEMSTR,
+                                   IOCS_B_BPOKE, IOCS_B_WPOKE, IOCS_B_LPOKE, IOCS_B_MEMSET};
+static const int kGraphicsCalls[] = {IOCS_APAGE, IOCS_PSET, IOCS_POINT, IOCS_LINE, IOCS_BOX, IOCS_FILL};
+
+// IOCS work area: console size less one and cursor position, in words.
+static const LONG kWorkMaxX = 0x970;
+static const LONG kWorkMaxY = 0x972;
+static const LONG kWorkCursorX = 0x974;
+static const LONG kWorkCursorY = 0x976;
+// Before the ROM has set up the console.
+static const int kDefaultMaxX = 95;
+static const int kDefaultMaxY = 30;
+
+static const LONG kTextVram = 0xe00000;
+static const LONG kTextPlaneSize = 0x20000;
+static const int kTextLineBytes = 128;
+static const int kCellLines = 16;
+static const LONG kAnkFont = 0xf3a800;  // 8x16 in the CG ROM.
+static const LONG kCrtcR20 = 0xe80028;
+static const LONG kCrtcR21 = 0xe8002a;
+static const LONG kCrtcR22 = 0xe8002c;
+static const LONG kCrtcOperation = 0xe80481;
+static const BYTE kRasterCopy = 1 << 3;
+
+static const BYTE COLOR_BOLD = 1 << 2;
+static const BYTE COLOR_REVERSE = 1 << 3;
+
+static const LONG kGraphicVram = 0xc00000;
+static const LONG kGraphicPageSize = 0x80000;
+
+static WORD read16(X68K* x68k, LONG adr) {
+  return (x68k->readMem8(adr) << 8) | x68k->readMem8(adr + 1);
+}
+
+static LONG read32(X68K* x68k, LONG adr) {
+  return (read16(x68k, adr) << 16) | read16(x68k, adr + 2);
+}
+
+static void write16(X68K* x68k, LONG adr, WORD value) {
+  x68k->writeMem8(adr, value >> 8);
+  x68k->writeMem8(adr + 1, value);
+}
+
+static void write32(X68K* x68k, LONG adr, LONG value) {
+  write16(x68k, adr, value >> 16);
+  write16(x68k, adr + 2, value);
+}
+
+Iocs::Iocs()
+  : color(3), escape(0), savedAccess(0), page(0) {
+  memset(enabled, 0, sizeof(enabled));
+}
+
+bool Iocs::isImplemented(int no) const {
+  switch (no) {
+  case IOCS_B_PUTC: case IOCS_B_PRINT: case IOCS_B_COLOR: case IOCS_B_LOCATE: case IOCS_B_CLR_ST:
+  case IOCS_B_BPEEK: case IOCS_B_WPEEK: case IOCS_B_LPEEK: case IOCS_B_MEMSTR:
+  case IOCS_B_BPOKE: case IOCS_B_WPOKE: case IOCS_B_LPOKE: case IOCS_B_MEMSET:
+  case IOCS_APAGE: case IOCS_PSET: case IOCS_POINT: case IOCS_LINE: case IOCS_BOX: case IOCS_FILL:
+    return true;
+  default:
+    return false;
+  }
+}
+
+void Iocs::enable(int no, bool on) {
+  if (no >= 0 && no < 256)
+    enabled[no] = on && isImplemented(no);
+}
+
+bool Iocs::enable(const char* list) {
+  std::string s(list);
+  for (size_t start = 0; start <= s.size(); ) {
+    size_t end = s.find(',', start);
+    if (end == std::string::npos)
+      end = s.size();
+    std::string name = s.substr(start, end - start);
+    start = end + 1;
+    const int* calls = nullptr;
+    size_t count = 0;
+    if (name == "text") {
+      calls = kTextCalls;
+      count = sizeof(kTextCalls) / sizeof(kTextCalls[0]);
+    } else if (name == "memory") {
+      calls = kMemoryCalls;
+      count = sizeof(kMemoryCalls) / sizeof(kMemoryCalls[0]);
+    } else if (name == "graphics") {
+      calls = kGraphicsCalls;
+      count = sizeof(kGraphicsCalls) / sizeof(kGraphicsCalls[0]);
+    } else if (name == "all") {
+      for (int i = 0; i < 256; ++i)
+        enable(i, true);
+      continue;
+    } else {
+      char* p;
+      long no = strtol(name.c_str(), &p, 16);
+      if (name.empty() || *p != '\0' || !isImplemented(no))
+        return false;
+      enable(no, true);
+      continue;
+    }
+    for (size_t i = 0; i < count; ++i)
+      enable(calls[i], true);
+  }
+  return true;
+}
+
+// Kanji, control sequences and unknown modes go to the ROM.
+bool Iocs::iocsAccepts(X68K* x68k, int no) {
+  if (!enabled[no])
+    return false;
+  switch (no) {
+  case IOCS_B_PUTC:
+    return x68k->d[1].w <= 0xff && canPrint(x68k->d[1].w);
+  case IOCS_B_PRINT: {
+    std::vector<BYTE> text;
+    readText(x68k, &text);
+    for (size_t i = 0; i < text.size(); ++i) {
+      if (!canPrint(text[i]))
+        return false;
+    }
+    return true;
+  }
+  case IOCS_B_CLR_ST:
+    return x68k->d[1].b <= 2;
+  default:
+    return true;
+  }
+}
+
+bool Iocs::iocsCall(X68K* x68k, int no) {
+  MC68K::Reg* d = x68k->d;
+  LONG* a = x68k->a;
+  if (!iocsAccepts(x68k, no)) {
+    // The ROM prints it; escape sequences are followed here too.
+    std::vector<BYTE> text;
+    if (enabled[no] && no == IOCS_B_PUTC)
+      text.push_back(d[1].w);
+    else if (enabled[no] && no == IOCS_B_PRINT)
+      readText(x68k, &text);
+    for (size_t i = 0; i < text.size(); ++i)
+      trackEscape(text[i]);
+    return false;
+  }
+  switch (no) {
+  case IOCS_B_PUTC: {
+    WORD c = d[1].w;
+    beginText(x68k);
+    putChar(x68k, c);
+    endText(x68k);
+    d[0].l = cursor(x68k);
+    return true;
+  }
+  case IOCS_B_PRINT: {
+    std::vector<BYTE> text;
+    readText(x68k, &text);
+    beginText(x68k);
+    for (size_t i = 0; i < text.size(); ++i)
+      putChar(x68k, text[i]);
+    endText(x68k);
+    a[1] += text.size() + 1;
+    d[0].l = cursor(x68k);
+    return true;
+  }
+  case IOCS_B_COLOR: {
+    WORD c = d[1].w;
+    LONG old = color;
+    if (c > 15 && c != 0xffff)  // -1 only reads.
+      old = -1;
+    else if (c <= 15)
+      color = c;
+    d[0].l = old;
+    return true;
+  }
+  case IOCS_B_LOCATE: {
+    LONG old = cursor(x68k);
+    WORD x = d[1].w;
+    WORD y = d[2].w;
+    if (x != 0xffff) {
+      int maxX = read16(x68k, kWorkMaxX);
+      int maxY = read16(x68k, kWorkMaxY);
+      if (maxX == 0 && maxY == 0) {
+        maxX = kDefaultMaxX;
+        maxY = kDefaultMaxY;
+      }
+      if (x > maxX || y > maxY) {
+        old = -1;
+      } else {
+        write16(x68k, kWorkCursorX, x);
+        write16(x68k, kWorkCursorY, y);
+      }
+    }
+    d[0].l = old;
+    return true;
+  }
+  case IOCS_B_CLR_ST: {
+    int maxX = read16(x68k, kWorkMaxX);
+    int maxY = read16(x68k, kWorkMaxY);
+    if (maxX == 0 && maxY == 0) {
+      maxX = kDefaultMaxX;
+      maxY = kDefaultMaxY;
+    }
+    int columns = maxX + 1;
+    int x = read16(x68k, kWorkCursorX);
+    int y = read16(x68k, kWorkCursorY);
+    int first = 0, last = columns * (maxY + 1);  // Cells, row major.
+    switch (d[1].b) {
+    case 0:  first = y * columns + x; break;
+    case 1:  last = y * columns + x + 1; break;
+    default: break;
+    }
+    beginText(x68k);
+    for (int cell = first; cell < last; ) {
+      int n = std::min(last - cell, columns - cell % columns);
+      clearCells(x68k, cell % columns, cell / columns, n);
+      cell += n;
+    }
+    endText(x68k);
+    if (d[1].b == 2) {
+      write16(x68k, kWorkCursorX, 0);
+      write16(x68k, kWorkCursorY, 0);
+    }
+    d[0].l = 0;
+    return true;
+  }
+
+  case IOCS_B_BPEEK:
+    d[0].b = x68k->readMem8(a[1]);
+    a[1] += 1;
+    return true;
+  case IOCS_B_WPEEK:
+    d[0].w = read16(x68k, a[1]);
+    a[1] += 2;
+    return true;
+  case IOCS_B_LPEEK:
+    d[0].l = read32(x68k, a[1]);
+    a[1] += 4;
+    return true;
+  case IOCS_B_MEMSTR:  // a1 to a2
+    copy(x68k, a[1], a[2], d[1].l);
+    a[1] += d[1].l;
+    a[2] += d[1].l;
+    return true;
+  case IOCS_B_BPOKE:
+    x68k->writeMem8(a[1], d[1].b);
+    a[1] += 1;
+    return true;
+  case IOCS_B_WPOKE:
+    write16(x68k, a[1], d[1].w);
+    a[1] += 2;
+    return true;
+  case IOCS_B_LPOKE:
+    write32(x68k, a[1], d[1].l);
+    a[1] += 4;
+    return true;
+  case IOCS_B_MEMSET:  // a2 to a1
+    copy(x68k, a[2], a[1], d[1].l);
+    a[1] += d[1].l;
+    a[2] += d[1].l;
+    return true;
+
+  case IOCS_APAGE: {
+    WORD mode = read16(x68k, kCrtcR20) & 0x0700;
+    int count = mode == 0 ? 4 : mode == 0x0100 ? 2 : 1;
+    if (d[1].b >= count) {
+      d[0].l = -1;
+    } else {
+      page = d[1].b;
+      d[0].l = 0;
+    }
+    return true;
+  }
+  case IOCS_PSET:
+  case IOCS_POINT:
+  case IOCS_LINE:
+  case IOCS_BOX:
+  case IOCS_FILL: {
+    // Parameter block at a1: x0, y0[, x1, y1], colour[, line style].
+    Screen s = screen(x68k);
+    int x0 = (int16_t)read16(x68k, a[1]);
+    int y0 = (int16_t)read16(x68k, a[1] + 2);
+    if (no == IOCS_PSET) {
+      pset(x68k, s, x0, y0, read16(x68k, a[1] + 4));
+    } else if (no == IOCS_POINT) {
+      bool inside = x0 >= 0 && x0 < s.width && y0 >= 0 && y0 < s.height;
+      write16(x68k, a[1] + 4, inside ? read16(x68k, pixelAdr(s, x0, y0)) & s.mask : 0xffff);
+    } else {
+      int x1 = (int16_t)read16(x68k, a[1] + 4);
+      int y1 = (int16_t)read16(x68k, a[1] + 6);
+      WORD c = read16(x68k, a[1] + 8);
+      WORD style = no == IOCS_FILL ? 0xffff : read16(x68k, a[1] + 10);
+      if (no == IOCS_LINE) {
+        line(x68k, s, x0, y0, x1, y1, c, &style);
+      } else if (no == IOCS_BOX) {
+        line(x68k, s, x0, y0, x1, y0, c, &style);
+        line(x68k, s, x1, y0, x1, y1, c, &style);
+        line(x68k, s, x1, y1, x0, y1, c, &style);
+        line(x68k, s, x0, y1, x0, y0, c, &style);
+      } else {
+        fill(x68k, s, x0, y0, x1, y1, c);
+      }
+    }
+    d[0].l = 0;
+    return true;
+  }
+  default:
+    return false;
+  }
+}
+
+// The string at a1, up to 64KB.
+void Iocs::readText(X68K* x68k, std::vector<BYTE>* text) const {
+  for (BYTE c; (c = x68k->readMem8(x68k->a[1] + text->size())) != 0 && text->size() < 0x10000; )
+    text->push_back(c);
+}
+
+bool Iocs::canPrint(BYTE c) const {
+  return escape == 0 && ((c >= 0x20 && c <= 0x7e) || (c >= 0xa1 && c <= 0xdf) ||
+                         c == '\r' || c == '\n' || c == '\b' || c == '\t' || c == 0x07);
+}
+
+// Follows an escape sequence sent to the ROM, so that its parameters are
+// not printed here: ESC [ ... final, ESC = y x, or ESC and one byte.
+void Iocs::trackEscape(BYTE c) {
+  if (escape == 0)
+    escape = c == 0x1b ? -2 : 0;
+  else if (escape == -2)
+    escape = c == '[' ? -1 : c == '=' ? 2 : 0;
+  else if (escape == -1)
+    escape = c >= 0x40 && c <= 0x7e ? 0 : -1;
+  else
+    --escape;
+}
+
+void Iocs::putChar(X68K* x68k, BYTE c) {
+  int maxX = read16(x68k, kWorkMaxX);
+  int maxY = read16(x68k, kWorkMaxY);
+  if (maxX == 0 && maxY == 0) {
+    maxX = kDefaultMaxX;
+    maxY = kDefaultMaxY;
+  }
+  int x = read16(x68k, kWorkCursorX);
+  int y = read16(x68k, kWorkCursorY);
+  switch (c) {
+  case 0x07:  // Bell
+    break;
+  case '\b':
+    if (x > 0)
+      --x;
+    break;
+  case '\t':
+    x = (x + 8) & ~7;
+    if (x > maxX) {
+      x = 0;
+      newLine(x68k, &y, maxY);
+    }
+    break;
+  case '\r':
+    x = 0;
+    break;
+  case '\n':
+    newLine(x68k, &y, maxY);
+    break;
+  default:
+    drawGlyph(x68k, x, y, c);
+    if (++x > maxX) {
+      x = 0;
+      newLine(x68k, &y, maxY);
+    }
+    break;
+  }
+  write16(x68k, kWorkCursorX, x);
+  write16(x68k, kWorkCursorY, y);
+}
+
+// Scrolls with CRTC raster copies as the ROM does: a text row is four
+// raster units.
+void Iocs::newLine(X68K* x68k, int* y, int maxY) {
+  if (++*y <= maxY)
+    return;
+  *y = maxY;
+  static const int kUnits = kCellLines / 4;
+  write16(x68k, kCrtcR21, 0x0003);
+  for (int unit = kUnits; unit < (maxY + 1) * kUnits; ++unit) {
+    write16(x68k, kCrtcR22, (unit << 8) | (unit - kUnits));
+    x68k->writeMem8(kCrtcOperation, kRasterCopy);
+  }
+  write16(x68k, kCrtcR21, 0);
+  int maxX = read16(x68k, kWorkMaxX);
+  clearCells(x68k, 0, maxY, (maxX != 0 ? maxX : kDefaultMaxX) + 1);
+}
+
+// Planes 0 and 1 take colour bits 0 and 1.
+void Iocs::drawGlyph(X68K* x68k, int x, int y, BYTE c) {
+  LONG adr = kTextVram + y * kCellLines * kTextLineBytes + x;
+  for (int line = 0; line < kCellLines; ++line) {
+    BYTE glyph = x68k->readMem8(kAnkFont + c * kCellLines + line);
+    if ((color & COLOR_BOLD) != 0)
+      glyph |= glyph >> 1;
+    if ((color & COLOR_REVERSE) != 0)
+      glyph = ~glyph;
+    for (int plane = 0; plane < 2; ++plane)
+      x68k->writeMem8(adr + plane * kTextPlaneSize + line * kTextLineBytes, (color >> plane) & 1 ? glyph : 0);
+  }
+}
+
+void Iocs::clearCells(X68K* x68k, int x, int y, int count) {
+  std::vector<BYTE> zero(count);
+  LONG adr = kTextVram + y * kCellLines * kTextLineBytes + x;
+  for (int line = 0; line < kCellLines; ++line) {
+    for (int plane = 0; plane < 2; ++plane)
+      x68k->writeBlock(adr + plane * kTextPlaneSize + line * kTextLineBytes, zero.data(), count);
+  }
+}
+
+// Text VRAM is written plane by plane with the simultaneous access and
+// mask modes off, whatever the program left in R21.
+void Iocs::beginText(X68K* x68k) {
+  savedAccess = read16(x68k, kCrtcR21);
+  write16(x68k, kCrtcR21, 0);
+}
+
+void Iocs::endText(X68K* x68k) {
+  write16(x68k, kCrtcR21, savedAccess);
+}
+
+LONG Iocs::cursor(X68K* x68k) const {
+  return (read16(x68k, kWorkCursorX) << 16) | read16(x68k, kWorkCursorY);
+}
+
+// R20 bits 8-9 select 16, 256 or 65536 colours, bit 10 the 1024x1024
+// screen. Clipping is to the screen; a _WINDOW set in the ROM is not seen.
+Iocs::Screen Iocs::screen(X68K* x68k) const {
+  WORD r20 = read16(x68k, kCrtcR20);
+  Screen s;
+  int mode = (r20 >> 8) & 3;
+  s.quadrants = (r20 & 0x0400) != 0;
+  s.width = s.height = s.quadrants ? 1024 : 512;
+  s.mask = mode == 0 ? 0x000f : mode == 1 ? 0x00ff : 0xffff;
+  s.base = kGraphicVram + (s.quadrants ? 0 : page * kGraphicPageSize);
+  return s;
+}
+
+LONG Iocs::pixelAdr(const Screen& s, int x, int y) const {
+  LONG adr = s.base + ((y & 511) * 512 + (x & 511)) * 2;
+  if (s.quadrants)
+    adr += ((x & 512) != 0 ? kGraphicPageSize : 0) + ((y & 512) != 0 ? kGraphicPageSize * 2 : 0);
+  return adr;
+}
+
+void Iocs::pset(X68K* x68k, const Screen& s, int x, int y, WORD color) {
+  if (x >= 0 && x < s.width && y >= 0 && y < s.height)
+    write16(x68k, pixelAdr(s, x, y), color & s.mask);
+}
+
+// Bresenham; the line style is a bit pattern rotated a pixel at a time.
+void Iocs::line(X68K* x68k, const Screen& s, int x0, int y0, int x1, int y1, WORD color, WORD* style) {
+  int dx = abs(x1 - x0), sx = x0 < x1 ? 1 : -1;
+  int dy = -abs(y1 - y0), sy = y0 < y1 ? 1 : -1;
+  int err = dx + dy;
+  for (;;) {
+    if ((*style & 0x8000) != 0)
+      pset(x68k, s, x0, y0, color);
+    *style = (*style << 1) | (*style >> 15);
+    if (x0 == x1 && y0 == y1)
+      break;
+    int e2 = err * 2;
+    if (e2 >= dy) {
+      err += dy;
+      x0 += sx;
+    }
+    if (e2 <= dx) {
+      err += dx;
+      y0 += sy;
+    }
+  }
+}
+
+void Iocs::fill(X68K* x68k, const Screen& s, int x0, int y0, int x1, int y1, WORD color) {
+  if (x0 > x1)
+    std::swap(x0, x1);
+  if (y0 > y1)
+    std::swap(y0, y1);
+  x0 = std::max(x0, 0);
+  y0 = std::max(y0, 0);
+  x1 = std::min(x1, s.width - 1);
+  y1 = std::min(y1, s.height - 1);
+  if (x0 > x1 || y0 > y1)
+    return;
+  color &= s.mask;
+  std::vector<BYTE> row((x1 - x0 + 1) * 2);
+  for (size_t i = 0; i < row.size(); i += 2) {
+    row[i] = color >> 8;
+    row[i + 1] = color;
+  }
+  for (int y = y0; y <= y1; ++y) {
+    // A row is contiguous within a 512 pixel block.
+    for (int x = x0; x <= x1; ) {
+      int n = std::min(x1 + 1, (x | 511) + 1) - x;
+      x68k->writeBlock(pixelAdr(s, x, y), row.data(), n * 2);
+      x += n;
+    }
+  }
+}
+
+void Iocs::copy(X68K* x68k, LONG from, LONG to, LONG bytes) {
+  static const LONG kChunk = 0x10000;
+  std::vector<BYTE> buf(std::min(bytes, kChunk));
+  while (bytes > 0) {
+    LONG n = std::min(bytes, kChunk);
+    x68k->readBlock(from, buf.data(), n);
+    x68k->writeBlock(to, buf.data(), n);
+    from += n;
+    to += n;
+    bytes -= n;
+  }
+}
@@ -0,0 +1,72 @@
+#ifndef __IOCS_H__
+#define __IOCS_H__
+
+#include <stdint.h>
+#include <vector>
+#include "x68k.h"
+
+// Native IOCS routines for trap #15, each enabled on its own; a call that
+// is not enabled, or that a routine cannot handle (escape sequences, kanji,
+// ...), runs the ROM code as before. The routines work on the emulated
+// devices as the ROM does: text VRAM through the CRTC, the cursor in the
+// IOCS work area, graphics VRAM in the mode set in R20.
+// The text colour and the active graphics page are kept here rather than
+// where the ROM keeps them, so the console and graphics groups should each
+// be switched as a whole.
+class Iocs : public X68K::IocsHandler {
+public:
+  typedef MC68K::BYTE BYTE;
+  typedef MC68K::WORD WORD;
+  typedef MC68K::LONG LONG;
+
+  Iocs();
+
+  // Enables the native routine for call `no`, if there is one.
+  void enable(int no, bool on);
+  // Enables a comma separated list of call numbers in hex and groups:
+  // text, memory, graphics or all. Returns false on an unknown entry.
+  bool enable(const char* list);
+  bool isImplemented(int no) const;
+
+  virtual bool iocsCall(X68K* x68k, int no) override;
+  virtual bool iocsAccepts(X68K* x68k, int no) override;
+
+private:
+  struct Screen {
+    LONG base;  // Active page.
+    int width, height;
+    WORD mask;  // Colour bits.
+    bool quadrants;  // 1024x1024: four 512x512 blocks.
+  };
+
+  // Text console.
+  void readText(X68K* x68k, std::vector<BYTE>* text) const;
+  bool canPrint(BYTE c) const;
+  void trackEscape(BYTE c);
+  void putChar(X68K* x68k, BYTE c);
+  void newLine(X68K* x68k, int* y, int maxY);
+  void drawGlyph(X68K* x68k, int x, int y, BYTE c);
+  void clearCells(X68K* x68k, int x, int y, int count);
+  void beginText(X68K* x68k);
+  void endText(X68K* x68k);
+  LONG cursor(X68K* x68k) const;
+
+  // Graphics.
+  Screen screen(X68K* x68k) const;
+  LONG pixelAdr(const Screen& s, int x, int y) const;
+  void pset(X68K* x68k, const Screen& s, int x, int y, WORD color);
+  void line(X68K* x68k, const Screen& s, int x0, int y0, int x1, int y1, WORD color, WORD* style);
+  void fill(X68K* x68k, const Screen& s, int x0, int y0, int x1, int y1, WORD color);
+
+  void copy(X68K* x68k, LONG from, LONG to, LONG bytes);
+
+  bool enabled[256];
+  BYTE color;
+  // Escape sequence going to the ROM: 0 none, -2 after ESC, -1 up to the
+  // final byte, otherwise the bytes left.
+  int escape;
+  WORD savedAccess;  // CRTC R21 while drawing.
+  int page;
+};
+
+#endif
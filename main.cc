@@ -1,8 +1,21 @@
 #include <fcntl.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include "audiothread.h"
+#include "diskimage.h"
+#include "harddisk.h"
+#include "human68k.h"
+#include "iocs.h"
+#include "recording.h"
+#include "renderthread.h"
+#include "rommap.h"
+#include "sramfile.h"
+#include "statspage.h"
+#include "videosink.h"
 #include "x68k.h"
 
 uint8_t* readFile(const char* fileName, size_t* pSize) {
@@ -37,8 +50,49 @@ uint8_t* readFile(const char* fileName, size_t* pSize) {
   return data;
 }
 
-int main() {
+static const char kOptions[] = "+b:r:w:o:a:f:Ms:m:i:cR:P:L:SCqd:x:";
+
+// Parses "start[-end]" in hex.
+static bool parseRange(const char* str, uint32_t* pStart, uint32_t* pEnd) {
+  char* p;
+  *pStart = *pEnd = strtoul(str, &p, 16);
+  if (*p == '-')
+    *pEnd = strtoul(p + 1, &p, 16);
+  return p != str && *p == '\0' && *pStart <= *pEnd;
+}
+
+static void usage(const char* argv0) {
+  fprintf(stderr, "Usage: %s [-b adr] [-r start[-end]] [-w start[-end]] [-o path] [-a path] [-f image[,journal]] [-M] [-s image] [-m path] [-i calls [-c]] [-R path | -P path[,cycle]] [-L n] [-S] [-C] [-q]\n", argv0);
+  fprintf(stderr, "       %s [-d dir] -x program [args...]\n", argv0);
+  fprintf(stderr, "  -b  Break when PC reaches adr\n");
+  fprintf(stderr, "  -r  Break when the range is read\n");
+  fprintf(stderr, "  -w  Break when the range is written\n");
+  fprintf(stderr, "  -o  Write frames to a .y4m file, - (Y4M to stdout) or a PPM name pattern\n");
+  fprintf(stderr, "  -a  Write sound to a WAV file or - (stdout)\n");
+  fprintf(stderr, "  -f  Insert a floppy image into the next drive. Writes go to the journal, or a\n");
+  fprintf(stderr, "      new image.XXXXXX.jnl, and are kept at exit so images can be shared\n");
+  fprintf(stderr, "  -M  Merge the floppy journals into the images at exit if no one else uses them\n");
+  fprintf(stderr, "  -s  Connect a SASI hard disk image (HDF/HDS) as the next unit\n");
+  fprintf(stderr, "  -m  Keep SRAM in a file, created if missing\n");
+  fprintf(stderr, "  -i  Run IOCS calls natively: hex numbers and text, memory, graphics or all,\n");
+  fprintf(stderr, "      comma separated\n");
+  fprintf(stderr, "  -c  Also run each native IOCS call in the ROM on a fork and report differences\n");
+  fprintf(stderr, "  -R  Record the session for replay, with a keyframe every 2 s of emulated time\n");
+  fprintf(stderr, "  -P  Replay a recorded session, from the given cycle if any. Needs the floppy\n");
+  fprintf(stderr, "      images without what was merged since, and hard disks of the same sizes,\n");
+  fprintf(stderr, "      but not their contents, the program or its files\n");
+  fprintf(stderr, "  -L  Check the CPU fast paths against the reference interpreter on a fork every\n");
+  fprintf(stderr, "      n instructions (1: every block), stopping at the first difference\n");
+  fprintf(stderr, "  -S  Publish live counters in /dev/shm for tools/x68stat\n");
+  fprintf(stderr, "  -C  Neither read nor write the decode table caches\n");
+  fprintf(stderr, "  -q  Do not trace instructions\n");
+  fprintf(stderr, "  -x  Run a Human68k .X/.R program with DOS calls emulated; ends the options\n");
+  fprintf(stderr, "  -d  Host directory seen as drive A: by the program (default .)\n");
+}
+
+int main(int argc, char* argv[]) {
   static const char* kIplRomFileName = "X68BIOSE/IPLROM.DAT";
+  static const long kStepsPerRun = 10000;
   size_t iplSize;
   uint8_t* ipl = readFile(kIplRomFileName, &iplSize);
   if (ipl == nullptr) {
@@ -46,14 +100,275 @@ int main() {
     return 1;
   }
 
-  X68K x68k(ipl);
+  static const char* kCgRomFileName = "X68BIOSE/CGROM.DAT";
+  static const size_t kCgRomSize = 0xc0000;
+  size_t cgromSize;
+  uint8_t* cgrom = readFile(kCgRomFileName, &cgromSize);
+  if (cgrom != nullptr && cgromSize < kCgRomSize) {
+    fprintf(stderr, "Ignoring %s: too small\n", kCgRomFileName);
+    delete[] cgrom;
+    cgrom = nullptr;
+  }
+
+  // -C has to be known before the first CPU is made; the options proper
+  // are parsed once the machine is there.
+  bool decodeCache = true;
+  int opt;
+  opterr = 0;
+  while ((opt = getopt(argc, argv, kOptions)) != -1 && opt != 'x')
+    decodeCache = decodeCache && opt != 'C';
+  opterr = 1;
+  optind = 0;
+
+  // Decode tables are shared through the user's cache directory.
+  std::string cacheDir;
+  const char* home;
+  if ((home = getenv("XDG_CACHE_HOME")) != nullptr && *home != '\0')
+    cacheDir = home;
+  else if ((home = getenv("HOME")) != nullptr)
+    cacheDir = std::string(home) + "/.cache";
+  const char* cache = decodeCache && !cacheDir.empty() ? cacheDir.c_str() : nullptr;
+  MC68K::initDecoder(cache);
+
+  X68K x68k(ipl, cgrom);
+  // Symbols for the trace, analysed once per ROM and build.
+  RomMap romMap;
+  if (iplSize == RomMap::kSize) {
+    romMap.load(ipl, cache);
+    x68k.setRomMap(&romMap);
+  }
+  const char* outPath = nullptr;
+  const char* audioPath = nullptr;
+  DiskImage disks[2];
+  bool mergeJournals = false;
+  int diskCount = 0;
+  HardDisk hardDisks[4];
+  int hardDiskCount = 0;
+  SramFile sramFile;
+  const char* program = nullptr;
+  Iocs iocs;
+  bool nativeIocs = false;
+  bool checkIocs = false;
+  const char* rootDir = ".";
+  Recording recording(x68k.recordingLayout());
+  const char* recordPath = nullptr;
+  const char* replayPath = nullptr;
+  uint64_t replayCycle = 0;
+  long lockstepInterval = 0;
+  bool publishStats = false;
+
+  while (program == nullptr && (opt = getopt(argc, argv, kOptions)) != -1) {
+    uint32_t start, end;
+    switch (opt) {
+    case 'b':
+    case 'r':
+    case 'w':
+      if (!parseRange(optarg, &start, &end)) {
+        usage(argv[0]);
+        return 1;
+      }
+      if (opt == 'b')
+        x68k.addBreakpoint(start);
+      else
+        x68k.addWatchpoint(start, end, opt == 'r' ? X68K::WATCH_READ : X68K::WATCH_WRITE);
+      break;
+    case 'o':
+      outPath = optarg;
+      break;
+    case 'a':
+      audioPath = optarg;
+      break;
+    case 'f': {
+      char* journal = strchr(optarg, ',');
+      if (journal != nullptr)
+        *journal++ = '\0';
+      if (diskCount >= 2 || !disks[diskCount].open(optarg, journal)) {
+        fprintf(stderr, "Cannot insert %s\n", optarg);
+        return 1;
+      }
+      x68k.insertDisk(diskCount, &disks[diskCount]);
+      ++diskCount;
+      break;
+    }
+    case 'M':
+      mergeJournals = true;
+      break;
+    case 's':
+      if (hardDiskCount >= 4 || !hardDisks[hardDiskCount].open(optarg)) {
+        fprintf(stderr, "Cannot connect %s\n", optarg);
+        return 1;
+      }
+      x68k.attachHardDisk(hardDiskCount, &hardDisks[hardDiskCount]);
+      ++hardDiskCount;
+      break;
+    case 'm':
+      if (!sramFile.open(optarg)) {
+        fprintf(stderr, "Cannot open %s\n", optarg);
+        return 1;
+      }
+      x68k.attachSram(&sramFile);
+      break;
+    case 'i':
+      if (!iocs.enable(optarg)) {
+        fprintf(stderr, "Unknown IOCS call in %s\n", optarg);
+        return 1;
+      }
+      nativeIocs = true;
+      break;
+    case 'c':
+      checkIocs = true;
+      break;
+    case 'R':
+      recordPath = optarg;
+      break;
+    case 'P': {
+      char* cycle = strchr(optarg, ',');
+      if (cycle != nullptr) {
+        *cycle++ = '\0';
+        replayCycle = strtoull(cycle, nullptr, 0);
+      }
+      replayPath = optarg;
+      break;
+    }
+    case 'L':
+      lockstepInterval = strtol(optarg, nullptr, 0);
+      if (lockstepInterval <= 0) {
+        usage(argv[0]);
+        return 1;
+      }
+      break;
+    case 'S':
+      publishStats = true;
+      break;
+    case 'C':
+      break;
+    case 'q':
+      x68k.setTrace(false);
+      break;
+    case 'd':
+      rootDir = optarg;
+      break;
+    case 'x':
+      program = optarg;
+      break;
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (mergeJournals && (recordPath != nullptr || replayPath != nullptr)) {
+    fprintf(stderr, "-M would change the images the recording starts from\n");
+    return 1;
+  }
+
+  if (nativeIocs)
+    x68k.setIocsHandler(&iocs, checkIocs);
+
+  // The rest of the arguments make the command line of the program.
+  std::string commandLine;
+  for (int i = optind; program != nullptr && i < argc; ++i)
+    commandLine += std::string(i > optind ? " " : "") + argv[i];
+  Human68k human68k(rootDir);
+  if (program != nullptr) {
+    x68k.setTrace(false);
+    if (!human68k.load(&x68k, program, commandLine.c_str())) {
+      fprintf(stderr, "Cannot load %s\n", program);
+      return 1;
+    }
+    x68k.setDosHandler(&human68k);
+  }
+
+  if (recordPath != nullptr) {
+    x68k.setRecording(&recording, false);
+    x68k.addKeyframe();
+  } else if (replayPath != nullptr) {
+    if (!recording.load(replayPath)) {
+      fprintf(stderr, "Cannot load %s\n", replayPath);
+      return 1;
+    }
+    x68k.setRecording(&recording, true);
+    x68k.seek(replayCycle);
+  }
+
+  // Best effort: monitoring must not stop the emulator.
+  StatsPage statsPage;
+  if (publishStats && statsPage.open())
+    x68k.setStatsPage(&statsPage);
+
+  VideoSink sink;
+  RenderThread renderThread(&sink);
+  if (outPath != nullptr) {
+    if (strcmp(outPath, "-") == 0)
+      x68k.setTrace(false);  // Stdout carries the stream.
+    if (!sink.open(outPath, X68K::kFrameWidth, X68K::kFrameHeight, X68K::kCpuHz, x68k.frameCycles())) {
+      fprintf(stderr, "Cannot open %s\n", outPath);
+      return 1;
+    }
+    renderThread.start();
+    x68k.setRenderThread(&renderThread);
+  }
+
+  AudioThread audio;
+  if (audioPath != nullptr) {
+    if (strcmp(audioPath, "-") == 0)
+      x68k.setTrace(false);
+    if (!audio.open(audioPath)) {
+      fprintf(stderr, "Cannot open %s\n", audioPath);
+      return 1;
+    }
+    audio.start();
+    x68k.setAudioThread(&audio);
+  }
 
   for (;;) {
     //x68k.stat();
-    x68k.step();
+    MC68K::StopReason reason = lockstepInterval > 0 ? x68k.runLockstep(kStepsPerRun, lockstepInterval)
+                                                    : x68k.run(kStepsPerRun);
+    if (recordPath != nullptr && recording.keyframeDue(x68k.cycles))
+      x68k.addKeyframe();
+    if (reason == MC68K::STOP_EXIT)
+      break;
+    if (reason != MC68K::STOP_NONE) {
+      static const char* kReasons[] = {"", "breakpoint", "read watchpoint", "write watchpoint", "exit",
+                                       "lockstep difference"};
+      fflush(stdout);
+      fprintf(stderr, "Stopped by %s at %06x (PC=%06x)\n", kReasons[reason], x68k.stopAddress(), x68k.pc);
+      break;
+    }
+  }
+
+  if (outPath != nullptr) {
+    renderThread.stop();
+    sink.close();
+    fprintf(stderr, "Frames: %llu written, %llu repeated, %llu dropped\n",
+            (unsigned long long)sink.framesWritten(), (unsigned long long)sink.framesRepeated(),
+            (unsigned long long)sink.framesDropped());
+  }
+
+  if (audioPath != nullptr)
+    audio.stop(x68k.cycles);
+
+  if (lockstepInterval > 0)
+    fprintf(stderr, "Lockstep: %llu intervals checked, %llu skipped\n",
+            (unsigned long long)x68k.lockstepChecked(), (unsigned long long)x68k.lockstepSkipped());
+
+  if (recordPath != nullptr && !recording.save(recordPath))
+    fprintf(stderr, "Cannot write %s\n", recordPath);
+
+  for (int i = 0; i < diskCount; ++i) {
+    if (!mergeJournals && !disks[i].journal().empty())
+      fprintf(stderr, "Drive %d writes kept in %s\n", i, disks[i].journal().c_str());
+    disks[i].close(mergeJournals);
   }
+  for (int i = 0; i < hardDiskCount; ++i)
+    hardDisks[i].close();
+  x68k.flushSram(true);
+  sramFile.close();
+  statsPage.close();
 
   delete[] ipl;
+  delete[] cgrom;
 
-  return 0;
+  return program != nullptr ? human68k.exitCode() & 0xff : 0;
 }
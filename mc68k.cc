@@ -1,8 +1,10 @@
 #include "mc68k.h"
 #include <assert.h>
 #include <stdio.h>
+#include <string.h>
+#include "decodecache.h"
 
-#define DUMP(pc, n, fmt, ...)  { dumpOps(pc, n); printf(fmt "\n", ##__VA_ARGS__); }
+#define DUMP(pc, n, fmt, ...)  { if (trace) { dumpOps(pc, n); printf(fmt "\n", ##__VA_ARGS__); } }
 
 typedef MC68K::BYTE BYTE;
 typedef MC68K::WORD WORD;
@@ -12,7 +14,18 @@ constexpr BYTE FLAG_C = 1 << 0;
 constexpr BYTE FLAG_V = 1 << 1;
 constexpr BYTE FLAG_Z = 1 << 2;
 constexpr BYTE FLAG_N = 1 << 3;
+constexpr WORD FLAG_S = 1 << 13;
+constexpr WORD FLAG_T = 1 << 15;
+constexpr WORD SR_MASK = 0xa71f;
+constexpr int IPL_SHIFT = 8;
+constexpr WORD IPL_MASK = 7 << IPL_SHIFT;
 
+// No instruction timing yet, use a typical 68000 average.
+constexpr int AVERAGE_CYCLES = 8;
+
+constexpr int PRIVILEGE_VIOLATION_VECTOR = 8;
+constexpr int LINE_F_VECTOR = 11;
+constexpr int AUTOVECTOR_BASE = 24;
 constexpr LONG TRAP_VECTOR_START = 0x0080;
 
 static const char kSizeStr[] = {'\0', 'b', 'l', 'w'};
@@ -24,9 +37,173 @@ static const char kPostIncAdrIndirectNames[][6] = {"(A0)+", "(A1)+", "(A2)+", "(
 static const char kPreDecAdrIndirectNames[][6] = {"-(A0)", "-(A1)", "-(A2)", "-(A3)", "-(A4)", "-(A5)", "-(A6)", "-(A7)"};
 static const char kMoveNames[][6] = {"move", "movea", "move", "move", "move", "move", "move", "move"};
 
+// Instruction kinds handled by step().
+enum OpKind {
+  OP_UNIMPLEMENTED,
+  OP_MOVE_IMM_POSTINC,
+  OP_MOVE_IMM_ABS,
+  OP_BTST_REG,
+  OP_MOVE_B,
+  OP_MOVE_L,
+  OP_MOVE_W,
+  OP_MOVE_W_ABS_D,
+  OP_MOVE_W_IMM_D,
+  OP_MOVE_W_IMM_DISP,
+  OP_MOVEA_W_D,
+  OP_MOVE_W_D_ABS,
+  OP_MOVE_W_IND_DISP,
+  OP_MOVE_W_DISP_DISP,
+  OP_LEA_DISP,
+  OP_LEA_INDEX,
+  OP_LEA_ABS,
+  OP_LEA_PC,
+  OP_CLR_B,
+  OP_CLR_W,
+  OP_CLR_L,
+  OP_CLR_W_ABS,
+  OP_CLR_L_POSTINC,
+  OP_MOVE_TO_SR,
+  OP_MOVEM,
+  OP_TST_B,
+  OP_TST_W,
+  OP_TST_L,
+  OP_TRAP,
+  OP_RESET,
+  OP_NOP,
+  OP_RTE,
+  OP_RTS,
+  OP_JSR_IND,
+  OP_ADDQ_L_A,
+  OP_SUBQ_W_D,
+  OP_DBRA,
+  OP_BSR,
+  OP_BCC,
+  OP_BNE,
+  OP_BEQ,
+  OP_MOVEQ,
+  OP_SUBA_L,
+  OP_CMP_B,
+  OP_CMP_W,
+  OP_CMPM_B,
+  OP_CMPA_L,
+  OP_AND_W,
+  OP_AND_L,
+  OP_ADD_L_D,
+  OP_ADD_L_IMM,
+  OP_ADDA_L,
+  OP_ADDA_L_IMM,
+  OP_ROR_W_IMM,
+  OP_ROL_B_IMM,
+  OP_ASL_B_REG,
+  OP_ASL_W_IMM,
+  OP_LINE_F,
+  OP_KIND_COUNT,
+};
+
+// Decode patterns, first match wins.
+struct OpPattern {
+  WORD mask;
+  WORD value;
+  BYTE kind;
+};
+
+static const OpPattern kOpPatterns[] = {
+  {0xc1ff, 0x00fc, OP_MOVE_IMM_POSTINC},
+  {0xcfff, 0x03fc, OP_MOVE_IMM_ABS},
+  {0xf1f8, 0x0100, OP_BTST_REG},
+  {0xf000, 0x1000, OP_MOVE_B},
+  {0xf000, 0x2000, OP_MOVE_L},
+  {0xf000, 0x3000, OP_MOVE_W},
+  {0xf1ff, 0x3039, OP_MOVE_W_ABS_D},
+  {0xf1ff, 0x303c, OP_MOVE_W_IMM_D},
+  {0xf1ff, 0x317c, OP_MOVE_W_IMM_DISP},
+  {0xf1f8, 0x3040, OP_MOVEA_W_D},
+  {0xfff8, 0x33c0, OP_MOVE_W_D_ABS},
+  {0xf1f8, 0x3150, OP_MOVE_W_IND_DISP},
+  {0xf1f8, 0x3168, OP_MOVE_W_DISP_DISP},
+  {0xf1f8, 0x41e8, OP_LEA_DISP},
+  {0xf1f8, 0x41f0, OP_LEA_INDEX},
+  {0xf1ff, 0x41f9, OP_LEA_ABS},
+  {0xf1ff, 0x41fa, OP_LEA_PC},
+  {0xffc0, 0x4200, OP_CLR_B},
+  {0xffc0, 0x4240, OP_CLR_W},
+  {0xffc0, 0x4280, OP_CLR_L},
+  {0xffff, 0x4279, OP_CLR_W_ABS},
+  {0xfff8, 0x4298, OP_CLR_L_POSTINC},
+  {0xffff, 0x46fc, OP_MOVE_TO_SR},
+  {0xfb80, 0x4880, OP_MOVEM},
+  {0xffc0, 0x4a00, OP_TST_B},
+  {0xffc0, 0x4a40, OP_TST_W},
+  {0xffc0, 0x4a80, OP_TST_L},
+  {0xfff0, 0x4e40, OP_TRAP},
+  {0xffff, 0x4e70, OP_RESET},
+  {0xffff, 0x4e71, OP_NOP},
+  {0xffff, 0x4e73, OP_RTE},
+  {0xffff, 0x4e75, OP_RTS},
+  {0xfff8, 0x4e90, OP_JSR_IND},
+  {0xf1f8, 0x5088, OP_ADDQ_L_A},
+  {0xf1f8, 0x5140, OP_SUBQ_W_D},
+  {0xfff8, 0x51c8, OP_DBRA},
+  {0xff00, 0x6100, OP_BSR},
+  {0xff00, 0x6400, OP_BCC},
+  {0xff00, 0x6600, OP_BNE},
+  {0xff00, 0x6700, OP_BEQ},
+  {0xf100, 0x7000, OP_MOVEQ},
+  {0xf1f8, 0x91c8, OP_SUBA_L},
+  {0xf1c0, 0xb000, OP_CMP_B},
+  {0xf1c0, 0xb040, OP_CMP_W},
+  {0xf1f8, 0xb108, OP_CMPM_B},
+  {0xf1c0, 0xb1c0, OP_CMPA_L},
+  {0xf1c0, 0xc040, OP_AND_W},
+  {0xf1c0, 0xc080, OP_AND_L},
+  {0xf1f8, 0xd080, OP_ADD_L_D},
+  {0xf1ff, 0xd0bc, OP_ADD_L_IMM},
+  {0xf1f8, 0xd1c8, OP_ADDA_L},
+  {0xf1ff, 0xd1fc, OP_ADDA_L_IMM},
+  {0xf1f8, 0xe058, OP_ROR_W_IMM},
+  {0xf1f8, 0xe118, OP_ROL_B_IMM},
+  {0xf1f8, 0xe120, OP_ASL_B_REG},
+  {0xf1f8, 0xe140, OP_ASL_W_IMM},
+  {0xf000, 0xf000, OP_LINE_F},
+};
+
 #define NOT_IMPLEMENTED  { fflush(stdout); fflush(stderr); assert(!"Unimplemented op"); }
 
+const BYTE* MC68K::opKinds = nullptr;
+bool MC68K::opKindsCached = false;
+
+static BYTE decodeOp(WORD op) {
+  static const int kPatterns = sizeof(kOpPatterns) / sizeof(kOpPatterns[0]);
+  for (int i = 0; i < kPatterns; ++i) {
+    if ((op & kOpPatterns[i].mask) == kOpPatterns[i].value)
+      return kOpPatterns[i].kind;
+  }
+  return OP_UNIMPLEMENTED;
+}
+
+static void buildOpKinds(BYTE* table, void*) {
+  for (int op = 0; op < 0x10000; ++op)
+    table[op] = decodeOp(op);
+}
+
+// The table follows from the patterns alone, so they make the cache key,
+// with the build: a rebuild may change what a kind means without touching
+// the patterns. The ROM plays no part.
+void MC68K::initDecoder(const char* cacheDir) {
+  uint64_t key = DecodeCache::kHashSeed;
+  for (size_t i = 0; i < sizeof(kOpPatterns) / sizeof(kOpPatterns[0]); ++i) {
+    const OpPattern& p = kOpPatterns[i];
+    const LONG fields[] = {p.mask, p.value, p.kind};
+    key = DecodeCache::hash(fields, sizeof(fields), key);
+  }
+  static const char kBuild[] = __DATE__ " " __TIME__;
+  key = DecodeCache::hash(kBuild, sizeof(kBuild) - 1, key);
+  opKinds = DecodeCache::open(cacheDir, "x68emu-decode", key, 0x10000, buildOpKinds, nullptr, &opKindsCached);
+}
+
 MC68K::MC68K() {
+  if (opKinds == nullptr)
+    initDecoder(nullptr);
   clear();
 }
 
@@ -41,6 +218,178 @@ void MC68K::setSp(LONG adr) {
   a[7] = adr;
 }
 
+void MC68K::saveContext(Context* ctx) const {
+  for (int i = 0; i < 8; ++i) {
+    ctx->d[i] = d[i];
+    ctx->a[i] = a[i];
+  }
+  ctx->pc = pc;
+  ctx->sr = sr;
+  ctx->usp = usp;
+  ctx->ssp = ssp;
+  ctx->irqPending = irqPending;
+  ctx->cycles = cycles;
+}
+
+void MC68K::loadContext(const Context& ctx) {
+  for (int i = 0; i < 8; ++i) {
+    d[i] = ctx.d[i];
+    a[i] = ctx.a[i];
+  }
+  pc = ctx.pc;
+  usp = ctx.usp;
+  ssp = ctx.ssp;
+  irqPending = ctx.irqPending;
+  cycles = ctx.cycles;
+  // a[7] already holds the stack pointer of the mode in ctx.sr.
+  sr = ctx.sr;
+  updateIrqMask();
+}
+
+void MC68K::addBreakpoint(LONG adr) {
+  adr &= 0xffffff;
+  if (breakpoints.insert(adr).second)
+    ++breakPages[adr >> kBreakPageShift];
+}
+
+void MC68K::removeBreakpoint(LONG adr) {
+  adr &= 0xffffff;
+  if (breakpoints.erase(adr) != 0)
+    --breakPages[adr >> kBreakPageShift];
+}
+
+void MC68K::copyBreakpoints(const MC68K& other) {
+  breakpoints = other.breakpoints;
+  memcpy(breakPages, other.breakPages, sizeof(breakPages));
+}
+
+// Block boundary: everything here is checked once per block only. Returns
+// false when stopped by a breakpoint.
+bool MC68K::enterBlock(bool first) {
+  if (cycles >= nextEventCycle)
+    processEvents();
+  if ((irqPending & irqAccepted) != 0)
+    processInterrupt();
+  LONG page = (pc & 0xffffff) >> kBreakPageShift;
+  if (breakPages[page] != 0 && !first && breakpoints.count(pc & 0xffffff) != 0) {
+    stopReason = STOP_BREAKPOINT;
+    stopAdr = pc;
+    return false;
+  }
+  // Single step through pages holding breakpoints, so that a breakpoint in
+  // the middle of a block is not skipped.
+  blockEnd = (breakPages[page] | breakPages[(page + 1) & (kBreakPageCount - 1)]) != 0;
+  return true;
+}
+
+MC68K::StopReason MC68K::run(long count) {
+  stopReason = STOP_NONE;
+  for (bool first = true; count > 0; first = false) {
+    if (!enterBlock(first))
+      break;
+    do {
+      step();
+      cycles += AVERAGE_CYCLES;
+      ++instructions;
+      --count;
+    } while (!blockEnd);
+    if (stopReason != STOP_NONE)
+      break;
+  }
+  return stopReason;
+}
+
+MC68K::StopReason MC68K::runInstruction() {
+  stopReason = STOP_NONE;
+  if (blockEnd)
+    enterBlock(true);
+  step();
+  cycles += AVERAGE_CYCLES;
+  ++instructions;
+  return stopReason;
+}
+
+void MC68K::raiseIrq(int level) {
+  irqPending |= 1 << level;
+  blockEnd = true;
+}
+
+void MC68K::clearIrq(int level) {
+  irqPending &= ~(1 << level);
+}
+
+void MC68K::setSr(WORD value) {
+  value &= SR_MASK;
+  if (((sr ^ value) & FLAG_S) != 0) {
+    // Swap the stack pointers.
+    if ((value & FLAG_S) != 0) {
+      usp = a[7];
+      a[7] = ssp;
+    } else {
+      ssp = a[7];
+      a[7] = usp;
+    }
+  }
+  sr = value;
+  updateIrqMask();
+}
+
+void MC68K::updateIrqMask() {
+  // Levels above the mask are accepted, level 7 is non-maskable.
+  irqAccepted = (~((2 << ((sr & IPL_MASK) >> IPL_SHIFT)) - 1) | 0x80) & 0xfe;
+  // The mask may have changed, so check interrupts at the next boundary.
+  blockEnd = true;
+}
+
+void MC68K::exception(int vector) {
+  WORD oldSr = sr;
+  setSr((sr | FLAG_S) & ~FLAG_T);
+  push32(pc);
+  push16(oldSr);
+  pc = readMem32(vector * 4);
+}
+
+void MC68K::processInterrupt() {
+  int accepted = irqPending & irqAccepted;
+  int level = 7;
+  while ((accepted & (1 << level)) == 0)
+    --level;
+
+  WORD oldSr = sr;
+  setSr(((sr | FLAG_S) & ~(FLAG_T | IPL_MASK)) | (level << IPL_SHIFT));
+  int vector = acknowledgeInterrupt(level);
+  push32(pc);
+  push16(oldSr);
+  pc = readMem32(vector * 4);
+}
+
+int MC68K::acknowledgeInterrupt(int level) {
+  clearIrq(level);
+  return AUTOVECTOR_BASE + level;
+}
+
+void MC68K::processEvents() {
+  nextEventCycle = ~(uint64_t)0;
+}
+
+bool MC68K::emulateLineF(WORD op) {
+  (void)op;
+  return false;
+}
+
+bool MC68K::emulateTrap(int no) {
+  (void)no;
+  return false;
+}
+
+void MC68K::requestStop(StopReason reason, LONG adr) {
+  if (stopReason == STOP_NONE) {  // Keep the first hit.
+    stopReason = reason;
+    stopAdr = adr;
+  }
+  blockEnd = true;
+}
+
 void MC68K::stat() {
   printf("PC:%08x\n", pc);
 }
@@ -50,23 +399,33 @@ void MC68K::step() {
   pc += 2;
   LONG opc = pc;
 
-  printf("%06x: %04x ", pc - 2, op);
+  if (trace) {
+    const char* name = symbolName(pc - 2);
+    if (name != nullptr)
+      printf("%s:\n", name);
+    printf("%06x: %04x ", pc - 2, op);
+  }
 
-  if ((op & 0xc1ff) == 0x00fc) {  // Except 0x0xxx  (0x1xxx, 0x2xxx, 0x3xxx)
+  switch (reference ? decodeOp(op) : opKinds[op]) {
+  case OP_MOVE_IMM_POSTINC: {  // Except 0x0xxx  (0x1xxx, 0x2xxx, 0x3xxx)
     int size = (op >> 12) & 3;
     int di = (op >> 9) & 7;
     LONG src = fetchImmediate(size);
     DUMP(opc, pc - opc, "move.%c #$%x, (A%d)+", kSizeStr[size], src, di);
     writeValue(a[di], size, src);
     a[di] += kSizeTable[size];
-  } else if ((op & 0xcfff) == 0x03fc) {  // Except 0x0xxx  (0x1xxx, 0x2xxx, 0x3xxx)
+    break;
+  }
+  case OP_MOVE_IMM_ABS: {  // Except 0x0xxx  (0x1xxx, 0x2xxx, 0x3xxx)
     int size = (op >> 12) & 3;
     LONG src = fetchImmediate(size);
     LONG dst = readMem32(pc);
     pc += 4;
     DUMP(opc, pc - opc, "move.%c #$%x, $%08x.l", kSizeStr[size], src, dst);
     writeValue(dst, size, src);
-  } else if ((op & 0xf1f8) == 0x0100) {
+    break;
+  }
+  case OP_BTST_REG: {
     int si = op & 7;
     int di = (op >> 9) & 7;
     DUMP(opc, pc - opc, "btst D%d, D%d", si, di);
@@ -74,7 +433,9 @@ void MC68K::step() {
       sr |= FLAG_Z;
     else
       sr &= ~FLAG_Z;
-  } else if ((op & 0xf000) == 0x1000) {  // move.b
+    break;
+  }
+  case OP_MOVE_B: {  // move.b
     char srcBuf[32], *srcStr = srcBuf;
     char dstBuf[32], *dstStr = dstBuf;
     int n = (op >> 9) & 7;
@@ -83,7 +444,9 @@ void MC68K::step() {
     BYTE src = readSource8((op >> 3) & 7, m, &srcStr);
     writeDestination8(dt, n, src, &dstStr);
     DUMP(opc, pc - opc, "%s.b %s, %s", kMoveNames[dt], srcStr, dstStr);
-  } else if ((op & 0xf000) == 0x2000) {  // move.l
+    break;
+  }
+  case OP_MOVE_L: {  // move.l
     char srcBuf[32], *srcStr = srcBuf;
     char dstBuf[32], *dstStr = dstBuf;
     int n = (op >> 9) & 7;
@@ -92,7 +455,9 @@ void MC68K::step() {
     LONG src = readSource32((op >> 3) & 7, m, &srcStr);
     writeDestination32(dt, n, src, &dstStr);
     DUMP(opc, pc - opc, "%s.l %s, %s", kMoveNames[dt], srcStr, dstStr);
-  } else if ((op & 0xf000) == 0x3000) {  // move.w
+    break;
+  }
+  case OP_MOVE_W: {  // move.w
     char srcBuf[32], *srcStr = srcBuf;
     char dstBuf[32], *dstStr = dstBuf;
     int n = (op >> 9) & 7;
@@ -101,43 +466,57 @@ void MC68K::step() {
     WORD src = readSource16((op >> 3) & 7, m, &srcStr);
     writeDestination16(dt, n, src, &dstStr);
     DUMP(opc, pc - opc, "%s.w %s, %s", kMoveNames[dt], srcStr, dstStr);
-  } else if ((op & 0xf1ff) == 0x3039) {
+    break;
+  }
+  case OP_MOVE_W_ABS_D: {
     int di = (op >> 9) & 7;
     LONG src = readMem32(pc);
     pc += 4;
     DUMP(opc, pc - opc, "move.w $%08x.l, D%d", src, di);
     d[di].w = readMem16(src);
-  } else if ((op & 0xf1ff) == 0x303c) {
+    break;
+  }
+  case OP_MOVE_W_IMM_D: {
     int di = (op >> 9) & 7;
     d[di].w = readMem16(pc);
     pc += 2;
     DUMP(opc, pc - opc, "move.w #$%04x, D%d", d[di].w, di);
-  } else if ((op & 0xf1ff) == 0x317c) {
+    break;
+  }
+  case OP_MOVE_W_IMM_DISP: {
     int di = (op >> 9) & 7;
     WORD src = readMem16(pc);
     SWORD ofs = readMem16(pc + 2);
     pc += 4;
     DUMP(opc, pc - opc, "move.w #$%04x, (%d, A%d)", src, ofs, di);
     writeMem16(a[di] + ofs, src);
-  } else if ((op & 0xf1f8) == 0x3040) {
+    break;
+  }
+  case OP_MOVEA_W_D: {
     int si = op & 7;
     int di = (op >> 9) & 7;
     DUMP(opc, pc - opc, "move.w D%d, A%d", si, di);
     a[di] = (SWORD) d[si].w;
-  } else if ((op & 0xfff8) == 0x33c0) {
+    break;
+  }
+  case OP_MOVE_W_D_ABS: {
     int si = op & 7;
     LONG dst = readMem32(pc);
     pc += 4;
     DUMP(opc, pc - opc, "move.w D%d, $%08x.l", si, dst);
     writeMem16(dst, d[si].w);
-  } else if ((op & 0xf1f8) == 0x3150) {
+    break;
+  }
+  case OP_MOVE_W_IND_DISP: {
     int di = (op >> 9) & 7;
     int si = op & 7;
     SWORD ofs = readMem16(pc);
     pc += 2;
     DUMP(opc, pc - opc, "move.w (A%d), (%d, A%d)", si, ofs, di);
     writeMem32(a[di] + ofs, readMem16(a[si]));
-  } else if ((op & 0xf1f8) == 0x3168) {
+    break;
+  }
+  case OP_MOVE_W_DISP_DISP: {
     int di = (op >> 9) & 7;
     int si = op & 7;
     SWORD sofs = readMem16(pc);
@@ -145,14 +524,18 @@ void MC68K::step() {
     pc += 4;
     DUMP(opc, pc - opc, "move.w (%d, A%d), (%d, A%d)", sofs, si, dofs, di);
     writeMem32(a[di] + dofs, readMem16(a[si] + sofs));
-  } else if ((op & 0xf1f8) == 0x41e8) {
+    break;
+  }
+  case OP_LEA_DISP: {
     int di = (op >> 9) & 7;
     int si = op & 7;
     SWORD ofs = readMem16(pc);
     pc += 2;
     DUMP(opc, pc - opc, "lea (%d, A%d), A%d", ofs, si, di);
     a[di] = a[si] + ofs;
-  } else if ((op & 0xf1f8) == 0x41f0) {
+    break;
+  }
+  case OP_LEA_INDEX: {
     int di = (op >> 9) & 7;
     int si = op & 7;
     WORD next = readMem16(pc);
@@ -165,62 +548,77 @@ void MC68K::step() {
     } else {
       NOT_IMPLEMENTED;
     }
-  } else if ((op & 0xf1ff) == 0x41f9) {
+    break;
+  }
+  case OP_LEA_ABS: {
     int di = (op >> 9) & 7;
     a[di] = readMem32(pc);
     pc += 4;
     DUMP(opc, pc - opc, "lea $%08x.l, A%d", a[di], di);
-  } else if ((op & 0xf1ff) == 0x41fa) {
+    break;
+  }
+  case OP_LEA_PC: {
     int di = (op >> 9) & 7;
     SWORD ofs = readMem16(pc);
     pc += 2;
     DUMP(opc, pc - opc, "lea (%d, PC), A%d", ofs, di);
     a[di] = pc + ofs;
-  } else if ((op & 0xffc0) == 0x4200) {
+    break;
+  }
+  case OP_CLR_B: {
     char dstBuf[32], *dstStr = dstBuf;
     int si = op & 7;
     writeDestination8((op >> 3) & 7, si, 0, &dstStr);
     DUMP(opc, pc - opc, "clr.b %s", dstStr);
-  } else if ((op & 0xffc0) == 0x4240) {
+    break;
+  }
+  case OP_CLR_W: {
     char dstBuf[32], *dstStr = dstBuf;
     int si = op & 7;
     writeDestination16((op >> 3) & 7, si, 0, &dstStr);
     DUMP(opc, pc - opc, "clr.w %s", dstStr);
-  } else if ((op & 0xffc0) == 0x4280) {
+    break;
+  }
+  case OP_CLR_L: {
     char dstBuf[32], *dstStr = dstBuf;
     int si = op & 7;
     writeDestination32((op >> 3) & 7, si, 0, &dstStr);
     DUMP(opc, pc - opc, "clr.l %s", dstStr);
-  } else if (op == 0x4279) {
+    break;
+  }
+  case OP_CLR_W_ABS: {
     LONG adr = readMem32(pc);
     pc += 4;
     DUMP(opc, pc - opc, "clr.w $%08x.l", adr);
     writeMem16(adr, 0);
-  } else if ((op & 0xfff8) == 0x4298) {
+    break;
+  }
+  case OP_CLR_L_POSTINC: {
     int si = op & 7;
     DUMP(opc, pc - opc, "clr.l (A%d)+", si);
     writeMem32(a[si], 0);
     a[si] += 4;
-  } else if (op == 0x46fc) {
-    sr = readMem16(pc);
-    pc += 2;
-    DUMP(opc, pc - opc, "move #$%04x, SR", sr);
-  } else if ((op & 0xfff8) == 0x48e0) {
-    int di = op & 7;
-    WORD bits = readMem16(pc);
+    break;
+  }
+  case OP_MOVE_TO_SR: {
+    WORD src = readMem16(pc);
     pc += 2;
-    DUMP(opc, pc - opc, "movem.l #$%04x, -(A%d)", bits, di);  // TODO: Print registers.
-    for (int i = 0; i < 8; ++i) {
-      if ((bits & 0x8000) != 0)
-        push32(d[i].l);
-      bits <<= 1;
-    }
-    for (int i = 0; i < 8; ++i) {
-      if ((bits & 0x8000) != 0)
-        push32(a[i]);
-      bits <<= 1;
+    DUMP(opc, pc - opc, "move #$%04x, SR", src);
+    if ((sr & FLAG_S) == 0) {
+      pc = opc - 2;
+      exception(PRIVILEGE_VIOLATION_VECTOR);
+    } else {
+      setSr(src);
     }
-  } else if ((op & 0xffc0) == 0x4a00) {
+    break;
+  }
+  case OP_MOVEM: {
+    WORD mask = readMem16(pc);
+    pc += 2;
+    movem(op, mask, opc);
+    break;
+  }
+  case OP_TST_B: {
     char srcBuf[32], *srcStr = srcBuf;
     int si = op & 7;
     SBYTE val = readSource8((op >> 3) & 7, si, &srcStr);
@@ -231,11 +629,13 @@ void MC68K::step() {
     else
       sr &= ~FLAG_Z;
     if (val < 0)
-      sr |= ~FLAG_N;
+      sr |= FLAG_N;
     else
       sr &= ~FLAG_N;
     sr &= ~(FLAG_V | FLAG_C);
-  } else if ((op & 0xffc0) == 0x4a40) {
+    break;
+  }
+  case OP_TST_W: {
     char srcBuf[32], *srcStr = srcBuf;
     int si = op & 7;
     SWORD val = readSource16((op >> 3) & 7, si, &srcStr);
@@ -246,11 +646,13 @@ void MC68K::step() {
     else
       sr &= ~FLAG_Z;
     if (val < 0)
-      sr |= ~FLAG_N;
+      sr |= FLAG_N;
     else
       sr &= ~FLAG_N;
     sr &= ~(FLAG_V | FLAG_C);
-  } else if ((op & 0xffc0) == 0x4a80) {
+    break;
+  }
+  case OP_TST_L: {
     char srcBuf[32], *srcStr = srcBuf;
     int si = op & 7;
     SLONG val = readSource32((op >> 3) & 7, si, &srcStr);
@@ -261,62 +663,73 @@ void MC68K::step() {
     else
       sr &= ~FLAG_Z;
     if (val < 0)
-      sr |= ~FLAG_N;
+      sr |= FLAG_N;
     else
       sr &= ~FLAG_N;
     sr &= ~(FLAG_V | FLAG_C);
-  } else if ((op & 0xfff8) == 0x4cd8) {
-    int si = op & 7;
-    WORD bits = readMem16(pc);
-    pc += 2;
-    DUMP(opc, pc - opc, "movem.l (A%d)+, #$%04x", si, bits);  // TODO: Print registers.
-    for (int i = 8; --i >= 0;) {
-      if ((bits & 0x8000) != 0)
-        a[i] = pop32();
-      bits <<= 1;
-    }
-    for (int i = 8; --i >= 0;) {
-      if ((bits & 0x8000) != 0)
-        d[i].l = pop32();
-      bits <<= 1;
-    }
-  } else if ((op & 0xfff0) == 0x4e40) {
+    break;
+  }
+  case OP_TRAP: {
     int no = op & 0x000f;
     DUMP(opc, pc - opc, "trap #$%x", no);
-    // TODO: Move to super visor mode.
-    LONG adr = readMem32(TRAP_VECTOR_START + no * 4);
-    push32(pc);
-    pc = adr;
-  } else if (op == 0x4e70) {
+    if (!emulateTrap(no))
+      exception(TRAP_VECTOR_START / 4 + no);
+    blockEnd = true;
+    break;
+  }
+  case OP_RESET: {
     DUMP(opc, pc - opc, "reset");
+    blockEnd = true;
     // TODO:
-  } else if (op == 0x4e71) {
+    break;
+  }
+  case OP_NOP: {
     DUMP(opc, pc - opc, "nop");
-  } else if (op == 0x4e73) {
+    break;
+  }
+  case OP_RTE: {
     DUMP(opc, pc - opc, "rte");
-    pc = pop32();
-    // TODO: Switch to user mode.
-  } else if (op == 0x4e75) {
+    if ((sr & FLAG_S) == 0) {
+      pc = opc - 2;
+      exception(PRIVILEGE_VIOLATION_VECTOR);
+    } else {
+      WORD newSr = pop16();
+      pc = pop32();
+      setSr(newSr);
+    }
+    break;
+  }
+  case OP_RTS: {
     DUMP(opc, pc - opc, "rts");
     pc = pop32();
-  } else if ((op & 0xfff8) == 0x4e90) {
+    blockEnd = true;
+    break;
+  }
+  case OP_JSR_IND: {
     int di = op & 7;
     DUMP(opc, pc - opc, "jsr (A%d)", di);
     push32(pc);
     pc = a[di];
-  } else if ((op & 0xf1f8) == 0x5088) {
+    blockEnd = true;
+    break;
+  }
+  case OP_ADDQ_L_A: {
     int ofs = (op >> 9) & 7;
     int si = op & 7;
     ofs = ((ofs - 1) & 7) + 1;
     DUMP(opc, pc - opc, "addq.l #%d, A%d", ofs, si);
     a[si] += ofs;
-  } else if ((op & 0xf1f8) == 0x5140) {
+    break;
+  }
+  case OP_SUBQ_W_D: {
     int ofs = (op >> 9) & 7;
     int si = op & 7;
     ofs = ((ofs - 1) & 7) + 1;
     DUMP(opc, pc - opc, "subq.w #%d, D%d", ofs, si);
     d[si].w += ofs;
-  } else if ((op & 0xfff8) == 0x51c8) {
+    break;
+  }
+  case OP_DBRA: {
     int si = op & 7;
     SWORD ofs = readMem16(pc);
     pc += 2;
@@ -324,7 +737,10 @@ void MC68K::step() {
     d[si].w -= 1;
     if (d[si].w != (WORD)(-1))
       pc = (pc - 2) + ofs;
-  } else if ((op & 0xff00) == 0x6100) {
+    blockEnd = true;
+    break;
+  }
+  case OP_BSR: {
     SWORD ofs = static_cast<SBYTE>(op & 0x00ff);
     if (ofs == 0) {
       ofs = readMem16(pc);
@@ -333,7 +749,10 @@ void MC68K::step() {
     DUMP(opc, pc - opc, "bsr $%06x", opc + ofs);
     push32(pc);
     pc = opc + ofs;
-  } else if ((op & 0xff00) == 0x6400) {
+    blockEnd = true;
+    break;
+  }
+  case OP_BCC: {
     SWORD ofs = static_cast<SBYTE>(op & 0xff);
     if (ofs == 0) {
       ofs = readMem16(pc);
@@ -342,7 +761,10 @@ void MC68K::step() {
     DUMP(opc, pc - opc, "bcc %06x", pc + ofs);
     if ((sr & FLAG_C) == 0)
       pc += ofs;
-  } else if ((op & 0xff00) == 0x6600) {
+    blockEnd = true;
+    break;
+  }
+  case OP_BNE: {
     SWORD ofs = static_cast<SBYTE>(op & 0xff);
     if (ofs == 0) {
       ofs = readMem16(pc);
@@ -351,7 +773,10 @@ void MC68K::step() {
     DUMP(opc, pc - opc, "bne %06x", pc + ofs);
     if ((sr & FLAG_Z) == 0)
       pc += ofs;
-  } else if ((op & 0xff00) == 0x6700) {
+    blockEnd = true;
+    break;
+  }
+  case OP_BEQ: {
     SWORD ofs = static_cast<SBYTE>(op & 0x00ff);
     if (ofs == 0) {
       ofs = readMem16(pc);
@@ -360,19 +785,26 @@ void MC68K::step() {
     DUMP(opc, pc - opc, "beq %08x", pc + ofs);
     if ((sr & FLAG_Z) != 0)
       pc += ofs;
-  } else if ((op & 0xf100) == 0x7000) {
+    blockEnd = true;
+    break;
+  }
+  case OP_MOVEQ: {
     int di = (op >> 9) & 7;
     LONG val = op & 0xff;
     if (val >= 0x80)
       val = -256 + val;
     d[di].l = val;
     DUMP(opc, pc - opc, "moveq #%d, D%d", val, di);
-  } else if ((op & 0xf1f8) == 0x91c8) {
+    break;
+  }
+  case OP_SUBA_L: {
     int di = (op >> 9) & 7;
     int si = op & 7;
     DUMP(opc, pc - opc, "suba.l A%d, A%d", si, di);
     a[di] -= a[si];
-  } else if ((op & 0xf1c0) == 0xb000) {  // cmp.b
+    break;
+  }
+  case OP_CMP_B: {  // cmp.b
     char srcBuf[32], *srcStr = srcBuf;
     char dstBuf[32], *dstStr = dstBuf;
     int n = (op >> 9) & 7;
@@ -391,7 +823,9 @@ void MC68K::step() {
     if (((dst - src) & 0x80) != 0)
       c |= FLAG_N;
     sr = (sr & 0xff00) | c;
-  } else if ((op & 0xf1c0) == 0xb040) {  // cmp.w
+    break;
+  }
+  case OP_CMP_W: {  // cmp.w
     char srcBuf[32], *srcStr = srcBuf;
     char dstBuf[32], *dstStr = dstBuf;
     int n = (op >> 9) & 7;
@@ -410,7 +844,9 @@ void MC68K::step() {
     if (((dst - src) & 0x80) != 0)
       c |= FLAG_N;
     sr = (sr & 0xff00) | c;
-  } else if ((op & 0xf1f8) == 0xb108) {
+    break;
+  }
+  case OP_CMPM_B: {
     int si = op & 7;
     int di = (op >> 9) & 7;
     BYTE v1 = readMem8(a[di]);
@@ -427,7 +863,9 @@ void MC68K::step() {
       c |= FLAG_N;
     sr = (sr & 0xff00) | c;
     DUMP(opc, pc - opc, "cmpm.b (A%d)+, (A%d)+", si, di);
-  } else if ((op & 0xf1c0) == 0xb1c0) {  // cmpa.l
+    break;
+  }
+  case OP_CMPA_L: {  // cmpa.l
     char srcBuf[32], *srcStr = srcBuf;
     char dstBuf[32], *dstStr = dstBuf;
     int n = (op >> 9) & 7;
@@ -446,73 +884,288 @@ void MC68K::step() {
     if (((dst - src) & 0x80) != 0)
       c |= FLAG_N;
     sr = (sr & 0xff00) | c;
-  } else if ((op & 0xf1c0) == 0xc040) {
+    break;
+  }
+  case OP_AND_W: {
     char srcBuf[32], *srcStr = srcBuf;
     int n = (op >> 9) & 7;
     int m = op & 7;
     WORD src = readSource16((op >> 3) & 7, m, &srcStr);
     DUMP(opc, pc - opc, "and.w %s, D%d", srcStr, n);
     d[n].w &= src;
-  } else if ((op & 0xf1c0) == 0xc080) {
+    break;
+  }
+  case OP_AND_L: {
     char srcBuf[32], *srcStr = srcBuf;
     int n = (op >> 9) & 7;
     int m = op & 7;
     LONG src = readSource32((op >> 3) & 7, m, &srcStr);
     DUMP(opc, pc - opc, "and.l %s, D%d", srcStr, n);
     d[n].l &= src;
-  } else if ((op & 0xf1f8) == 0xd080) {
+    break;
+  }
+  case OP_ADD_L_D: {
     int di = (op >> 9) & 7;
     int si = op & 7;
     DUMP(opc, pc - opc, "add.l D%d, D%d", si, di);
     d[di].l += d[si].l;
-  } else if ((op & 0xf1ff) == 0xd0bc) {
+    break;
+  }
+  case OP_ADD_L_IMM: {
     int di = (op >> 9) & 7;
     LONG src = readMem32(pc);
     pc += 4;
     DUMP(opc, pc - opc, "add.l #$%08x, D%d", src, di);
     d[di].l += src;
-  } else if ((op & 0xf1f8) == 0xd1c8) {
+    break;
+  }
+  case OP_ADDA_L: {
     int di = (op >> 9) & 7;
     int si = op & 7;
     DUMP(opc, pc - opc, "adda.l A%d, A%d", si, di);
     a[di] += a[si];
-  } else if ((op & 0xf1ff) == 0xd1fc) {
+    break;
+  }
+  case OP_ADDA_L_IMM: {
     int di = (op >> 9) & 7;
     LONG src = readMem32(pc);
     pc += 4;
     DUMP(opc, pc - opc, "adda.l #$%08x, A%d", src, di);
     a[di] += src;
-  } else if ((op & 0xf1f8) == 0xe058) {
+    break;
+  }
+  case OP_ROR_W_IMM: {
     int si = (op >> 9) & 7;
     si = ((si - 1) & 7) + 1;
     int di = op & 7;
     DUMP(opc, pc - opc, "ror.w #%d, D%d", si, di);
     d[di].w = (d[di].w >> si) | (d[di].w << (16 - si));
     // TODO: Set SR.
-  } else if ((op & 0xf1f8) == 0xe118) {
+    break;
+  }
+  case OP_ROL_B_IMM: {
     int si = (op >> 9) & 7;
     si = ((si - 1) & 7) + 1;
     int di = op & 7;
     DUMP(opc, pc - opc, "rol.b #%d, D%d", si, di);
     d[di].b = (d[di].b << si) | (d[di].b >> (8 - si));
     // TODO: Set SR.
-  } else if ((op & 0xf1f8) == 0xe120) {
+    break;
+  }
+  case OP_ASL_B_REG: {
     int si = (op >> 9) & 7;
     int di = op & 7;
     DUMP(opc, pc - opc, "asl.b D%d, D%d", si, di);
     BYTE src = d[si].b & 63;
     d[di].b <<= src;  // TODO: Check this is true.
     // TODO: Set SR.
-  } else if ((op & 0xf1f8) == 0xe140) {
+    break;
+  }
+  case OP_ASL_W_IMM: {
     int si = (op >> 9) & 7;
     si = ((si - 1) & 7) + 1;
     int di = op & 7;
     DUMP(opc, pc - opc, "asl.w #%d, D%d", si, di);
     d[di].w <<= si;
     // TODO: Set SR.
+    break;
+  }
+  case OP_LINE_F: {
+    DUMP(opc, pc - opc, "dc.w $%04x", op);
+    if (!emulateLineF(op)) {
+      pc = opc - 2;
+      exception(LINE_F_VECTOR);
+    }
+    blockEnd = true;
+
+    break;
+  }
+  default:
+    NOT_IMPLEMENTED;
+    break;
+  }
+}
+
+// Registers move in ascending order, D0-D7 then A0-A7, with the lowest at
+// the lowest address; -(An) has the mask reversed. The set bits are walked
+// with ctz, and when the whole transfer lies in RAM it goes through one host
+// pointer instead of a bus access per byte.
+void MC68K::movem(WORD op, WORD mask, LONG opc) {
+  bool toRegs = (op & 0x0400) != 0;
+  int size = (op & 0x0040) != 0 ? 4 : 2;
+  int mode = (op >> 3) & 7;
+  int n = op & 7;
+  char eaBuf[32], *eaStr = eaBuf;
+  if (mode == 4) {
+    if (toRegs)
+      NOT_IMPLEMENTED;
+    mask = reverseBits16(mask);
+  }
+  LONG bytes = __builtin_popcount(mask) * size;
+  LONG adr;
+  if (mode == 3 && toRegs) {
+    adr = a[n];
+    eaStr = const_cast<char*>(kPostIncAdrIndirectNames[n]);
+  } else if (mode == 4) {
+    adr = a[n] - bytes;
+    eaStr = const_cast<char*>(kPreDecAdrIndirectNames[n]);
+  } else if (mode == 2 || mode == 5 || mode == 6 || (mode == 7 && n <= (toRegs ? 3 : 1))) {
+    adr = effectiveAddress(mode, n, &eaStr);
   } else {
     NOT_IMPLEMENTED;
+    return;
+  }
+  char list[64];
+  if (trace)
+    formatRegisterList(mask, list);
+  DUMP(opc, pc - opc, "movem.%c %s, %s", size == 4 ? 'l' : 'w', toRegs ? eaStr : list, toRegs ? list : eaStr);
+
+  if (!toRegs) {
+    BYTE* p = !reference ? directWrite(adr, bytes) : nullptr;
+    ++(p != nullptr ? blockHits : blockMisses);
+    LONG at = adr;
+    for (WORD bits = mask; bits != 0; bits &= bits - 1) {
+      int i = __builtin_ctz(bits);
+      LONG value = i < 8 ? d[i].l : a[i - 8];  // -(An) stores the initial An.
+      if (p != nullptr) {
+        if (size == 4) {
+          *p++ = value >> 24;
+          *p++ = value >> 16;
+        }
+        *p++ = value >> 8;
+        *p++ = value;
+      } else if (size == 4) {
+        writeMem32(at, value);
+      } else {
+        writeMem16(at, value);
+      }
+      at += size;
+    }
+    if (mode == 4)
+      a[n] = adr;
+  } else {
+    const BYTE* p = !reference ? directRead(adr, bytes) : nullptr;
+    ++(p != nullptr ? blockHits : blockMisses);
+    LONG at = adr;
+    for (WORD bits = mask; bits != 0; bits &= bits - 1) {
+      int i = __builtin_ctz(bits);
+      LONG value;
+      if (p != nullptr) {
+        value = size == 4 ? (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3] : (SWORD)((p[0] << 8) | p[1]);
+        p += size;
+      } else {
+        value = size == 4 ? readMem32(at) : (SWORD)readMem16(at);
+      }
+      if (i < 8)
+        d[i].l = value;
+      else
+        a[i - 8] = value;
+      at += size;
+    }
+    if (mode == 3)
+      a[n] = adr + bytes;  // Overrides An loaded from the list.
+  }
+}
+
+// Address of a control mode operand, reading its extension words.
+LONG MC68K::effectiveAddress(int mode, int m, char** str) {
+  switch (mode) {
+  case 2:  // (Am)
+    *str = const_cast<char*>(kAdrIndirectNames[m]);
+    return a[m];
+  case 5:  // ($123,Am)
+    {
+      SWORD ofs = readMem16(pc);
+      pc += 2;
+      sprintf(*str, "(%d, A%d)", ofs, m);
+      return a[m] + ofs;
+    }
+  case 6:  // ($12,Am,Xn)
+    return indexedAddress(a[m], kAdrRegNames[m], str);
+  case 7:
+    switch (m) {
+    case 0:  // $XXXX.w
+      {
+        LONG adr = (SWORD)readMem16(pc);
+        pc += 2;
+        sprintf(*str, "$%04x", adr & 0xffff);
+        return adr;
+      }
+    case 1:  // $XXXXXXXX.l
+      {
+        LONG adr = readMem32(pc);
+        pc += 4;
+        sprintf(*str, "$%08x", adr);
+        return adr;
+      }
+    case 2:  // ($XXXX,PC)
+      {
+        SWORD ofs = readMem16(pc);
+        LONG adr = pc + ofs;
+        pc += 2;
+        sprintf(*str, "(%d, PC)", ofs);
+        return adr;
+      }
+    case 3:  // ($XX,PC,Xn)
+      return indexedAddress(pc, "PC", str);
+    default:
+      break;
+    }
+    break;
+  default:
+    break;
   }
+  NOT_IMPLEMENTED;
+  return 0;
+}
+
+// Brief extension word: base + d8 + Xn.w/l.
+LONG MC68K::indexedAddress(LONG base, const char* baseName, char** str) {
+  WORD ext = readMem16(pc);
+  pc += 2;
+  if ((ext & 0x0100) != 0)
+    NOT_IMPLEMENTED;  // 68020 full extension.
+  int xi = (ext >> 12) & 7;
+  LONG index = (ext & 0x8000) != 0 ? a[xi] : d[xi].l;
+  if ((ext & 0x0800) == 0)
+    index = (SWORD)index;
+  SBYTE ofs = ext & 0xff;
+  sprintf(*str, "(%d, %s, %c%d.%c)", ofs, baseName, (ext & 0x8000) != 0 ? 'A' : 'D', xi,
+          (ext & 0x0800) != 0 ? 'l' : 'w');
+  return base + ofs + index;
+}
+
+void MC68K::formatRegisterList(WORD mask, char* str) {
+  char* p = str;
+  *p = '\0';
+  for (WORD bits = mask; bits != 0; bits &= bits - 1) {
+    int i = __builtin_ctz(bits);
+    p += sprintf(p, "%s%s", p != str ? "/" : "", i < 8 ? kDataRegNames[i] : kAdrRegNames[i - 8]);
+  }
+}
+
+WORD MC68K::reverseBits16(WORD value) {
+  value = ((value & 0x5555) << 1) | ((value >> 1) & 0x5555);
+  value = ((value & 0x3333) << 2) | ((value >> 2) & 0x3333);
+  value = ((value & 0x0f0f) << 4) | ((value >> 4) & 0x0f0f);
+  return (value << 8) | (value >> 8);
+}
+
+const BYTE* MC68K::directRead(LONG adr, LONG bytes) {
+  (void)adr;
+  (void)bytes;
+  return nullptr;
+}
+
+BYTE* MC68K::directWrite(LONG adr, LONG bytes) {
+  (void)adr;
+  (void)bytes;
+  return nullptr;
+}
+
+const char* MC68K::symbolName(LONG adr) {
+  (void)adr;
+  return nullptr;
 }
 
 void MC68K::clear() {
@@ -521,12 +1174,39 @@ void MC68K::clear() {
     a[i] = 0;
   }
   pc = 0;
+  usp = ssp = 0;
+  cycles = 0;
+  instructions = 0;
+  blockHits = blockMisses = 0;
+  nextEventCycle = ~(uint64_t)0;
+  irqPending = 0;
+  sr = 0;
+  setSr(FLAG_S | IPL_MASK);
+
+  blockEnd = true;  // At a block boundary.
+  stopReason = STOP_NONE;
+  stopAdr = 0;
+  breakpoints.clear();
+  trace = true;
+  reference = false;
+  for (int i = 0; i < kBreakPageCount; ++i)
+    breakPages[i] = 0;
+}
+
+void MC68K::push16(WORD value) {
+  writeMem16(a[7] -= 2, value);
 }
 
 void MC68K::push32(LONG value) {
   writeMem32(a[7] -= 4, value);
 }
 
+WORD MC68K::pop16() {
+  LONG adr = a[7];
+  a[7] += 2;
+  return readMem16(adr);
+}
+
 LONG MC68K::pop32() {
   LONG adr = a[7];
   a[7] += 4;
@@ -2,6 +2,7 @@
 #define __MC68K_H__
 
 #include <stdint.h>
+#include <set>
 
 class MC68K {
 public:
@@ -30,14 +31,68 @@ public:
 #endif
   };
 
+  // Programmer visible state, used to fork and rewind machines.
+  struct Context {
+    Reg d[8];
+    LONG a[8];
+    LONG pc;
+    WORD sr;
+    LONG usp, ssp;  // Inactive stack pointer, a[7] holds the active one.
+    int irqPending;
+    uint64_t cycles;
+  };
+
+  enum StopReason {
+    STOP_NONE,         // Instruction count exhausted.
+    STOP_BREAKPOINT,   // PC reached a breakpoint.
+    STOP_WATCH_READ,   // A watched address was read.
+    STOP_WATCH_WRITE,  // A watched address was written.
+    STOP_EXIT,         // The guest program exited through an emulated call.
+    STOP_DIVERGED,     // A lockstep check failed (see X68K::runLockstep).
+  };
+
 public:
+  // Makes step() decode through a table of instruction kinds by opcode
+  // word, mapped from a file in `cacheDir` when given (see decodecache.h)
+  // and keyed on the decoder and the build. Call before creating the first
+  // instance, which otherwise builds the table in memory.
+  static void initDecoder(const char* cacheDir);
+  static bool decoderCached()  { return opKindsCached; }
+
   MC68K();
   virtual ~MC68K();
 
   void setPc(LONG adr);
   void setSp(LONG adr);
 
+  void saveContext(Context* ctx) const;
+  void loadContext(const Context& ctx);
+
   void step();
+  // Runs at least `count` instructions, stopping early on a breakpoint or a
+  // watchpoint hit. Stops and counts are checked at block boundaries.
+  StopReason run(long count);
+  // Runs one instruction the way run() would: at a block boundary, events
+  // and interrupts are processed first. Breakpoints do not stop it.
+  StopReason runInstruction();
+  LONG stopAddress() const  { return stopAdr; }
+
+  void addBreakpoint(LONG adr);
+  void removeBreakpoint(LONG adr);
+  // Sets the breakpoints of `other`, which also give the same blocks.
+  void copyBreakpoints(const MC68K& other);
+
+  // Disassembles every executed instruction to stdout when on (default).
+  void setTrace(bool on)  { trace = on; }
+  // Runs the reference interpreter when on: every instruction is decoded by
+  // scanning the pattern list instead of the table, and block transfers go
+  // through the bus. Slow, for checking the fast paths against.
+  void setReference(bool on)  { reference = on; }
+
+  // Interrupt request lines for levels 1-7, driven by devices.
+  // Pending requests are taken at the next block boundary.
+  void raiseIrq(int level);
+  void clearIrq(int level);
 
 //protected:
 public:
@@ -45,8 +100,44 @@ public:
   LONG a[8];  // Address registers.
   LONG pc;    // Program counter.
   WORD sr;     // Status register.
+  LONG usp;    // User stack pointer, valid while in supervisor mode.
+  LONG ssp;    // Supervisor stack pointer, valid while in user mode.
+  uint64_t cycles;  // Clock cycles executed.
+
+  // For monitoring only; not part of the context.
+  uint64_t instructions;  // Executed by run().
+  uint64_t blockHits;     // movem transfers done in host memory,
+  uint64_t blockMisses;   // and on the bus.
+
+protected:
+  // Ends the current block and makes run() return with `reason`.
+  void requestStop(StopReason reason, LONG adr);
+
+  // Returns the vector number for an interrupt being taken at `level`.
+  // Default is an autovector, which also drops the request.
+  virtual int acknowledgeInterrupt(int level);
+  // Called at a block boundary once `cycles` reached nextEventCycle.
+  virtual void processEvents();
+  // Gets an F-line opcode with pc past it. Returns false to take the
+  // F-line exception instead (default).
+  virtual bool emulateLineF(WORD op);
+  // Gets trap #`no` with pc past it. Returns false to take the trap
+  // exception instead (default).
+  virtual bool emulateTrap(int no);
+  // Host memory for [adr, adr + bytes) when plain RAM can be accessed there
+  // directly, for block transfers; nullptr (default) to use the bus.
+  virtual const BYTE* directRead(LONG adr, LONG bytes);
+  virtual BYTE* directWrite(LONG adr, LONG bytes);
+  // Label printed above the traced instruction at `adr`, nullptr (default)
+  // for none.
+  virtual const char* symbolName(LONG adr);
+
+  uint64_t nextEventCycle;
 
 private:
+  static const int kBreakPageShift = 12;
+  static const int kBreakPageCount = 1 << (24 - kBreakPageShift);
+
   virtual BYTE readMem8(LONG adr) = 0;
   virtual WORD readMem16(LONG adr);
   virtual LONG readMem32(LONG adr);
@@ -57,8 +148,22 @@ private:
 
   void clear();
   void stat();
+  bool enterBlock(bool first);
+
+  void setSr(WORD value);
+  void updateIrqMask();
+  void exception(int vector);
+  void processInterrupt();
 
+  void movem(WORD op, WORD mask, LONG opc);
+  LONG effectiveAddress(int mode, int m, char** str);
+  LONG indexedAddress(LONG base, const char* baseName, char** str);
+  static void formatRegisterList(WORD mask, char* str);
+  static WORD reverseBits16(WORD value);
+
+  void push16(WORD value);
   void push32(LONG value);
+  WORD pop16();
   LONG pop32();
 
   inline LONG fetchImmediate(int size) {
@@ -101,6 +206,19 @@ private:
   void writeDestination8(int type, int n, BYTE src, char** str);
 
   void dumpOps(uint32_t adr, int bytes);
+
+  static const BYTE* opKinds;  // OpKind by opcode word, shared.
+  static bool opKindsCached;   // Mapped from an existing cache file.
+
+  bool blockEnd;  // Set by instructions which end a block.
+  bool trace;
+  bool reference;
+  int irqPending;   // Bit n: level n requested.
+  int irqAccepted;  // Levels not masked by SR.
+  StopReason stopReason;
+  LONG stopAdr;
+  std::set<LONG> breakpoints;
+  uint16_t breakPages[kBreakPageCount];  // Number of breakpoints per page.
 };
 
 #endif
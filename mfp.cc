@@ -0,0 +1,244 @@
+#include "mfp.h"
+
+typedef MFP::BYTE BYTE;
+
+// Delay mode prescalers, indexed by control value.
+static const int kPrescale[] = {0, 4, 10, 16, 50, 64, 100, 200};
+
+// GPIP bit to interrupt channel.
+static const int kGpipChannel[] = {0, 1, 2, 3, 6, 7, 14, 15};
+
+// The MFP runs on 4MHz, the CPU on 10MHz.
+static const int kMfpClock = 4;
+static const int kCpuClock = 10;
+
+static const BYTE TIMER_EVENT_MODE = 8;
+static const BYTE VR_S = 1 << 3;  // Software end-of-interrupt.
+static const BYTE RSR_RE = 1 << 0;
+static const BYTE RSR_OE = 1 << 6;
+static const BYTE RSR_BF = 1 << 7;
+static const BYTE TSR_BE = 1 << 7;
+
+MFP::MFP()
+  : gpip(0), aer(0), ddr(0), vr(0), ier(0), ipr(0), isr(0), imr(0)
+  , ucr(0), rsr(0), tsr(TSR_BE), udr(0) {
+  static const int kChannels[] = {CH_TIMER_A, CH_TIMER_B, CH_TIMER_C, CH_TIMER_D};
+  for (int i = 0; i < 4; ++i) {
+    Timer& t = timers[i];
+    t.control = 0;
+    t.reload = 0;
+    t.counter = 256;
+    t.base = 0;
+    t.expiry = kNever;
+    t.channel = kChannels[i];
+  }
+}
+
+uint64_t MFP::toMfpClock(uint64_t cycles) {
+  return cycles * kMfpClock / kCpuClock;
+}
+
+uint64_t MFP::toCycles(uint64_t mfpClock) {
+  return (mfpClock * kCpuClock + kMfpClock - 1) / kMfpClock;
+}
+
+int MFP::prescale(const Timer& t) const {
+  return t.control < TIMER_EVENT_MODE ? kPrescale[t.control] : 0;
+}
+
+int MFP::timerValue(const Timer& t, uint64_t now) const {
+  int p = prescale(t);
+  if (p == 0)
+    return t.counter;
+
+  uint64_t ticks = (toMfpClock(now) - t.base) / p;
+  if (ticks < (uint64_t)t.counter)
+    return t.counter - ticks;
+  int reload = t.reload != 0 ? t.reload : 256;
+  return reload - (ticks - t.counter) % reload;
+}
+
+BYTE MFP::read(int reg, uint64_t now) {
+  switch (reg) {
+  case 0:  return gpip;
+  case 1:  return aer;
+  case 2:  return ddr;
+  case 3:  return ier >> 8;
+  case 4:  return ier;
+  case 5:  return ipr >> 8;
+  case 6:  return ipr;
+  case 7:  return isr >> 8;
+  case 8:  return isr;
+  case 9:  return imr >> 8;
+  case 10:  return imr;
+  case 11:  return vr;
+  case 12:  return timers[0].control;
+  case 13:  return timers[1].control;
+  case 14:  return (timers[2].control << 4) | timers[3].control;
+  case 15: case 16: case 17: case 18:
+    return timerValue(timers[reg - 15], now);
+  case 19:  return 0;  // SCR
+  case 20:  return ucr;
+  case 21:  return rsr;
+  case 22:  return tsr;
+  case 23:
+    rsr &= ~(RSR_BF | RSR_OE);
+    return udr;
+  default:
+    return 0xff;
+  }
+}
+
+void MFP::write(int reg, BYTE value, uint64_t now) {
+  switch (reg) {
+  case 0:  gpip = (gpip & ~ddr) | (value & ddr); break;
+  case 1:  aer = value; break;
+  case 2:  ddr = value; break;
+  case 3:
+    ier = (value << 8) | (ier & 0x00ff);
+    ipr &= ier;
+    break;
+  case 4:
+    ier = (ier & 0xff00) | value;
+    ipr &= ier;
+    break;
+  case 5:  ipr &= (value << 8) | 0x00ff; break;
+  case 6:  ipr &= 0xff00 | value; break;
+  case 7:  isr &= (value << 8) | 0x00ff; break;
+  case 8:  isr &= 0xff00 | value; break;
+  case 9:  imr = (value << 8) | (imr & 0x00ff); break;
+  case 10:  imr = (imr & 0xff00) | value; break;
+  case 11:  vr = value; break;
+  case 12:  setTimerControl(&timers[0], value & 0x0f, now); break;
+  case 13:  setTimerControl(&timers[1], value & 0x0f, now); break;
+  case 14:
+    setTimerControl(&timers[2], (value >> 4) & 7, now);
+    setTimerControl(&timers[3], value & 7, now);
+    break;
+  case 15: case 16: case 17: case 18:
+    setTimerData(&timers[reg - 15], value, now);
+    break;
+  case 20:  ucr = value; break;
+  case 21:  rsr = (rsr & (RSR_BF | RSR_OE)) | (value & ~(RSR_BF | RSR_OE)); break;
+  case 22:  tsr = (value & ~TSR_BE) | TSR_BE; break;
+  case 23:  break;  // Sent to the keyboard at once, the buffer stays empty.
+  default:
+    break;
+  }
+}
+
+void MFP::setTimerControl(Timer* t, BYTE control, uint64_t now) {
+  // Freeze the counter at its current value and restart from now.
+  t->counter = timerValue(*t, now);
+  t->base = toMfpClock(now);
+  t->control = control;
+  armTimer(t);
+}
+
+void MFP::setTimerData(Timer* t, BYTE value, uint64_t now) {
+  t->reload = value;
+  if (t->control == 0) {
+    t->counter = value != 0 ? value : 256;
+    t->base = toMfpClock(now);
+  }
+  armTimer(t);
+}
+
+void MFP::armTimer(Timer* t) {
+  int p = prescale(*t);
+  t->expiry = p != 0 ? toCycles(t->base + (uint64_t)t->counter * p) : kNever;
+}
+
+void MFP::update(uint64_t now) {
+  for (int i = 0; i < 4; ++i) {
+    Timer& t = timers[i];
+    if (t.expiry > now)
+      continue;
+
+    // Skip the whole periods which passed since the first time-out.
+    int p = prescale(t);
+    uint64_t first = t.base + (uint64_t)t.counter * p;
+    uint64_t period = (uint64_t)(t.reload != 0 ? t.reload : 256) * p;
+    t.base = first + (toMfpClock(now) - first) / period * period;
+    t.counter = t.reload != 0 ? t.reload : 256;
+    armTimer(&t);
+    request(t.channel);
+  }
+}
+
+uint64_t MFP::nextEvent() const {
+  uint64_t next = kNever;
+  for (int i = 0; i < 4; ++i) {
+    if (timers[i].expiry < next)
+      next = timers[i].expiry;
+  }
+  return next;
+}
+
+void MFP::setGpip(int bit, bool level) {
+  BYTE mask = 1 << bit;
+  if (((gpip & mask) != 0) == level)
+    return;
+  gpip ^= mask;
+  if (((aer & mask) != 0) != level)
+    return;
+
+  request(kGpipChannel[bit]);
+  // TAI is wired to V-DISP.
+  if (bit == GPIP_VDISP && timers[0].control == TIMER_EVENT_MODE)
+    countEvent(&timers[0]);
+}
+
+void MFP::countEvent(Timer* t) {
+  if (--t->counter == 0) {
+    t->counter = t->reload != 0 ? t->reload : 256;
+    request(t->channel);
+  }
+}
+
+void MFP::receive(BYTE data) {
+  if ((rsr & RSR_RE) == 0)
+    return;
+  udr = data;
+  if ((rsr & RSR_BF) != 0) {
+    rsr |= RSR_OE;
+    request(CH_RCV_ERROR);
+  } else {
+    rsr |= RSR_BF;
+    request(CH_RCV_FULL);
+  }
+}
+
+void MFP::request(int channel) {
+  ipr |= ier & (1 << channel);
+}
+
+// Returns the channels which may interrupt, highest first in bit order.
+static uint16_t activeChannels(uint16_t ipr, uint16_t imr, uint16_t isr, BYTE vr) {
+  uint16_t active = ipr & imr;
+  if ((vr & VR_S) != 0 && isr != 0) {
+    // Only channels above the highest one in service.
+    int top = 15;
+    while ((isr & (1 << top)) == 0)
+      --top;
+    active &= ~((2 << top) - 1);
+  }
+  return active;
+}
+
+bool MFP::irq() const {
+  return activeChannels(ipr, imr, isr, vr) != 0;
+}
+
+int MFP::acknowledge() {
+  uint16_t active = activeChannels(ipr, imr, isr, vr);
+  if (active == 0)
+    return -1;
+  int channel = 15;
+  while ((active & (1 << channel)) == 0)
+    --channel;
+  ipr &= ~(1 << channel);
+  if ((vr & VR_S) != 0)
+    isr |= 1 << channel;
+  return (vr & 0xf0) | channel;
+}
@@ -0,0 +1,85 @@
+#ifndef __MFP_H__
+#define __MFP_H__
+
+#include <stdint.h>
+
+// MC68901 Multi Function Peripheral.
+// Timers are never ticked: a running timer remembers when its counter was
+// loaded, the counter value is derived from the cycle count on demand, and
+// the next expiry is handed to the scheduler.
+// All times are CPU cycles.
+class MFP {
+public:
+  typedef uint8_t BYTE;
+
+  static const int kIrqLevel = 6;
+  static const uint64_t kNever = ~(uint64_t)0;
+
+  // General purpose inputs on the X68000.
+  enum {
+    GPIP_ALARM = 0,
+    GPIP_EXPON = 1,
+    GPIP_POWSW = 2,
+    GPIP_OPMIRQ = 3,
+    GPIP_VDISP = 4,
+    GPIP_CIRQ = 6,
+    GPIP_HSYNC = 7,
+  };
+
+  MFP();
+
+  BYTE read(int reg, uint64_t now);
+  void write(int reg, BYTE value, uint64_t now);
+
+  // Drives a GPIP input; an edge selected by AER requests an interrupt.
+  void setGpip(int bit, bool level);
+  // Puts a byte into the USART receiver (keyboard).
+  void receive(BYTE data);
+
+  // Brings timers up to `now`, requesting interrupts for expired ones.
+  void update(uint64_t now);
+  uint64_t nextEvent() const;
+
+  bool irq() const;
+  // Interrupt acknowledge cycle: returns the vector, or -1 if none.
+  int acknowledge();
+
+private:
+  enum {
+    CH_TIMER_D = 4,
+    CH_TIMER_C = 5,
+    CH_TIMER_B = 8,
+    CH_XMIT_ERROR = 9,
+    CH_XMIT_EMPTY = 10,
+    CH_RCV_ERROR = 11,
+    CH_RCV_FULL = 12,
+    CH_TIMER_A = 13,
+  };
+
+  struct Timer {
+    BYTE control;   // Mode and prescaler, 0 = stopped.
+    BYTE reload;    // Data register, 0 means 256.
+    int counter;    // Counter value at `base`, 1-256.
+    uint64_t base;  // MFP clock at which `counter` was loaded.
+    uint64_t expiry;  // CPU cycle of the next time-out, or kNever.
+    int channel;
+  };
+
+  static uint64_t toMfpClock(uint64_t cycles);
+  static uint64_t toCycles(uint64_t mfpClock);
+
+  int prescale(const Timer& t) const;
+  int timerValue(const Timer& t, uint64_t now) const;
+  void setTimerControl(Timer* t, BYTE control, uint64_t now);
+  void setTimerData(Timer* t, BYTE value, uint64_t now);
+  void armTimer(Timer* t);
+  void countEvent(Timer* t);
+  void request(int channel);
+
+  BYTE gpip, aer, ddr, vr;
+  uint16_t ier, ipr, isr, imr;  // Bit n: channel n.
+  BYTE ucr, rsr, tsr, udr;
+  Timer timers[4];
+};
+
+#endif
@@ -0,0 +1,103 @@
+#include "opm.h"
+#include <string.h>
+
+typedef OPM::BYTE BYTE;
+
+static const int kCpuKHz = 10000;
+static const uint64_t kBusyClocks = 64;
+
+static const int REG_TIMER_A_HIGH = 0x10;
+static const int REG_TIMER_A_LOW = 0x11;
+static const int REG_TIMER_B = 0x12;
+static const int REG_TIMER_CONTROL = 0x14;
+
+// REG_TIMER_CONTROL bits for timer A, shifted left by one for timer B.
+static const BYTE TIMER_LOAD = 1 << 0;
+static const BYTE TIMER_IRQ_ENABLE = 1 << 2;
+static const BYTE TIMER_RESET_FLAG = 1 << 4;
+
+static const BYTE STATUS_BUSY = 1 << 7;
+
+static uint64_t toCycles(uint64_t clocks) {
+  return clocks * kCpuKHz / OPM::kClockKHz;
+}
+
+OPM::OPM()
+  : address(0), status(0), busyUntil(0) {
+  memset(regs, 0, sizeof(regs));
+  for (int i = 0; i < 2; ++i) {
+    timers[i].period = timerPeriod(i);
+    timers[i].expiry = kNever;
+  }
+}
+
+BYTE OPM::read(uint32_t ofs, uint64_t now) const {
+  (void)ofs;  // Both ports read the status.
+  return status | (now < busyUntil ? STATUS_BUSY : 0);
+}
+
+int OPM::write(uint32_t ofs, BYTE value, uint64_t now) {
+  if ((ofs & 3) == 1) {
+    address = value;
+    return -1;
+  }
+  if ((ofs & 3) != 3)
+    return -1;
+
+  regs[address] = value;
+  busyUntil = now + toCycles(kBusyClocks);
+  switch (address) {
+  case REG_TIMER_A_HIGH:
+  case REG_TIMER_A_LOW:
+    timers[0].period = timerPeriod(0);
+    break;
+  case REG_TIMER_B:
+    timers[1].period = timerPeriod(1);
+    break;
+  case REG_TIMER_CONTROL:
+    writeTimerControl(value, now);
+    break;
+  }
+  return address;
+}
+
+uint64_t OPM::timerPeriod(int no) const {
+  if (no == 0) {
+    int na = (regs[REG_TIMER_A_HIGH] << 2) | (regs[REG_TIMER_A_LOW] & 3);
+    return toCycles(64 * (1024 - na));
+  }
+  return toCycles(1024 * (256 - regs[REG_TIMER_B]));
+}
+
+void OPM::writeTimerControl(BYTE value, uint64_t now) {
+  update(now);
+  for (int i = 0; i < 2; ++i) {
+    Timer& t = timers[i];
+    if ((value & (TIMER_RESET_FLAG << i)) != 0)
+      status &= ~(1 << i);
+    if ((value & (TIMER_LOAD << i)) == 0)
+      t.expiry = kNever;
+    else if (t.expiry == kNever)
+      t.expiry = now + t.period;
+  }
+}
+
+void OPM::update(uint64_t now) {
+  for (int i = 0; i < 2; ++i) {
+    Timer& t = timers[i];
+    if (t.expiry > now)
+      continue;
+    if ((regs[REG_TIMER_CONTROL] & (TIMER_IRQ_ENABLE << i)) != 0)
+      status |= 1 << i;
+    // Expirations missed by a late update collapse into one.
+    t.expiry += ((now - t.expiry) / t.period + 1) * t.period;
+  }
+}
+
+uint64_t OPM::nextEvent() const {
+  return timers[0].expiry < timers[1].expiry ? timers[0].expiry : timers[1].expiry;
+}
+
+bool OPM::irq() const {
+  return (status & 3) != 0;
+}
@@ -0,0 +1,52 @@
+#ifndef __OPM_H__
+#define __OPM_H__
+
+#include <stdint.h>
+
+// YM2151 (OPM) at 0xe90000, CPU side: address latch, register mirror,
+// timers A/B, status and the interrupt output (MFP GPIP 3, active low).
+// Sound is generated elsewhere from the register writes; write() tells
+// which writes reach a register.
+class OPM {
+public:
+  typedef uint8_t BYTE;
+
+  static const uint64_t kNever = ~(uint64_t)0;
+  // The OPM runs on 4MHz, one sample every 64 clocks.
+  static const int kClockKHz = 4000;
+  static const int kSampleRate = kClockKHz * 1000 / 64;
+
+  enum {
+    REG_CT = 0x1b,  // Bit 7: CT2, bit 6: CT1 (ADPCM clock select).
+  };
+
+  OPM();
+
+  BYTE read(uint32_t ofs, uint64_t now) const;
+  // Returns the register number written, or -1 for an address write.
+  int write(uint32_t ofs, BYTE value, uint64_t now);
+
+  BYTE reg(int no) const  { return regs[no]; }
+
+  // Brings timers up to `now`, setting flags of the expired ones.
+  void update(uint64_t now);
+  uint64_t nextEvent() const;
+  bool irq() const;
+
+private:
+  struct Timer {
+    uint64_t period;  // CPU cycles.
+    uint64_t expiry;  // kNever when stopped.
+  };
+
+  void writeTimerControl(BYTE value, uint64_t now);
+  uint64_t timerPeriod(int no) const;
+
+  BYTE address;
+  BYTE regs[256];
+  BYTE status;  // Bit 0: timer A flag, bit 1: timer B flag.
+  uint64_t busyUntil;
+  Timer timers[2];
+};
+
+#endif
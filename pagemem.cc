@@ -0,0 +1,122 @@
+#include "pagemem.h"
+#include <assert.h>
+#include <string.h>
+
+PageStore::PageStore(size_t size)
+  : count((size + kPageSize - 1) >> kPageShift), base(nullptr), gen(1)
+  , observer(nullptr), firstPageNo(0) {
+  // All pages share one zero frame until they are written.
+  Frame* zero = new Frame;
+  zero->refs = 0;
+  memset(zero->data, 0, sizeof(zero->data));
+
+  frames = new Frame*[count];
+  dirty = new BYTE[count];
+  lent = new BYTE[count];
+  stamps = new uint32_t[count];
+  for (int i = 0; i < count; ++i) {
+    frames[i] = retain(zero);
+    dirty[i] = 0;
+    lent[i] = 0;
+    stamps[i] = 0;
+  }
+}
+
+PageStore::PageStore(PageStore* parent)
+  : count(parent->count), gen(1), observer(nullptr), firstPageNo(0) {
+  frames = new Frame*[count];
+  base = new Frame*[count];
+  dirty = new BYTE[count];
+  lent = new BYTE[count];
+  stamps = new uint32_t[count];
+  for (int i = 0; i < count; ++i) {
+    frames[i] = retain(parent->frames[i]);
+    base[i] = retain(parent->frames[i]);
+    dirty[i] = 0;
+    lent[i] = 0;
+    stamps[i] = 0;
+    // Pages are shared now, so the parent loses direct write access.
+    parent->lent[i] = 1;
+    parent->notify(i);
+  }
+}
+
+PageStore::~PageStore() {
+  for (int i = 0; i < count; ++i) {
+    release(frames[i]);
+    if (base != nullptr)
+      release(base[i]);
+  }
+  delete[] frames;
+  delete[] base;
+  delete[] dirty;
+  delete[] lent;
+  delete[] stamps;
+}
+
+void PageStore::setObserver(Observer* observer, int firstPageNo) {
+  this->observer = observer;
+  this->firstPageNo = firstPageNo;
+}
+
+PageStore::BYTE* PageStore::writablePage(int index) {
+  Frame* frame = frames[index];
+  bool remapped = false;
+  if (frame->refs > 1) {
+    Frame* copy = new Frame;
+    copy->refs = 1;
+    memcpy(copy->data, frame->data, sizeof(copy->data));
+    release(frame);
+    frames[index] = frame = copy;
+    remapped = true;
+  }
+  if (dirty[index] == 0) {
+    dirty[index] = 1;
+    remapped = true;
+  }
+  if (stamps[index] != gen) {
+    stamps[index] = gen;
+    remapped = true;
+  }
+  // A fork which let go of the frame leaves it writable without a word
+  // to the observer.
+  if (lent[index] != 0) {
+    lent[index] = 0;
+    remapped = true;
+  }
+  if (remapped)
+    notify(index);
+  return frame->data;
+}
+
+void PageStore::rewind() {
+  assert(base != nullptr);
+  for (int i = 0; i < count; ++i) {
+    if (dirty[i] == 0)
+      continue;
+    release(frames[i]);
+    frames[i] = retain(base[i]);
+    dirty[i] = 0;
+    stamps[i] = gen;
+    notify(i);
+  }
+}
+
+uint32_t PageStore::advanceGeneration() {
+  ++gen;
+  for (int i = 0; i < count; ++i) {
+    if (stamps[i] == gen - 1)
+      notify(i);
+  }
+  return gen;
+}
+
+void PageStore::release(Frame* frame) {
+  if (--frame->refs == 0)
+    delete frame;
+}
+
+void PageStore::notify(int index) {
+  if (observer != nullptr)
+    observer->pageRemapped(firstPageNo + index);
+}
@@ -0,0 +1,82 @@
+#ifndef __PAGEMEM_H__
+#define __PAGEMEM_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Page granular backing memory.
+// A store can be forked: the child shares every page with its parent and
+// copies a page only when either side writes to it (copy-on-write).
+// Pages are also stamped with the write generation in which they were
+// first written, so that consumers can find the pages changed since a
+// point in time without tracking every write.
+class PageStore {
+public:
+  typedef uint8_t BYTE;
+
+  static const int kPageShift = 12;
+  static const size_t kPageSize = 1 << kPageShift;
+  static const size_t kPageMask = kPageSize - 1;
+
+  // Gets notified when the host frame or the writability of a page changes,
+  // so that cached host pointers can be refreshed.
+  class Observer {
+  public:
+    virtual ~Observer() {}
+    virtual void pageRemapped(int pageNo) = 0;
+  };
+
+  explicit PageStore(size_t size);
+  explicit PageStore(PageStore* parent);  // Fork.
+  ~PageStore();
+
+  // Observer receives `firstPageNo + index` for a remapped page.
+  void setObserver(Observer* observer, int firstPageNo);
+
+  size_t size() const  { return count << kPageShift; }
+  int pageCount() const  { return count; }
+
+  const BYTE* page(int index) const  { return frames[index]->data; }
+  bool isDirty(int index) const  { return dirty[index] != 0; }
+  // True if the page can be written directly without copying or stamping.
+  bool isWritable(int index) const {
+    return dirty[index] != 0 && frames[index]->refs == 1 && stamps[index] == gen;
+  }
+  // Returns the host frame for writing, copying it first if it is shared.
+  BYTE* writablePage(int index);
+
+  BYTE read8(size_t ofs) const  { return frames[ofs >> kPageShift]->data[ofs & kPageMask]; }
+  void write8(size_t ofs, BYTE value)  { writablePage(ofs >> kPageShift)[ofs & kPageMask] = value; }
+
+  // Restores the pages dirtied since the fork to the parent's contents.
+  void rewind();
+
+  uint32_t generation() const  { return gen; }
+  // Starts a new write generation. Pages written in the old one lose direct
+  // write access, so their next write stamps them again.
+  uint32_t advanceGeneration();
+  // True if the page was written or rewound after `generation` started.
+  bool writtenSince(int index, uint32_t generation) const  { return stamps[index] >= generation; }
+
+private:
+  struct Frame {
+    int refs;
+    BYTE data[kPageSize];
+  };
+
+  static Frame* retain(Frame* frame)  { ++frame->refs; return frame; }
+  static void release(Frame* frame);
+  void notify(int index);
+
+  int count;
+  Frame** frames;
+  Frame** base;  // Frames at the time of the fork, nullptr for a root store.
+  BYTE* dirty;
+  BYTE* lent;  // Shared with a fork since the observer last heard of the page.
+  uint32_t* stamps;  // Generation of the last stamping write, 0 for never.
+  uint32_t gen;
+  Observer* observer;
+  int firstPageNo;
+};
+
+#endif
@@ -0,0 +1,272 @@
+#include "recording.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+typedef Recording::BYTE BYTE;
+
+static const char kMagic[8] = {'X', '6', '8', 'R', 'E', 'C', 0, 3};
+
+Recording::Recording(const Layout& layout, uint64_t interval)
+  : layout(layout), interval(interval) {
+}
+
+bool Recording::keyframeDue(uint64_t cycles) const {
+  return keyframes.empty() || cycles >= keyframes.back().cycles + interval;
+}
+
+int Recording::addKeyframe(uint64_t cycles, const void* state, size_t size) {
+  Keyframe frame;
+  frame.cycles = cycles;
+  frame.events = events.size();
+  frame.transfers = transfers.size();
+  frame.state.assign(static_cast<const BYTE*>(state), static_cast<const BYTE*>(state) + size);
+  keyframes.push_back(frame);
+  return (int)keyframes.size() - 1;
+}
+
+void Recording::addKeyframePage(int area, int index, const BYTE* data) {
+  std::vector<Version>& list = versions[pageKey(area, index)];
+  if (!list.empty() && memcmp(&pool[list.back().offset], data, kPageSize) == 0)
+    return;
+  PageCopy copy = {area, index, addPage(data)};
+  keyframes.back().pages.push_back(copy);
+  Version version = {(int)keyframes.size() - 1, copy.offset};
+  list.push_back(version);
+}
+
+void Recording::addEvent(uint64_t cycles, uint16_t op, bool exited, const void* state, size_t size) {
+  Event event;
+  event.cycles = cycles;
+  event.op = op;
+  event.exited = exited;
+  event.state.assign(static_cast<const BYTE*>(state), static_cast<const BYTE*>(state) + size);
+  events.push_back(event);
+}
+
+void Recording::addEventPage(int area, int index, const BYTE* data) {
+  PageCopy copy = {area, index, addPage(data)};
+  events.back().pages.push_back(copy);
+}
+
+void Recording::addKeyframeDisk(const std::vector<BYTE>& writes) {
+  keyframes.back().disks.push_back(writes);
+}
+
+void Recording::addTransfer(uint64_t cycles, int unit, bool ok, const BYTE* data, size_t size) {
+  Transfer transfer;
+  transfer.cycles = cycles;
+  transfer.unit = unit;
+  transfer.ok = ok;
+  transfer.data.assign(data, data + size);
+  transfers.push_back(transfer);
+}
+
+size_t Recording::addPage(const BYTE* data) {
+  size_t offset = pool.size();
+  pool.insert(pool.end(), data, data + kPageSize);
+  return offset;
+}
+
+int Recording::keyframeBefore(uint64_t cycles) const {
+  int lo = 0, hi = (int)keyframes.size() - 1;
+  while (lo < hi) {
+    int mid = (lo + hi + 1) / 2;
+    if (keyframes[mid].cycles <= cycles)
+      lo = mid;
+    else
+      hi = mid - 1;
+  }
+  return lo;
+}
+
+const BYTE* Recording::pageAt(int area, int index, int keyframe) const {
+  std::map<uint32_t, std::vector<Version> >::const_iterator it = versions.find(pageKey(area, index));
+  if (it == versions.end())
+    return nullptr;
+  const std::vector<Version>& list = it->second;
+  const BYTE* data = nullptr;
+  for (size_t i = 0; i < list.size() && list[i].keyframe <= keyframe; ++i)
+    data = &pool[list[i].offset];
+  return data;
+}
+
+bool Recording::changedBetween(int area, int index, int from, int to) const {
+  std::map<uint32_t, std::vector<Version> >::const_iterator it = versions.find(pageKey(area, index));
+  if (it == versions.end())
+    return false;
+  for (size_t i = 0; i < it->second.size(); ++i) {
+    int keyframe = it->second[i].keyframe;
+    if (from < keyframe && keyframe <= to)
+      return true;
+  }
+  return false;
+}
+
+// File layout: magic, machine layout, interval, the page pool, then the
+// keyframes and the events, each with its state and page list, and the
+// transfers.
+
+static bool sameLayout(const Recording::Layout& x, const Recording::Layout& y) {
+  if (x.build != y.build || x.stateSize != y.stateSize || x.bufferSize != y.bufferSize ||
+      x.contextSize != y.contextSize || x.areas != y.areas)
+    return false;
+  for (uint32_t i = 0; i < x.areas && i < Recording::kMaxAreas; ++i) {
+    if (x.areaPages[i] != y.areaPages[i])
+      return false;
+  }
+  return true;
+}
+
+bool Recording::fits(const PageCopy& copy) const {
+  return copy.area >= 0 && (uint32_t)copy.area < layout.areas && copy.index >= 0 &&
+         (uint32_t)copy.index < layout.areaPages[copy.area] && copy.offset <= pool.size() &&
+         pool.size() - copy.offset >= kPageSize;
+}
+
+// The registers, with the transfer buffer during a data phase.
+bool Recording::fits(const Keyframe& frame) const {
+  if (frame.state.size() != layout.stateSize && frame.state.size() != layout.stateSize + layout.bufferSize)
+    return false;
+  for (size_t i = 0; i < frame.pages.size(); ++i) {
+    if (!fits(frame.pages[i]))
+      return false;
+  }
+  return true;
+}
+
+// (index, value) pairs of context words.
+bool Recording::fits(const Event& event) const {
+  if (event.state.size() % (2 * sizeof(uint32_t)) != 0)
+    return false;
+  for (size_t i = 0; i < event.state.size(); i += 2 * sizeof(uint32_t)) {
+    uint32_t index;
+    memcpy(&index, &event.state[i], sizeof(index));
+    if (index >= layout.contextSize / sizeof(uint32_t))
+      return false;
+  }
+  for (size_t i = 0; i < event.pages.size(); ++i) {
+    if (!fits(event.pages[i]))
+      return false;
+  }
+  return true;
+}
+
+static bool put(FILE* fp, const void* data, size_t size) {
+  return size == 0 || fwrite(data, size, 1, fp) == 1;
+}
+
+static bool get(FILE* fp, void* data, size_t size) {
+  return size == 0 || fread(data, size, 1, fp) == 1;
+}
+
+template <typename T>
+static bool putVector(FILE* fp, const std::vector<T>& v) {
+  uint64_t count = v.size();
+  return put(fp, &count, sizeof(count)) && put(fp, v.data(), count * sizeof(T));
+}
+
+// Bytes left in the file, which bounds the counts read.
+static uint64_t remaining(FILE* fp) {
+  struct stat st;
+  long pos = ftell(fp);
+  return fstat(fileno(fp), &st) == 0 && pos >= 0 && st.st_size >= pos ? st.st_size - pos : 0;
+}
+
+template <typename T>
+static bool getVector(FILE* fp, std::vector<T>* v) {
+  uint64_t count;
+  if (!get(fp, &count, sizeof(count)) || count > remaining(fp) / sizeof(T))
+    return false;
+  v->resize(count);
+  return get(fp, v->data(), count * sizeof(T));
+}
+
+bool Recording::save(const char* path) const {
+  FILE* fp = fopen(path, "wb");
+  if (fp == nullptr)
+    return false;
+  uint64_t keyframeCount = keyframes.size(), eventCount = events.size(), transferCount = transfers.size();
+  bool ok = put(fp, kMagic, sizeof(kMagic)) && put(fp, &layout, sizeof(layout)) &&
+            put(fp, &interval, sizeof(interval)) && putVector(fp, pool) &&
+            put(fp, &keyframeCount, sizeof(keyframeCount));
+  for (size_t i = 0; ok && i < keyframes.size(); ++i) {
+    const Keyframe& frame = keyframes[i];
+    uint64_t diskCount = frame.disks.size();
+    ok = put(fp, &frame.cycles, sizeof(frame.cycles)) && put(fp, &frame.events, sizeof(frame.events)) &&
+         put(fp, &frame.transfers, sizeof(frame.transfers)) && putVector(fp, frame.state) &&
+         putVector(fp, frame.pages) && put(fp, &diskCount, sizeof(diskCount));
+    for (size_t j = 0; ok && j < frame.disks.size(); ++j)
+      ok = putVector(fp, frame.disks[j]);
+  }
+  ok = ok && put(fp, &eventCount, sizeof(eventCount));
+  for (size_t i = 0; ok && i < events.size(); ++i) {
+    const Event& event = events[i];
+    ok = put(fp, &event.cycles, sizeof(event.cycles)) && put(fp, &event.op, sizeof(event.op)) &&
+         put(fp, &event.exited, sizeof(event.exited)) && putVector(fp, event.state) &&
+         putVector(fp, event.pages);
+  }
+  ok = ok && put(fp, &transferCount, sizeof(transferCount));
+  for (size_t i = 0; ok && i < transfers.size(); ++i) {
+    const Transfer& transfer = transfers[i];
+    ok = put(fp, &transfer.cycles, sizeof(transfer.cycles)) && put(fp, &transfer.unit, sizeof(transfer.unit)) &&
+         put(fp, &transfer.ok, sizeof(transfer.ok)) && putVector(fp, transfer.data);
+  }
+  return fclose(fp) == 0 && ok;
+}
+
+bool Recording::load(const char* path) {
+  FILE* fp = fopen(path, "rb");
+  if (fp == nullptr)
+    return false;
+  keyframes.clear();
+  events.clear();
+  transfers.clear();
+  versions.clear();
+  char magic[sizeof(kMagic)];
+  Layout fileLayout;
+  uint64_t keyframeCount = 0, eventCount = 0, transferCount = 0;
+  bool ok = get(fp, magic, sizeof(magic)) && memcmp(magic, kMagic, sizeof(kMagic)) == 0 &&
+            get(fp, &fileLayout, sizeof(fileLayout));
+  if (ok && !sameLayout(fileLayout, layout)) {
+    fprintf(stderr, "%s was recorded by another build\n", path);
+    ok = false;
+  }
+  ok = ok && get(fp, &interval, sizeof(interval)) && getVector(fp, &pool) &&
+       get(fp, &keyframeCount, sizeof(keyframeCount));
+  for (uint64_t i = 0; ok && i < keyframeCount; ++i) {
+    Keyframe frame;
+    uint64_t diskCount = 0;
+    ok = get(fp, &frame.cycles, sizeof(frame.cycles)) && get(fp, &frame.events, sizeof(frame.events)) &&
+         get(fp, &frame.transfers, sizeof(frame.transfers)) && getVector(fp, &frame.state) &&
+         getVector(fp, &frame.pages) && get(fp, &diskCount, sizeof(diskCount)) && diskCount <= 16;
+    frame.disks.resize(ok ? diskCount : 0);
+    for (size_t j = 0; ok && j < frame.disks.size(); ++j)
+      ok = getVector(fp, &frame.disks[j]);
+    ok = ok && fits(frame);
+    for (size_t j = 0; ok && j < frame.pages.size(); ++j) {
+      const PageCopy& copy = frame.pages[j];
+      Version version = {(int)i, copy.offset};
+      versions[pageKey(copy.area, copy.index)].push_back(version);
+    }
+    keyframes.push_back(frame);
+  }
+  ok = ok && get(fp, &eventCount, sizeof(eventCount));
+  for (uint64_t i = 0; ok && i < eventCount; ++i) {
+    Event event;
+    ok = get(fp, &event.cycles, sizeof(event.cycles)) && get(fp, &event.op, sizeof(event.op)) &&
+         get(fp, &event.exited, sizeof(event.exited)) && getVector(fp, &event.state) &&
+         getVector(fp, &event.pages);
+    ok = ok && fits(event);
+    events.push_back(event);
+  }
+  ok = ok && get(fp, &transferCount, sizeof(transferCount));
+  for (uint64_t i = 0; ok && i < transferCount; ++i) {
+    Transfer transfer;
+    ok = get(fp, &transfer.cycles, sizeof(transfer.cycles)) && get(fp, &transfer.unit, sizeof(transfer.unit)) &&
+         get(fp, &transfer.ok, sizeof(transfer.ok)) && getVector(fp, &transfer.data);
+    transfers.push_back(transfer);
+  }
+  fclose(fp);
+  return ok && !keyframes.empty();
+}
@@ -0,0 +1,131 @@
+#ifndef __RECORDING_H__
+#define __RECORDING_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <map>
+#include <vector>
+#include "pagemem.h"
+
+// Session log for deterministic replay.
+// The emulated machine is deterministic on its own: devices complete at
+// modeled times, and the SASI worker and disk images never decide timing.
+// What comes from the host are the results of emulated DOS and IOCS calls
+// (host files, the clock), so each handled call is logged against the
+// cycle counter with the registers and the pages it left behind. Replay
+// applies the log in place of the handlers. Hard disk transfers are
+// logged the same way, reads with their data, and replay neither reads
+// nor writes the images.
+// Keyframes hold the CPU and device registers and only the pages written
+// since the previous keyframe, skipping pages written back unchanged. A
+// page at keyframe n is its last version at or before n, so seeking loads
+// the nearest keyframe and runs forward from there. Floppy writes are kept
+// alongside as journal records, the whole overlay at keyframe 0, so replay
+// needs the floppy images only as they were without their journals.
+// Files are for the same build and host: registers are stored raw, so the
+// header carries the layout of the machine that wrote them, and a file
+// with another layout is refused.
+class Recording {
+public:
+  typedef uint8_t BYTE;
+
+  static const size_t kPageSize = PageStore::kPageSize;
+  static const uint64_t kDefaultInterval = 20000000;  // 2 s at 10 MHz.
+  static const int kMaxAreas = 8;
+
+  // What the machine stores raw, given by X68K::recordingLayout().
+  struct Layout {
+    uint64_t build;        // Key of the emulator build.
+    uint32_t stateSize;    // Keyframe registers.
+    uint32_t bufferSize;   // Appended to them during a hard disk data phase.
+    uint32_t contextSize;  // Registers an event changes words of.
+    uint32_t areas;
+    uint32_t areaPages[kMaxAreas];
+  };
+
+  struct PageCopy {
+    int area;
+    int index;
+    size_t offset;  // In the page pool.
+  };
+
+  struct Keyframe {
+    uint64_t cycles;
+    size_t events;  // Calls logged before it.
+    size_t transfers;  // Hard disk transfers logged before it.
+    std::vector<BYTE> state;
+    std::vector<PageCopy> pages;
+    std::vector<std::vector<BYTE> > disks;  // Floppy writes since the previous one, by drive.
+  };
+
+  struct Event {
+    uint64_t cycles;
+    uint16_t op;    // Instruction word of the call.
+    bool exited;    // The program ended.
+    std::vector<BYTE> state;  // Registers changed.
+    std::vector<PageCopy> pages;
+  };
+
+  // A hard disk transfer collected, with the data for a read.
+  struct Transfer {
+    uint64_t cycles;
+    int32_t unit;
+    bool ok;
+    std::vector<BYTE> data;
+  };
+
+  explicit Recording(const Layout& layout, uint64_t interval = kDefaultInterval);
+
+  bool save(const char* path) const;
+  // Fails on files that are short, made with another layout, or hold
+  // anything the layout cannot take.
+  bool load(const char* path);
+
+  // Recording.
+  bool keyframeDue(uint64_t cycles) const;
+  int addKeyframe(uint64_t cycles, const void* state, size_t size);
+  // Adds a page to the last keyframe unless it is unchanged.
+  void addKeyframePage(int area, int index, const BYTE* data);
+  void addEvent(uint64_t cycles, uint16_t op, bool exited, const void* state, size_t size);
+  void addEventPage(int area, int index, const BYTE* data);
+  void addKeyframeDisk(const std::vector<BYTE>& writes);
+  void addTransfer(uint64_t cycles, int unit, bool ok, const BYTE* data, size_t size);
+
+  // Replay.
+  int keyframeCount() const  { return (int)keyframes.size(); }
+  const Keyframe& keyframe(int index) const  { return keyframes[index]; }
+  // Last keyframe at or before `cycles`.
+  int keyframeBefore(uint64_t cycles) const;
+  size_t eventCount() const  { return events.size(); }
+  const Event& event(size_t index) const  { return events[index]; }
+  size_t transferCount() const  { return transfers.size(); }
+  const Transfer& transfer(size_t index) const  { return transfers[index]; }
+  const BYTE* page(const PageCopy& copy) const  { return &pool[copy.offset]; }
+  // The page as of keyframe `index`, nullptr when it was never written.
+  const BYTE* pageAt(int area, int index, int keyframe) const;
+  // True if the page has a version in keyframes (from, to].
+  bool changedBetween(int area, int index, int from, int to) const;
+
+private:
+  struct Version {
+    int keyframe;
+    size_t offset;
+  };
+
+  static uint32_t pageKey(int area, int index)  { return (area << 20) | index; }
+  size_t addPage(const BYTE* data);
+
+  bool fits(const Keyframe& frame) const;
+  bool fits(const Event& event) const;
+  bool fits(const PageCopy& copy) const;
+
+  Layout layout;
+  uint64_t interval;
+  std::vector<Keyframe> keyframes;
+  std::vector<Event> events;
+  std::vector<Transfer> transfers;
+  std::vector<BYTE> pool;
+  std::map<uint32_t, std::vector<Version> > versions;  // By keyframe.
+};
+
+#endif
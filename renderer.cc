@@ -0,0 +1,136 @@
+#include "renderer.h"
+#include <string.h>
+#include "compositor.h"
+
+typedef VideoSnapshot::BYTE BYTE;
+
+const uint32_t VideoSnapshot::kAreaSizes[AREA_COUNT] = {
+  TextVram::kSize,
+  GraphicVram::kSize,
+  SpriteController::kPcgSize,
+};
+
+VideoSnapshot::VideoSnapshot()
+  : frameNo(0) {
+  memset(&sprites, 0, sizeof(sprites));
+  for (int i = 0; i < AREA_COUNT; ++i) {
+    changed[i] = new BYTE[pageCount(i)];
+    data[i] = new BYTE[kAreaSizes[i]];
+    memset(changed[i], 0, pageCount(i));
+  }
+}
+
+VideoSnapshot::~VideoSnapshot() {
+  for (int i = 0; i < AREA_COUNT; ++i) {
+    delete[] changed[i];
+    delete[] data[i];
+  }
+}
+
+void VideoSnapshot::clearPages() {
+  for (int i = 0; i < AREA_COUNT; ++i)
+    memset(changed[i], 0, pageCount(i));
+}
+
+FrameRenderer::FrameRenderer() {
+  tvram = new TextVram();
+  gvram = new GraphicVram();
+  sprite = new SpriteController();
+  textLayer = new uint32_t[kWidth * kHeight];
+}
+
+FrameRenderer::~FrameRenderer() {
+  delete tvram;
+  delete gvram;
+  delete sprite;
+  delete[] textLayer;
+}
+
+void FrameRenderer::apply(VideoSnapshot* snap) {
+  // The text layer is cached per line, so scrolling or recolouring it
+  // invalidates every line.
+  if (snap->crtc.reg(CRTC::R10_TEXT_SCROLL_X) != crtc.reg(CRTC::R10_TEXT_SCROLL_X) ||
+      snap->crtc.reg(CRTC::R11_TEXT_SCROLL_Y) != crtc.reg(CRTC::R11_TEXT_SCROLL_Y) ||
+      memcmp(snap->video.rgbaPalette() + VideoController::kTextPalette,
+             video.rgbaPalette() + VideoController::kTextPalette, 16 * sizeof(uint32_t)) != 0)
+    tvram->markAllDirty();
+  video = snap->video;
+  crtc = snap->crtc;
+  sprite->loadRegisters(snap->sprites);
+
+  for (int area = 0; area < VideoSnapshot::AREA_COUNT; ++area) {
+    for (int i = 0; i < snap->pageCount(area); ++i) {
+      if (snap->changed[area][i] == 0)
+        continue;
+      const BYTE* data = snap->page(area, i);
+      switch (area) {
+      case VideoSnapshot::AREA_TEXT:     tvram->loadPage(i, data); break;
+      case VideoSnapshot::AREA_GRAPHIC:  gvram->loadPage(i, data); break;
+      case VideoSnapshot::AREA_PCG:      sprite->loadPcgPage(i, data); break;
+      }
+    }
+  }
+  snap->clearPages();
+}
+
+void FrameRenderer::render(uint32_t* frame) {
+  uint32_t textPalette[16];
+  memcpy(textPalette, video.rgbaPalette() + VideoController::kTextPalette, sizeof(textPalette));
+  textPalette[0] = 0;  // Transparent.
+  tvram->render(textLayer, kWidth, kWidth, kHeight,
+                crtc.reg(CRTC::R10_TEXT_SCROLL_X) & 0x3ff, crtc.reg(CRTC::R11_TEXT_SCROLL_Y) & 0x3ff,
+                textPalette);
+
+  // Layers sorted front to back.
+  VideoController::Layer order[VideoController::LAYER_COUNT];
+  for (int i = 0; i < VideoController::LAYER_COUNT; ++i) {
+    VideoController::Layer layer = static_cast<VideoController::Layer>(i);
+    int j = i;
+    for (; j > 0 && video.layerPriority(order[j - 1]) > video.layerPriority(layer); --j)
+      order[j] = order[j - 1];
+    order[j] = layer;
+  }
+
+  int pages[4];
+  int pageCount = video.layerOn(VideoController::LAYER_GRAPHIC) ? video.graphicPages(pages) : 0;
+  VideoController::GraphicMode mode = video.graphicMode();
+
+  uint32_t graphicLine[kWidth];
+  uint32_t pageLine[kWidth];
+  uint32_t spriteLine[kWidth];
+  for (int y = 0; y < kHeight; ++y) {
+    const uint32_t* layers[VideoController::LAYER_COUNT];
+    for (int i = 0; i < VideoController::LAYER_COUNT; ++i) {
+      layers[i] = nullptr;
+      switch (order[i]) {
+      case VideoController::LAYER_SPRITE:
+        if (video.layerOn(VideoController::LAYER_SPRITE)) {
+          sprite->renderLine(y, kWidth, video.rgbaPalette() + VideoController::kTextPalette, spriteLine);
+          layers[i] = spriteLine;
+        }
+        break;
+      case VideoController::LAYER_TEXT:
+        if (video.layerOn(VideoController::LAYER_TEXT))
+          layers[i] = textLayer + y * kWidth;
+        break;
+      case VideoController::LAYER_GRAPHIC:
+        if (pageCount == 0)
+          break;
+        memset(graphicLine, 0, sizeof(graphicLine));
+        for (int p = pageCount; --p >= 0;) {
+          int page = pages[p];
+          gvram->convertLine(mode, page, y,
+                             crtc.reg(CRTC::R12_GRAPHIC_SCROLL + page * 2) & 0x3ff,
+                             crtc.reg(CRTC::R12_GRAPHIC_SCROLL + page * 2 + 1) & 0x3ff,
+                             kWidth, video.rgbaPalette(), pageLine);
+          Compositor::overlay(graphicLine, pageLine, kWidth);
+        }
+        layers[i] = graphicLine;
+        break;
+      default:
+        break;
+      }
+    }
+    Compositor::composeLine(frame + y * kWidth, layers, VideoController::LAYER_COUNT, kWidth);
+  }
+}
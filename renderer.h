@@ -0,0 +1,66 @@
+#ifndef __RENDERER_H__
+#define __RENDERER_H__
+
+#include <stdint.h>
+#include "crtc.h"
+#include "gvram.h"
+#include "sprite.h"
+#include "tvram.h"
+#include "video.h"
+
+// Video state of one frame as seen by a renderer: the registers and the
+// video memory pages changed since the previous snapshot. Pages still
+// flagged when a snapshot is reused are carried over into the next one.
+struct VideoSnapshot {
+  typedef uint8_t BYTE;
+
+  enum Area {
+    AREA_TEXT,
+    AREA_GRAPHIC,
+    AREA_PCG,
+    AREA_COUNT
+  };
+
+  static const uint32_t kAreaSizes[AREA_COUNT];
+
+  VideoSnapshot();
+  ~VideoSnapshot();
+
+  int pageCount(int area) const  { return kAreaSizes[area] >> PageStore::kPageShift; }
+  BYTE* page(int area, int index)  { return data[area] + (index << PageStore::kPageShift); }
+  void clearPages();
+
+  uint64_t frameNo;
+  VideoController video;
+  CRTC crtc;
+  SpriteController::Registers sprites;
+  BYTE* changed[AREA_COUNT];  // Flag per page.
+  BYTE* data[AREA_COUNT];     // Contents of the flagged pages.
+};
+
+// Composites frames from shadow copies of the video memory, which are kept
+// up to date by applying snapshots. It owns all of its state, so it can run
+// on a thread of its own.
+class FrameRenderer {
+public:
+  static const int kWidth = 768;
+  static const int kHeight = 512;
+
+  FrameRenderer();
+  ~FrameRenderer();
+
+  // Brings the shadow state up to `snap` and clears its page flags.
+  void apply(VideoSnapshot* snap);
+  // Composites text, graphics and sprites into a kWidth x kHeight RGBA frame.
+  void render(uint32_t* frame);
+
+private:
+  TextVram* tvram;
+  GraphicVram* gvram;
+  SpriteController* sprite;
+  VideoController video;
+  CRTC crtc;
+  uint32_t* textLayer;  // Text plane in RGBA, updated for dirty lines only.
+};
+
+#endif
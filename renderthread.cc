@@ -0,0 +1,72 @@
+#include "renderthread.h"
+#include "videosink.h"
+
+RenderThread::RenderThread(VideoSink* sink)
+  : back(0), front(1), middle(2), lastFrameNo(0), sink(sink), quit(false), rendered(0) {
+  for (int i = 0; i < 3; ++i)
+    slots[i] = new VideoSnapshot();
+  frame = new uint32_t[FrameRenderer::kWidth * FrameRenderer::kHeight];
+}
+
+RenderThread::~RenderThread() {
+  stop();
+  for (int i = 0; i < 3; ++i)
+    delete slots[i];
+  delete[] frame;
+}
+
+void RenderThread::start() {
+  quit = false;
+  thread = std::thread(&RenderThread::renderMain, this);
+}
+
+void RenderThread::stop() {
+  if (!thread.joinable())
+    return;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    quit = true;
+    cond.notify_one();
+  }
+  thread.join();
+}
+
+void RenderThread::publish() {
+  int prev = middle.exchange(back | kFresh, std::memory_order_acq_rel);
+  // An unrendered slot keeps its page flags, so its pages are captured again
+  // into the next snapshot.
+  back = prev & 3;
+  std::lock_guard<std::mutex> lock(mutex);
+  cond.notify_one();
+}
+
+bool RenderThread::takeFresh() {
+  if ((middle.load(std::memory_order_acquire) & kFresh) == 0)
+    return false;
+  front = middle.exchange(front, std::memory_order_acq_rel) & 3;
+  return true;
+}
+
+void RenderThread::renderMain() {
+  for (;;) {
+    if (!takeFresh()) {
+      if (quit)
+        return;
+      std::unique_lock<std::mutex> lock(mutex);
+      cond.wait(lock, [this] { return quit || (middle.load(std::memory_order_acquire) & kFresh) != 0; });
+      continue;
+    }
+
+    VideoSnapshot* snap = slots[front];
+    renderer.apply(snap);
+    if (sink != nullptr && rendered > 0) {
+      for (uint64_t no = lastFrameNo + 1; no < snap->frameNo; ++no)
+        sink->submit(frame);  // Skipped, shows as a repeat.
+    }
+    renderer.render(frame);
+    if (sink != nullptr)
+      sink->submit(frame);
+    lastFrameNo = snap->frameNo;
+    rendered.fetch_add(1, std::memory_order_relaxed);
+  }
+}
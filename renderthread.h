@@ -0,0 +1,59 @@
+#ifndef __RENDERTHREAD_H__
+#define __RENDERTHREAD_H__
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "renderer.h"
+
+class VideoSink;
+
+// Renders published snapshots on a thread of its own and hands the frames
+// to a VideoSink.
+// Snapshots pass through a triple buffer: the CPU thread fills the back
+// slot and swaps it with the middle one, the render thread swaps the middle
+// slot with its front one. Neither side waits for the other; if the CPU
+// publishes faster than frames are rendered, the newest snapshot wins and
+// the skipped frames go to the sink as repeats.
+class RenderThread {
+public:
+  explicit RenderThread(VideoSink* sink);
+  ~RenderThread();
+
+  void start();
+  // Renders the last published snapshot, then stops the thread.
+  void stop();
+
+  // CPU side: the slot to capture the next frame into, then publish it.
+  VideoSnapshot* backBuffer()  { return slots[back]; }
+  void publish();
+
+  uint64_t framesRendered() const  { return rendered.load(std::memory_order_relaxed); }
+
+private:
+  static const int kFresh = 4;  // Middle slot holds an unrendered snapshot.
+
+  void renderMain();
+  bool takeFresh();
+
+  VideoSnapshot* slots[3];
+  int back;                  // Owned by the CPU thread.
+  int front;                 // Owned by the render thread.
+  std::atomic<int> middle;   // Slot index | kFresh.
+
+  FrameRenderer renderer;
+  uint32_t* frame;
+  uint64_t lastFrameNo;
+  VideoSink* sink;
+
+  std::thread thread;
+  std::atomic<bool> quit;
+  std::atomic<uint64_t> rendered;
+  // Sleeps while there is nothing to render; notified under the lock.
+  std::mutex mutex;
+  std::condition_variable cond;
+};
+
+#endif
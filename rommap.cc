@@ -0,0 +1,394 @@
+#include "rommap.h"
+#include <stdio.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "decodecache.h"
+
+typedef RomMap::BYTE BYTE;
+typedef RomMap::WORD WORD;
+typedef RomMap::LONG LONG;
+typedef int16_t SWORD;
+typedef int8_t SBYTE;
+
+static const LONG kNoTarget = ~(LONG)0;
+static const int QUEUED = 1 << 7;  // Internal: entry handed out.
+
+enum Flow {
+  FLOW_NEXT,    // Falls through.
+  FLOW_BRANCH,  // Bcc and DBcc: target or fall through.
+  FLOW_CALL,    // Target, then back.
+  FLOW_JUMP,    // Target only.
+  FLOW_END,     // Returns or traps for good.
+};
+
+struct Analysis {
+  const BYTE* rom;
+  std::atomic<BYTE>* flags;
+  std::mutex mutex;
+  std::condition_variable cond;
+  std::vector<LONG> queue;  // Entries not walked yet.
+  int busy;                 // Workers walking.
+};
+
+// Zero past the end, where decode() rejects the instruction anyway.
+static WORD read16(const BYTE* rom, LONG adr) {
+  adr -= RomMap::kBase;
+  if (adr + 2 > RomMap::kSize)
+    return 0;
+  return (rom[adr] << 8) | rom[adr + 1];
+}
+
+static LONG read32(const BYTE* rom, LONG adr) {
+  return (read16(rom, adr) << 16) | read16(rom, adr + 2);
+}
+
+// Extension bytes of an effective address with an operand of `size`
+// bytes, -1 if the mode does not exist on the 68000.
+static int eaLength(int mode, int reg, int size) {
+  if (mode < 5)
+    return 0;
+  if (mode < 7)
+    return 2;
+  switch (reg) {
+  case 0:  // abs.w
+  case 2:  // (d16,PC)
+  case 3:  // (d8,PC,Xn)
+    return 2;
+  case 1:  // abs.l
+    return 4;
+  case 4:  // #imm
+    return size == 4 ? 4 : 2;
+  }
+  return -1;
+}
+
+// Target of jmp/jsr when the address follows from the instruction alone.
+static LONG eaTarget(const BYTE* rom, LONG adr, int mode, int reg) {
+  if (mode != 7)
+    return kNoTarget;
+  switch (reg) {
+  case 0:
+    return (LONG)(SWORD)read16(rom, adr + 2) & 0xffffff;
+  case 1:
+    return read32(rom, adr + 2) & 0xffffff;
+  case 2:
+    return adr + 2 + (SWORD)read16(rom, adr + 2);
+  }
+  return kNoTarget;
+}
+
+// Decodes the length of the instruction at `adr` and where it goes. Returns
+// 0 for words that are not 68000 instructions.
+static int decode(const BYTE* rom, LONG adr, Flow* flow, LONG* target) {
+  static const int kSizes[] = {1, 2, 4, 0};  // By bits 7-6.
+  WORD op = read16(rom, adr);
+  int mode = (op >> 3) & 7;
+  int reg = op & 7;
+  int size = kSizes[(op >> 6) & 3];
+  int len = 2;
+  int ea = 0;
+  *flow = FLOW_NEXT;
+  *target = kNoTarget;
+  switch (op >> 12) {
+  case 0x0:
+    if ((op & 0xf138) == 0x0108) {  // movep
+      len = 4;
+    } else if ((op & 0xf100) == 0x0100) {  // btst/bchg/bclr/bset Dn
+      ea = eaLength(mode, reg, 1);
+    } else if ((op & 0xff00) == 0x0800) {  // btst/bchg/bclr/bset #
+      len = 4;
+      ea = eaLength(mode, reg, 1);
+    } else if ((op & 0xf5bf) == 0x003c) {  // ori/andi/eori to CCR/SR
+      len = 4;
+    } else {
+      int type = (op >> 9) & 7;
+      if (size == 0 || type == 4 || type == 7)
+        return 0;
+      len += size == 4 ? 4 : 2;
+      ea = eaLength(mode, reg, size);
+    }
+    break;
+  case 0x1:
+  case 0x2:
+  case 0x3: {  // move
+    static const int kMoveSizes[] = {0, 1, 4, 2};
+    int dstMode = (op >> 6) & 7;
+    int dstReg = (op >> 9) & 7;
+    int src = eaLength(mode, reg, kMoveSizes[op >> 12]);
+    int dst = eaLength(dstMode, dstReg, kMoveSizes[op >> 12]);
+    if (src < 0 || dst < 0 || (dstMode == 7 && dstReg > 1))
+      return 0;
+    ea = src + dst;
+    break;
+  }
+  case 0x4:
+    if (op == 0x4afc) {  // illegal
+      *flow = FLOW_END;
+    } else if ((op & 0xfff0) == 0x4e40 || (op & 0xfff0) == 0x4e60 || (op & 0xfff8) == 0x4e58 ||
+               op == 0x4e70 || op == 0x4e71 || op == 0x4e76) {  // trap, move USP, unlk, reset, nop, trapv
+    } else if ((op & 0xfff8) == 0x4e50 || op == 0x4e72) {  // link, stop
+      len = 4;
+    } else if (op == 0x4e73 || op == 0x4e75 || op == 0x4e77) {  // rte, rts, rtr
+      *flow = FLOW_END;
+    } else if ((op & 0xff80) == 0x4e80) {  // jsr, jmp
+      if (mode < 2 || mode == 3 || mode == 4 || (mode == 7 && reg > 3))
+        return 0;
+      ea = eaLength(mode, reg, 4);
+      *flow = (op & 0x40) != 0 ? FLOW_JUMP : FLOW_CALL;
+      *target = eaTarget(rom, adr, mode, reg);
+    } else if ((op & 0xfeb8) == 0x4880 || (op & 0xfff8) == 0x4840) {  // ext, swap
+    } else if ((op & 0xfb80) == 0x4880) {  // movem
+      len = 4;
+      ea = eaLength(mode, reg, (op & 0x40) != 0 ? 4 : 2);
+    } else if ((op & 0xf1c0) == 0x41c0 || (op & 0xffc0) == 0x4840) {  // lea, pea
+      ea = eaLength(mode, reg, 4);
+    } else if ((op & 0xf1c0) == 0x4180) {  // chk
+      ea = eaLength(mode, reg, 2);
+    } else if ((op & 0xf900) == 0x4000 || (op & 0xff00) == 0x4a00) {  // negx/clr/neg/not/tst, SR/CCR moves, tas
+      if ((op & 0xffc0) == 0x42c0)  // move from CCR is 68010
+        return 0;
+      ea = eaLength(mode, reg, size != 0 ? size : 2);
+    } else if ((op & 0xffc0) == 0x4800) {  // nbcd
+      ea = eaLength(mode, reg, 1);
+    } else {
+      return 0;
+    }
+    break;
+  case 0x5:
+    if ((op & 0xf8) == 0xc8) {  // dbcc
+      len = 4;
+      *flow = FLOW_BRANCH;
+      *target = adr + 2 + (SWORD)read16(rom, adr + 2);
+    } else {  // addq, subq, scc
+      ea = eaLength(mode, reg, size != 0 ? size : 1);
+    }
+    break;
+  case 0x6: {  // bra, bsr, bcc
+    int cond = (op >> 8) & 15;
+    LONG disp = (SBYTE)op;
+    if (disp == 0) {
+      len = 4;
+      disp = (SWORD)read16(rom, adr + 2);
+    } else if ((disp & 1) != 0) {
+      return 0;
+    }
+    *flow = cond == 0 ? FLOW_JUMP : cond == 1 ? FLOW_CALL : FLOW_BRANCH;
+    *target = adr + 2 + disp;
+    break;
+  }
+  case 0x7:  // moveq
+    if ((op & 0x100) != 0)
+      return 0;
+    break;
+  case 0x8:
+  case 0xc:
+    if ((op & 0xf0c0) == 0x80c0 || (op & 0xf0c0) == 0xc0c0) {  // div, mul
+      ea = eaLength(mode, reg, 2);
+    } else if ((op & 0xb1f0) == 0x8100) {  // sbcd, abcd
+    } else if ((op & 0xf1f8) == 0xc140 || (op & 0xf1f8) == 0xc148 || (op & 0xf1f8) == 0xc188) {  // exg
+    } else {  // or, and
+      ea = eaLength(mode, reg, size);
+    }
+    break;
+  case 0x9:
+  case 0xd:
+    if (size == 0)  // suba, adda
+      ea = eaLength(mode, reg, (op & 0x100) != 0 ? 4 : 2);
+    else if ((op & 0x130) != 0x100)  // sub, add; subx and addx have no extension
+      ea = eaLength(mode, reg, size);
+    break;
+  case 0xb:
+    if (size == 0)  // cmpa
+      ea = eaLength(mode, reg, (op & 0x100) != 0 ? 4 : 2);
+    else if ((op & 0x138) != 0x108)  // cmp, eor; cmpm has no extension
+      ea = eaLength(mode, reg, size);
+    break;
+  case 0xe:
+    if (size == 0) {  // Memory shifts.
+      if (mode < 2 || (op & 0x800) != 0)
+        return 0;
+      ea = eaLength(mode, reg, 2);
+    }
+    break;
+  case 0xa:  // Line A and line F are emulator traps, and return.
+  case 0xf:
+    break;
+  }
+  if (ea < 0)
+    return 0;
+  len += ea;
+  if (adr + len > RomMap::kBase + RomMap::kSize)
+    return 0;
+  return len;
+}
+
+// Marks `adr` as a block start and hands it out unless it was already.
+static void addEntry(Analysis* an, LONG adr, int flags, std::vector<LONG>* found) {
+  if (adr - RomMap::kBase >= RomMap::kSize || (adr & 1) != 0)
+    return;
+  if ((an->flags[adr - RomMap::kBase].fetch_or(flags | RomMap::BLOCK | QUEUED) & QUEUED) == 0)
+    found->push_back(adr);
+}
+
+// Decodes from `adr` until control leaves for good or reaches code another
+// walk already took.
+static void walk(Analysis* an, LONG adr, std::vector<LONG>* found) {
+  while (adr - RomMap::kBase < RomMap::kSize) {
+    Flow flow;
+    LONG target;
+    int len = decode(an->rom, adr, &flow, &target);
+    if (len == 0)
+      return;
+    std::atomic<BYTE>* flags = &an->flags[adr - RomMap::kBase];
+    if ((flags[0].fetch_or(RomMap::INSN | RomMap::CODE) & RomMap::INSN) != 0)
+      return;
+    for (int i = 1; i < len; ++i)
+      flags[i].fetch_or(RomMap::CODE);
+    if (target != kNoTarget)
+      addEntry(an, target, flow == FLOW_CALL ? RomMap::CALL : 0, found);
+    adr += len;
+    if (flow == FLOW_JUMP || flow == FLOW_END)
+      return;
+    if (flow != FLOW_NEXT && adr - RomMap::kBase < RomMap::kSize)
+      an->flags[adr - RomMap::kBase].fetch_or(RomMap::BLOCK);
+  }
+}
+
+static void work(Analysis* an) {
+  std::unique_lock<std::mutex> lock(an->mutex);
+  for (;;) {
+    while (an->queue.empty() && an->busy > 0)
+      an->cond.wait(lock);
+    if (an->queue.empty())
+      break;  // Nobody left to find more.
+    LONG adr = an->queue.back();
+    an->queue.pop_back();
+    ++an->busy;
+    lock.unlock();
+    std::vector<LONG> found;
+    walk(an, adr, &found);
+    lock.lock();
+    --an->busy;
+    an->queue.insert(an->queue.end(), found.begin(), found.end());
+    an->cond.notify_all();
+  }
+}
+
+static std::string vectorName(int no) {
+  static const char* kNames[] = {
+    nullptr, "reset", "bus_error", "address_error", "illegal", "zero_divide", "chk", "trapv",
+    "privilege", "trace", "line_a", "line_f",
+  };
+  char name[16];
+  if (no < (int)(sizeof(kNames) / sizeof(kNames[0])))
+    return kNames[no];
+  if (no == 24)
+    snprintf(name, sizeof(name), "spurious");
+  else if (no >= 25 && no < 32)
+    snprintf(name, sizeof(name), "level_%d", no - 24);
+  else if (no >= 32 && no < 48)
+    snprintf(name, sizeof(name), "trap_%x", no - 32);
+  else
+    snprintf(name, sizeof(name), "vector_%02x", no);
+  return name;
+}
+
+RomMap::RomMap()
+  : map(kSize, 0), instructions(0), blocks(0), code(0) {
+}
+
+// Vector 1 is the reset PC; the first vector naming an address names it.
+static std::map<LONG, int> vectorEntries(const BYTE* rom) {
+  std::map<LONG, int> entries;
+  for (int no = 255; no >= 1; --no) {
+    LONG adr = read32(rom, RomMap::kResetVector + no * 4) & 0xffffff;
+    if (adr - RomMap::kBase < RomMap::kSize && (adr & 1) == 0)
+      entries[adr] = no;
+  }
+  return entries;
+}
+
+// Flags of every ROM byte into `out`, kSize bytes.
+static void analyzeFlags(const BYTE* rom, int threads, BYTE* out) {
+  Analysis an;
+  an.rom = rom;
+  an.flags = new std::atomic<BYTE>[RomMap::kSize];
+  for (LONG i = 0; i < RomMap::kSize; ++i)
+    an.flags[i].store(0, std::memory_order_relaxed);
+  an.busy = 0;
+
+  std::map<LONG, int> entries = vectorEntries(rom);
+  for (std::map<LONG, int>::const_iterator it = entries.begin(); it != entries.end(); ++it)
+    addEntry(&an, it->first, RomMap::ENTRY, &an.queue);
+
+  if (threads <= 0)
+    threads = std::max(1, (int)std::thread::hardware_concurrency());
+  std::vector<std::thread> workers;
+  for (int i = 1; i < threads; ++i)
+    workers.push_back(std::thread(work, &an));
+  work(&an);
+  for (size_t i = 0; i < workers.size(); ++i)
+    workers[i].join();
+
+  for (LONG i = 0; i < RomMap::kSize; ++i) {
+    int f = an.flags[i].load(std::memory_order_relaxed) & ~QUEUED;
+    if ((f & RomMap::INSN) == 0)
+      f &= ~(RomMap::BLOCK | RomMap::CALL | RomMap::ENTRY);  // Target that did not decode.
+    out[i] = f;
+  }
+  delete[] an.flags;
+}
+
+static void buildCached(BYTE* table, void* rom) {
+  analyzeFlags(static_cast<const BYTE*>(rom), 0, table);
+}
+
+void RomMap::analyze(const BYTE* rom, int threads) {
+  analyzeFlags(rom, threads, map.data());
+  index(rom);
+}
+
+// The flags follow from the ROM and the analysis, which changes with the
+// build.
+void RomMap::load(const BYTE* rom, const char* cacheDir, bool* hit) {
+  static const char kBuild[] = __DATE__ " " __TIME__;
+  uint64_t key = DecodeCache::hash(rom, kSize);
+  key = DecodeCache::hash(kBuild, sizeof(kBuild) - 1, key);
+  const BYTE* flags = DecodeCache::open(cacheDir, "x68emu-rommap", key, kSize, buildCached,
+                                        const_cast<BYTE*>(rom), hit);
+  std::copy(flags, flags + kSize, map.begin());
+  index(rom);
+}
+
+// Counts and names the blocks in `map`.
+void RomMap::index(const BYTE* rom) {
+  std::map<LONG, int> entries = vectorEntries(rom);
+  names.clear();
+  instructions = blocks = code = 0;
+  for (LONG i = 0; i < kSize; ++i) {
+    int f = map[i];
+    instructions += (f & INSN) != 0;
+    code += (f & CODE) != 0;
+    if ((f & BLOCK) == 0)
+      continue;
+    ++blocks;
+    LONG adr = kBase + i;
+    char name[16];
+    if ((f & ENTRY) != 0) {
+      names[adr] = vectorName(entries[adr]);
+    } else {
+      snprintf(name, sizeof(name), "%s_%06x", (f & CALL) != 0 ? "sub" : "loc", adr);
+      names[adr] = name;
+    }
+  }
+}
+
+const char* RomMap::symbol(LONG adr) const {
+  if ((flags(adr) & BLOCK) == 0)
+    return nullptr;
+  std::map<LONG, std::string>::const_iterator it = names.find(adr);
+  return it != names.end() ? it->second.c_str() : nullptr;
+}
@@ -0,0 +1,68 @@
+#ifndef __ROMMAP_H__
+#define __ROMMAP_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+
+// Code map of the IPL ROM, found statically by recursive descent from the
+// reset vector and the exception vectors. Every bsr/jsr/jmp/bra/bcc/dbcc
+// target that can be computed from the instruction alone is followed, so
+// code reached only through registers or tables in RAM stays unknown (data).
+// Entry points are shared out to worker threads, which claim instructions
+// in a common map as they decode them.
+class RomMap {
+public:
+  typedef uint8_t BYTE;
+  typedef uint16_t WORD;
+  typedef uint32_t LONG;
+
+  static const LONG kBase = 0xfe0000;
+  static const LONG kSize = 0x20000;
+  static const LONG kResetVector = 0xff0000;  // SSP, then PC.
+
+  // Flags by ROM byte.
+  enum {
+    CODE = 1 << 0,   // Part of an instruction.
+    INSN = 1 << 1,   // An instruction starts here.
+    BLOCK = 1 << 2,  // A basic block starts here.
+    CALL = 1 << 3,   // Target of bsr/jsr.
+    ENTRY = 1 << 4,  // Target of a vector.
+  };
+
+  RomMap();
+
+  // Analyses `rom`, kSize bytes mapped at kBase, on `threads` threads (0:
+  // one per CPU). Replaces any previous result.
+  void analyze(const BYTE* rom, int threads);
+  // Same on one thread per CPU, but the flags are kept in a file in
+  // `cacheDir` keyed on the ROM and the build (see decodecache.h), so the
+  // analysis runs once per ROM. `hit` tells whether the file was used.
+  void load(const BYTE* rom, const char* cacheDir, bool* hit = nullptr);
+
+  bool contains(LONG adr) const  { return adr - kBase < kSize; }
+  int flags(LONG adr) const  { return contains(adr) ? map[adr - kBase] : 0; }
+  bool isCode(LONG adr) const  { return (flags(adr) & CODE) != 0; }
+  // Label of a block start: a vector name such as "reset" or "trap_f" for
+  // entries, "sub_ffxxxx" for calls and "loc_ffxxxx" for other blocks;
+  // nullptr elsewhere.
+  const char* symbol(LONG adr) const;
+  const std::map<LONG, std::string>& symbols() const  { return names; }
+
+  int instructionCount() const  { return instructions; }
+  int blockCount() const  { return blocks; }
+  int codeBytes() const  { return code; }
+
+private:
+  void index(const BYTE* rom);
+
+  std::vector<BYTE> map;
+  std::map<LONG, std::string> names;
+  int instructions;
+  int blocks;
+  int code;
+};
+
+#endif
@@ -0,0 +1,284 @@
+#include "sasi.h"
+#include "harddisk.h"
+
+typedef SASI::BYTE BYTE;
+
+enum {
+  CMD_TEST_UNIT_READY = 0x00,
+  CMD_REZERO_UNIT = 0x01,
+  CMD_REQUEST_SENSE = 0x03,
+  CMD_FORMAT_UNIT = 0x04,
+  CMD_FORMAT_TRACK = 0x06,
+  CMD_READ = 0x08,
+  CMD_WRITE = 0x0a,
+  CMD_SEEK = 0x0b,
+  CMD_ASSIGN = 0xc2,
+};
+
+// Status port bits.
+static const BYTE STATUS_REQ = 1 << 0;
+static const BYTE STATUS_BSY = 1 << 1;
+static const BYTE STATUS_IO = 1 << 2;
+static const BYTE STATUS_CD = 1 << 3;
+static const BYTE STATUS_MSG = 1 << 4;
+
+static const BYTE STATUS_CHECK_CONDITION = 0x02;
+
+static const BYTE SENSE_WRITE_FAULT = 0x03;
+static const BYTE SENSE_NOT_READY = 0x04;
+static const BYTE SENSE_READ_ERROR = 0x11;
+static const BYTE SENSE_INVALID_COMMAND = 0x20;
+static const BYTE SENSE_ILLEGAL_ADDRESS = 0x21;
+
+// A 10MB SASI drive at 3600rpm with the CPU at 10MHz: 33 blocks a track,
+// four heads.
+static const uint32_t kCylinderBlocks = 33 * 4;
+static const uint64_t kRotationCycles = 10000000 * 60 / 3600;
+static const uint64_t kSettleCycles = 30000;
+static const uint64_t kCylinderCycles = 2000;
+static const uint64_t kByteCycles = 16;
+static const uint64_t kCommandCycles = 10000;
+
+SASI::SASI()
+  : phase(PHASE_BUS_FREE), next(PHASE_BUS_FREE), eventAt(kNever), interrupt(false), target(0),
+    unit(0), commandCount(0), status(0), dataPos(0), dataLength(0), block(0), blockCount(0),
+    writing(false) {
+  for (int i = 0; i < kUnits; ++i) {
+    sense[i] = 0;
+    cylinder[i] = 0;
+  }
+}
+
+BYTE SASI::read(uint32_t ofs, uint64_t now, Host* host) {
+  switch (ofs & 7) {
+  case 1:  // Data
+    switch (phase) {
+    case PHASE_DATA_IN: {
+      BYTE* buffer = dataBuffer(host);
+      BYTE value = buffer != nullptr ? buffer[dataPos] : 0xff;
+      if (++dataPos >= dataLength)
+        dataDone(now, host);
+      return value;
+    }
+    case PHASE_STATUS:
+      interrupt = false;
+      phase = PHASE_MESSAGE;
+      return status;
+    case PHASE_MESSAGE:
+      phase = PHASE_BUS_FREE;
+      return 0x00;
+    default:
+      return 0xff;
+    }
+  case 3: {  // Status
+    static const BYTE kStatus[] = {
+      0,                                                           // BUS FREE
+      STATUS_BSY,                                                  // SELECTION
+      STATUS_BSY | STATUS_REQ | STATUS_CD,                         // COMMAND
+      STATUS_BSY,                                                  // BUSY
+      STATUS_BSY | STATUS_REQ | STATUS_IO,                         // DATA IN
+      STATUS_BSY | STATUS_REQ,                                     // DATA OUT
+      STATUS_BSY | STATUS_REQ | STATUS_CD | STATUS_IO,             // STATUS
+      STATUS_BSY | STATUS_REQ | STATUS_MSG | STATUS_CD | STATUS_IO,  // MESSAGE
+    };
+    return kStatus[phase];
+  }
+  default:
+    return 0xff;
+  }
+}
+
+void SASI::write(uint32_t ofs, BYTE value, uint64_t now, Host* host) {
+  switch (ofs & 7) {
+  case 1:  // Data
+    if (phase == PHASE_COMMAND) {
+      command[commandCount++] = value;
+      if (commandCount >= 6)
+        execute(now, host);
+    } else if (phase == PHASE_DATA_OUT) {
+      BYTE* buffer = dataBuffer(host);
+      if (buffer != nullptr)
+        buffer[dataPos] = value;
+      if (++dataPos >= dataLength)
+        dataDone(now, host);
+    }
+    break;
+  case 3:  // Bus reset
+    phase = PHASE_BUS_FREE;
+    eventAt = kNever;
+    interrupt = false;
+    writing = false;
+    break;
+  case 5:  // SEL off
+    if (phase == PHASE_SELECTION) {
+      phase = PHASE_COMMAND;
+      commandCount = 0;
+    }
+    break;
+  case 7:  // SEL on with the target ID bit on the data lines
+    if (phase == PHASE_BUS_FREE && value != 0) {
+      int id = __builtin_ctz(value);
+      if (id * 2 + 1 < kUnits && (host->hardDisk(id * 2) != nullptr || host->hardDisk(id * 2 + 1) != nullptr)) {
+        target = id;
+        phase = PHASE_SELECTION;
+      }
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+void SASI::execute(uint64_t now, Host* host) {
+  unit = target * 2 + ((command[1] >> 5) & 1);
+  HardDisk* disk = host->hardDisk(unit);
+  uint32_t lba = ((command[1] & 0x1f) << 16) | (command[2] << 8) | command[3];
+  uint32_t count = command[4] == 0 ? 256 : command[4];
+
+  if (command[0] == CMD_REQUEST_SENSE) {
+    senseData[0] = sense[unit];
+    senseData[1] = (command[1] & 0xe0) | ((block >> 16) & 0x1f);
+    senseData[2] = block >> 8;
+    senseData[3] = block;
+    sense[unit] = 0;
+    startData(PHASE_DATA_IN, sizeof(senseData));
+    return;
+  }
+  if (disk == nullptr) {
+    finish(now + kCommandCycles, SENSE_NOT_READY);
+    return;
+  }
+  switch (command[0]) {
+  case CMD_TEST_UNIT_READY:
+  case CMD_FORMAT_UNIT:
+  case CMD_FORMAT_TRACK:
+    finish(now + kCommandCycles, 0);
+    break;
+  case CMD_REZERO_UNIT:
+    finish(now + positionCycles(0), 0);
+    break;
+  case CMD_SEEK:
+  case CMD_READ:
+  case CMD_WRITE:
+    block = lba;
+    blockCount = command[0] == CMD_SEEK ? 1 : count;
+    if (lba + blockCount > disk->blockCount()) {
+      finish(now + kCommandCycles, SENSE_ILLEGAL_ADDRESS);
+    } else if (command[0] == CMD_SEEK) {
+      finish(now + positionCycles(lba), 0);
+    } else if (command[0] == CMD_READ) {
+      // The worker reads while the heads are modeled to move.
+      host->sasiStartRead(unit, lba, count);
+      phase = PHASE_BUSY;
+      next = PHASE_DATA_IN;
+      eventAt = now + positionCycles(lba);
+    } else {
+      startData(PHASE_DATA_OUT, count * HardDisk::kBlockSize);
+      pump(now, host);
+    }
+    break;
+  case CMD_ASSIGN:  // Drive parameters, not needed for an image.
+    startData(PHASE_DATA_OUT, 10);
+    break;
+  default:
+    finish(now + kCommandCycles, SENSE_INVALID_COMMAND);
+    break;
+  }
+}
+
+void SASI::startData(Phase phase, uint32_t length) {
+  this->phase = phase;
+  dataPos = 0;
+  dataLength = length;
+}
+
+BYTE* SASI::dataBuffer(Host* host) {
+  if (command[0] == CMD_REQUEST_SENSE)
+    return senseData;
+  HardDisk* disk = host->hardDisk(unit);
+  return disk != nullptr ? disk->buffer() : nullptr;
+}
+
+void SASI::pump(uint64_t now, Host* host) {
+  if (phase != PHASE_DATA_IN && phase != PHASE_DATA_OUT)
+    return;
+  BYTE* buffer = dataBuffer(host);
+  if (buffer == nullptr)
+    return;
+  if (phase == PHASE_DATA_IN)
+    dataPos += host->sasiToMemory(buffer + dataPos, dataLength - dataPos);
+  else
+    dataPos += host->sasiFromMemory(buffer + dataPos, dataLength - dataPos);
+  if (dataPos >= dataLength)
+    dataDone(now, host);
+}
+
+// The status phase follows once the data would have passed the heads.
+void SASI::dataDone(uint64_t now, Host* host) {
+  uint64_t transfer = dataLength * kByteCycles;
+  switch (command[0]) {
+  case CMD_READ:
+    finish(now + transfer, 0);
+    break;
+  case CMD_WRITE: {
+    HardDisk* disk = host->hardDisk(unit);
+    if (disk == nullptr) {
+      finish(now + kCommandCycles, SENSE_NOT_READY);
+      break;
+    }
+    host->sasiWrite(unit, block, blockCount);
+    writing = true;
+    finish(now + positionCycles(block) + transfer, 0);
+    break;
+  }
+  default:
+    finish(now, 0);
+    break;
+  }
+}
+
+void SASI::finish(uint64_t at, BYTE code) {
+  sense[unit] = code;
+  status = (code != 0 ? STATUS_CHECK_CONDITION : 0) | (command[1] & 0xe0);
+  phase = PHASE_BUSY;
+  next = PHASE_STATUS;
+  eventAt = at;
+}
+
+void SASI::update(uint64_t now, Host* host) {
+  if (eventAt > now)
+    return;
+  eventAt = kNever;
+  if (next == PHASE_STATUS) {
+    // A write the image did not take ends in CHECK CONDITION.
+    if (writing) {
+      writing = false;
+      if (host->hardDisk(unit) == nullptr || !host->sasiFinishWrite(unit)) {
+        sense[unit] = SENSE_WRITE_FAULT;
+        status = STATUS_CHECK_CONDITION | (command[1] & 0xe0);
+      }
+    }
+    phase = PHASE_STATUS;
+    interrupt = true;
+    return;
+  }
+  HardDisk* disk = host->hardDisk(unit);
+  if (disk == nullptr || !host->sasiFinishRead(unit, blockCount * HardDisk::kBlockSize)) {
+    finish(now, disk == nullptr ? SENSE_NOT_READY : SENSE_READ_ERROR);
+    return;
+  }
+  startData(PHASE_DATA_IN, blockCount * HardDisk::kBlockSize);
+  pump(now, host);
+}
+
+int SASI::transferUnit() const {
+  bool data = phase == PHASE_DATA_IN || phase == PHASE_DATA_OUT;
+  return data && command[0] != CMD_REQUEST_SENSE ? unit : -1;
+}
+
+uint64_t SASI::positionCycles(uint32_t block) {
+  uint32_t cyl = block / kCylinderBlocks;
+  uint32_t distance = cyl > cylinder[unit] ? cyl - cylinder[unit] : cylinder[unit] - cyl;
+  cylinder[unit] = cyl;
+  return (distance > 0 ? kSettleCycles + distance * kCylinderCycles : 0) + kRotationCycles / 2;
+}
@@ -0,0 +1,91 @@
+#ifndef __SASI_H__
+#define __SASI_H__
+
+#include <stdint.h>
+
+class HardDisk;
+
+// SASI host interface at 0xe96000 with the controllers behind it. Unit
+// numbers are ID * 2 + LUN.
+// A command completes at a time modeled from seek, rotation and transfer,
+// handed to the scheduler, never at the time the host disk took, so runs
+// stay deterministic. Data phases move whole blocks through DMAC channel
+// 1 when it is active, and a byte at a time through the data port
+// otherwise.
+class SASI {
+public:
+  typedef uint8_t BYTE;
+
+  static const int kUnits = 16;
+  static const int kDmaChannel = 1;
+  static const uint64_t kNever = ~(uint64_t)0;
+
+  class Host {
+  public:
+    virtual ~Host() {}
+    virtual HardDisk* hardDisk(int unit) = 0;
+    // DMA channel 1; both return the bytes moved.
+    virtual uint32_t sasiToMemory(const BYTE* data, uint32_t bytes) = 0;
+    virtual uint32_t sasiFromMemory(BYTE* data, uint32_t bytes) = 0;
+    // Disk traffic of a unit, through the host so that replay can take
+    // reads from the log and leave the image alone. The read is collected
+    // into the buffer of the unit, and writes are collected for the status
+    // phase; false on an I/O error.
+    virtual void sasiStartRead(int unit, uint32_t block, uint32_t count) = 0;
+    virtual bool sasiFinishRead(int unit, uint32_t bytes) = 0;
+    virtual void sasiWrite(int unit, uint32_t block, uint32_t count) = 0;
+    virtual bool sasiFinishWrite(int unit) = 0;
+  };
+
+  SASI();
+
+  BYTE read(uint32_t ofs, uint64_t now, Host* host);
+  void write(uint32_t ofs, BYTE value, uint64_t now, Host* host);
+
+  // Moves data phase bytes through the DMAC, for when a channel starts.
+  void pump(uint64_t now, Host* host);
+  void update(uint64_t now, Host* host);
+  uint64_t nextEvent() const  { return eventAt; }
+  bool irq() const  { return interrupt; }
+  // Unit whose buffer holds a data phase under way, -1 if none.
+  int transferUnit() const;
+
+private:
+  enum Phase {
+    PHASE_BUS_FREE,
+    PHASE_SELECTION,
+    PHASE_COMMAND,
+    PHASE_BUSY,  // Executing, no REQ.
+    PHASE_DATA_IN,
+    PHASE_DATA_OUT,
+    PHASE_STATUS,
+    PHASE_MESSAGE,
+  };
+
+  void execute(uint64_t now, Host* host);
+  void startData(Phase phase, uint32_t length);
+  BYTE* dataBuffer(Host* host);
+  void dataDone(uint64_t now, Host* host);
+  void finish(uint64_t at, BYTE code);
+  uint64_t positionCycles(uint32_t block);
+
+  Phase phase;
+  Phase next;         // Entered at eventAt.
+  uint64_t eventAt;
+  bool interrupt;     // Status phase until the status byte is read.
+  int target;         // Selected ID.
+  int unit;
+  BYTE command[6];
+  int commandCount;
+  BYTE status;
+  BYTE sense[kUnits];
+  BYTE senseData[4];  // REQUEST SENSE reply.
+  uint32_t dataPos;
+  uint32_t dataLength;
+  uint32_t block;
+  uint32_t blockCount;
+  uint32_t cylinder[kUnits];  // Head position for the seek model.
+  bool writing;       // The status waits for a write.
+};
+
+#endif
@@ -0,0 +1,51 @@
+#include "scheduler.h"
+
+Scheduler::Scheduler() {
+  for (int i = 0; i < EVENT_COUNT; ++i)
+    times[i] = kNever;
+  next = kNever;
+}
+
+void Scheduler::schedule(int id, uint64_t time) {
+  times[id] = time;
+  if (time < next)
+    next = time;
+  else
+    updateNext();
+}
+
+void Scheduler::cancel(int id) {
+  times[id] = kNever;
+  updateNext();
+}
+
+int Scheduler::pop(uint64_t now, uint64_t* pTime) {
+  if (next > now)
+    return -1;
+  for (int i = 0; i < EVENT_COUNT; ++i) {
+    if (times[i] == next) {
+      *pTime = times[i];
+      times[i] = kNever;
+      updateNext();
+      return i;
+    }
+  }
+  return -1;
+}
+
+int Scheduler::queueDepth() const {
+  int n = 0;
+  for (int i = 0; i < EVENT_COUNT; ++i) {
+    if (times[i] != kNever)
+      ++n;
+  }
+  return n;
+}
+
+void Scheduler::updateNext() {
+  next = kNever;
+  for (int i = 0; i < EVENT_COUNT; ++i) {
+    if (times[i] < next)
+      next = times[i];
+  }
+}
@@ -0,0 +1,43 @@
+#ifndef __SCHEDULER_H__
+#define __SCHEDULER_H__
+
+#include <stdint.h>
+
+// Event timetable in CPU cycles.
+// Each event source owns a fixed id and has at most one armed event, so the
+// table is a plain value which can be copied together with the machine.
+class Scheduler {
+public:
+  static const uint64_t kNever = ~(uint64_t)0;
+
+  enum EventId {
+    EVENT_MFP,
+    EVENT_CRTC,
+    EVENT_DMAC,
+    EVENT_OPM,
+    EVENT_ADPCM,
+    EVENT_FDC,
+    EVENT_SASI,
+    EVENT_COUNT
+  };
+
+  Scheduler();
+
+  // Arms `id` at cycle `time`, replacing any event already armed for it.
+  void schedule(int id, uint64_t time);
+  void cancel(int id);
+
+  uint64_t nextTime() const  { return next; }
+  // Disarms and returns the earliest event due at `now`, or -1.
+  int pop(uint64_t now, uint64_t* pTime);
+
+  int queueDepth() const;
+
+private:
+  void updateNext();
+
+  uint64_t times[EVENT_COUNT];
+  uint64_t next;
+};
+
+#endif
@@ -0,0 +1,230 @@
+#include "sprite.h"
+#include <string.h>
+
+typedef SpriteController::BYTE BYTE;
+typedef SpriteController::WORD WORD;
+
+static const uint32_t BG_REGS = 0x800;
+static const uint32_t BG_CONTROL = 0x808;
+static const WORD BG_DISPLAY_ON = 1 << 9;
+static const uint32_t kBgTextOfs[] = {0x4000, 0x6000};  // In PCG RAM.
+
+static void readHalf(WORD value, uint32_t ofs, BYTE* out) {
+  *out = (ofs & 1) == 0 ? value >> 8 : value;
+}
+
+static void writeHalf(WORD* r, uint32_t ofs, BYTE value) {
+  if ((ofs & 1) == 0)
+    *r = (value << 8) | (*r & 0x00ff);
+  else
+    *r = (*r & 0xff00) | value;
+}
+
+SpriteController::SpriteController() {
+  memset(&regs, 0, sizeof(regs));
+  forkRegs = regs;
+  pcg = new PageStore(kPcgSize);
+  rebuildLines();
+  memset(valid16, 0, sizeof(valid16));
+  memset(valid8, 0, sizeof(valid8));
+}
+
+SpriteController::SpriteController(SpriteController* parent) {
+  regs = forkRegs = parent->regs;
+  pcg = new PageStore(parent->pcg);
+  rebuildLines();
+  memset(valid16, 0, sizeof(valid16));
+  memset(valid8, 0, sizeof(valid8));
+}
+
+SpriteController::~SpriteController() {
+  delete pcg;
+}
+
+void SpriteController::rewind() {
+  regs = forkRegs;
+  pcg->rewind();
+  rebuildLines();
+  memset(valid16, 0, sizeof(valid16));
+  memset(valid8, 0, sizeof(valid8));
+}
+
+BYTE SpriteController::read8(uint32_t ofs) const {
+  BYTE value = 0;
+  if (ofs < kSprites * 8) {
+    const Sprite& s = regs.sprites[ofs >> 3];
+    const WORD fields[] = {s.x, s.y, s.control, s.priority};
+    readHalf(fields[(ofs >> 1) & 3], ofs, &value);
+  } else if (BG_REGS <= ofs && ofs < BG_CONTROL) {
+    readHalf(regs.bgScroll[(ofs - BG_REGS) >> 1], ofs, &value);
+  } else if ((ofs & ~1) == BG_CONTROL) {
+    readHalf(regs.bgControl, ofs, &value);
+  }
+  return value;
+}
+
+void SpriteController::write8(uint32_t ofs, BYTE value) {
+  if (ofs < kSprites * 8) {
+    int no = ofs >> 3;
+    Sprite& s = regs.sprites[no];
+    switch ((ofs >> 1) & 3) {
+    case 0:  writeHalf(&s.x, ofs, value); break;
+    case 1:
+      setLines(no, false);
+      writeHalf(&s.y, ofs, value);
+      setLines(no, true);
+      break;
+    case 2:  writeHalf(&s.control, ofs, value); break;
+    case 3:
+      setLines(no, false);
+      writeHalf(&s.priority, ofs, value);
+      setLines(no, true);
+      break;
+    }
+  } else if (BG_REGS <= ofs && ofs < BG_CONTROL) {
+    writeHalf(&regs.bgScroll[(ofs - BG_REGS) >> 1], ofs, value);
+  } else if ((ofs & ~1) == BG_CONTROL) {
+    writeHalf(&regs.bgControl, ofs, value);
+  }
+}
+
+void SpriteController::writePcg(uint32_t ofs, BYTE value) {
+  pcg->write8(ofs, value);
+  valid16[(ofs >> 7) & 0xff] = false;
+  valid8[(ofs >> 5) & 0xff] = false;
+}
+
+void SpriteController::loadRegisters(const Registers& r) {
+  regs = r;
+  rebuildLines();
+}
+
+void SpriteController::loadPcgPage(int index, const BYTE* data) {
+  memcpy(pcg->writablePage(index), data, PageStore::kPageSize);
+  uint32_t start = index << PageStore::kPageShift;
+  for (uint32_t ofs = start; ofs < start + PageStore::kPageSize; ofs += 32) {
+    valid16[(ofs >> 7) & 0xff] = false;
+    valid8[(ofs >> 5) & 0xff] = false;
+  }
+}
+
+// Adds or removes sprite `no` from the lines it covers.
+void SpriteController::setLines(int no, bool on) {
+  const Sprite& s = regs.sprites[no];
+  if ((s.priority & 3) == 0)
+    return;
+  uint64_t bit = (uint64_t)1 << (no & 63);
+  int top = (s.y & 0x3ff) - 16;
+  for (int y = top; y < top + 16; ++y) {
+    if (y < 0 || y >= kLines)
+      continue;
+    if (on)
+      lines[y][no >> 6] |= bit;
+    else
+      lines[y][no >> 6] &= ~bit;
+  }
+}
+
+void SpriteController::rebuildLines() {
+  memset(lines, 0, sizeof(lines));
+  for (int i = 0; i < kSprites; ++i)
+    setLines(i, true);
+}
+
+// 16x16 patterns are stored as four 8x8 blocks: upper left, lower left,
+// upper right, lower right, 4 bits per pixel.
+const BYTE* SpriteController::pattern16(int no) {
+  BYTE* dst = decoded16[no];
+  if (!valid16[no]) {
+    for (int block = 0; block < 4; ++block) {
+      uint32_t ofs = no * 128 + block * 32;
+      int bx = (block >> 1) * 8;
+      int by = (block & 1) * 8;
+      for (int i = 0; i < 32; ++i) {
+        BYTE b = pcg->read8(ofs + i);
+        BYTE* p = dst + (by + (i >> 2)) * 16 + bx + (i & 3) * 2;
+        p[0] = b >> 4;
+        p[1] = b & 0x0f;
+      }
+    }
+    valid16[no] = true;
+  }
+  return dst;
+}
+
+const BYTE* SpriteController::pattern8(int no) {
+  BYTE* dst = decoded8[no];
+  if (!valid8[no]) {
+    for (int i = 0; i < 32; ++i) {
+      BYTE b = pcg->read8(no * 32 + i);
+      dst[i * 2] = b >> 4;
+      dst[i * 2 + 1] = b & 0x0f;
+    }
+    valid8[no] = true;
+  }
+  return dst;
+}
+
+void SpriteController::renderLine(int y, int width, const uint32_t* palette, uint32_t* dst) {
+  memset(dst, 0, width * sizeof(*dst));
+  if ((regs.bgControl & BG_DISPLAY_ON) == 0)
+    return;
+
+  // Back to front: sprites behind both BGs, BG1, sprites between, BG0,
+  // sprites in front.
+  drawSprites(y, 1, width, palette, dst);
+  if ((regs.bgControl & (1 << 3)) != 0)
+    drawBg(1, y, width, palette, dst);
+  drawSprites(y, 2, width, palette, dst);
+  if ((regs.bgControl & (1 << 0)) != 0)
+    drawBg(0, y, width, palette, dst);
+  drawSprites(y, 3, width, palette, dst);
+}
+
+void SpriteController::drawSprites(int y, int priority, int width, const uint32_t* palette, uint32_t* dst) {
+  if (y < 0 || y >= kLines)
+    return;
+  // Higher numbers first, so that lower numbers end up in front.
+  for (int word = 1; word >= 0; --word) {
+    uint64_t bits = lines[y][word];
+    while (bits != 0) {
+      int bit = 63 - __builtin_clzll(bits);
+      bits &= ~((uint64_t)1 << bit);
+      const Sprite& s = regs.sprites[word * 64 + bit];
+      if ((s.priority & 3) != priority)
+        continue;
+
+      int row = y - ((s.y & 0x3ff) - 16);
+      if ((s.control & 0x8000) != 0)
+        row = 15 - row;
+      const BYTE* pixels = pattern16(s.control & 0xff) + row * 16;
+      const uint32_t* colors = palette + ((s.control >> 8) & 0x0f) * 16;
+      bool hflip = (s.control & 0x4000) != 0;
+      int left = (s.x & 0x3ff) - 16;
+      for (int i = 0; i < 16; ++i) {
+        int x = left + i;
+        BYTE index = pixels[hflip ? 15 - i : i];
+        if (index != 0 && 0 <= x && x < width)
+          dst[x] = colors[index];
+      }
+    }
+  }
+}
+
+void SpriteController::drawBg(int layer, int y, int width, const uint32_t* palette, uint32_t* dst) {
+  // Bits 1-2 (BG0) and 4-5 (BG1) select the cell map.
+  int text = (regs.bgControl >> (layer == 0 ? 1 : 4)) & 1;
+  int sy = (y + regs.bgScroll[layer * 2 + 1]) & 511;
+  int sx = regs.bgScroll[layer * 2];
+  uint32_t rowOfs = kBgTextOfs[text] + (sy >> 3) * 64 * 2;
+  for (int x = 0; x < width; ++x) {
+    int px = (sx + x) & 511;
+    uint32_t cellOfs = rowOfs + (px >> 3) * 2;
+    WORD cell = (pcg->read8(cellOfs) << 8) | pcg->read8(cellOfs + 1);
+    int cy = (cell & 0x8000) != 0 ? 7 - (sy & 7) : sy & 7;
+    int cx = (cell & 0x4000) != 0 ? 7 - (px & 7) : px & 7;
+    BYTE index = pattern8(cell & 0xff)[cy * 8 + cx];
+    if (index != 0)
+      dst[x] = palette[((cell >> 8) & 0x0f) * 16 + index];
+  }
+}
@@ -0,0 +1,75 @@
+#ifndef __SPRITE_H__
+#define __SPRITE_H__
+
+#include <stdint.h>
+#include "pagemem.h"
+
+// Sprite/BG controller at 0xeb0000: 128 16x16 sprites, two 64x64 cell BG
+// layers of 8x8 patterns, and PCG RAM at 0xeb8000-0xebffff which also holds
+// the BG cell maps.
+// Every display line keeps a bit set of the sprites covering it, updated
+// when a sprite moves, and patterns are decoded once per PCG change.
+class SpriteController {
+public:
+  typedef uint8_t BYTE;
+  typedef uint16_t WORD;
+
+  static const int kSprites = 128;
+  static const uint32_t kPcgBase = 0x8000;
+  static const uint32_t kPcgSize = 0x8000;
+  static const int kLines = 512;
+
+  SpriteController();
+  explicit SpriteController(SpriteController* parent);  // Fork.
+  ~SpriteController();
+
+  PageStore* store()  { return pcg; }
+
+  // Registers, `ofs` relative to 0xeb0000 below kPcgBase.
+  BYTE read8(uint32_t ofs) const;
+  void write8(uint32_t ofs, BYTE value);
+  // PCG RAM, `ofs` relative to 0xeb8000.
+  void writePcg(uint32_t ofs, BYTE value);
+
+  void rewind();
+
+  struct Sprite {
+    WORD x, y, control, priority;
+  };
+
+  struct Registers {
+    Sprite sprites[kSprites];
+    WORD bgScroll[4];  // BG0 X, BG0 Y, BG1 X, BG1 Y.
+    WORD bgControl;
+  };
+
+  // Register and PCG state transfer, for shadow copies.
+  const Registers& registers() const  { return regs; }
+  void loadRegisters(const Registers& r);
+  void loadPcgPage(int index, const BYTE* data);
+
+  // Renders sprites and BG of display line `y` to RGBA, transparent pixels
+  // at alpha 0. `palette` is the 256 entry text/sprite palette.
+  void renderLine(int y, int width, const uint32_t* palette, uint32_t* dst);
+
+private:
+  void setLines(int no, bool on);
+  void rebuildLines();
+  const BYTE* pattern16(int no);
+  const BYTE* pattern8(int no);
+  void drawSprites(int y, int priority, int width, const uint32_t* palette, uint32_t* dst);
+  void drawBg(int layer, int y, int width, const uint32_t* palette, uint32_t* dst);
+
+  Registers regs;
+  Registers forkRegs;
+  PageStore* pcg;
+  uint64_t lines[kLines][2];  // Bit n: sprite n covers the line.
+
+  // Decoded patterns, one palette index per byte.
+  BYTE decoded16[256][16 * 16];
+  BYTE decoded8[256][8 * 8];
+  bool valid16[256];
+  bool valid8[256];
+};
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef __SPSC_H__
+#define __SPSC_H__
+
+#include <stddef.h>
+#include <atomic>
+
+// Lock-free ring for one producer thread and one consumer thread.
+// `N` must be a power of two.
+template <typename T, size_t N>
+class SpscQueue {
+public:
+  SpscQueue() : head(0), tail(0) {}
+
+  // Producer side. Returns false when full.
+  bool push(const T& value) {
+    size_t t = tail.load(std::memory_order_relaxed);
+    if (t - head.load(std::memory_order_acquire) == N)
+      return false;
+    items[t & (N - 1)] = value;
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side. Returns false when empty.
+  bool pop(T* value) {
+    size_t h = head.load(std::memory_order_relaxed);
+    if (h == tail.load(std::memory_order_acquire))
+      return false;
+    *value = items[h & (N - 1)];
+    head.store(h + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool empty() const {
+    return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+  }
+  bool full() const {
+    return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire) == N;
+  }
+
+private:
+  T items[N];
+  // Apart to keep the two sides off each other's cache line.
+  alignas(64) std::atomic<size_t> head;
+  alignas(64) std::atomic<size_t> tail;
+};
+
+#endif
@@ -0,0 +1,78 @@
+#include "sramfile.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+typedef SramFile::BYTE BYTE;
+
+SramFile::SramFile()
+  : fd(-1), map(nullptr), dirty(0) {
+}
+
+SramFile::~SramFile() {
+  close();
+}
+
+bool SramFile::open(const char* path) {
+  close();
+  fd = ::open(path, O_RDWR | O_CREAT, 0666);
+  if (fd == -1)
+    return false;
+  struct stat st;
+  if (fstat(fd, &st) == -1 || (st.st_size < (off_t)kSize && ftruncate(fd, kSize) == -1)) {
+    ::close(fd);
+    fd = -1;
+    return false;
+  }
+  void* p = mmap(nullptr, kSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (p == MAP_FAILED) {
+    ::close(fd);
+    fd = -1;
+    return false;
+  }
+  map = static_cast<BYTE*>(p);
+  dirty = 0;
+  return true;
+}
+
+void SramFile::close() {
+  if (map != nullptr) {
+    sync(true);
+    munmap(map, kSize);
+    map = nullptr;
+  }
+  if (fd != -1)
+    ::close(fd);
+  fd = -1;
+}
+
+void SramFile::update(int index, const BYTE* page) {
+  BYTE* p = map + index * kPageSize;
+  if (memcmp(p, page, kPageSize) != 0) {
+    memcpy(p, page, kPageSize);
+    dirty |= 1 << index;
+  }
+}
+
+// Adjacent pages go out in one msync, widened to host pages.
+void SramFile::sync(bool wait) {
+  static const int kPages = kSize / kPageSize;
+  size_t hostPage = sysconf(_SC_PAGESIZE);
+  for (int i = 0; i < kPages; ) {
+    if ((dirty & (1 << i)) == 0) {
+      ++i;
+      continue;
+    }
+    int start = i;
+    while (i < kPages && (dirty & (1 << i)) != 0)
+      ++i;
+    size_t from = start * kPageSize / hostPage * hostPage;
+    size_t to = i * kPageSize;
+    if (msync(map + from, to - from, wait ? MS_SYNC : MS_ASYNC) == -1)
+      perror("SramFile");
+  }
+  dirty = 0;
+}
@@ -0,0 +1,37 @@
+#ifndef __SRAMFILE_H__
+#define __SRAMFILE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Battery backed SRAM kept in a file mapped MAP_SHARED. The machine copies
+// pages in only when it flushes, so guest writes cost nothing here, and
+// msync then covers just the pages that changed.
+class SramFile {
+public:
+  typedef uint8_t BYTE;
+
+  static const size_t kSize = 0x4000;
+  static const size_t kPageSize = 0x1000;
+
+  SramFile();
+  ~SramFile();
+
+  // Maps `path`, creating or extending it to kSize with zeros.
+  bool open(const char* path);
+  // Syncs and unmaps.
+  void close();
+
+  const BYTE* data() const  { return map; }
+  // Copies page `index` into the mapping if it differs.
+  void update(int index, const BYTE* page);
+  // Writes the updated pages back; `wait` waits for the disk.
+  void sync(bool wait);
+
+private:
+  int fd;
+  BYTE* map;
+  uint32_t dirty;  // Bit per page.
+};
+
+#endif
@@ -0,0 +1,79 @@
+#include "statspage.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#include <new>
+
+static const uint64_t kRateInterval = 1000000000;  // ns
+
+static uint64_t now(clockid_t clock) {
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+StatsPage::StatsPage()
+  : layout(nullptr), rateTime(0), rateCycles(0) {
+  path[0] = '\0';
+}
+
+StatsPage::~StatsPage() {
+  close();
+}
+
+bool StatsPage::open() {
+  close();
+  snprintf(path, sizeof(path), "%s/%s%d", kDir, kPrefix, (int)getpid());
+  int fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1)
+    return false;
+  void* p = MAP_FAILED;
+  if (ftruncate(fd, sizeof(Layout)) != -1)
+    p = mmap(nullptr, sizeof(Layout), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (p == MAP_FAILED) {
+    unlink(path);
+    return false;
+  }
+  layout = new (p) Layout();
+  layout->version = kVersion;
+  layout->pid = getpid();
+  layout->reserved = 0;
+  rateTime = now(CLOCK_MONOTONIC);
+  rateCycles = 0;
+  // Readers check the magic last.
+  std::atomic_thread_fence(std::memory_order_release);
+  layout->magic = kMagic;
+  return true;
+}
+
+void StatsPage::close() {
+  if (layout == nullptr)
+    return;
+  munmap(layout, sizeof(Layout));
+  unlink(path);
+  layout = nullptr;
+}
+
+void StatsPage::publish(const Sample& sample) {
+  if (layout == nullptr)
+    return;
+  static const std::memory_order kRelaxed = std::memory_order_relaxed;
+  uint64_t time = now(CLOCK_MONOTONIC);
+  if (time - rateTime >= kRateInterval) {
+    layout->khz.store((sample.cycles - rateCycles) * 1000000 / (time - rateTime), kRelaxed);
+    rateTime = time;
+    rateCycles = sample.cycles;
+  }
+  layout->instructions.store(sample.instructions, kRelaxed);
+  layout->cycles.store(sample.cycles, kRelaxed);
+  layout->frames.store(sample.frames, kRelaxed);
+  layout->pc.store(sample.pc, kRelaxed);
+  layout->queueDepth.store(sample.queueDepth, kRelaxed);
+  layout->decodeCached.store(sample.decodeCached, kRelaxed);
+  layout->blockHits.store(sample.blockHits, kRelaxed);
+  layout->blockMisses.store(sample.blockMisses, kRelaxed);
+  layout->updated.store(now(CLOCK_REALTIME), kRelaxed);
+}
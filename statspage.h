@@ -0,0 +1,65 @@
+#ifndef __STATSPAGE_H__
+#define __STATSPAGE_H__
+
+#include <stdint.h>
+#include <atomic>
+
+// Live counters of one emulator process in /dev/shm/x68emu.<pid>, read by
+// tools/x68stat. The emulator stores each field with a relaxed atomic once
+// per frame and never waits on readers; a reader sees every field whole,
+// though not all from the same instant.
+class StatsPage {
+public:
+  static const uint32_t kMagic = 0x53383658;  // "X68S"
+  static const uint32_t kVersion = 1;
+  static constexpr const char* kDir = "/dev/shm";
+  static constexpr const char* kPrefix = "x68emu.";
+
+  // Fixed layout shared with the reader; add fields at the end only, and
+  // bump kVersion when changing any.
+  struct Layout {
+    uint32_t magic;
+    uint32_t version;
+    int32_t pid;
+    uint32_t reserved;
+    std::atomic<uint64_t> updated;       // Host time of the last update, ns.
+    std::atomic<uint64_t> instructions;
+    std::atomic<uint64_t> cycles;
+    std::atomic<uint64_t> frames;
+    std::atomic<uint32_t> khz;           // Effective clock over the last second.
+    std::atomic<uint32_t> pc;
+    std::atomic<uint32_t> queueDepth;    // Scheduler events armed.
+    std::atomic<uint32_t> decodeCached;  // Decode table mapped from the cache.
+    std::atomic<uint64_t> blockHits;     // movem transfers through host memory,
+    std::atomic<uint64_t> blockMisses;   // and through the bus.
+  };
+
+  struct Sample {
+    uint64_t instructions;
+    uint64_t cycles;
+    uint64_t frames;
+    uint32_t pc;
+    int queueDepth;
+    bool decodeCached;
+    uint64_t blockHits;
+    uint64_t blockMisses;
+  };
+
+  StatsPage();
+  ~StatsPage();
+
+  // Creates the page of this process.
+  bool open();
+  // Removes it.
+  void close();
+
+  void publish(const Sample& sample);
+
+private:
+  Layout* layout;
+  char path[64];
+  uint64_t rateTime;    // Host time and cycles at the start of the
+  uint64_t rateCycles;  // current rate interval.
+};
+
+#endif
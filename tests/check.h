@@ -0,0 +1,23 @@
+#ifndef __CHECK_H__
+#define __CHECK_H__
+
+#include <stdio.h>
+
+// Minimal unit test support: CHECK() reports a failed condition and counts
+// it, and main() returns checkResult().
+static int checkFailures = 0;
+
+#define CHECK(cond) \
+  do { \
+    if (!(cond)) { \
+      fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+      ++checkFailures; \
+    } \
+  } while (0)
+
+static int checkResult(const char* name) {
+  printf("%s: %s\n", name, checkFailures == 0 ? "ok" : "FAILED");
+  return checkFailures == 0 ? 0 : 1;
+}
+
+#endif
@@ -0,0 +1,107 @@
+// DiskImage journals, merging and the write logs used by recordings.
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include "../diskimage.h"
+#include "check.h"
+
+typedef DiskImage::BYTE BYTE;
+
+static const size_t kXdfSize = 77 * 2 * 8 * 1024;  // 2HD, 1024 byte sectors.
+static const DiskImage::SectorId kFirst = {0, 0, 1, 3};
+
+// Makes a blank XDF image and returns its path.
+static std::string makeImage() {
+  char path[] = "/tmp/diskimage_test.XXXXXX";
+  int fd = mkstemp(path);
+  CHECK(fd != -1);
+  std::vector<BYTE> zero(kXdfSize);
+  CHECK(write(fd, zero.data(), zero.size()) == (ssize_t)zero.size());
+  close(fd);
+  return path;
+}
+
+static BYTE firstByte(DiskImage* disk) {
+  uint32_t size;
+  bool deleted;
+  return disk->sectorData(0, disk->findSector(0, kFirst), &size, &deleted)[0];
+}
+
+static void writeFirst(DiskImage* disk, BYTE value) {
+  BYTE data[1024];
+  memset(data, value, sizeof(data));
+  CHECK(disk->writeSector(0, disk->findSector(0, kFirst), data, false));
+}
+
+static void testJournal() {
+  std::string path = makeImage();
+  DiskImage a;
+  CHECK(a.open(path.c_str()));
+  CHECK(a.format() == DiskImage::FORMAT_XDF);
+  CHECK(a.sectorCount(0) == 8);
+  CHECK(a.sectorCount(DiskImage::kTracks + 10) == 0);
+  CHECK(a.journal().empty());
+  writeFirst(&a, 0x55);
+  CHECK(firstByte(&a) == 0x55);
+  std::string journal = a.journal();
+  CHECK(!journal.empty() && access(journal.c_str(), F_OK) == 0);
+
+  // Another instance sees the image, not the overlay, and blocks a merge.
+  DiskImage b;
+  CHECK(b.open(path.c_str()));
+  CHECK(firstByte(&b) == 0);
+  a.close(true);
+  CHECK(access(journal.c_str(), F_OK) == 0);
+  b.close(false);
+
+  // Replaying the journal brings the write back, and a merge empties it.
+  CHECK(a.open(path.c_str(), journal.c_str()));
+  CHECK(firstByte(&a) == 0x55);
+  a.close(true);
+  CHECK(access(journal.c_str(), F_OK) != 0);
+  CHECK(a.open(path.c_str()));
+  CHECK(firstByte(&a) == 0x55);
+  a.close(false);
+  unlink(path.c_str());
+}
+
+static void testReplay() {
+  std::string path = makeImage();
+  DiskImage recorded;
+  CHECK(recorded.open(path.c_str()));
+  writeFirst(&recorded, 0x11);
+  std::vector<BYTE> first, second, none;
+  recorded.takeWrites(&first);
+  CHECK(!first.empty());
+  writeFirst(&recorded, 0x22);
+  recorded.takeWrites(&second);
+  recorded.takeWrites(&none);
+  CHECK(none.empty());
+  std::string journal = recorded.journal();
+  recorded.close(false);
+  unlink(journal.c_str());
+
+  DiskImage replayed;
+  CHECK(replayed.open(path.c_str()));
+  replayed.clearWrites();
+  replayed.applyWrites(first);
+  CHECK(firstByte(&replayed) == 0x11);
+  replayed.applyWrites(second);
+  CHECK(firstByte(&replayed) == 0x22);
+  // Writes while replaying stay in memory.
+  writeFirst(&replayed, 0x33);
+  CHECK(replayed.journal().empty());
+  replayed.clearWrites();
+  CHECK(firstByte(&replayed) == 0);
+  replayed.close(false);
+  unlink(path.c_str());
+}
+
+int main() {
+  testJournal();
+  testReplay();
+  return checkResult("diskimage_test");
+}
@@ -0,0 +1,132 @@
+// Lockstep runs pass on a sound machine, and a corrupted decode table is
+// caught and located down to the instruction and the registers.
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include "../x68k.h"
+#include "check.h"
+
+typedef X68K::BYTE BYTE;
+typedef X68K::LONG LONG;
+
+static const LONG kCode = 0x1000;
+static const LONG kData = 0x10000;
+static const int kMovem = 0x4cd1;  // movem.l (a1),d0-d1
+static const int kDbra = 0x51cf;   // dbra d7
+
+static bool readIpl(std::vector<uint8_t>* ipl) {
+  FILE* fp = fopen("X68BIOSE/IPLROM.DAT", "rb");
+  ipl->resize(0x20000);
+  bool ok = fp != nullptr && fread(ipl->data(), ipl->size(), 1, fp) == 1;
+  if (fp != nullptr)
+    fclose(fp);
+  return ok;
+}
+
+// The only file in `dir`.
+static std::string cacheFile(const char* dir) {
+  std::string path;
+  DIR* d = opendir(dir);
+  for (struct dirent* e; d != nullptr && (e = readdir(d)) != nullptr; ) {
+    if (e->d_name[0] != '.')
+      path = std::string(dir) + "/" + e->d_name;
+  }
+  if (d != nullptr)
+    closedir(d);
+  return path;
+}
+
+// Gives `op` the kind of `like` in the mapped table, which every machine
+// and fork decodes through. The table is the end of the file.
+static bool corruptTable(const std::string& path, int op, int like) {
+  int fd = open(path.c_str(), O_RDWR);
+  if (fd == -1)
+    return false;
+  off_t table = lseek(fd, 0, SEEK_END) - 0x10000;
+  BYTE kind;
+  bool ok = pread(fd, &kind, 1, table + like) == 1 && pwrite(fd, &kind, 1, table + op) == 1;
+  close(fd);
+  return ok;
+}
+
+// Runs `x68k` in lockstep with stdout and stderr going to `out`.
+static MC68K::StopReason runCaptured(X68K* x68k, long count, long interval, std::string* out) {
+  char path[] = "/tmp/lockstep_test.XXXXXX";
+  int fd = mkstemp(path);
+  fflush(stdout);
+  fflush(stderr);
+  int savedOut = dup(1), savedErr = dup(2);
+  dup2(fd, 1);
+  dup2(fd, 2);
+  MC68K::StopReason reason = x68k->runLockstep(count, interval);
+  fflush(stdout);
+  fflush(stderr);
+  dup2(savedOut, 1);
+  dup2(savedErr, 2);
+  close(savedOut);
+  close(savedErr);
+  out->clear();
+  char buf[4096];
+  ssize_t n;
+  lseek(fd, 0, SEEK_SET);
+  while ((n = read(fd, buf, sizeof(buf))) > 0)
+    out->append(buf, n);
+  close(fd);
+  unlink(path);
+  return reason;
+}
+
+int main() {
+  char dir[] = "/tmp/lockstep_test.XXXXXX";
+  if (mkdtemp(dir) == nullptr)
+    return 1;
+  MC68K::initDecoder(dir);
+  std::vector<uint8_t> ipl;
+  if (!readIpl(&ipl)) {
+    fprintf(stderr, "Cannot read X68BIOSE/IPLROM.DAT\n");
+    return 1;
+  }
+  static const BYTE kProgram[] = {
+    kMovem >> 8, kMovem & 0xff, 0x00, 0x03,  // movem.l (a1),d0-d1
+    0xd4, 0x80,                              // add.l d0,d2
+    kDbra >> 8, kDbra & 0xff, 0xff, 0xf8,    // dbra d7,$1000
+  };
+  static const BYTE kValues[] = {0x12, 0x34, 0x56, 0x78, 0x9a, 0xbc, 0xde, 0xf0};
+  X68K x68k(ipl.data());
+  x68k.setTrace(false);
+  x68k.writeBlock(kCode, kProgram, sizeof(kProgram));
+  x68k.writeBlock(kData, kValues, sizeof(kValues));
+  x68k.pc = kCode;
+  x68k.a[7] = 0x8000;
+  x68k.a[1] = kData;
+  x68k.d[7].l = 0xffff;
+
+  std::string report;
+  CHECK(runCaptured(&x68k, 3000, 100, &report) == MC68K::STOP_NONE);
+  CHECK(report.empty());
+  CHECK(x68k.lockstepChecked() > 0);
+  CHECK(x68k.d[0].l == 0x12345678 && x68k.d[1].l == 0x9abcdef0);
+
+  // The fast path now runs the movem as a dbra on d1, which reads the same
+  // extension word and ends the block there.
+  std::string path = cacheFile(dir);
+  CHECK(corruptTable(path, kMovem, kDbra));
+  x68k.d[0].l = x68k.d[1].l = 0;
+  CHECK(runCaptured(&x68k, 3000, 1, &report) == MC68K::STOP_DIVERGED);
+  CHECK(report.find("at $001000") != std::string::npos);
+  CHECK(report.find("D0 00000000, reference 12345678") != std::string::npos);
+  CHECK(report.find("D1 0000ffff, reference 9abcdef0") != std::string::npos);
+  CHECK(report.find("movem.l") != std::string::npos);
+  if (checkFailures != 0)
+    fprintf(stderr, "%s", report.c_str());
+
+  unlink(path.c_str());
+  rmdir(dir);
+  return checkResult("lockstep_test");
+}
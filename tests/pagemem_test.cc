@@ -0,0 +1,114 @@
+// PageStore copy-on-write forks, rewind and write generations.
+#include <string.h>
+
+#include "../pagemem.h"
+#include "check.h"
+
+static const int kPages = 4;
+
+// Records which pages were reported and whether they were writable then.
+class Recorder : public PageStore::Observer {
+public:
+  explicit Recorder(PageStore* store) : store(store)  { clear(); }
+  virtual void pageRemapped(int pageNo) override {
+    notified[pageNo] = true;
+    writable[pageNo] = store->isWritable(pageNo);
+  }
+  void clear() {
+    memset(notified, 0, sizeof(notified));
+    memset(writable, 0, sizeof(writable));
+  }
+
+  PageStore* store;
+  bool notified[kPages];
+  bool writable[kPages];
+};
+
+static void testFork() {
+  PageStore parent(kPages * PageStore::kPageSize);
+  parent.write8(0, 1);
+  PageStore* child = new PageStore(&parent);
+  CHECK(child->read8(0) == 1);
+  CHECK(child->page(0) == parent.page(0));
+  CHECK(!child->isDirty(0));
+
+  child->write8(0, 2);
+  CHECK(child->read8(0) == 2);
+  CHECK(parent.read8(0) == 1);
+  CHECK(child->isDirty(0));
+
+  parent.write8(PageStore::kPageSize, 3);
+  CHECK(parent.read8(PageStore::kPageSize) == 3);
+  CHECK(child->read8(PageStore::kPageSize) == 0);
+  CHECK(!child->isDirty(1));
+  CHECK(child->page(2) == parent.page(2));
+  delete child;
+  CHECK(parent.read8(0) == 1);
+}
+
+static void testRewind() {
+  PageStore parent(kPages * PageStore::kPageSize);
+  parent.write8(5, 7);
+  PageStore child(&parent);
+  child.write8(5, 8);
+  child.write8(2 * PageStore::kPageSize, 9);
+  uint32_t gen = child.advanceGeneration();
+  child.rewind();
+  CHECK(child.read8(5) == 7);
+  CHECK(child.read8(2 * PageStore::kPageSize) == 0);
+  CHECK(!child.isDirty(0) && !child.isDirty(2));
+  // Rewound pages count as written, so their consumers refresh.
+  CHECK(child.writtenSince(0, gen) && child.writtenSince(2, gen));
+  CHECK(!child.writtenSince(1, gen));
+  child.write8(5, 10);
+  CHECK(child.read8(5) == 10 && parent.read8(5) == 7);
+}
+
+static void testGeneration() {
+  PageStore store(kPages * PageStore::kPageSize);
+  Recorder recorder(&store);
+  store.setObserver(&recorder, 0);
+  store.write8(0, 1);
+  CHECK(recorder.notified[0] && recorder.writable[0]);
+  CHECK(store.isWritable(0));
+
+  recorder.clear();
+  uint32_t gen = store.advanceGeneration();
+  CHECK(recorder.notified[0] && !recorder.writable[0]);
+  CHECK(!recorder.notified[1]);
+  CHECK(!store.writtenSince(0, gen));
+
+  store.write8(PageStore::kPageSize, 2);
+  CHECK(store.writtenSince(1, gen));
+  CHECK(!store.writtenSince(0, gen));
+  store.write8(1, 3);
+  CHECK(store.writtenSince(0, gen));
+  CHECK(store.isWritable(0));
+}
+
+// A fork takes direct write access away from its parent, and the parent
+// gets it back on the first write after the fork is gone.
+static void testLentPages() {
+  PageStore parent(kPages * PageStore::kPageSize);
+  Recorder recorder(&parent);
+  parent.setObserver(&recorder, 0);
+  parent.write8(0, 1);
+  PageStore* child = new PageStore(&parent);
+  CHECK(recorder.notified[0] && !recorder.writable[0]);
+  delete child;
+
+  recorder.clear();
+  parent.write8(0, 2);
+  CHECK(recorder.notified[0] && recorder.writable[0]);
+  recorder.clear();
+  parent.write8(0, 3);
+  CHECK(!recorder.notified[0]);
+}
+
+int main() {
+  testFork();
+  testRewind();
+  testGeneration();
+  testLentPages();
+  return checkResult("pagemem_test");
+}
@@ -0,0 +1,76 @@
+// Prints the code map and symbols found in an IPL ROM image, as the
+// emulator sees them at startup.
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#include "../rommap.h"
+
+typedef RomMap::LONG LONG;
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Code and data as address ranges.
+static void showRanges(const RomMap& map) {
+  LONG start = RomMap::kBase;
+  for (LONG adr = RomMap::kBase + 1; adr <= RomMap::kBase + RomMap::kSize; ++adr) {
+    if (adr < RomMap::kBase + RomMap::kSize && map.isCode(adr) == map.isCode(start))
+      continue;
+    printf("%06x-%06x %s\n", start, adr - 1, map.isCode(start) ? "code" : "data");
+    start = adr;
+  }
+}
+
+int main(int argc, char* argv[]) {
+  int threads = 0;
+  bool ranges = false;
+  int opt;
+  while ((opt = getopt(argc, argv, "t:m")) != -1) {
+    switch (opt) {
+    case 't':
+      threads = atoi(optarg);
+      break;
+    case 'm':
+      ranges = true;
+      break;
+    default:
+      fprintf(stderr, "Usage: %s [-t threads] [-m] [IPLROM.DAT]\n", argv[0]);
+      fprintf(stderr, "  -t  Worker threads (default one per CPU)\n");
+      fprintf(stderr, "  -m  Print code and data ranges instead of symbols\n");
+      return 1;
+    }
+  }
+  const char* path = optind < argc ? argv[optind] : "X68BIOSE/IPLROM.DAT";
+
+  std::vector<RomMap::BYTE> rom(RomMap::kSize);
+  FILE* fp = fopen(path, "rb");
+  if (fp == nullptr || fread(rom.data(), rom.size(), 1, fp) != 1) {
+    fprintf(stderr, "Cannot read %s\n", path);
+    if (fp != nullptr)
+      fclose(fp);
+    return 1;
+  }
+  fclose(fp);
+
+  RomMap map;
+  double start = now();
+  map.analyze(rom.data(), threads);
+  double elapsed = now() - start;
+
+  if (ranges) {
+    showRanges(map);
+  } else {
+    const std::map<LONG, std::string>& symbols = map.symbols();
+    for (std::map<LONG, std::string>::const_iterator it = symbols.begin(); it != symbols.end(); ++it)
+      printf("%06x %s\n", it->first, it->second.c_str());
+  }
+  fprintf(stderr, "%d instructions in %d blocks, %d of %d bytes code, %.2f ms\n",
+          map.instructionCount(), map.blockCount(), map.codeBytes(), (int)RomMap::kSize, elapsed * 1000);
+  return 0;
+}
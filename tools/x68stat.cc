@@ -0,0 +1,137 @@
+// Shows the stats pages of the running emulator instances, top-style.
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include "../statspage.h"
+
+static const std::memory_order kRelaxed = std::memory_order_relaxed;
+
+struct Instance {
+  int pid;
+  StatsPage::Layout* layout;
+};
+
+static bool alive(int pid) {
+  return kill(pid, 0) == 0 || errno != ESRCH;
+}
+
+// Maps the pages of live processes and removes those left by crashed ones.
+static std::vector<Instance> openInstances() {
+  std::vector<Instance> instances;
+  DIR* dir = opendir(StatsPage::kDir);
+  if (dir == nullptr)
+    return instances;
+  size_t prefixLength = strlen(StatsPage::kPrefix);
+  struct dirent* entry;
+  while ((entry = readdir(dir)) != nullptr) {
+    if (strncmp(entry->d_name, StatsPage::kPrefix, prefixLength) != 0)
+      continue;
+    std::string path = std::string(StatsPage::kDir) + "/" + entry->d_name;
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1)
+      continue;
+    // A page being created, or left empty by a process that died before
+    // sizing it, would fault when read.
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size < (off_t)sizeof(StatsPage::Layout)) {
+      close(fd);
+      if (!alive(atoi(entry->d_name + prefixLength)))
+        unlink(path.c_str());
+      continue;
+    }
+    void* p = mmap(nullptr, sizeof(StatsPage::Layout), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+      continue;
+    StatsPage::Layout* layout = static_cast<StatsPage::Layout*>(p);
+    if (layout->magic != StatsPage::kMagic || layout->version != StatsPage::kVersion || !alive(layout->pid)) {
+      if (layout->magic == StatsPage::kMagic && !alive(layout->pid))
+        unlink(path.c_str());
+      munmap(p, sizeof(StatsPage::Layout));
+      continue;
+    }
+    Instance instance = {layout->pid, layout};
+    instances.push_back(instance);
+  }
+  closedir(dir);
+  return instances;
+}
+
+static void closeInstances(const std::vector<Instance>& instances) {
+  for (size_t i = 0; i < instances.size(); ++i)
+    munmap(instances[i].layout, sizeof(StatsPage::Layout));
+}
+
+static void show(const std::vector<Instance>& instances) {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  uint64_t now = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+  printf("%7s %8s %14s %14s %9s %3s %6s %3s %7s %5s\n",
+         "PID", "MHz", "INSTRUCTIONS", "CYCLES", "FRAMES", "Q", "BLOCK%", "DC", "PC", "AGE");
+  uint64_t totalKhz = 0, totalInstructions = 0;
+  for (size_t i = 0; i < instances.size(); ++i) {
+    const StatsPage::Layout* s = instances[i].layout;
+    uint64_t khz = s->khz.load(kRelaxed);
+    uint64_t instructions = s->instructions.load(kRelaxed);
+    uint64_t hits = s->blockHits.load(kRelaxed);
+    uint64_t misses = s->blockMisses.load(kRelaxed);
+    uint64_t updated = s->updated.load(kRelaxed);
+    char blockRate[8] = "-";
+    if (hits + misses != 0)
+      snprintf(blockRate, sizeof(blockRate), "%.1f", hits * 100.0 / (hits + misses));
+    printf("%7d %8.2f %14llu %14llu %9llu %3u %6s %3s %06x %4.0fs\n",
+           instances[i].pid, khz / 1000.0, (unsigned long long)instructions,
+           (unsigned long long)s->cycles.load(kRelaxed), (unsigned long long)s->frames.load(kRelaxed),
+           s->queueDepth.load(kRelaxed), blockRate, s->decodeCached.load(kRelaxed) ? "yes" : "no",
+           s->pc.load(kRelaxed), updated != 0 && updated < now ? (now - updated) / 1e9 : 0.0);
+    totalKhz += khz;
+    totalInstructions += instructions;
+  }
+  printf("%zu instances, %.2f MHz, %llu instructions in total\n",
+         instances.size(), totalKhz / 1000.0, (unsigned long long)totalInstructions);
+}
+
+int main(int argc, char* argv[]) {
+  double interval = 1.0;
+  bool once = false;
+  int opt;
+  while ((opt = getopt(argc, argv, "d:1")) != -1) {
+    switch (opt) {
+    case 'd':
+      interval = atof(optarg);
+      break;
+    case '1':
+      once = true;
+      break;
+    default:
+      fprintf(stderr, "Usage: %s [-d seconds] [-1]\n", argv[0]);
+      fprintf(stderr, "  -d  Refresh interval (default 1)\n");
+      fprintf(stderr, "  -1  Print once and exit\n");
+      return 1;
+    }
+  }
+
+  for (;;) {
+    std::vector<Instance> instances = openInstances();
+    if (!once)
+      printf("\033[H\033[2J");
+    show(instances);
+    closeInstances(instances);
+    if (once)
+      break;
+    fflush(stdout);
+    usleep(interval * 1000000);
+  }
+  return 0;
+}
@@ -0,0 +1,121 @@
+#include "tvram.h"
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+typedef TextVram::BYTE BYTE;
+
+// Turns `bytes` bytes of each plane into 8 * `bytes` palette indices.
+static void planesToIndices(const BYTE* const planes[4], int bytes, BYTE* indices) {
+  int i = 0;
+#ifdef __SSE2__
+  // 16 pixels per iteration: spread each plane byte over 8 lanes, test one
+  // bit per lane and merge the planes with their weights.
+  const __m128i bits = _mm_set_epi8(1, 2, 4, 8, 16, 32, 64, (char)128,
+                                    1, 2, 4, 8, 16, 32, 64, (char)128);
+  for (; i + 2 <= bytes; i += 2) {
+    __m128i index = _mm_setzero_si128();
+    for (int p = 0; p < 4; ++p) {
+      __m128i v = _mm_cvtsi32_si128(planes[p][i] | (planes[p][i + 1] << 8));
+      v = _mm_unpacklo_epi8(v, v);
+      v = _mm_unpacklo_epi16(v, v);
+      v = _mm_unpacklo_epi32(v, v);
+      v = _mm_cmpeq_epi8(_mm_and_si128(v, bits), bits);
+      index = _mm_or_si128(index, _mm_and_si128(v, _mm_set1_epi8(1 << p)));
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(indices + i * 8), index);
+  }
+#endif
+  for (; i < bytes; ++i) {
+    for (int b = 0; b < 8; ++b) {
+      int shift = 7 - b;
+      indices[i * 8 + b] = ((planes[0][i] >> shift) & 1) |
+                           (((planes[1][i] >> shift) & 1) << 1) |
+                           (((planes[2][i] >> shift) & 1) << 2) |
+                           (((planes[3][i] >> shift) & 1) << 3);
+    }
+  }
+}
+
+TextVram::TextVram() {
+  mem = new PageStore(kSize);
+  markAllDirty();
+}
+
+TextVram::TextVram(TextVram* parent) {
+  mem = new PageStore(parent->mem);
+  markAllDirty();
+}
+
+TextVram::~TextVram() {
+  delete mem;
+}
+
+void TextVram::writePlanes(uint32_t ofs, BYTE value, int planes, BYTE protect) {
+  ofs &= kPlaneSize - 1;
+  for (int p = 0; p < 4; ++p) {
+    if ((planes & (1 << p)) == 0)
+      continue;
+    uint32_t adr = p * kPlaneSize + ofs;
+    write8(adr, (read8(adr) & protect) | (value & ~protect));
+  }
+}
+
+void TextVram::rasterCopy(int src, int dst, int planes) {
+  // A raster unit never crosses a page, so each plane is a single move.
+  static const uint32_t kUnitBytes = kLineBytes * 4;
+  uint32_t srcOfs = (src & 0xff) * kUnitBytes;
+  uint32_t dstOfs = (dst & 0xff) * kUnitBytes;
+  for (int p = 0; p < 4; ++p) {
+    if ((planes & (1 << p)) == 0)
+      continue;
+    uint32_t s = p * kPlaneSize + srcOfs;
+    uint32_t d = p * kPlaneSize + dstOfs;
+    BYTE* to = mem->writablePage(d >> PageStore::kPageShift) + (d & PageStore::kPageMask);
+    const BYTE* from = mem->page(s >> PageStore::kPageShift) + (s & PageStore::kPageMask);
+    memmove(to, from, kUnitBytes);
+  }
+  for (int i = 0; i < 4; ++i)
+    markDirty((dst & 0xff) * 4 + i);
+}
+
+void TextVram::loadPage(int index, const BYTE* data) {
+  memcpy(mem->writablePage(index), data, PageStore::kPageSize);
+  int first = (index << PageStore::kPageShift) / kLineBytes;
+  for (int i = 0; i < (int)(PageStore::kPageSize / kLineBytes); ++i)
+    markDirty(first + i);
+}
+
+void TextVram::rewind() {
+  mem->rewind();
+  markAllDirty();
+}
+
+void TextVram::markAllDirty() {
+  memset(dirty, 1, sizeof(dirty));
+}
+
+void TextVram::render(uint32_t* frame, int pitch, int width, int height,
+                      int scrollX, int scrollY, const uint32_t* palette) {
+  for (int y = 0; y < height; ++y) {
+    int line = (scrollY + y) & (kLines - 1);
+    if (dirty[line] == 0)
+      continue;
+    convertLine(line, scrollX, width, palette, frame + y * pitch);
+    dirty[line] = 0;
+  }
+}
+
+void TextVram::convertLine(int line, int scrollX, int width, const uint32_t* palette, uint32_t* dst) const {
+  const BYTE* planes[4];
+  for (int p = 0; p < 4; ++p) {
+    uint32_t ofs = p * kPlaneSize + line * kLineBytes;
+    planes[p] = mem->page(ofs >> PageStore::kPageShift) + (ofs & PageStore::kPageMask);
+  }
+
+  BYTE indices[kWidth];
+  planesToIndices(planes, kLineBytes, indices);
+  for (int x = 0; x < width; ++x)
+    dst[x] = palette[indices[(scrollX + x) & (kWidth - 1)]];
+}
@@ -0,0 +1,57 @@
+#ifndef __TVRAM_H__
+#define __TVRAM_H__
+
+#include <stdint.h>
+#include "pagemem.h"
+
+// Text VRAM: four 1024x1024 bit planes of 128KB, plane n holds bit n of the
+// palette index. Writes mark the raster line dirty, and only dirty lines are
+// converted to pixels.
+class TextVram {
+public:
+  typedef uint8_t BYTE;
+
+  static const uint32_t kPlaneSize = 0x20000;
+  static const uint32_t kSize = kPlaneSize * 4;
+  static const int kLineBytes = 128;
+  static const int kLines = 1024;
+  static const int kWidth = kLineBytes * 8;
+
+  TextVram();
+  explicit TextVram(TextVram* parent);  // Fork.
+  ~TextVram();
+
+  PageStore* store()  { return mem; }
+
+  BYTE read8(uint32_t ofs) const  { return mem->read8(ofs); }
+  void write8(uint32_t ofs, BYTE value) {
+    mem->write8(ofs, value);
+    dirty[(ofs / kLineBytes) & (kLines - 1)] = 1;
+  }
+
+  // Write with the CRTC access mode: `value` goes to every plane in
+  // `planes`, keeping the bits set in `protect`.
+  void writePlanes(uint32_t ofs, BYTE value, int planes, BYTE protect);
+  // Copies 4-line raster unit `src` to `dst` in the selected planes.
+  void rasterCopy(int src, int dst, int planes);
+
+  // Replaces page `index` of the store, for shadow copies.
+  void loadPage(int index, const BYTE* data);
+
+  void rewind();
+  void markDirty(int line)  { dirty[line & (kLines - 1)] = 1; }
+  void markAllDirty();
+
+  // Converts the dirty lines visible in a width x height window at
+  // (scrollX, scrollY) to RGBA.
+  void render(uint32_t* frame, int pitch, int width, int height,
+              int scrollX, int scrollY, const uint32_t* palette);
+
+private:
+  void convertLine(int line, int scrollX, int width, const uint32_t* palette, uint32_t* dst) const;
+
+  PageStore* mem;
+  BYTE dirty[kLines];
+};
+
+#endif
@@ -0,0 +1,111 @@
+#include "video.h"
+
+typedef VideoController::BYTE BYTE;
+typedef VideoController::WORD WORD;
+
+static const uint32_t R0_OFS = 0x400;
+static const uint32_t R1_OFS = 0x500;
+static const uint32_t R2_OFS = 0x600;
+
+static void writeHalf(VideoController::WORD* r, uint32_t ofs, BYTE value) {
+  if ((ofs & 1) == 0)
+    *r = (value << 8) | (*r & 0x00ff);
+  else
+    *r = (*r & 0xff00) | value;
+}
+
+VideoController::VideoController()
+  : r0(0), r1(0x06e4), r2(0) {
+  for (int i = 0; i < kPaletteEntries; ++i) {
+    palette[i] = 0;
+    rgba[i] = toRgba(0);
+  }
+}
+
+BYTE VideoController::read8(uint32_t ofs) const {
+  if (ofs < kPaletteEntries * 2) {
+    WORD color = palette[ofs >> 1];
+    return (ofs & 1) == 0 ? color >> 8 : color;
+  }
+  WORD r;
+  switch (ofs & ~1) {
+  case R0_OFS:  r = r0; break;
+  case R1_OFS:  r = r1; break;
+  case R2_OFS:  r = r2; break;
+  default:  return 0;
+  }
+  return (ofs & 1) == 0 ? r >> 8 : r;
+}
+
+int VideoController::write8(uint32_t ofs, BYTE value) {
+  if (ofs < kPaletteEntries * 2) {
+    int index = ofs >> 1;
+    WORD color = palette[index];
+    if ((ofs & 1) == 0)
+      color = (value << 8) | (color & 0x00ff);
+    else
+      color = (color & 0xff00) | value;
+    palette[index] = color;
+    rgba[index] = toRgba(color);
+    return index;
+  }
+  switch (ofs & ~1) {
+  case R0_OFS:  writeHalf(&r0, ofs, value); break;
+  case R1_OFS:  writeHalf(&r1, ofs, value); break;
+  case R2_OFS:  writeHalf(&r2, ofs, value); break;
+  default:  break;
+  }
+  return -1;
+}
+
+int VideoController::layerPriority(Layer layer) const {
+  static const int kShift[] = {12, 10, 8};
+  return (r1 >> kShift[layer]) & 3;
+}
+
+bool VideoController::layerOn(Layer layer) const {
+  switch (layer) {
+  case LAYER_SPRITE:  return (r2 & (1 << 6)) != 0;
+  case LAYER_TEXT:  return (r2 & (1 << 5)) != 0;
+  case LAYER_GRAPHIC:  return (r2 & 0x1f) != 0;
+  default:  return false;
+  }
+}
+
+int VideoController::graphicPages(int order[4]) const {
+  GraphicMode mode = graphicMode();
+  int count = 0;
+  for (int rank = 0; rank < 4; ++rank) {
+    int field = (r1 >> (rank * 2)) & 3;
+    int page, on;
+    switch (mode) {
+    case GRAPHIC_16:
+      page = field;
+      on = r2 & (1 << field);
+      break;
+    case GRAPHIC_256:
+      page = field >> 1;
+      on = r2 & (3 << (page * 2));
+      break;
+    default:
+      page = 0;
+      on = r2 & 0x0f;
+      break;
+    }
+    bool seen = false;
+    for (int i = 0; i < count; ++i)
+      seen = seen || order[i] == page;
+    if (on != 0 && !seen)
+      order[count++] = page;
+  }
+  return count;
+}
+
+// GGGGGRRRRRBBBBBI to RGBA in memory order.
+uint32_t VideoController::toRgba(WORD color) {
+  int i = color & 1;
+  int g = (((color >> 11) & 0x1f) << 3) | (i << 2);
+  int r = (((color >> 6) & 0x1f) << 3) | (i << 2);
+  int b = (((color >> 1) & 0x1f) << 3) | (i << 2);
+  return 0xff000000 | (b << 16) | (g << 8) | r;
+}
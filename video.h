@@ -0,0 +1,55 @@
+#ifndef __VIDEO_H__
+#define __VIDEO_H__
+
+#include <stdint.h>
+
+// Video controller: palette RAM at 0xe82000-0xe823ff and the screen mode,
+// priority and on/off registers R0-R2 at 0xe82400, 0xe82500, 0xe82600.
+// The palette holds 256 graphics entries followed by 256 text/sprite
+// entries, in the X68000 GGGGGRRRRRBBBBBI format. An RGBA copy is kept for
+// the renderers.
+class VideoController {
+public:
+  typedef uint8_t BYTE;
+  typedef uint16_t WORD;
+
+  static const int kPaletteEntries = 512;
+  static const int kTextPalette = 256;
+
+  enum GraphicMode {
+    GRAPHIC_16 = 0,     // 4 pages, low nibble of each word.
+    GRAPHIC_256 = 1,    // 2 pages, low byte of each word.
+    GRAPHIC_65536 = 3,  // 1 page, direct colour.
+  };
+
+  enum Layer {
+    LAYER_SPRITE,
+    LAYER_TEXT,
+    LAYER_GRAPHIC,
+    LAYER_COUNT
+  };
+
+  VideoController();
+
+  BYTE read8(uint32_t ofs) const;
+  // Returns the palette entry changed, or -1.
+  int write8(uint32_t ofs, BYTE value);
+
+  const uint32_t* rgbaPalette() const  { return rgba; }
+
+  GraphicMode graphicMode() const  { return static_cast<GraphicMode>(r0 & 3); }
+  // Priority of a layer, 0 is the front.
+  int layerPriority(Layer layer) const;
+  bool layerOn(Layer layer) const;
+  // Graphic pages which are on, front first. Returns the count.
+  int graphicPages(int order[4]) const;
+
+  static uint32_t toRgba(WORD color);
+
+private:
+  WORD palette[kPaletteEntries];
+  uint32_t rgba[kPaletteEntries];
+  WORD r0, r1, r2;
+};
+
+#endif
@@ -0,0 +1,218 @@
+#include "videosink.h"
+#include <string.h>
+#include <unistd.h>
+
+VideoSink::VideoSink()
+  : width(0), height(0), y4m(false), fp(nullptr), last(-1), planes(nullptr)
+  , jobHead(0), jobCount(0), quit(false)
+  , written(0), repeated(0), dropped(0) {
+  buffers[0] = buffers[1] = nullptr;
+  states[0] = states[1] = FREE;
+}
+
+VideoSink::~VideoSink() {
+  close();
+}
+
+bool VideoSink::open(const char* path, int width, int height, uint64_t fpsNum, uint64_t fpsDen) {
+  this->width = width;
+  this->height = height;
+  size_t len = strlen(path);
+  y4m = strcmp(path, "-") == 0 || (len >= 4 && strcmp(path + len - 4, ".y4m") == 0);
+  if (!y4m && !parsePattern(path)) {
+    fprintf(stderr, "%s needs one %%d or %%0Nd for the frame number\n", path);
+    return false;
+  }
+
+  if (y4m) {
+    fp = strcmp(path, "-") == 0 ? stdout : fopen(path, "wb");
+    if (fp == nullptr)
+      return false;
+    fprintf(fp, "YUV4MPEG2 W%d H%d F%llu:%llu Ip A1:1 C444\n", width, height,
+            (unsigned long long)fpsNum, (unsigned long long)fpsDen);
+  }
+
+  for (int i = 0; i < 2; ++i) {
+    buffers[i] = new uint32_t[width * height];
+    states[i] = FREE;
+  }
+  planes = new uint8_t[width * height * 3];
+  last = -1;
+  quit = false;
+  writer = std::thread(&VideoSink::writerMain, this);
+  return true;
+}
+
+void VideoSink::close() {
+  if (writer.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      quit = true;
+    }
+    cond.notify_all();
+    writer.join();
+  }
+  if (fp != nullptr) {
+    if (fp != stdout)
+      fclose(fp);
+    else
+      fflush(fp);
+    fp = nullptr;
+  }
+  for (int i = 0; i < 2; ++i) {
+    delete[] buffers[i];
+    buffers[i] = nullptr;
+  }
+  delete[] planes;
+  planes = nullptr;
+}
+
+void VideoSink::submit(const uint32_t* frame) {
+  size_t bytes = width * height * sizeof(*frame);
+  std::unique_lock<std::mutex> lock(mutex);
+  if (jobCount >= kMaxJobs) {
+    ++dropped;
+    return;
+  }
+
+  Job job;
+  // The writer only ever reads the buffers, so comparing against the last
+  // one needs no lock.
+  if (last >= 0) {
+    lock.unlock();
+    bool same = memcmp(frame, buffers[last], bytes) == 0;
+    lock.lock();
+    if (same) {
+      job.buffer = -1;
+      jobs[(jobHead + jobCount++) % kMaxJobs] = job;
+      cond.notify_one();
+      return;
+    }
+  }
+
+  int b = last == 0 ? 1 : 0;
+  if (states[b] != FREE)
+    b = 1 - b;
+  if (states[b] != FREE) {
+    ++dropped;
+    return;
+  }
+  states[b] = QUEUED;
+  lock.unlock();
+  memcpy(buffers[b], frame, bytes);
+  lock.lock();
+  last = b;
+  job.buffer = b;
+  jobs[(jobHead + jobCount++) % kMaxJobs] = job;
+  cond.notify_one();
+}
+
+void VideoSink::writerMain() {
+  for (;;) {
+    Job job;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      cond.wait(lock, [this] { return jobCount > 0 || quit; });
+      if (jobCount == 0)
+        return;
+      job = jobs[jobHead];
+      jobHead = (jobHead + 1) % kMaxJobs;
+      --jobCount;
+      if (job.buffer >= 0)
+        states[job.buffer] = WRITING;
+    }
+
+    if (job.buffer >= 0)
+      writeFrame(job.buffer);
+    else
+      writeRepeat();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (job.buffer >= 0)
+      states[job.buffer] = FREE;
+  }
+}
+
+void VideoSink::writeFrame(int buffer) {
+  bool ok = y4m ? writeY4m(buffers[buffer]) : writePpm(buffers[buffer], written);
+  if (ok)
+    ++written;
+}
+
+// Y4M has no repeat marker, so the cached planes are written again without
+// converting. PPM output links the previous file.
+void VideoSink::writeRepeat() {
+  if (written == 0)
+    return;
+  if (y4m) {
+    fputs("FRAME\n", fp);
+    fwrite(planes, 1, width * height * 3, fp);
+  } else {
+    std::string name = fileName(written);
+    if (link(fileName(written - 1).c_str(), name.c_str()) != 0)
+      perror(name.c_str());
+  }
+  ++written;
+  ++repeated;
+}
+
+bool VideoSink::writeY4m(const uint32_t* frame) {
+  int n = width * height;
+  uint8_t* y = planes;
+  uint8_t* u = planes + n;
+  uint8_t* v = planes + n * 2;
+  for (int i = 0; i < n; ++i) {
+    uint32_t c = frame[i];
+    int r = c & 0xff, g = (c >> 8) & 0xff, b = (c >> 16) & 0xff;
+    // BT.601 studio range.
+    y[i] = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+    u[i] = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+    v[i] = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+  }
+  fputs("FRAME\n", fp);
+  return fwrite(planes, 1, n * 3, fp) == (size_t)(n * 3);
+}
+
+bool VideoSink::writePpm(const uint32_t* frame, uint64_t no) {
+  std::string name = fileName(no);
+  FILE* out = fopen(name.c_str(), "wb");
+  if (out == nullptr) {
+    perror(name.c_str());
+    return false;
+  }
+  int n = width * height;
+  for (int i = 0; i < n; ++i) {
+    planes[i * 3] = frame[i];
+    planes[i * 3 + 1] = frame[i] >> 8;
+    planes[i * 3 + 2] = frame[i] >> 16;
+  }
+  fprintf(out, "P6\n%d %d\n255\n", width, height);
+  bool ok = fwrite(planes, 1, n * 3, out) == (size_t)(n * 3);
+  fclose(out);
+  return ok;
+}
+
+// The name is used as given apart from the one number conversion, so it
+// never reaches printf.
+bool VideoSink::parsePattern(const char* path) {
+  const char* percent = strchr(path, '%');
+  if (percent == nullptr)
+    return false;
+  const char* p = percent + 1;
+  digits = 0;
+  if (*p == '0') {
+    while (*p >= '0' && *p <= '9' && digits <= 20)
+      digits = digits * 10 + (*p++ - '0');
+  }
+  if (*p != 'd' || digits > 20 || strchr(p, '%') != nullptr)
+    return false;
+  prefix.assign(path, percent);
+  suffix = p + 1;
+  return true;
+}
+
+std::string VideoSink::fileName(uint64_t no) const {
+  char number[24];
+  snprintf(number, sizeof(number), "%0*llu", digits, (unsigned long long)no);
+  return prefix + number + suffix;
+}
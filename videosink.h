@@ -0,0 +1,77 @@
+#ifndef __VIDEOSINK_H__
+#define __VIDEOSINK_H__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Headless frame output: a Y4M stream or numbered PPM files.
+// submit() only copies the frame into a free buffer of a double buffer;
+// conversion and file I/O happen on a dedicated thread. A frame equal to
+// the previous one is passed on as a repeat without copying.
+class VideoSink {
+public:
+  VideoSink();
+  ~VideoSink();
+
+  // `path` ending with ".y4m" or "-" (stdout) writes a Y4M stream, anything
+  // else is a pattern for PPM file names with one %d or %0Nd for the frame
+  // number, e.g. "out/%05d.ppm".
+  // Frame rate is fps_num/fps_den.
+  bool open(const char* path, int width, int height, uint64_t fpsNum, uint64_t fpsDen);
+  void close();
+
+  // Called from the CPU thread at vsync. Never waits for the disk; drops
+  // the frame if the writer is still busy with both buffers.
+  void submit(const uint32_t* frame);
+
+  uint64_t framesWritten() const  { return written; }
+  uint64_t framesRepeated() const  { return repeated; }
+  uint64_t framesDropped() const  { return dropped; }
+
+private:
+  enum BufferState {
+    FREE,
+    QUEUED,
+    WRITING,
+  };
+
+  struct Job {
+    int buffer;  // -1 for a repeat of the previous frame.
+  };
+
+  void writerMain();
+  void writeFrame(int buffer);
+  void writeRepeat();
+  bool writeY4m(const uint32_t* frame);
+  bool writePpm(const uint32_t* frame, uint64_t no);
+  bool parsePattern(const char* path);
+  std::string fileName(uint64_t no) const;
+
+  int width, height;
+  bool y4m;
+  std::string prefix, suffix;  // PPM names, around the number.
+  int digits;                  // Zero padded to.
+  FILE* fp;
+
+  uint32_t* buffers[2];
+  BufferState states[2];
+  int last;  // Buffer holding the last submitted frame, or -1.
+  uint8_t* planes;  // Y4M conversion area.
+
+  // Ring of pending jobs, guarded by `mutex`.
+  static const int kMaxJobs = 64;
+  Job jobs[kMaxJobs];
+  int jobHead, jobCount;
+  bool quit;
+  std::mutex mutex;
+  std::condition_variable cond;
+  std::thread writer;
+
+  uint64_t written, repeated, dropped;
+};
+
+#endif
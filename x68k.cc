@@ -1,35 +1,1221 @@
 #include "x68k.h"
 #include <assert.h>
 #include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include "audiothread.h"
+#include "decodecache.h"
+#include "diskimage.h"
+#include "harddisk.h"
+#include "recording.h"
+#include "renderthread.h"
+#include "rommap.h"
+#include "sramfile.h"
+#include "statspage.h"
 
 typedef MC68K::BYTE BYTE;
+typedef MC68K::WORD WORD;
 
-X68K::X68K(const uint8_t* ipl) {
+static const int SPURIOUS_VECTOR = 24;
+
+static const BYTE kZeroPage[PageStore::kPageSize] = {};
+
+static const MC68K::LONG kSramAdr = 0xed0000;
+static const BYTE kSramUnlock = 0x31;
+static const uint64_t kSramFlushFrames = 60;
+
+static const MC68K::WORD kTrap15 = 0x4e4f;
+
+X68K::X68K(const uint8_t* ipl, const uint8_t* cgrom) {
   this->ipl = ipl;
-  mem = new BYTE[0x10000];
-  sram = new BYTE[0x4000];
+  this->cgrom = cgrom;
+  mem = new PageStore(kRamSize);
+  sram = new PageStore(0x4000);
+  tvram = new TextVram();
+  gvram = new GraphicVram();
+  sprite = new SpriteController();
+  frame = new uint32_t[kFrameWidth * kFrameHeight];
+  renderer = nullptr;
+  snapshot = nullptr;
+  renderThread = nullptr;
+  audioThread = nullptr;
+  memset(disks, 0, sizeof(disks));
+  memset(hardDisks, 0, sizeof(hardDisks));
+  sramFile = nullptr;
+  sramGeneration = 0;
+  romMap = nullptr;
+  statsPage = nullptr;
+  statsFrames = 0;
+  dosHandler = nullptr;
+  iocsHandler = nullptr;
+  iocsCheck = false;
+  hostUses = 0;
+  checkedIntervals = skippedIntervals = 0;
+  recording = nullptr;
+  replaying = false;
+  nextEvent = 0;
+  nextTransfer = 0;
+  keyframeAt = -1;
+  for (int i = 0; i < AREA_COUNT; ++i)
+    keyframeGeneration[i] = 1;  // Everything written since power on.
+  memset(videoGeneration, 0, sizeof(videoGeneration));
+  forked = false;
+  mapMemory();
+  devices.vdisp = false;
+  devices.frames = 0;
+  devices.ppiPortC = 0x0b;
+  devices.sramWritable = false;
+  syncCrtc(cycles);
+  syncOpm();
 
   setSp((ipl[0x10000] << 24) | (ipl[0x10001] << 16) | (ipl[0x10002] << 8) | ipl[0x10003]);
   setPc((ipl[0x10004] << 24) | (ipl[0x10005] << 16) | (ipl[0x10006] << 8) | ipl[0x10007]);
 }
 
+X68K::X68K(X68K* parent)
+  : devices(parent->devices), forkDevices(parent->devices) {
+  ipl = parent->ipl;
+  cgrom = parent->cgrom;
+  mem = new PageStore(parent->mem);
+  sram = new PageStore(parent->sram);
+  tvram = new TextVram(parent->tvram);
+  gvram = new GraphicVram(parent->gvram);
+  sprite = new SpriteController(parent->sprite);
+  frame = new uint32_t[kFrameWidth * kFrameHeight];
+  renderer = nullptr;
+  snapshot = nullptr;
+  renderThread = nullptr;
+  audioThread = nullptr;
+  memset(disks, 0, sizeof(disks));
+  memset(hardDisks, 0, sizeof(hardDisks));
+  sramFile = nullptr;
+  sramGeneration = 0;
+  romMap = parent->romMap;
+  statsPage = nullptr;
+  statsFrames = 0;
+  dosHandler = nullptr;
+  iocsHandler = nullptr;
+  iocsCheck = false;
+  hostUses = 0;
+  checkedIntervals = skippedIntervals = 0;
+  recording = nullptr;
+  replaying = false;
+  nextEvent = 0;
+  nextTransfer = 0;
+  keyframeAt = -1;
+  for (int i = 0; i < AREA_COUNT; ++i)
+    keyframeGeneration[i] = 1;  // Everything written since power on.
+  memset(videoGeneration, 0, sizeof(videoGeneration));
+  forked = true;
+  mapMemory();
+
+  parent->saveContext(&forkContext);
+  loadContext(forkContext);
+  syncEvents();
+}
+
 X68K::~X68K() {
-  delete[] mem;
-  delete[] sram;
+  delete mem;
+  delete sram;
+  delete tvram;
+  delete gvram;
+  delete sprite;
+  delete[] frame;
+  delete renderer;
+  delete snapshot;
+}
+
+X68K* X68K::fork() {
+  return new X68K(this);
+}
+
+void X68K::rewind() {
+  assert(forked);
+  mem->rewind();
+  sram->rewind();
+  tvram->rewind();
+  gvram->rewind();
+  sprite->rewind();
+  loadContext(forkContext);
+  devices = forkDevices;
+  syncEvents();
+}
+
+void X68K::mapMemory() {
+  for (int i = 0; i < kPageCount; ++i) {
+    pages[i].read = nullptr;
+    pages[i].write = nullptr;
+    pages[i].host = nullptr;
+    pages[i].store = nullptr;
+    pages[i].index = 0;
+    pages[i].watch = 0;
+    pages[i].hooked = false;
+  }
+  for (LONG adr = 0xf00000; adr <= 0xfbffff; adr += PageStore::kPageSize)
+    pages[adr >> kPageShift].host = cgrom != nullptr ? cgrom + (adr - 0xf00000) : kZeroPage;
+  for (LONG adr = 0xfe0000; adr <= 0xffffff; adr += PageStore::kPageSize)
+    pages[adr >> kPageShift].host = ipl + (adr - 0xfe0000);
+  for (int i = 0xf00000 >> kPageShift; i < kPageCount; ++i)
+    pageRemapped(i);
+  mapStore(0x000000, mem, false);
+  mapStore(0xc00000, gvram->store(), false);
+  mapStore(0xe00000, tvram->store(), true);
+  mapStore(0xeb8000, sprite->store(), true);
+  mapStore(kSramAdr, sram, false);
+}
+
+void X68K::mapStore(LONG adr, PageStore* store, bool hooked) {
+  int firstPageNo = adr >> kPageShift;
+  for (int i = 0; i < store->pageCount(); ++i) {
+    Page& page = pages[firstPageNo + i];
+    page.store = store;
+    page.index = i;
+    page.hooked = hooked;
+    pageRemapped(firstPageNo + i);
+  }
+  store->setObserver(this, firstPageNo);
+}
+
+void X68K::pageRemapped(int pageNo) {
+  Page& page = pages[pageNo];
+  if (page.store != nullptr)
+    page.host = page.store->page(page.index);
+  page.read = (page.watch & WATCH_READ) == 0 ? page.host : nullptr;
+  page.write = nullptr;
+  if (page.store != nullptr && !page.hooked && (page.watch & WATCH_WRITE) == 0 &&
+      (page.store != sram || devices.sramWritable) && page.store->isWritable(page.index))
+    page.write = page.store->writablePage(page.index);
+}
+
+void X68K::attachSram(SramFile* file) {
+  sramFile = file;
+  for (int i = 0; i < sram->pageCount(); ++i)
+    memcpy(sram->writablePage(i), file->data() + i * PageStore::kPageSize, PageStore::kPageSize);
+  sramGeneration = sram->advanceGeneration();
+}
+
+// Generations find the written pages, so guest writes are never tracked
+// one by one.
+void X68K::flushSram(bool wait) {
+  if (sramFile == nullptr)
+    return;
+  for (int i = 0; i < sram->pageCount(); ++i) {
+    if (sram->writtenSince(i, sramGeneration))
+      sramFile->update(i, sram->page(i));
+  }
+  sramGeneration = sram->advanceGeneration();
+  sramFile->sync(wait);
+}
+
+void X68K::addWatchpoint(LONG start, LONG end, int kind) {
+  start &= 0xffffff;
+  end &= 0xffffff;
+  Watchpoint w = {start, end, kind};
+  watchpoints.push_back(w);
+  for (LONG pageNo = start >> kPageShift; pageNo <= (end >> kPageShift); ++pageNo) {
+    pages[pageNo].watch |= kind;
+    pageRemapped(pageNo);
+  }
+}
+
+void X68K::clearWatchpoints() {
+  watchpoints.clear();
+  for (int i = 0; i < kPageCount; ++i) {
+    if (pages[i].watch != 0) {
+      pages[i].watch = 0;
+      pageRemapped(i);
+    }
+  }
+}
+
+void X68K::renderFrame() {
+  if (renderer == nullptr) {
+    renderer = new FrameRenderer();
+    snapshot = new VideoSnapshot();
+    memset(videoGeneration, 0, sizeof(videoGeneration));
+  }
+  captureVideo(snapshot);
+  renderer->apply(snapshot);
+  renderer->render(frame);
+}
+
+void X68K::setRenderThread(RenderThread* thread) {
+  renderThread = thread;
+  // The new consumer starts from a full copy.
+  memset(videoGeneration, 0, sizeof(videoGeneration));
+  delete renderer;
+  delete snapshot;
+  renderer = nullptr;
+  snapshot = nullptr;
+}
+
+// Copies the video registers and the video memory pages written since the
+// last capture. Pages left flagged in a reused snapshot are copied again.
+void X68K::captureVideo(VideoSnapshot* snap) {
+  PageStore* const stores[] = {tvram->store(), gvram->store(), sprite->store()};
+  snap->frameNo = devices.frames;
+  snap->video = devices.video;
+  snap->crtc = devices.crtc;
+  snap->sprites = sprite->registers();
+  for (int area = 0; area < VideoSnapshot::AREA_COUNT; ++area) {
+    PageStore* store = stores[area];
+    for (int i = 0; i < store->pageCount(); ++i) {
+      if (store->writtenSince(i, videoGeneration[area]))
+        snap->changed[area][i] = 1;
+      if (snap->changed[area][i] != 0)
+        memcpy(snap->page(area, i), store->page(i), PageStore::kPageSize);
+    }
+    videoGeneration[area] = store->advanceGeneration();
+  }
+}
+
+void X68K::checkWatch(LONG adr, int kind) {
+  for (size_t i = 0; i < watchpoints.size(); ++i) {
+    const Watchpoint& w = watchpoints[i];
+    if ((w.kind & kind) != 0 && w.start <= adr && adr <= w.end) {
+      requestStop(kind == WATCH_READ ? STOP_WATCH_READ : STOP_WATCH_WRITE, adr);
+      return;
+    }
+  }
 }
 
 BYTE X68K::readMem8(LONG adr) {
-  if (/*0x0000 <= adr &&*/ adr <= 0xffff) {
-    return mem[adr];
+  adr &= 0xffffff;
+  const BYTE* p = pages[adr >> kPageShift].read;
+  if (p != nullptr)
+    return p[adr & kPageMask];
+  return readSlow8(adr);
+}
+
+void X68K::writeMem8(LONG adr, BYTE value) {
+  adr &= 0xffffff;
+  BYTE* p = pages[adr >> kPageShift].write;
+  if (p != nullptr) {
+    p[adr & kPageMask] = value;
+    return;
+  }
+  writeSlow8(adr, value);
+}
+
+// Only within one page, so that a single lookup covers the block.
+const BYTE* X68K::directRead(LONG adr, LONG bytes) {
+  adr &= 0xffffff;
+  const BYTE* p = pages[adr >> kPageShift].read;
+  if (p == nullptr || (adr & kPageMask) + bytes > PageStore::kPageSize)
+    return nullptr;
+  return p + (adr & kPageMask);
+}
+
+BYTE* X68K::directWrite(LONG adr, LONG bytes) {
+  adr &= 0xffffff;
+  BYTE* p = pages[adr >> kPageShift].write;
+  if (p == nullptr || (adr & kPageMask) + bytes > PageStore::kPageSize)
+    return nullptr;
+  return p + (adr & kPageMask);
+}
+
+const char* X68K::symbolName(LONG adr) {
+  return romMap != nullptr ? romMap->symbol(adr & 0xffffff) : nullptr;
+}
+
+int X68K::acknowledgeInterrupt(int level) {
+  if (level == MFP::kIrqLevel) {
+    int vector = devices.mfp.acknowledge();
+    syncMfp();
+    return vector >= 0 ? vector : SPURIOUS_VECTOR;
+  }
+  if (level == IOC::kIrqLevel) {
+    int vector = devices.ioc.acknowledge();
+    return vector >= 0 ? vector : SPURIOUS_VECTOR;
+  }
+  if (level == DMAC::kIrqLevel) {
+    int vector = devices.dmac.acknowledge();
+    return vector >= 0 ? vector : SPURIOUS_VECTOR;
+  }
+  return MC68K::acknowledgeInterrupt(level);
+}
+
+void X68K::processEvents() {
+  uint64_t time;
+  int id;
+  while ((id = devices.scheduler.pop(cycles, &time)) >= 0) {
+    switch (id) {
+    case Scheduler::EVENT_MFP:
+      devices.mfp.update(cycles);
+      syncMfp();
+      break;
+    case Scheduler::EVENT_CRTC:
+      syncCrtc(time);
+      break;
+    case Scheduler::EVENT_DMAC:
+      devices.dmac.update(cycles);
+      syncDmac();
+      break;
+    case Scheduler::EVENT_OPM:
+      devices.opm.update(cycles);
+      syncOpm();
+      break;
+    case Scheduler::EVENT_ADPCM:
+      fetchAdpcm();
+      break;
+    case Scheduler::EVENT_FDC:
+      devices.fdc.update(cycles, this);
+      syncDmac();
+      syncFdc();
+      break;
+    case Scheduler::EVENT_SASI:
+      devices.sasi.update(cycles, this);
+      syncDmac();
+      syncSasi();
+      break;
+    default:
+      break;
+    }
+  }
+  syncEvents();
+  if (statsPage != nullptr && statsFrames != devices.frames)
+    publishStats();
+}
+
+bool X68K::emulateLineF(WORD op) {
+  if ((op & 0xff00) != 0xff00)
+    return false;
+  if (replaying)
+    return replayCall(op);
+  if (dosHandler == nullptr)
+    return false;
+  Context before;
+  uint32_t generations[AREA_COUNT];
+  startCall(&before, generations);
+  ++hostUses;
+  bool running = dosHandler->dosCall(this, op & 0xff);
+  recordCall(op, !running, before, generations);
+  if (!running)
+    requestStop(STOP_EXIT, pc);
+  return true;
+}
+
+bool X68K::emulateTrap(int no) {
+  if (no != 15)
+    return false;
+  if (replaying)
+    return replayCall(kTrap15);
+  if (iocsHandler == nullptr)
+    return false;
+  int fn = d[0].l & 0xff;
+  Context before;
+  uint32_t generations[AREA_COUNT];
+  startCall(&before, generations);
+  ++hostUses;
+  if (!(iocsCheck ? checkIocs(fn) : iocsHandler->iocsCall(this, fn)))
+    return false;
+  recordCall(kTrap15, false, before, generations);
+  return true;
+}
+
+static void reportRange(int no, uint32_t first, uint32_t last, BYTE x, BYTE y) {
+  if (first == last)
+    fprintf(stderr, "IOCS $%02x: $%06x %02x, ROM %02x\n", no, first, x, y);
+  else
+    fprintf(stderr, "IOCS $%02x: $%06x-$%06x differ (%02x, ROM %02x first)\n", no, first, last, x, y);
+}
+
+// Forks before the native call and lets the fork execute the trap again
+// without a handler, until it returns to the same stack depth. Only pages
+// written by either side can differ, and of the supervisor stack only what
+// the ROM used below the SSP at the trap, dead once it returned.
+bool X68K::checkIocs(int no) {
+  static const long kMaxSteps = 10000000;
+  PageStore* stores[] = {mem, gvram->store(), tvram->store(), sprite->store(), sram};
+  static const LONG kBases[] = {0x000000, 0xc00000, 0xe00000, 0xeb8000, 0xed0000};
+  static const int kStores = sizeof(kBases) / sizeof(kBases[0]);
+
+  if (!iocsHandler->iocsAccepts(this, no))
+    return iocsHandler->iocsCall(this, no);
+  LONG stackTop = (sr & 0x2000) != 0 ? a[7] : ssp;  // Supervisor stack at the trap.
+  X68K* rom = fork();
+  PageStore* romStores[] = {rom->mem, rom->gvram->store(), rom->tvram->store(), rom->sprite->store(), rom->sram};
+  uint32_t generations[kStores];
+  for (int i = 0; i < kStores; ++i)
+    generations[i] = stores[i]->advanceGeneration();
+  bool taken = iocsHandler->iocsCall(this, no);
+  assert(taken);
+
+  LONG ret = rom->pc;
+  LONG sp = rom->a[7];
+  LONG stackLow = stackTop;
+  rom->setTrace(false);
+  rom->pc -= 2;
+  for (long steps = 0; steps == 0 || rom->pc != ret || rom->a[7] != sp; ++steps) {
+    if (steps >= kMaxSteps) {
+      fprintf(stderr, "IOCS $%02x: ROM routine did not return\n", no);
+      delete rom;
+      return taken;
+    }
+    rom->runInstruction();
+    stackLow = std::min(stackLow, (rom->sr & 0x2000) != 0 ? rom->a[7] : rom->ssp);
+  }
+
+  for (int i = 0; i < 8; ++i) {
+    if (rom->d[i].l != d[i].l)
+      fprintf(stderr, "IOCS $%02x: D%d %08x, ROM %08x\n", no, i, d[i].l, rom->d[i].l);
+  }
+  for (int i = 0; i < 8; ++i) {
+    if (rom->a[i] != a[i])
+      fprintf(stderr, "IOCS $%02x: A%d %08x, ROM %08x\n", no, i, a[i], rom->a[i]);
+  }
+  for (int i = 0; i < kStores; ++i) {
+    PageStore* native = stores[i];
+    PageStore* romStore = romStores[i];
+    // Differing bytes are reported as ranges, each with its first pair.
+    LONG first = 0, last = 0;
+    BYTE x0 = 0, y0 = 0;
+    bool open = false;
+    for (int p = 0; p < native->pageCount(); ++p) {
+      if (!romStore->isDirty(p) && !native->writtenSince(p, generations[i]))
+        continue;
+      const BYTE* x = native->page(p);
+      const BYTE* y = romStore->page(p);
+      for (size_t ofs = 0; ofs < PageStore::kPageSize; ++ofs) {
+        LONG adr = kBases[i] + p * PageStore::kPageSize + ofs;
+        if (x[ofs] == y[ofs] || (adr >= stackLow && adr < stackTop))
+          continue;
+        if (open && adr == last + 1) {
+          last = adr;
+          continue;
+        }
+        if (open)
+          reportRange(no, first, last, x0, y0);
+        open = true;
+        first = last = adr;
+        x0 = x[ofs];
+        y0 = y[ofs];
+      }
+    }
+    if (open)
+      reportRange(no, first, last, x0, y0);
+  }
+  delete rom;
+  return taken;
+}
+
+// Each interval starts from a new fork, which shares every page with this
+// machine until either side writes it, so only pages no longer sharing a
+// frame are compared.
+MC68K::StopReason X68K::runLockstep(long count, long interval) {
+  StopReason reason = STOP_NONE;
+  while (count > 0 && reason == STOP_NONE) {
+    X68K* ref = fork();
+    ref->setTrace(false);
+    ref->setReference(true);
+    ref->copyBreakpoints(*this);  // Same blocks, same interrupt points.
+    uint64_t uses = hostUses;
+    uint64_t start = instructions;
+    reason = run(std::min(count, interval));
+    long ran = instructions - start;
+    count -= ran;
+    if (reason != STOP_NONE || hostUses != uses) {
+      ++skippedIntervals;
+      delete ref;
+      continue;
+    }
+    ++checkedIntervals;
+    ref->run(ran);
+    if (differsFrom(ref, false)) {
+      locateDivergence(ref, ran);
+      requestStop(STOP_DIVERGED, pc);
+      reason = STOP_DIVERGED;
+    }
+    delete ref;
+  }
+  return reason;
+}
+
+// Compares the registers and memory with `other`, reporting the differences
+// to stderr when `report`.
+bool X68K::differsFrom(X68K* other, bool report) {
+  static const LONG kAreaBases[AREA_COUNT] = {0x000000, kSramAdr, 0xe00000, 0xc00000, 0xeb8000};
+  bool differs = false;
+  for (int i = 0; i < 16; ++i) {
+    LONG x = i < 8 ? d[i].l : a[i - 8];
+    LONG y = i < 8 ? other->d[i].l : other->a[i - 8];
+    if (x != y) {
+      differs = true;
+      if (report)
+        fprintf(stderr, "  %c%d %08x, reference %08x\n", i < 8 ? 'D' : 'A', i & 7, x, y);
+    }
+  }
+  const LONG regs[][2] = {{pc, other->pc}, {sr, other->sr}, {usp, other->usp}, {ssp, other->ssp}};
+  static const char* kRegNames[] = {"PC", "SR", "USP", "SSP"};
+  for (int i = 0; i < 4; ++i) {
+    if (regs[i][0] != regs[i][1]) {
+      differs = true;
+      if (report)
+        fprintf(stderr, "  %s %08x, reference %08x\n", kRegNames[i], regs[i][0], regs[i][1]);
+    }
+  }
+  if (differs && !report)
+    return true;
+  for (int area = 0; area < AREA_COUNT; ++area) {
+    PageStore* x = areaStore(area);
+    PageStore* y = other->areaStore(area);
+    for (int p = 0; p < x->pageCount(); ++p) {
+      const BYTE* xp = x->page(p);
+      const BYTE* yp = y->page(p);
+      if (xp == yp || memcmp(xp, yp, PageStore::kPageSize) == 0)
+        continue;
+      differs = true;
+      if (!report)
+        return true;
+      size_t ofs = 0;
+      while (xp[ofs] == yp[ofs])
+        ++ofs;
+      fprintf(stderr, "  $%06x %02x, reference %02x\n", (LONG)(kAreaBases[area] + p * PageStore::kPageSize + ofs),
+              xp[ofs], yp[ofs]);
+    }
+  }
+  return differs;
+}
+
+// Repeats the interval `ref` ran from both engines on forks, comparing after
+// every instruction, then runs the pair up to the first instruction that
+// differs once more to disassemble it.
+void X68K::locateDivergence(X68K* ref, long count) {
+  ref->rewind();
+  X68K* fast = ref->fork();
+  fast->setTrace(false);
+  fast->copyBreakpoints(*this);
+  long n = 0;
+  LONG adr = ref->pc;
+  while (n < count) {
+    adr = fast->pc;
+    fast->runInstruction();
+    ref->runInstruction();
+    ++n;
+    if (fast->differsFrom(ref, false))
+      break;
+  }
+  fflush(stdout);
+  if (!fast->differsFrom(ref, false)) {
+    fprintf(stderr, "Lockstep: interval from $%06x differs, but not when run an instruction at a time\n",
+            ref->forkContext.pc);
+    delete fast;
+    return;
+  }
+  fprintf(stderr, "Lockstep: differs after instruction %llu at $%06x (cycle %llu):\n",
+          (unsigned long long)(instructions - count + n), adr,
+          (unsigned long long)ref->cycles);
+  fast->differsFrom(ref, true);
+
+  fast->rewind();
+  ref->rewind();
+  for (long i = 1; i < n; ++i) {
+    fast->runInstruction();
+    ref->runInstruction();
+  }
+  fprintf(stderr, "  fast path:\n");
+  fast->setTrace(true);
+  fast->runInstruction();
+  fflush(stdout);
+  fprintf(stderr, "  reference:\n");
+  ref->setTrace(true);
+  ref->runInstruction();
+  fflush(stdout);
+  delete fast;
+}
+
+// Keyframes hold a KeyframeState and, in a data phase, the SASI buffer of
+// the unit; events hold words of a Context.
+Recording::Layout X68K::recordingLayout() {
+  static const char kBuild[] = __DATE__ " " __TIME__;
+  assert(AREA_COUNT <= Recording::kMaxAreas);
+  Recording::Layout layout;
+  memset(&layout, 0, sizeof(layout));
+  layout.build = DecodeCache::hash(kBuild, sizeof(kBuild) - 1);
+  layout.stateSize = sizeof(KeyframeState);
+  layout.bufferSize = HardDisk::kMaxBlocks * HardDisk::kBlockSize;
+  layout.contextSize = sizeof(Context);
+  layout.areas = AREA_COUNT;
+  for (int area = 0; area < AREA_COUNT; ++area)
+    layout.areaPages[area] = areaStore(area)->pageCount();
+  return layout;
+}
+
+void X68K::setRecording(Recording* rec, bool replay) {
+  assert(!forked);  // Keyframes start from stores written since power on.
+  recording = rec;
+  replaying = rec != nullptr && replay;
+  nextEvent = 0;
+  nextTransfer = 0;
+}
+
+void X68K::addKeyframe() {
+  assert(recording != nullptr && !replaying);
+  KeyframeState state;
+  saveContext(&state.cpu);
+  state.devices = devices;
+  state.sprite = sprite->registers();
+  // A data phase under way continues from the buffer of the unit.
+  std::vector<BYTE> buffer(reinterpret_cast<const BYTE*>(&state), reinterpret_cast<const BYTE*>(&state + 1));
+  int unit = devices.sasi.transferUnit();
+  if (unit >= 0 && hardDisks[unit] != nullptr)
+    buffer.insert(buffer.end(), hardDisks[unit]->buffer(),
+                  hardDisks[unit]->buffer() + HardDisk::kMaxBlocks * HardDisk::kBlockSize);
+  keyframeAt = recording->addKeyframe(cycles, buffer.data(), buffer.size());
+  for (int drive = 0; drive < FDC::kDrives; ++drive) {
+    std::vector<BYTE> writes;
+    if (disks[drive] != nullptr)
+      disks[drive]->takeWrites(&writes);
+    recording->addKeyframeDisk(writes);
+  }
+  for (int area = 0; area < AREA_COUNT; ++area) {
+    PageStore* store = areaStore(area);
+    for (int i = 0; i < store->pageCount(); ++i) {
+      if (store->writtenSince(i, keyframeGeneration[area]))
+        recording->addKeyframePage(area, i, store->page(i));
+    }
+    keyframeGeneration[area] = store->advanceGeneration();
+  }
+}
+
+// Pages differ from the target if they were written since the machine was
+// last at a keyframe (since power on at first), or if the log has a version
+// between the two keyframes. Everything else is left alone.
+void X68K::loadKeyframe(int index) {
+  assert(replaying);
+  const Recording::Keyframe& frame = recording->keyframe(index);
+  assert(frame.state.size() >= sizeof(KeyframeState));  // Checked by Recording::load().
+  const KeyframeState& state = *reinterpret_cast<const KeyframeState*>(frame.state.data());
+  loadContext(state.cpu);
+  devices = state.devices;
+  sprite->loadRegisters(state.sprite);
+  int unit = devices.sasi.transferUnit();
+  if (unit >= 0 && hardDisks[unit] != nullptr && frame.state.size() > sizeof(KeyframeState))
+    memcpy(hardDisks[unit]->buffer(), &frame.state[sizeof(KeyframeState)], frame.state.size() - sizeof(KeyframeState));
+  for (int drive = 0; drive < FDC::kDrives; ++drive) {
+    if (disks[drive] == nullptr)
+      continue;
+    disks[drive]->clearWrites();
+    for (int i = 0; i <= index; ++i) {
+      const Recording::Keyframe& k = recording->keyframe(i);
+      if (drive < (int)k.disks.size())
+        disks[drive]->applyWrites(k.disks[drive]);
+    }
+  }
+
+  int from = keyframeAt < index ? keyframeAt : index;
+  int to = keyframeAt < index ? index : keyframeAt;
+  for (int area = 0; area < AREA_COUNT; ++area) {
+    PageStore* store = areaStore(area);
+    for (int i = 0; i < store->pageCount(); ++i) {
+      if (!store->writtenSince(i, keyframeGeneration[area]) && !recording->changedBetween(area, i, from, to))
+        continue;
+      const BYTE* data = recording->pageAt(area, i, index);
+      loadAreaPage(area, i, data != nullptr ? data : kZeroPage);
+    }
+    keyframeGeneration[area] = store->advanceGeneration();
+  }
+  for (int i = 0; i < sram->pageCount(); ++i)  // Write protect may differ.
+    pageRemapped((kSramAdr >> kPageShift) + i);
+  keyframeAt = index;
+  nextEvent = frame.events;
+  nextTransfer = frame.transfers;
+  syncEvents();
+}
+
+MC68K::StopReason X68K::seek(uint64_t cycle) {
+  loadKeyframe(recording->keyframeBefore(cycle));
+  StopReason reason = STOP_NONE;
+  while (cycles < cycle && (reason = run(1)) == STOP_NONE) {
+  }
+  return reason;
+}
+
+PageStore* X68K::areaStore(int area) {
+  switch (area) {
+  case AREA_MEM:
+    return mem;
+  case AREA_SRAM:
+    return sram;
+  case AREA_TVRAM:
+    return tvram->store();
+  case AREA_GVRAM:
+    return gvram->store();
+  default:
+    return sprite->store();
+  }
+}
+
+// Writes a whole page past write protection, keeping the device caches in
+// step.
+void X68K::loadAreaPage(int area, int index, const BYTE* data) {
+  switch (area) {
+  case AREA_TVRAM:
+    tvram->loadPage(index, data);
+    break;
+  case AREA_GVRAM:
+    gvram->loadPage(index, data);
+    break;
+  case AREA_PCG:
+    sprite->loadPcgPage(index, data);
+    break;
+  default:
+    memcpy(areaStore(area)->writablePage(index), data, PageStore::kPageSize);
+    break;
+  }
+}
+
+// Keeps the registers and starts new write generations, so that what a
+// call changes can be logged.
+void X68K::startCall(Context* before, uint32_t* generations) {
+  if (recording == nullptr)
+    return;
+  memset(before, 0, sizeof(*before));  // Padding compares equal.
+  saveContext(before);
+  for (int area = 0; area < AREA_COUNT; ++area)
+    generations[area] = areaStore(area)->advanceGeneration();
+}
+
+// Most calls change a register or two, so the log keeps the changed words
+// of the context as (index, value) pairs.
+void X68K::recordCall(WORD op, bool exited, const Context& before, const uint32_t* generations) {
+  if (recording == nullptr)
+    return;
+  Context after;
+  memset(&after, 0, sizeof(after));
+  saveContext(&after);
+  const uint32_t* x = reinterpret_cast<const uint32_t*>(&before);
+  const uint32_t* y = reinterpret_cast<const uint32_t*>(&after);
+  std::vector<uint32_t> changes;
+  for (size_t i = 0; i < sizeof(Context) / sizeof(uint32_t); ++i) {
+    if (x[i] != y[i]) {
+      changes.push_back(i);
+      changes.push_back(y[i]);
+    }
   }
-  if (0xe80000 <= adr && adr <= 0xe80030) {  // CRTC
-    return 0;
+  recording->addEvent(cycles, op, exited, changes.data(), changes.size() * sizeof(uint32_t));
+  for (int area = 0; area < AREA_COUNT; ++area) {
+    PageStore* store = areaStore(area);
+    for (int i = 0; i < store->pageCount(); ++i) {
+      if (store->writtenSince(i, generations[area]))
+        recording->addEventPage(area, i, store->page(i));
+    }
   }
-  if (0xed0000 <= adr && adr <= 0xed3fff) {
-    return sram[adr - 0xed0000];
+}
+
+// Applies the logged call made at this cycle, if any. A call missing from
+// the log means the replay went elsewhere than the recording.
+bool X68K::replayCall(WORD op) {
+  if (nextEvent == recording->eventCount())
+    return false;
+  const Recording::Event& event = recording->event(nextEvent);
+  if (event.cycles > cycles)
+    return false;
+  if (event.cycles < cycles || event.op != op) {
+    replayDiverged();
+    return true;
   }
-  if (0xfe0000 <= adr && adr <= 0xffffff) {
-    return ipl[adr - 0xfe0000];
+  ++nextEvent;
+  ++hostUses;
+  Context context;
+  memset(&context, 0, sizeof(context));
+  saveContext(&context);
+  uint32_t* words = reinterpret_cast<uint32_t*>(&context);
+  const uint32_t* changes = reinterpret_cast<const uint32_t*>(event.state.data());
+  for (size_t i = 0; i + 1 < event.state.size() / sizeof(uint32_t); i += 2)
+    words[changes[i]] = changes[i + 1];
+  loadContext(context);
+  for (size_t i = 0; i < event.pages.size(); ++i)
+    loadAreaPage(event.pages[i].area, event.pages[i].index, recording->page(event.pages[i]));
+  if (event.exited)
+    requestStop(STOP_EXIT, pc);
+  return true;
+}
+
+void X68K::replayDiverged() {
+  fprintf(stderr, "Replay diverged at cycle %llu (PC=%06x)\n", (unsigned long long)cycles, pc);
+  requestStop(STOP_EXIT, pc);
+}
+
+void X68K::syncEvents() {
+  nextEventCycle = devices.scheduler.nextTime();
+}
+
+// Reflects the MFP interrupt output and next timer expiry.
+void X68K::syncMfp() {
+  if (devices.mfp.irq())
+    raiseIrq(MFP::kIrqLevel);
+  else
+    clearIrq(MFP::kIrqLevel);
+  uint64_t next = devices.mfp.nextEvent();
+  if (next != MFP::kNever)
+    devices.scheduler.schedule(Scheduler::EVENT_MFP, next);
+  else
+    devices.scheduler.cancel(Scheduler::EVENT_MFP);
+  syncEvents();
+}
+
+// Reflects the DMAC interrupt output and next transfer completion.
+void X68K::syncDmac() {
+  if (devices.dmac.irq())
+    raiseIrq(DMAC::kIrqLevel);
+  else
+    clearIrq(DMAC::kIrqLevel);
+  uint64_t next = devices.dmac.nextEvent();
+  if (next != DMAC::kNever)
+    devices.scheduler.schedule(Scheduler::EVENT_DMAC, next);
+  else
+    devices.scheduler.cancel(Scheduler::EVENT_DMAC);
+  syncEvents();
+}
+
+// Reflects the OPM interrupt output and next timer expiry.
+void X68K::syncOpm() {
+  devices.mfp.setGpip(MFP::GPIP_OPMIRQ, !devices.opm.irq());  // Active low.
+  uint64_t next = devices.opm.nextEvent();
+  if (next != OPM::kNever)
+    devices.scheduler.schedule(Scheduler::EVENT_OPM, next);
+  else
+    devices.scheduler.cancel(Scheduler::EVENT_OPM);
+  syncMfp();
+}
+
+// Reflects the level 1 interrupt output gathered by the IOC.
+void X68K::syncIoc() {
+  if (devices.ioc.irq())
+    raiseIrq(IOC::kIrqLevel);
+  else
+    clearIrq(IOC::kIrqLevel);
+}
+
+// Reflects the FDC interrupt output and next seek or transfer completion.
+void X68K::syncFdc() {
+  devices.ioc.setRequest(IOC::SOURCE_FDC, devices.fdc.irq());
+  syncIoc();
+  uint64_t next = devices.fdc.nextEvent();
+  if (next != FDC::kNever)
+    devices.scheduler.schedule(Scheduler::EVENT_FDC, next);
+  else
+    devices.scheduler.cancel(Scheduler::EVENT_FDC);
+  syncEvents();
+}
+
+// Reflects the SASI interrupt output and next command completion.
+void X68K::syncSasi() {
+  devices.ioc.setRequest(IOC::SOURCE_HDD, devices.sasi.irq());
+  syncIoc();
+  uint64_t next = devices.sasi.nextEvent();
+  if (next != SASI::kNever)
+    devices.scheduler.schedule(Scheduler::EVENT_SASI, next);
+  else
+    devices.scheduler.cancel(Scheduler::EVENT_SASI);
+  syncEvents();
+}
+
+void X68K::syncAdpcm() {
+  uint64_t next = devices.adpcm.nextEvent();
+  if (next != Adpcm::kNever)
+    devices.scheduler.schedule(Scheduler::EVENT_ADPCM, next);
+  else
+    devices.scheduler.cancel(Scheduler::EVENT_ADPCM);
+  syncEvents();
+}
+
+// Pulls the ADPCM bytes due by now through the DMAC in one block. Once
+// the DMAC runs dry the chip plays silence.
+void X68K::fetchAdpcm() {
+  BYTE buffer[4096];
+  uint32_t due = devices.adpcm.takeDue(cycles);
+  while (due > 0) {
+    uint32_t n = due < sizeof(buffer) ? due : sizeof(buffer);
+    uint32_t got = devices.dmac.transferFromMemory(Adpcm::kDmaChannel, buffer, n, this);
+    if (got > 0 && audioThread != nullptr)
+      audioThread->writeAdpcm(cycles, buffer, got);
+    if (got < n)
+      break;
+    due -= n;
+  }
+  syncDmac();
+  syncAdpcm();
+}
+
+void X68K::adpcmChanged(bool restart) {
+  if (audioThread != nullptr)
+    audioThread->controlAdpcm(cycles, devices.adpcm.upsampling(), devices.adpcm.pan(), restart);
+}
+
+// Drives the V-DISP and raster interrupt inputs of the MFP as of `time`.
+void X68K::syncCrtc(uint64_t time) {
+  const CRTC& crtc = devices.crtc;
+  bool vdisp = crtc.vdisp(time);
+  if (devices.vdisp && !vdisp)
+    vsync();
+  devices.vdisp = vdisp;
+  devices.mfp.setGpip(MFP::GPIP_VDISP, vdisp);
+  devices.mfp.setGpip(MFP::GPIP_CIRQ, !crtc.rasterMatch(time));  // Active low.
+  devices.scheduler.schedule(Scheduler::EVENT_CRTC, crtc.nextEvent(time));
+  syncMfp();
+}
+
+void X68K::vsync() {
+  ++devices.frames;
+  if (sramFile != nullptr && devices.frames % kSramFlushFrames == 0)
+    flushSram(false);
+  if (renderThread != nullptr) {
+    captureVideo(renderThread->backBuffer());
+    renderThread->publish();
+  }
+  if (audioThread != nullptr)
+    audioThread->advance(cycles);
+}
+
+// Once per frame, after the events are rearmed.
+void X68K::publishStats() {
+  statsFrames = devices.frames;
+  StatsPage::Sample sample;
+  sample.instructions = instructions;
+  sample.cycles = cycles;
+  sample.frames = devices.frames;
+  sample.pc = pc & 0xffffff;
+  sample.queueDepth = devices.scheduler.queueDepth();
+  sample.decodeCached = decoderCached();
+  sample.blockHits = blockHits;
+  sample.blockMisses = blockMisses;
+  statsPage->publish(sample);
+}
+
+void X68K::writeCrtc(LONG ofs, BYTE value) {
+  CRTC& crtc = devices.crtc;
+  if (crtc.write8(ofs, value, cycles))
+    syncCrtc(cycles);
+
+  BYTE op = crtc.takeOperation();
+  if ((op & CRTC::OP_RASTER_COPY) != 0) {
+    WORD r22 = crtc.reg(CRTC::R22_RASTER_COPY);
+    tvram->rasterCopy(r22 >> 8, r22 & 0xff, crtc.reg(CRTC::R21_TEXT_ACCESS) & 0x0f);
+  }
+}
+
+void X68K::writeOpm(LONG ofs, BYTE value) {
+  devices.opm.update(cycles);
+  int reg = devices.opm.write(ofs, value, cycles);
+  if (reg >= 0 && audioThread != nullptr)
+    audioThread->writeOpm(cycles, reg, value);
+  if (reg == OPM::REG_CT) {
+    // CT1 selects the ADPCM clock.
+    if (devices.adpcm.playing())
+      fetchAdpcm();
+    devices.adpcm.setClock4MHz((value & 0x40) != 0);
+    adpcmChanged(false);
+    syncAdpcm();
+  }
+  syncOpm();
+}
+
+// i8255 port C holds the ADPCM pan and divider in bits 0-3.
+void X68K::writePpi(LONG ofs, BYTE value) {
+  BYTE portC = devices.ppiPortC;
+  if ((ofs & 7) == 5) {
+    portC = value;
+  } else if ((ofs & 7) == 7 && (value & 0x80) == 0) {  // Bit set/reset.
+    int bit = (value >> 1) & 7;
+    portC = (value & 1) != 0 ? portC | (1 << bit) : portC & ~(1 << bit);
+  }
+  if (portC == devices.ppiPortC)
+    return;
+  if (devices.adpcm.playing())
+    fetchAdpcm();
+  devices.ppiPortC = portC;
+  devices.adpcm.setPortC(portC);
+  adpcmChanged(false);
+  syncAdpcm();
+}
+
+void X68K::writeTextVram(LONG ofs, BYTE value) {
+  WORD access = devices.crtc.reg(CRTC::R21_TEXT_ACCESS);
+  if ((access & (CRTC::TEXT_SIMULTANEOUS | CRTC::TEXT_MASK_ENABLE)) == 0) {
+    tvram->write8(ofs, value);
+    return;
+  }
+
+  int planes = (access & CRTC::TEXT_SIMULTANEOUS) != 0 ? (access >> 4) & 0x0f : 1 << (ofs / TextVram::kPlaneSize);
+  BYTE protect = 0;
+  if ((access & CRTC::TEXT_MASK_ENABLE) != 0) {
+    WORD mask = devices.crtc.reg(CRTC::R23_TEXT_MASK);
+    protect = (ofs & 1) == 0 ? mask >> 8 : mask;
+  }
+  tvram->writePlanes(ofs, value, planes, protect);
+}
+
+// Block accesses for the DMAC go page by page through the host pointers,
+// taking the byte path only where a page has none.
+void X68K::dmaRead(LONG adr, BYTE* data, uint32_t bytes) {
+  while (bytes > 0) {
+    adr &= 0xffffff;
+    uint32_t n = PageStore::kPageSize - (adr & kPageMask);
+    if (n > bytes)
+      n = bytes;
+    const BYTE* p = pages[adr >> kPageShift].read;
+    if (p != nullptr) {
+      memcpy(data, p + (adr & kPageMask), n);
+    } else {
+      for (uint32_t i = 0; i < n; ++i)
+        data[i] = readMem8(adr + i);
+    }
+    adr += n;
+    data += n;
+    bytes -= n;
+  }
+}
+
+void X68K::dmaWrite(LONG adr, const BYTE* data, uint32_t bytes) {
+  while (bytes > 0) {
+    adr &= 0xffffff;
+    uint32_t n = PageStore::kPageSize - (adr & kPageMask);
+    if (n > bytes)
+      n = bytes;
+    const Page& page = pages[adr >> kPageShift];
+    uint32_t i = 0;
+    if (page.write == nullptr) {
+      // The first write makes a plain memory page writable.
+      writeMem8(adr, data[0]);
+      i = 1;
+    }
+    if (page.write != nullptr) {
+      memcpy(page.write + (adr & kPageMask) + i, data + i, n - i);
+    } else {
+      for (; i < n; ++i)
+        writeMem8(adr + i, data[i]);
+    }
+    adr += n;
+    data += n;
+    bytes -= n;
+  }
+}
+
+uint32_t X68K::fdcToMemory(const BYTE* data, uint32_t bytes) {
+  return devices.dmac.transferToMemory(FDC::kDmaChannel, data, bytes, this);
+}
+
+uint32_t X68K::fdcFromMemory(BYTE* data, uint32_t bytes) {
+  return devices.dmac.transferFromMemory(FDC::kDmaChannel, data, bytes, this);
+}
+
+bool X68K::fdcDmaActive() {
+  return devices.dmac.active(FDC::kDmaChannel);
+}
+
+uint32_t X68K::sasiToMemory(const BYTE* data, uint32_t bytes) {
+  return devices.dmac.transferToMemory(SASI::kDmaChannel, data, bytes, this);
+}
+
+uint32_t X68K::sasiFromMemory(BYTE* data, uint32_t bytes) {
+  return devices.dmac.transferFromMemory(SASI::kDmaChannel, data, bytes, this);
+}
+
+void X68K::sasiStartRead(int unit, uint32_t block, uint32_t count) {
+  ++hostUses;
+  if (!replaying)
+    hardDisks[unit]->startRead(block, count);
+}
+
+// A transfer missing from the log fails like an I/O error and stops the
+// replay. Writes are logged without data.
+bool X68K::sasiFinishRead(int unit, uint32_t bytes) {
+  ++hostUses;
+  HardDisk* disk = hardDisks[unit];
+  if (replaying)
+    return replayTransfer(unit, disk->buffer(), bytes);
+  bool ok = disk->finishRead();
+  if (recording != nullptr)
+    recording->addTransfer(cycles, unit, ok, disk->buffer(), ok ? bytes : 0);
+  return ok;
+}
+
+void X68K::sasiWrite(int unit, uint32_t block, uint32_t count) {
+  ++hostUses;
+  if (!replaying)
+    hardDisks[unit]->write(block, count);
+}
+
+bool X68K::sasiFinishWrite(int unit) {
+  ++hostUses;
+  if (replaying)
+    return replayTransfer(unit, nullptr, 0);
+  bool ok = hardDisks[unit]->finishWrite();
+  if (recording != nullptr)
+    recording->addTransfer(cycles, unit, ok, nullptr, 0);
+  return ok;
+}
+
+bool X68K::replayTransfer(int unit, BYTE* data, uint32_t bytes) {
+  const Recording::Transfer* transfer =
+      nextTransfer < recording->transferCount() ? &recording->transfer(nextTransfer) : nullptr;
+  if (transfer == nullptr || transfer->cycles != cycles || transfer->unit != unit ||
+      (transfer->ok && transfer->data.size() != bytes)) {
+    replayDiverged();
+    return false;
+  }
+  ++nextTransfer;
+  if (transfer->ok && bytes > 0)
+    memcpy(data, transfer->data.data(), bytes);
+  return transfer->ok;
+}
+
+BYTE X68K::readSlow8(LONG adr) {
+  const Page& page = pages[adr >> kPageShift];
+  if ((page.watch & WATCH_READ) != 0)
+    checkWatch(adr, WATCH_READ);
+  if (page.host != nullptr)
+    return page.host[adr & kPageMask];
+  return readIo8(adr);
+}
+
+BYTE X68K::readIo8(LONG adr) {
+  if (0xe80000 <= adr && adr <= 0xe81fff) {  // CRTC
+    return devices.crtc.read8(adr - 0xe80000);
+  }
+  if (0xe82000 <= adr && adr <= 0xe83fff) {  // video
+    return devices.video.read8(adr - 0xe82000);
+  }
+  if (0xe84000 <= adr && adr <= 0xe85fff) {  // DMAC
+    return devices.dmac.read8(adr - 0xe84000);
+  }
+  if (0xe88000 <= adr && adr <= 0xe89fff) {  // MFP
+    if ((adr & 1) == 0)
+      return 0xff;
+    devices.mfp.update(cycles);
+    BYTE value = devices.mfp.read((adr & 0x3f) >> 1, cycles);
+    syncMfp();
+    return value;
+  }
+  if (0xe90000 <= adr && adr <= 0xe91fff) {  // OPM
+    devices.opm.update(cycles);
+    return devices.opm.read(adr - 0xe90000, cycles);
+  }
+  if (0xe92000 <= adr && adr <= 0xe93fff) {  // ADPCM
+    return devices.adpcm.read(adr - 0xe92000);
+  }
+  if (0xe94000 <= adr && adr <= 0xe95fff) {  // FDC
+    BYTE value = devices.fdc.read(adr - 0xe94000, this);
+    syncFdc();
+    return value;
+  }
+  if (0xe96000 <= adr && adr <= 0xe97fff) {  // SASI
+    BYTE value = devices.sasi.read(adr - 0xe96000, cycles, this);
+    syncDmac();
+    syncSasi();
+    return value;
+  }
+  if (0xe9a000 <= adr && adr <= 0xe9bfff) {  // i8255
+    // Joysticks are not connected.
+    return (adr & 7) == 5 ? devices.ppiPortC : 0xff;
+  }
+  if (0xe9c000 <= adr && adr <= 0xe9dfff) {  // IOC
+    return devices.ioc.read8(adr - 0xe9c000);
+  }
+  if (0xeb0000 <= adr && adr <= 0xeb7fff) {  // Sprite
+    return sprite->read8(adr - 0xeb0000);
   }
 
   fflush(stdout);
@@ -39,25 +1225,37 @@ BYTE X68K::readMem8(LONG adr) {
   return 0;
 }
 
-void X68K::writeMem8(LONG adr, BYTE value) {
-  if (/*0x0000 <= adr &&*/ adr <= 0xffff) {  // MAIN RAM
-    mem[adr] = value;
+void X68K::writeSlow8(LONG adr, BYTE value) {
+  const Page& page = pages[adr >> kPageShift];
+  if ((page.watch & WATCH_WRITE) != 0)
+    checkWatch(adr, WATCH_WRITE);
+  if (page.hooked) {
+    if (adr >= 0xeb8000)  // PCG
+      sprite->writePcg(adr - 0xeb8000, value);
+    else  // TEXT VRAM
+      writeTextVram(adr - 0xe00000, value);
     return;
   }
-  if (0xe00000 <= adr && adr <= 0xe7ffff) {  // TEXT VRAM
-    // TODO:
+  if (page.store != nullptr) {  // MAIN RAM, SRAM: first write since fork or watched.
+    if (page.store != sram || devices.sramWritable)
+      page.store->writablePage(page.index)[adr & kPageMask] = value;
     return;
   }
   if (0xe80000 <= adr && adr <= 0xe81fff) {  // CRTC
-    // TODO:
+    writeCrtc(adr - 0xe80000, value);
     return;
   }
   if (0xe82000 <= adr && adr <= 0xe83fff) {  // video
-    // TODO:
+    devices.video.write8(adr - 0xe82000, value);
     return;
   }
   if (0xe84000 <= adr && adr <= 0xe85fff) {  // DMAC
-    // TODO:
+    devices.dmac.update(cycles);
+    devices.dmac.write8(adr - 0xe84000, value, this, cycles);
+    // A channel started for a data phase already waiting.
+    devices.sasi.pump(cycles, this);
+    syncDmac();
+    syncSasi();
     return;
   }
   if (0xe86000 <= adr && adr <= 0xe87fff) {  // AREA set
@@ -65,7 +1263,11 @@ void X68K::writeMem8(LONG adr, BYTE value) {
     return;
   }
   if (0xe88000 <= adr && adr <= 0xe89fff) {  // MFP
-    // TODO:
+    if ((adr & 1) != 0) {
+      devices.mfp.update(cycles);
+      devices.mfp.write((adr & 0x3f) >> 1, value, cycles);
+      syncMfp();
+    }
     return;
   }
   if (0xe8a000 <= adr && adr <= 0xe8bfff) {  // Printer
@@ -76,15 +1278,48 @@ void X68K::writeMem8(LONG adr, BYTE value) {
     // TODO:
     return;
   }
+  if (0xe90000 <= adr && adr <= 0xe91fff) {  // OPM
+    writeOpm(adr - 0xe90000, value);
+    return;
+  }
+  if (0xe92000 <= adr && adr <= 0xe93fff) {  // ADPCM
+    if (devices.adpcm.playing())
+      fetchAdpcm();
+    if (devices.adpcm.write(adr - 0xe92000, value, cycles))
+      adpcmChanged(devices.adpcm.playing());
+    syncAdpcm();
+    return;
+  }
+  if (0xe94000 <= adr && adr <= 0xe95fff) {  // FDC
+    devices.fdc.write(adr - 0xe94000, value, cycles, this);
+    syncFdc();
+    return;
+  }
+  if (0xe96000 <= adr && adr <= 0xe97fff) {  // SASI
+    devices.sasi.write(adr - 0xe96000, value, cycles, this);
+    syncDmac();
+    syncSasi();
+    return;
+  }
   if (0xe9a000 <= adr && adr <= 0xe9bfff) {  // i8255
-    // TODO:
+    writePpi(adr - 0xe9a000, value);
+    return;
+  }
+  if (0xe9c000 <= adr && adr <= 0xe9dfff) {  // IOC
+    devices.ioc.write8(adr - 0xe9c000, value);
+    syncIoc();
     return;
   }
-  if (0xed0000 <= adr && adr <= 0xed3fff) {  // SRAM
-    sram[adr - 0xed0000] = value;
+  if (0xeb0000 <= adr && adr <= 0xeb7fff) {  // Sprite
+    sprite->write8(adr - 0xeb0000, value);
     return;
   }
-  if (adr == 0xe8e00d) {  // I/O port
+  if (adr == 0xe8e00d) {  // System port: SRAM write enable
+    if (devices.sramWritable != (value == kSramUnlock)) {
+      devices.sramWritable = value == kSramUnlock;
+      for (int i = 0; i < sram->pageCount(); ++i)
+        pageRemapped((kSramAdr >> kPageShift) + i);
+    }
     return;
   }
 
@@ -1,21 +1,314 @@
 #ifndef __X68K_H__
 #define __X68K_H__
 
+#include "adpcm.h"
+#include "crtc.h"
+#include "dmac.h"
+#include "fdc.h"
+#include "gvram.h"
+#include "ioc.h"
 #include "mc68k.h"
+#include "mfp.h"
+#include "opm.h"
+#include "pagemem.h"
+#include "recording.h"
+#include "renderer.h"
+#include "sasi.h"
+#include "scheduler.h"
+#include "sprite.h"
+#include "tvram.h"
+#include "video.h"
+#include <vector>
 
-class X68K : public MC68K {
+class AudioThread;
+class RomMap;
+class RenderThread;
+class SramFile;
+class StatsPage;
+
+class X68K : public MC68K, private PageStore::Observer, private DMAC::Bus, private FDC::Host,
+             private SASI::Host {
 public:
-  X68K(const uint8_t* ipl);
+  enum {
+    WATCH_READ = 1 << 0,
+    WATCH_WRITE = 1 << 1,
+  };
+
+  // Services DOS calls ($FFxx) in place of Human68k.
+  class DosHandler {
+  public:
+    virtual ~DosHandler() {}
+    // Gets the call number with the parameters on the stack. Returns false
+    // when the program exited.
+    virtual bool dosCall(X68K* x68k, int no) = 0;
+  };
+
+  // Services IOCS calls (trap #15) natively in place of the ROM.
+  class IocsHandler {
+  public:
+    virtual ~IocsHandler() {}
+    // Gets the call number from d0.b. Returns false, having changed
+    // nothing, to leave the call to the ROM.
+    virtual bool iocsCall(X68K* x68k, int no) = 0;
+    // Whether iocsCall() would take the call as the machine is now.
+    virtual bool iocsAccepts(X68K* x68k, int no) = 0;
+  };
+
+  static const LONG kRamSize = 0xc00000;
+
+  // `cgrom` is the 768KB CG ROM image; without it the fonts read as zero.
+  X68K(const uint8_t* ipl, const uint8_t* cgrom = nullptr);
   virtual ~X68K();
 
+  // Creates a child machine which shares all memory with this one
+  // copy-on-write, so the child only pays for the pages it writes.
+  X68K* fork();
+  // Rewinds a forked machine to the state it had when it was forked,
+  // touching only the pages dirtied since then.
+  void rewind();
+
+  // Stops run() when [start, end] is accessed. Only the pages covering the
+  // range leave the direct access path.
+  void addWatchpoint(LONG start, LONG end, int kind);
+  void clearWatchpoints();
+
+  static const int kFrameWidth = FrameRenderer::kWidth;
+  static const int kFrameHeight = FrameRenderer::kHeight;
+  static const uint64_t kCpuHz = 10000000;
+
+  // Composites text, graphics and sprites into the RGBA frame buffer on
+  // the calling thread.
+  void renderFrame();
+  const uint32_t* frameBuffer() const  { return frame; }
+  uint64_t frameCount() const  { return devices.frames; }
+  uint64_t frameCycles() const  { return devices.crtc.frameCycles(); }
+  // Publishes a snapshot to `thread` at every vsync when set. Not inherited
+  // by forks.
+  void setRenderThread(RenderThread* thread);
+  // Sends sound chip writes to `thread` when set. Not inherited by forks.
+  void setAudioThread(AudioThread* thread)  { audioThread = thread; }
+  // Puts `image` in floppy drive `drive`, or empties it with nullptr. The
+  // image stays owned by the caller. Not inherited by forks.
+  void insertDisk(int drive, DiskImage* image)  { disks[drive] = image; }
+  // Connects `disk` as SASI unit `unit` (ID * 2 + LUN), likewise.
+  void attachHardDisk(int unit, HardDisk* disk)  { hardDisks[unit] = disk; }
+  // Loads SRAM from `file` and keeps the file updated from then on, by
+  // flushing the pages written about once a second of emulated time. Not
+  // inherited by forks.
+  void attachSram(SramFile* file);
+  // Copies the SRAM pages written since the last flush to the file; `wait`
+  // waits for the disk, as at exit.
+  void flushSram(bool wait);
+  // Labels traced instructions in the IPL ROM with the symbols of `map`.
+  // Shared with forks.
+  void setRomMap(const RomMap* map)  { romMap = map; }
+  // Publishes counters to `page` once per frame. Not inherited by forks.
+  void setStatsPage(StatsPage* page)  { statsPage = page; }
+  // Routes DOS calls to `handler`, which makes run() stop with STOP_EXIT
+  // when the program exits. Not inherited by forks.
+  void setDosHandler(DosHandler* handler)  { dosHandler = handler; }
+  // Routes IOCS calls to `handler` first. With `check`, the ROM routine
+  // also runs on a fork for every call handled, and the registers and
+  // memory the two left behind are compared, reporting differences to
+  // stderr. Not inherited by forks.
+  void setIocsHandler(IocsHandler* handler, bool check)  { iocsHandler = handler; iocsCheck = check; }
+
+  // Lockstep check of the fast CPU paths (see MC68K::setReference). Runs
+  // like run(), but every `interval` instructions, rounded up to a block,
+  // are repeated on a fork with the reference interpreter from the same
+  // state, and the registers and memory the two left behind are compared.
+  // At the first difference the interval is repeated an instruction at a
+  // time to find the instruction, which is reported to stderr with the
+  // differences, and it stops with STOP_DIVERGED. Intervals in which a host
+  // resource was used (handled calls, replay, disks) or that stopped are
+  // not checked, as forks do not have them.
+  StopReason runLockstep(long count, long interval);
+  uint64_t lockstepChecked() const  { return checkedIntervals; }
+  uint64_t lockstepSkipped() const  { return skippedIntervals; }
+
+  // Record/replay, see recording.h. While recording, the results of the
+  // DOS and IOCS calls handled and of hard disk transfers are logged to
+  // `rec`; while replaying they come from it and neither the handlers nor
+  // the hard disks are used. Floppies run from their images and the writes
+  // in the keyframes. Not inherited by forks.
+  void setRecording(Recording* rec, bool replay);
+  // What keyframes and events hold, for making the Recording.
+  Recording::Layout recordingLayout();
+  // Appends a keyframe while recording; call between run()s.
+  void addKeyframe();
+  // Restores keyframe `index` of the replay, loading only the pages that
+  // differ from the current ones.
+  void loadKeyframe(int index);
+  // Replays up to `cycle` from the nearest keyframe before it.
+  StopReason seek(uint64_t cycle);
+
+  // Block copies between the bus and host memory, for loaders and HLE.
+  void readBlock(LONG adr, BYTE* data, uint32_t bytes)  { dmaRead(adr, data, bytes); }
+  void writeBlock(LONG adr, const BYTE* data, uint32_t bytes)  { dmaWrite(adr, data, bytes); }
+
   virtual BYTE readMem8(LONG adr) override;
 
   virtual void writeMem8(LONG adr, BYTE value) override;
 
 private:
+  static const int kPageShift = PageStore::kPageShift;
+  static const LONG kPageMask = PageStore::kPageMask;
+  static const int kPageCount = 1 << (24 - kPageShift);
+
+  // Page stores by recording area.
+  enum {
+    AREA_MEM,
+    AREA_SRAM,
+    AREA_TVRAM,
+    AREA_GVRAM,
+    AREA_PCG,
+    AREA_COUNT,
+  };
+
+  // Memory bus page: host pointers are used directly when available,
+  // otherwise the access goes through the slow path.
+  struct Page {
+    const BYTE* read;  // nullptr for I/O or a watched page.
+    BYTE* write;       // nullptr for I/O, ROM, a watched page or a page not yet writable.
+    const BYTE* host;  // Backing memory regardless of watches, nullptr for I/O.
+    PageStore* store;
+    int index;         // Page index in the store.
+    int watch;         // WATCH_READ | WATCH_WRITE
+    bool hooked;       // Writes go to the device even when writable.
+  };
+
+  // Register state of the devices, copied as a whole on fork.
+  struct Devices {
+    Scheduler scheduler;
+    MFP mfp;
+    CRTC crtc;
+    DMAC dmac;
+    IOC ioc;
+    FDC fdc;
+    SASI sasi;
+    OPM opm;
+    Adpcm adpcm;
+    BYTE ppiPortC;
+    bool sramWritable;  // System port 0xe8e00d unlocked with 0x31.
+    VideoController video;
+    bool vdisp;       // V-DISP level last signalled.
+    uint64_t frames;  // Vertical display periods finished.
+  };
+
+  // Registers of a keyframe.
+  struct KeyframeState {
+    Context cpu;
+    Devices devices;
+    SpriteController::Registers sprite;
+  };
+
+  struct Watchpoint {
+    LONG start, end;
+    int kind;
+  };
+
+  X68K(X68K* parent);
+
+  void mapMemory();
+  void mapStore(LONG adr, PageStore* store, bool hooked);
+  virtual void pageRemapped(int pageNo) override;
+  void checkWatch(LONG adr, int kind);
+
+  virtual int acknowledgeInterrupt(int level) override;
+  virtual void processEvents() override;
+  virtual bool emulateLineF(WORD op) override;
+  virtual bool emulateTrap(int no) override;
+  virtual const BYTE* directRead(LONG adr, LONG bytes) override;
+  virtual BYTE* directWrite(LONG adr, LONG bytes) override;
+  virtual const char* symbolName(LONG adr) override;
+  bool checkIocs(int no);
+  bool differsFrom(X68K* other, bool report);
+  void locateDivergence(X68K* ref, long count);
+  PageStore* areaStore(int area);
+  void loadAreaPage(int area, int index, const BYTE* data);
+  void startCall(Context* before, uint32_t* generations);
+  void recordCall(WORD op, bool exited, const Context& before, const uint32_t* generations);
+  bool replayCall(WORD op);
+  void replayDiverged();
+  bool replayTransfer(int unit, BYTE* data, uint32_t bytes);
+  void syncEvents();
+  void syncMfp();
+  void syncCrtc(uint64_t time);
+  void syncDmac();
+  void syncOpm();
+  void syncAdpcm();
+  void syncIoc();
+  void syncFdc();
+  void syncSasi();
+  void fetchAdpcm();
+  void adpcmChanged(bool restart);
+  void writeOpm(LONG ofs, BYTE value);
+  void writePpi(LONG ofs, BYTE value);
+  void vsync();
+  void publishStats();
+  void captureVideo(VideoSnapshot* snap);
+  void writeCrtc(LONG ofs, BYTE value);
+  void writeTextVram(LONG ofs, BYTE value);
+
+  virtual void dmaRead(LONG adr, BYTE* data, uint32_t bytes) override;
+  virtual void dmaWrite(LONG adr, const BYTE* data, uint32_t bytes) override;
+
+  virtual DiskImage* disk(int drive) override  { hostUses += disks[drive] != nullptr; return disks[drive]; }
+  virtual uint32_t fdcToMemory(const BYTE* data, uint32_t bytes) override;
+  virtual uint32_t fdcFromMemory(BYTE* data, uint32_t bytes) override;
+  virtual bool fdcDmaActive() override;
+
+  virtual HardDisk* hardDisk(int unit) override  { hostUses += hardDisks[unit] != nullptr; return hardDisks[unit]; }
+  virtual uint32_t sasiToMemory(const BYTE* data, uint32_t bytes) override;
+  virtual uint32_t sasiFromMemory(BYTE* data, uint32_t bytes) override;
+  virtual void sasiStartRead(int unit, uint32_t block, uint32_t count) override;
+  virtual bool sasiFinishRead(int unit, uint32_t bytes) override;
+  virtual void sasiWrite(int unit, uint32_t block, uint32_t count) override;
+  virtual bool sasiFinishWrite(int unit) override;
+
+  BYTE readSlow8(LONG adr);
+  BYTE readIo8(LONG adr);
+  void writeSlow8(LONG adr, BYTE value);
+
   const BYTE* ipl;
-  BYTE* mem;
-  BYTE* sram;
+  const BYTE* cgrom;
+  PageStore* mem;
+  PageStore* sram;
+  TextVram* tvram;
+  GraphicVram* gvram;
+  SpriteController* sprite;
+  uint32_t* frame;
+  FrameRenderer* renderer;   // For renderFrame(), created on first use.
+  VideoSnapshot* snapshot;
+  RenderThread* renderThread;
+  AudioThread* audioThread;
+  DiskImage* disks[FDC::kDrives];
+  HardDisk* hardDisks[SASI::kUnits];
+  SramFile* sramFile;
+  const RomMap* romMap;
+  StatsPage* statsPage;
+  uint64_t statsFrames;  // Frame last published.
+  uint32_t sramGeneration;  // Flushed up to.
+  DosHandler* dosHandler;
+  IocsHandler* iocsHandler;
+  bool iocsCheck;
+  uint64_t hostUses;  // Host resources consulted, for lockstep.
+  uint64_t checkedIntervals;
+  uint64_t skippedIntervals;
+  Recording* recording;
+  bool replaying;
+  size_t nextEvent;    // Replay position in the call log.
+  size_t nextTransfer;  // And in the hard disk transfers.
+  int keyframeAt;      // Keyframe the pages were last in step with, -1 for none.
+  uint32_t keyframeGeneration[AREA_COUNT];  // Store generations at keyframeAt.
+  uint32_t videoGeneration[VideoSnapshot::AREA_COUNT];  // Captured up to.
+  Page pages[kPageCount];
+  std::vector<Watchpoint> watchpoints;
+  Devices devices;
+
+  bool forked;
+  Context forkContext;
+  Devices forkDevices;
 };
 
 #endif